@@ -0,0 +1,89 @@
+#include "AllocationCounter.h"
+
+#ifdef TMS_COUNT_ALLOCATIONS
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+	std::atomic<long long> allocationCount(0);
+	thread_local long long threadAllocationCount = 0;
+
+	void* countedAllocate(std::size_t size)
+	{
+		allocationCount.fetch_add(1, std::memory_order_relaxed);
+		threadAllocationCount++;
+		void* result = std::malloc(size == 0 ? 1 : size);
+		if (!result)
+		{
+			throw std::bad_alloc();
+		}
+		return result;
+	}
+};
+
+void* operator new(std::size_t size)
+{
+	return countedAllocate(size);
+}
+
+void* operator new[](std::size_t size)
+{
+	return countedAllocate(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+bool AllocationCounter::isEnabled()
+{
+	return true;
+}
+
+long long AllocationCounter::getCount()
+{
+	return allocationCount.load(std::memory_order_relaxed);
+}
+
+long long AllocationCounter::getThreadCount()
+{
+	return threadAllocationCount;
+}
+
+#else
+
+bool AllocationCounter::isEnabled()
+{
+	return false;
+}
+
+long long AllocationCounter::getCount()
+{
+	return 0;
+}
+
+long long AllocationCounter::getThreadCount()
+{
+	return 0;
+}
+
+#endif // TMS_COUNT_ALLOCATIONS
@@ -0,0 +1,21 @@
+#pragma once
+
+/**
+Counts heap allocations made through operator new (this includes all protobuf allocations).
+Counting is compiled in only with TMS_COUNT_ALLOCATIONS defined (cmake -DTMS_COUNT_ALLOCATIONS=ON),
+since it replaces global operator new/delete. Otherwise all counts are 0.
+
+Usage:
+	long long before = AllocationCounter::getThreadCount();
+	... process events ...
+	double allocationsPerEvent = (double)(AllocationCounter::getThreadCount() - before)/eventCount;
+*/
+class AllocationCounter
+{
+public:
+	static bool isEnabled();
+	// Allocations made by all threads
+	static long long getCount();
+	// Allocations made by calling thread
+	static long long getThreadCount();
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+#include <google/protobuf/arena.h>
+
+/**
+Event object for listener's Read() calls, allocated on a protobuf arena.
+Without arena, every Read() frees and re-allocates each node of the event's Fields maps one by one.
+With arena, parsing an event just bumps a pointer inside a preallocated block, and memory of old events
+is released all at once by periodic arena reset. In steady state this makes reading events allocation-free.
+
+Usage:
+	ArenaEvent<OrderEvent> event;
+	rpc->Read(event.get(), tag);
+...
+	consumer(*event.get(), caller);
+	event.recycle(); // Only when there's no pending Read() into the event
+	rpc->Read(event.get(), tag);
+*/
+template <class Event> class ArenaEvent
+{
+public:
+    static const size_t DefaultInitialBlockSize = 256*1024;
+
+    explicit ArenaEvent(size_t initialBlockSize = DefaultInitialBlockSize) :
+        initialBlockSize_(initialBlockSize),
+        initialBlock_(new char[initialBlockSize]),
+        arena_(makeOptions(initialBlock_.get(), initialBlockSize)),
+        resetCount_(0)
+    {
+        event_ = google::protobuf::Arena::CreateMessage<Event>(&arena_);
+    }
+
+    ArenaEvent(const ArenaEvent&) = delete;
+    void operator=(const ArenaEvent&) = delete;
+
+    // Pointer is valid until the next recycle() call
+    Event* get()
+    {
+        return event_;
+    }
+
+    // Resets the arena once events read so far have used up half of its initial block.
+    // Initial block is kept by reset, so as long as one event fits into the other half, no memory is allocated or freed.
+    void recycle()
+    {
+        if (arena_.SpaceUsed() > initialBlockSize_/2)
+        {
+            arena_.Reset();
+            event_ = google::protobuf::Arena::CreateMessage<Event>(&arena_);
+            resetCount_++;
+        }
+    }
+
+    long long getResetCount() const
+    {
+        return resetCount_;
+    }
+
+private:
+    static google::protobuf::ArenaOptions makeOptions(char* initialBlock, size_t initialBlockSize)
+    {
+        google::protobuf::ArenaOptions options;
+        options.initial_block = initialBlock;
+        options.initial_block_size = initialBlockSize;
+        return options;
+    }
+
+private:
+    const size_t initialBlockSize_;
+    std::unique_ptr<char[]> initialBlock_;
+    google::protobuf::Arena arena_;
+    Event* event_;
+    long long resetCount_;
+};
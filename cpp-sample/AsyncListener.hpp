@@ -1,12 +1,18 @@
 #include <chrono>
+#include <mutex>
 #include <stdexcept>
 #include <thread>
 
+#include <grpcpp/alarm.h>
 #include <grpcpp/grpcpp.h>
 #include <tmsapigrpc/TMSRemote.grpc.pb.h>
 
 #include "Utils.h"
+#include "Logger.h"
 #include "AsyncListenerBase.h"
+#include "AllocationCounter.h"
+#include "Clock.h"
+#include "ArenaEvent.hpp"
 
 using namespace Utils;
 
@@ -16,7 +22,14 @@ public:
 	AsyncListener(const std::string name, int startTag) :
         name_(name),
 		logPrefix_("["+name+"] "),
-        startTag_(startTag)
+        startTag_(startTag),
+        stopTimeout_(DefaultStopTimeout),
+        isQueueUp_(false),
+        isStopAlarmSet_(false),
+        isStartPending_(false),
+        isWritePending_(false),
+        isReadPending_(false),
+        isReadStarted_(false)
     {
         isDebug_.store(false);
         listenerIsUp_.store(false);
@@ -25,6 +38,8 @@ public:
         requestTagSubscribe_ = reinterpret_cast<void*>(startTag_ + 2);
         requestTagRead_      = reinterpret_cast<void*>(startTag_ + 3);
         requestTagDone_      = reinterpret_cast<void*>(startTag_ + 4);
+        requestTagStop_      = reinterpret_cast<void*>(startTag_ + 5);
+        requestTagFinish_    = reinterpret_cast<void*>(startTag_ + 6);
     }
 
 	virtual ~AsyncListener()
@@ -36,14 +51,28 @@ public:
         waitForStop("[~AsyncListener()] ");
 	}
 
+    virtual const std::string& getName() const
+    {
+        return name_;
+    }
+
     virtual void setDebug(bool debug)
     {
         isDebug_.store(debug);
     }
 
+    virtual void setStopTimeout(const std::chrono::milliseconds& timeout)
+    {
+        std::lock_guard<std::mutex> lock(stopSignalLock_);
+        stopTimeout_ = timeout;
+    }
+
     void start(std::function< std::unique_ptr< ::grpc::ClientAsyncReaderWriter< Request, Event>>(grpc::ClientContext*, grpc::CompletionQueue*) > streamSupplier, const Request &request, std::function< bool(const Event&, const std::string&)> consumer)
     {
         listenerIsUp_.store(true);
+        stopSignalLock_.lock();
+        isQueueUp_ = true;
+        stopSignalLock_.unlock();
         std::thread* pThread = listenerThread_.exchange(new std::thread(&AsyncListener::run, this, streamSupplier, request, consumer));
         if (pThread)
         {
@@ -53,9 +82,17 @@ public:
 
 	virtual void signalStop(const std::string &caller)
 	{
-        if (isDebug()) std::cout << get_timestamp() << caller << name_ << "Flagging listener thread to stop..." << std::endl;
+        TMS_LOG_DEBUG_IF(isDebug(), caller, name_, "Flagging listener thread to stop...");
         listenerIsUp_.store(false);
-        if (isDebug()) std::cout << get_timestamp() << caller << name_ << "Listener thread stop flag is set" << std::endl;
+        std::lock_guard<std::mutex> lock(stopSignalLock_);
+        if (isQueueUp_ && !isStopAlarmSet_)
+        {
+            // Wake up listener thread right away instead of letting it notice the flag after its next event
+            stopDeadline_ = std::chrono::system_clock::now() + stopTimeout_;
+            stopAlarm_.Set(&queue_, std::chrono::system_clock::now(), requestTagStop_);
+            isStopAlarmSet_ = true;
+        }
+        TMS_LOG_DEBUG_IF(isDebug(), caller, name_, "Listener thread stop flag is set");
     }
 
     virtual void waitForStop(const std::string& caller)
@@ -63,10 +100,10 @@ public:
         std::thread* pThread = listenerThread_.exchange(NULL);
         if (pThread)
         {
-            if (isDebug()) std::cout << get_timestamp() << caller << name_ << "Terminating listener thread..." << std::endl;
+            TMS_LOG_DEBUG_IF(isDebug(), caller, name_, "Terminating listener thread...");
             pThread->join();
             delete pThread;
-            std::cout << get_timestamp() << caller << name_ << " thread is stopped" << std::endl;
+            TMS_LOG_INFO(caller, name_, " thread is stopped");
         }
 	}
 
@@ -79,145 +116,246 @@ private:
 
     void run(std::function< std::unique_ptr< ::grpc::ClientAsyncReaderWriter< Request, Event>>(grpc::ClientContext*, grpc::CompletionQueue*) > streamSupplier, const Request &request, std::function< bool(const Event&, const std::string&)> consumer)
     {
-        static const int timeOutSeconds = 1;
-        static const std::chrono::duration<long long> timeout = std::chrono::seconds(timeOutSeconds);
-
-        Event event;
+        // Events are parsed into arena memory, reused across Read() calls
+        ArenaEvent<Event> event;
+        // Heap allocations made by this thread in the read loop, both by gRPC/protobuf and by consumer
+        long long eventCount = 0;
+        long long allocationCount = 0;
+        long long allocationsAtFirstRead = 0;
         std::unique_ptr< ::grpc::ClientAsyncReaderWriter< Request, Event>> rpc(streamSupplier(&context_, &queue_));
-        if (isDebug()) std::cout << get_timestamp() << logPrefix_ << "Before StartCall()..." << std::endl;
+        TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "Before StartCall()...");
         rpc->StartCall(requestTagStart_);
+        isStartPending_ = true;
         bool result = true;
         void* responseTag;
         bool ok = false;
-        grpc::CompletionQueue::NextStatus nextStatus;
-        std::chrono::time_point<std::chrono::system_clock> deadline;
         do
         {
             if (!threadShouldContinue())
             {
-                stopStream(rpc, timeout, false); // Don't skip any events, we haven't received any new events yet
+                stopStream(rpc, event, getStopDeadline());
                 break;
             }
-            deadline = std::chrono::system_clock::now() + timeout;
-            if (isDebug()) std::cout << get_timestamp() << logPrefix_ << "Before AsyncNext()..." << std::endl;
-            nextStatus = queue_.AsyncNext(&responseTag, &ok, deadline);
+            // No timeout here: signalStop() wakes us up with stop alarm
+            TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "Before Next()...");
+            if (!queue_.Next(&responseTag, &ok))
+            {
+                TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "After Next(), status==SHUTDOWN");
+                break;
+            }
+            TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "After Next(), responseTag==", std::dec, (long long)responseTag);
+            if (requestTagStop_ == responseTag)
+            {
+                // Stop alarm has fired, stop flag will be picked up at the top of the loop
+                continue;
+            }
+            markCompleted(responseTag);
             if (!ok)
             {
-                std::cout << get_timestamp() << logPrefix_ << "Subscription call is dead!" << std::endl;
+                TMS_LOG_INFO(logPrefix_, "Subscription call is dead!");
                 Event disconnectEvent;
                 disconnectEvent.set_feedstatus(FeedStatus::Disconnected);
                 consumer(disconnectEvent, logPrefix_);
+                notifyDisconnected();
+                // Make sure any other pending operation completes before queue is drained
+                context_.TryCancel();
                 break;
             }
-            if (isDebug()) std::cout << get_timestamp() << logPrefix_ << "After AsyncNext(), responseTag==" << std::dec << (long long)responseTag << std::endl;
             if (!threadShouldContinue())
             {
-                stopStream(rpc, timeout, (nextStatus == grpc::CompletionQueue::NextStatus::GOT_EVENT && requestTagRead_ == responseTag)); // Skip event only if we've received it
+                // Event is skipped in stopStream() if we've received it
+                stopStream(rpc, event, getStopDeadline());
                 break;
             }
-            switch (nextStatus)
+            if (requestTagStart_ == responseTag)
             {
-            case grpc::CompletionQueue::NextStatus::TIMEOUT:
-                if (isDebug()) std::cout << get_timestamp() << logPrefix_ << "After AsyncNext(), status=TIMEOUT" << std::endl;
-                result = true;
-                continue;
-
-            case grpc::CompletionQueue::NextStatus::GOT_EVENT:
-                if (isDebug()) std::cout << get_timestamp() << logPrefix_ << "After AsyncNext(), status=GOT_EVENT" << std::endl;
-                assert(ok);
-                result = true;
-                if (requestTagStart_ == responseTag)
-                {
-                    // StartCall() is completed, time to write subscription request to our bidirectional rpc call
-                    std::cout << get_timestamp() << logPrefix_ << "Stream is up" << std::endl;
-                    if (isDebug()) std::cout << get_timestamp() << logPrefix_ << "Before Write()..." << std::endl;
-                    rpc->Write(request, requestTagSubscribe_);
-                    if (isDebug()) std::cout << get_timestamp() << logPrefix_ << "After Write()" << std::endl;
-                }
-                else if (requestTagSubscribe_ == responseTag)
-                {
-                    // Write() is completed, time to start calling Read() to get data server generates for our subscription
-                    std::cout << get_timestamp() << logPrefix_ << "Subscription is accepted" << std::endl;
-                    if (isDebug()) std::cout << get_timestamp() << logPrefix_ << "Before Read()..." << std::endl;
-                    rpc->Read(&event, requestTagRead_);
-                    if (isDebug()) std::cout << get_timestamp() << logPrefix_ << "After Read()" << std::endl;
-                }
-                else if (requestTagRead_ == responseTag)
+                // StartCall() is completed, time to write subscription request to our bidirectional rpc call
+                TMS_LOG_INFO(logPrefix_, "Stream is up");
+                TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "Before Write()...");
+                rpc->Write(request, requestTagSubscribe_);
+                isWritePending_ = true;
+                TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "After Write()");
+            }
+            else if (requestTagSubscribe_ == responseTag)
+            {
+                // Write() is completed, time to start calling Read() to get data server generates for our subscription
+                TMS_LOG_INFO(logPrefix_, "Subscription is accepted");
+                TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "Before Read()...");
+                allocationsAtFirstRead = AllocationCounter::getThreadCount();
+                rpc->Read(event.get(), requestTagRead_);
+                isReadPending_ = true;
+                isReadStarted_ = true;
+                TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "After Read()");
+            }
+            else if (requestTagRead_ == responseTag)
+            {
+                // We've received data for previous Read() call, process it
+                int64_t receivedTime = Clock::getMonotonicTime();
+                result = consumer(*event.get(), logPrefix_);
+                recordLatency(event.get()->sendingtime(), receivedTime);
+                eventCount++;
+                allocationCount = AllocationCounter::getThreadCount() - allocationsAtFirstRead;
+                if (result)
                 {
-                    // We've received data for previous Read() call, process it
-                    result = consumer(event, logPrefix_);
-                    if (result)
-                    {
-                        // Keep callling Read(), otherwise there will be no new events for our subscription
-                        if (isDebug()) std::cout << get_timestamp() << logPrefix_ << "Before Read()..." << std::endl;
-                        rpc->Read(&event, requestTagRead_);
-                        if (isDebug()) std::cout << get_timestamp() << logPrefix_ << "Received data event" << std::endl;
-                    }
-                    else
-                    {
-                        std::cout << get_timestamp() << logPrefix_ << "Got 'stop' flag from callback" << std::endl;
-                        // If we're here, we've definitely received event and need to skip it.
-                        // Or not... Sometimes, skipping event causes crash inside gRPC libraries.
-                        stopStream(rpc, timeout, false);
-                    }
+                    // Keep callling Read(), otherwise there will be no new events for our subscription
+                    TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "Before Read()...");
+                    event.recycle();
+                    rpc->Read(event.get(), requestTagRead_);
+                    isReadPending_ = true;
+                    TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "Received data event");
                 }
                 else
                 {
-                    std::cout << get_timestamp() << logPrefix_ << "Received unknown Completion Queue tag " << std::dec << (long long)responseTag << std::endl;
-                    result = false;
+                    TMS_LOG_INFO(logPrefix_, "Got 'stop' flag from callback");
+                    stopStream(rpc, event, std::chrono::system_clock::now() + getStopTimeout());
                 }
-                break;
-
-            case grpc::CompletionQueue::NextStatus::SHUTDOWN:
-                if (isDebug()) std::cout << get_timestamp() << logPrefix_ << "After AsyncNext(), status==SHUTDOWN" << std::endl;
-                result = false;
-                break;
-
-            default:
-                if (isDebug()) std::cout << get_timestamp() << logPrefix_ << "After AsyncNext(), status==WTF?" << std::endl;
+            }
+            else
+            {
+                TMS_LOG_INFO(logPrefix_, "Received unknown Completion Queue tag ", std::dec, (long long)responseTag);
                 result = false;
-                break;
             }
         } while (result);
-        if (isDebug()) std::cout << get_timestamp() << logPrefix_ << "Shutting down queue..." << std::endl;
-        queue_.Shutdown();
-        std::cout << get_timestamp() << logPrefix_ << "Stream completed" << std::endl;
+        shutdownQueue();
+        if (AllocationCounter::isEnabled() && eventCount > 0)
+        {
+            TMS_LOG_INFO(logPrefix_, "Received ", eventCount, " events, ", (double)allocationCount/eventCount, " heap allocations per event, ", event.getResetCount(), " arena resets");
+        }
+        TMS_LOG_INFO(logPrefix_, "Stream completed");
     }
 
     bool threadShouldContinue()
     {
-        if (isDebug()) std::cout << get_timestamp() << logPrefix_ << "Checking if continue..." << std::endl;
+        TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "Checking if continue...");
         bool goOn = listenerIsUp_.load();
-        if (isDebug()) std::cout << get_timestamp() << logPrefix_ << "Continue==" << std::boolalpha << goOn << std::endl;
+        TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "Continue==", std::boolalpha, goOn);
         return goOn;
     }
 
-    void stopStream(const std::unique_ptr<grpc::ClientAsyncReaderWriter<Request, Event>>& rpc, const std::chrono::seconds& timeout, bool needToSkipEvent)
+    void stopStream(const std::unique_ptr<grpc::ClientAsyncReaderWriter<Request, Event>>& rpc, ArenaEvent<Event>& event, std::chrono::system_clock::time_point deadline)
     {
-        std::cout << get_timestamp() << logPrefix_ << "Detected request to stop" << std::endl;
-        if (needToSkipEvent)
-        {
-            /* This leads to crashes on sample shutdown
-            if (isDebug()) std::cout << get_timestamp() << logPrefix_ << "Skipping event from completion queue" << std::endl;
-            Event event;
-            rpc->Read(&event, requestTagRead_);
-            */
-        }
-        if (isDebug()) std::cout << get_timestamp() << logPrefix_ << "Calling WritesDone()" << std::endl;
-        // Let server know we're done with our stream
-        rpc->WritesDone(requestTagDone_);
-        std::chrono::time_point<std::chrono::system_clock> deadline;
-        grpc::CompletionQueue::NextStatus nextStatus;
+        TMS_LOG_INFO(logPrefix_, "Detected request to stop");
+        bool isWritesDoneSent = false;
+        bool isCancelled = false;
+        // Finish() must not be called while server still has messages for us, so once reading has started we read until the end of stream
+        bool isReadsDone = !isReadStarted_;
         bool ok;
         void* responseTag;
-        // Wait for server to close the stream on its side
+        grpc::CompletionQueue::NextStatus nextStatus;
+        // Wait for server to close the stream on its side, but no longer than until deadline
+        while (true)
+        {
+            if (!isWritesDoneSent && !isCancelled && !isStartPending_ && !isWritePending_)
+            {
+                TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "Calling WritesDone()");
+                // Let server know we're done with our stream
+                rpc->WritesDone(requestTagDone_);
+                isWritePending_ = true;
+                isWritesDoneSent = true;
+            }
+            if (!isReadsDone && !isCancelled && !isReadPending_)
+            {
+                // Event received before stop was detected has been skipped, keep draining the stream
+                event.recycle();
+                rpc->Read(event.get(), requestTagRead_);
+                isReadPending_ = true;
+            }
+            if (!isStartPending_ && !isWritePending_ && !isReadPending_)
+            {
+                break;
+            }
+            TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "Waiting for server to close stream...");
+            nextStatus = queue_.AsyncNext(&responseTag, &ok, deadline);
+            if (nextStatus == grpc::CompletionQueue::NextStatus::TIMEOUT)
+            {
+                TMS_LOG_INFO(logPrefix_, "Server has not closed the stream in time, cancelling the call");
+                context_.TryCancel();
+                isCancelled = true;
+                // Cancelled operations complete right away
+                deadline = std::chrono::system_clock::time_point::max();
+                continue;
+            }
+            if (nextStatus == grpc::CompletionQueue::NextStatus::SHUTDOWN)
+            {
+                break;
+            }
+            TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "After AsyncNext(), responseTag==", std::dec, (long long)responseTag);
+            if (requestTagStop_ == responseTag)
+            {
+                continue;
+            }
+            markCompleted(responseTag);
+            if (!ok && !isCancelled && (requestTagStart_ == responseTag || requestTagSubscribe_ == responseTag))
+            {
+                // Call is dead, there's no one to send WritesDone() to
+                context_.TryCancel();
+                isCancelled = true;
+            }
+            if (requestTagRead_ == responseTag)
+            {
+                // Skip events sent before server has noticed WritesDone(), Read() is posted again at the top of the loop until server closes the stream
+                TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "Skipping event from completion queue");
+                isReadsDone = !ok;
+            }
+        }
+        // Collect the final status of the call
+        grpc::Status status;
+        rpc->Finish(&status, requestTagFinish_);
         do
         {
-            if (isDebug()) std::cout << get_timestamp() << logPrefix_ << "Waiting for server to close stream..." << std::endl;
-            deadline = std::chrono::system_clock::now() + timeout;
             nextStatus = queue_.AsyncNext(&responseTag, &ok, deadline);
-            if (isDebug()) std::cout << get_timestamp() << logPrefix_ << "After AsyncNext(), responseTag==" << std::dec << (long long)responseTag << std::endl;
-        } while (ok && nextStatus == grpc::CompletionQueue::NextStatus::TIMEOUT);
+            if (nextStatus == grpc::CompletionQueue::NextStatus::TIMEOUT)
+            {
+                TMS_LOG_INFO(logPrefix_, "Server has not closed the stream in time, cancelling the call");
+                context_.TryCancel();
+                deadline = std::chrono::system_clock::time_point::max();
+            }
+        } while (nextStatus != grpc::CompletionQueue::NextStatus::SHUTDOWN && requestTagFinish_ != responseTag);
+        TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "Stream is closed, status==", status.error_code(), " ", status.error_message());
+    }
+
+    void markCompleted(void* responseTag)
+    {
+        if (requestTagStart_ == responseTag)
+        {
+            isStartPending_ = false;
+        }
+        else if (requestTagSubscribe_ == responseTag || requestTagDone_ == responseTag)
+        {
+            isWritePending_ = false;
+        }
+        else if (requestTagRead_ == responseTag)
+        {
+            isReadPending_ = false;
+        }
+    }
+
+    std::chrono::milliseconds getStopTimeout()
+    {
+        std::lock_guard<std::mutex> lock(stopSignalLock_);
+        return stopTimeout_;
+    }
+
+    std::chrono::system_clock::time_point getStopDeadline()
+    {
+        std::lock_guard<std::mutex> lock(stopSignalLock_);
+        return isStopAlarmSet_ ? stopDeadline_ : std::chrono::system_clock::now() + stopTimeout_;
+    }
+
+    void shutdownQueue()
+    {
+        TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "Shutting down queue...");
+        stopSignalLock_.lock();
+        // No more stop alarms after this point: alarm can't be set on a queue that is shut down
+        isQueueUp_ = false;
+        stopSignalLock_.unlock();
+        queue_.Shutdown();
+        // Drain the queue: stop alarm and operations of cancelled call might still be there
+        void* responseTag;
+        bool ok;
+        while (queue_.Next(&responseTag, &ok))
+        {
+        }
     }
 
 private:
@@ -229,9 +367,26 @@ private:
 	void *requestTagSubscribe_;
 	void *requestTagRead_;
 	void *requestTagDone_;
+	void *requestTagStop_;
+	void *requestTagFinish_;
 
 	grpc::ClientContext context_;
 	grpc::CompletionQueue queue_;
+	grpc::Alarm stopAlarm_;
+
+    // Stop signalling state, guarded by stopSignalLock_
+    std::mutex stopSignalLock_;
+    std::chrono::milliseconds stopTimeout_;
+    std::chrono::system_clock::time_point stopDeadline_;
+    bool isQueueUp_;
+    bool isStopAlarmSet_;
+
+    // Pending operations, accessed by listener thread only
+    bool isStartPending_;
+    bool isWritePending_;
+    bool isReadPending_;
+    // Read() has been posted at least once, so the stream must be read to its end before Finish()
+    bool isReadStarted_;
 
     std::atomic<bool> isDebug_;
     std::atomic<bool> listenerIsUp_;
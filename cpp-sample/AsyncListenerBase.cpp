@@ -1,5 +1,26 @@
 #include "AsyncListenerBase.h"
+#include "Clock.h"
+
+const std::chrono::milliseconds AsyncListenerBase::DefaultStopTimeout(2000);
 
 AsyncListenerBase::~AsyncListenerBase()
 {
 }
+
+void AsyncListenerBase::recordLatency(int64_t sendingTime, int64_t receivedTime)
+{
+    processingLatency_.record(Clock::getMonotonicTime() - receivedTime);
+    // Events generated by client itself (e.g. Disconnected) have no sending time
+    if (sendingTime != 0)
+    {
+        transitLatency_.record(receivedTime - Clock::toMonotonicTime(Clock::fromSendingTime(sendingTime)));
+    }
+}
+
+void AsyncListenerBase::notifyDisconnected()
+{
+    if (disconnectHandler_)
+    {
+        disconnectHandler_();
+    }
+}
@@ -1,12 +1,51 @@
 #pragma once
 
+#include <chrono>
+#include <functional>
 #include <string>
 
+#include "LatencyHistogram.h"
+
 class AsyncListenerBase
 {
 public:
+    // How long a stopping listener waits for server to close its stream before cancelling the call
+    static const std::chrono::milliseconds DefaultStopTimeout;
+
     virtual ~AsyncListenerBase();
+    virtual const std::string& getName() const = 0;
     virtual void setDebug(bool debug) = 0;
+    virtual void setStopTimeout(const std::chrono::milliseconds& timeout) = 0;
     virtual void signalStop(const std::string &caller) = 0;
     virtual void waitForStop(const std::string &caller) = 0;
+
+    // Called once when the call dies without being asked to stop, after consumer has got Disconnected event.
+    // Called on listener's own thread, so it must not wait for the listener. Set it before the listener is started.
+    void setDisconnectHandler(const std::function<void()>& handler)
+    {
+        disconnectHandler_ = handler;
+    }
+
+    // Server-to-client latency of received events: receive time minus event's sendingTime.
+    // Includes the difference between server's and our clocks, unless server clock offset is known (see Clock::setServerClockOffset()).
+    const LatencyHistogram& getTransitLatency() const
+    {
+        return transitLatency_;
+    }
+
+    // Time spent in consumer callback
+    const LatencyHistogram& getProcessingLatency() const
+    {
+        return processingLatency_;
+    }
+
+protected:
+    // Call it right after consumer has returned, receivedTime is monotonic time taken before calling consumer
+    void recordLatency(int64_t sendingTime, int64_t receivedTime);
+    void notifyDisconnected();
+
+private:
+    std::function<void()> disconnectHandler_;
+    LatencyHistogram transitLatency_;
+    LatencyHistogram processingLatency_;
 };
@@ -1,50 +1,132 @@
+#include <stdexcept>
+
 #include "AsyncListenerBase.h"
 #include "AsyncListenersManager.h"
+#include "Clock.h"
+#include "CompletionQueuePool.h"
+#include "LatencyHistogram.h"
+#include "Logger.h"
+
+
+thread_local int AsyncListenersManager::dispatchDepth_ = 0;
 
+ReconnectOptions::ReconnectOptions() :
+	initialBackoff(100),
+	maxBackoff(30000),
+	backoffMultiplier(2.0),
+	jitter(0.2),
+	stablePeriod(10000)
+{
+}
 
 // Call setup(stub) before calling getInstance()
-void AsyncListenersManager::setup(const TMSRemote::Stub &stub)
+void AsyncListenersManager::setup(const TMSRemote::Stub &stub, ListenerMode mode, int pollerThreads)
 {
-	createImpl(&stub);
+	createImpl(&stub, NULL, mode, pollerThreads);
 }
 
-AsyncListenersManager &AsyncListenersManager::createImpl(const TMSRemote::Stub *stub)
+void AsyncListenersManager::setup(ChannelPool &channelPool, ListenerMode mode, int pollerThreads)
+{
+	createImpl(NULL, &channelPool, mode, pollerThreads);
+}
+
+AsyncListenersManager &AsyncListenersManager::createImpl(const TMSRemote::Stub *stub, ChannelPool *channelPool, ListenerMode mode, int pollerThreads)
 {
 	// Call setup(stub) before calling getInstance()
-	static AsyncListenersManager instance(*stub);
+	static AsyncListenersManager instance(stub, channelPool, mode, pollerThreads);
 	return instance;
 }
 
 // Call setup(stub) before calling getInstance()
 AsyncListenersManager &AsyncListenersManager::getInstance()
 {
-	return createImpl(NULL);
+	return createImpl(NULL, NULL, ListenerMode::ThreadPerListener, 0);
 }
 
-AsyncListenersManager::AsyncListenersManager(const TMSRemote::Stub &stub) :
-	stub_(stub)
+AsyncListenersManager::AsyncListenersManager(const TMSRemote::Stub *stub, ChannelPool *channelPool, ListenerMode mode, int pollerThreads) :
+	stub_(stub),
+	channelPool_(channelPool),
+	mode_(mode),
+	stopTimeout_(AsyncListenerBase::DefaultStopTimeout),
+	isReaping_(false),
+	isReaperStopping_(false),
+	dumpInterval_(0),
+	isReconnectEnabled_(false),
+	isReconnectorStopping_(false),
+	backoff_(0),
+	random_(std::random_device()()),
+	channelLostTime_(0),
+	disconnectTime_(0),
+	lastRecoveryEndTime_(0),
+	reconnectStats_(ReconnectStats())
 {
+	if (!stub_ && !channelPool_)
+	{
+		throw std::runtime_error("AsyncListenersManager::setup() must be called before getInstance()");
+	}
+	if (mode_ == ListenerMode::SharedCompletionQueues)
+	{
+		queuePool_.reset(new CompletionQueuePool(pollerThreads));
+	}
 }
 
 AsyncListenersManager::~AsyncListenersManager()
 {
 	static const std::string caller("[~AsyncListenersManager]");
+	setLatencyDumpInterval(std::chrono::seconds(0));
+	{
+		std::lock_guard<std::mutex> lock(reconnectLock_);
+		isReconnectorStopping_ = true;
+	}
+	reconnectCondition_.notify_all();
+	if (reconnector_.joinable())
+	{
+		reconnector_.join();
+	}
 	stopAllListeners(caller);
 	terminate(caller);
+	{
+		std::lock_guard<std::mutex> lock(reaperLock_);
+		isReaperStopping_ = true;
+	}
+	reaperCondition_.notify_all();
+	if (reaper_.joinable())
+	{
+		// Reaper finishes removals queued so far first
+		reaper_.join();
+	}
+	if (queuePool_)
+	{
+		// All streams are finished by now, so poller threads have nothing left to drain
+		queuePool_->shutdown();
+	}
 }
 
 void AsyncListenersManager::setDebug(int listenerId, bool debug)
 {
-	AsyncListenerBase* listener = getListener(listenerId);
+	std::shared_ptr<AsyncListenerBase> listener = getListener(listenerId);
 	if (listener)
 	{
 		listener->setDebug(debug);
 	}
 }
 
+void AsyncListenersManager::setStopTimeout(const std::chrono::milliseconds& timeout)
+{
+	mapLock_.lock();
+	stopTimeout_ = timeout;
+	std::for_each(idToListenerMap_.begin(), idToListenerMap_.end(), [timeout](const std::pair<const int, std::shared_ptr<AsyncListenerBase>>& element) {element.second->setStopTimeout(timeout); });
+	mapLock_.unlock();
+}
+
 void AsyncListenersManager::stopListener(int listenerId, const std::string &caller)
 {
-	AsyncListenerBase *listener = getListener(listenerId);
+	// Listener that is asked to stop must not be resubscribed
+	std::lock_guard<std::mutex> restartLock(restartLock_);
+	mapLock_.lock();
+	idToStarterMap_.erase(listenerId);
+	mapLock_.unlock();
+	std::shared_ptr<AsyncListenerBase> listener = getListener(listenerId);
 	if (listener)
 	{
 		listener->signalStop(caller);
@@ -53,25 +135,457 @@ void AsyncListenersManager::stopListener(int listenerId, const std::string &call
 
 void AsyncListenersManager::terminateListener(int listenerId, const std::string& caller)
 {
-	AsyncListenerBase* listener = getListener(listenerId);
+	restartLock_.lock();
+	mapLock_.lock();
+	idToStarterMap_.erase(listenerId);
+	mapLock_.unlock();
+	restartLock_.unlock();
+	std::shared_ptr<AsyncListenerBase> listener = getListener(listenerId);
+	if (listener)
+	{
+		listener->waitForStop(caller);
+	}
+}
+
+void AsyncListenersManager::removeListener(int listenerId, const std::string& caller)
+{
+	restartLock_.lock();
+	mapLock_.lock();
+	idToStarterMap_.erase(listenerId);
+	auto iter = idToListenerMap_.find(listenerId);
+	std::shared_ptr<AsyncListenerBase> listener = iter != idToListenerMap_.end() ? iter->second : nullptr;
+	if (listener)
+	{
+		idToListenerMap_.erase(iter);
+	}
+	auto channelIter = idToChannelMap_.find(listenerId);
+	int channel = channelIter != idToChannelMap_.end() ? channelIter->second : -1;
+	if (channel >= 0)
+	{
+		idToChannelMap_.erase(channelIter);
+	}
+	mapLock_.unlock();
+	restartLock_.unlock();
+	if (listener && dispatchDepth_ > 0)
+	{
+		// Listener (or one sharing this thread) can only finish its stop once this consumer returns
+		listener->signalStop(caller);
+		std::lock_guard<std::mutex> lock(reaperLock_);
+		RemovedListener removed = { listener, channel };
+		removedListeners_.push_back(removed);
+		if (!reaper_.joinable())
+		{
+			reaper_ = std::thread(&AsyncListenersManager::runReaper, this);
+		}
+		reaperCondition_.notify_all();
+		return;
+	}
 	if (listener)
 	{
+		listener->signalStop(caller);
 		listener->waitForStop(caller);
+		// Freed here, or by the last getListener() caller still using it
+		listener.reset();
+	}
+	if (channel >= 0)
+	{
+		channelPool_->releaseStream(channel);
 	}
 }
 
 void AsyncListenersManager::stopAllListeners(const std::string &caller)
 {
+	// signalStop() only posts a stop request, so all listeners proceed with their shutdown in parallel
+	std::lock_guard<std::mutex> restartLock(restartLock_);
 	mapLock_.lock();
-	std::for_each(idToListenerMap_.begin(), idToListenerMap_.end(), [caller](std::pair<int, AsyncListenerBase*> element) {element.second->signalStop(caller); });
+	idToStarterMap_.clear();
 	mapLock_.unlock();
+	std::vector<std::shared_ptr<AsyncListenerBase>> listeners = getListeners();
+	std::for_each(listeners.begin(), listeners.end(), [caller](const std::shared_ptr<AsyncListenerBase>& listener) {listener->signalStop(caller); });
 }
 
 void AsyncListenersManager::terminate(const std::string &caller)
 {
+	// Don't hold the map lock while waiting: listeners' consumers are allowed to call the manager
+	restartLock_.lock();
 	mapLock_.lock();
-	std::for_each(idToListenerMap_.begin(), idToListenerMap_.end(), [caller](std::pair<int, AsyncListenerBase*> element) {element.second->waitForStop(caller); });
+	idToStarterMap_.clear();
 	mapLock_.unlock();
+	restartLock_.unlock();
+	std::vector<std::shared_ptr<AsyncListenerBase>> listeners = getListeners();
+	std::for_each(listeners.begin(), listeners.end(), [caller](const std::shared_ptr<AsyncListenerBase>& listener) {listener->waitForStop(caller); });
+	// Listeners removed by consumers as well
+	std::unique_lock<std::mutex> lock(reaperLock_);
+	reaperCondition_.wait(lock, [this] { return removedListeners_.empty() && !isReaping_; });
+}
+
+bool AsyncListenersManager::getLatencyStats(int listenerId, LatencyStats* transit, LatencyStats* processing)
+{
+	std::shared_ptr<AsyncListenerBase> listener = getListener(listenerId);
+	if (!listener)
+	{
+		return false;
+	}
+	*transit = listener->getTransitLatency().getStats();
+	*processing = listener->getProcessingLatency().getStats();
+	return true;
+}
+
+void AsyncListenersManager::dumpLatencyStats(const std::string &caller)
+{
+	std::vector<std::shared_ptr<AsyncListenerBase>> listeners = getListeners();
+	std::for_each(listeners.begin(), listeners.end(), [&caller](const std::shared_ptr<AsyncListenerBase>& listener) {
+		TMS_LOG_INFO(caller, listener->getName(), " transit latency: ", listener->getTransitLatency().getStats().format());
+		TMS_LOG_INFO(caller, listener->getName(), " processing latency: ", listener->getProcessingLatency().getStats().format());
+	});
+	if (channelPool_)
+	{
+		channelPool_->dumpLoad(caller);
+	}
+}
+
+void AsyncListenersManager::setLatencyDumpInterval(const std::chrono::seconds& interval)
+{
+	std::lock_guard<std::mutex> dumperLock(dumperLock_);
+	{
+		std::lock_guard<std::mutex> lock(dumpLock_);
+		dumpInterval_ = interval;
+	}
+	dumpCondition_.notify_all();
+	if (interval.count() > 0 && !latencyDumper_.joinable())
+	{
+		latencyDumper_ = std::thread(&AsyncListenersManager::runLatencyDumper, this);
+	}
+	else if (interval.count() <= 0 && latencyDumper_.joinable())
+	{
+		latencyDumper_.join();
+	}
+}
+
+void AsyncListenersManager::runLatencyDumper()
+{
+	static const std::string caller("[Latency Dumper] ");
+	std::unique_lock<std::mutex> lock(dumpLock_);
+	while (dumpInterval_.count() > 0)
+	{
+		std::chrono::seconds interval = dumpInterval_;
+		if (dumpCondition_.wait_for(lock, interval, [this, interval] { return dumpInterval_ != interval; }))
+		{
+			// Interval has changed: start over with the new one, or stop
+			continue;
+		}
+		lock.unlock();
+		dumpLatencyStats(caller);
+		lock.lock();
+	}
+}
+
+void AsyncListenersManager::enableReconnect(const ReconnectOptions& options, std::shared_ptr<grpc::Channel> channel)
+{
+	std::vector<std::shared_ptr<grpc::Channel>> channels;
+	if (channelPool_)
+	{
+		for (int i = 0; i < channelPool_->size(); i++)
+		{
+			channels.push_back(channelPool_->getChannel(i));
+		}
+	}
+	else if (channel)
+	{
+		channels.push_back(channel);
+	}
+	else
+	{
+		throw std::runtime_error("enableReconnect() needs the channel of the stub passed to setup()");
+	}
+	std::lock_guard<std::mutex> lock(reconnectLock_);
+	if (isReconnectEnabled_)
+	{
+		throw std::runtime_error("enableReconnect() may only be called once");
+	}
+	isReconnectEnabled_ = true;
+	reconnectOptions_ = options;
+	backoff_ = options.initialBackoff;
+	channels_ = channels;
+	for (const std::shared_ptr<grpc::Channel>& each : channels_)
+	{
+		channelStates_.push_back(each->GetState(false));
+	}
+	channelLosses_.assign(channels_.size(), 0);
+	loggedInLosses_.assign(channels_.size(), 0);
+	reconnector_ = std::thread(&AsyncListenersManager::runReconnector, this);
+}
+
+ReconnectStats AsyncListenersManager::getReconnectStats()
+{
+	std::lock_guard<std::mutex> lock(reconnectLock_);
+	return reconnectStats_;
+}
+
+void AsyncListenersManager::startListener(int listenerId, const ListenerStarter& starter)
+{
+	mapLock_.lock();
+	idToStarterMap_[listenerId] = starter;
+	mapLock_.unlock();
+	starter(listenerId, false);
+}
+
+void AsyncListenersManager::registerListener(int listenerId, const std::shared_ptr<AsyncListenerBase>& listener, int channel)
+{
+	listener->setDisconnectHandler([this, listenerId] { onListenerDisconnected(listenerId); });
+	mapLock_.lock();
+	listener->setStopTimeout(stopTimeout_);
+	idToListenerMap_[listenerId] = listener;
+	if (channel >= 0)
+	{
+		idToChannelMap_[listenerId] = channel;
+	}
+	mapLock_.unlock();
+}
+
+void AsyncListenersManager::onListenerDisconnected(int listenerId)
+{
+	mapLock_.lock();
+	bool isRestartable = idToStarterMap_.count(listenerId) > 0;
+	auto channelIter = idToChannelMap_.find(listenerId);
+	// Without a pool, channels_ has the stub's channel only
+	int channel = channelIter != idToChannelMap_.end() ? channelIter->second : 0;
+	mapLock_.unlock();
+	std::lock_guard<std::mutex> lock(reconnectLock_);
+	if (!isReconnectEnabled_ || !isRestartable)
+	{
+		return;
+	}
+	// Call may have died with its connection before the channel state has been polled
+	channelLosses_[channel]++;
+	if (disconnectTime_ == 0)
+	{
+		disconnectTime_ = Clock::getMonotonicTime();
+	}
+	deadListenerIds_.insert(listenerId);
+	reconnectCondition_.notify_all();
+}
+
+void AsyncListenersManager::runReconnector()
+{
+	static const std::string caller("[Reconnector] ");
+	// Channel states are polled while there's nothing to recover: gRPC has no blocking wait for several channels
+	static const std::chrono::milliseconds statePollInterval(100);
+	std::unique_lock<std::mutex> lock(reconnectLock_);
+	while (!isReconnectorStopping_)
+	{
+		checkChannelStates();
+		if (deadListenerIds_.empty())
+		{
+			reconnectCondition_.wait_for(lock, statePollInterval);
+			continue;
+		}
+		if (!reconnectStats_.isRecovering)
+		{
+			reconnectStats_.isRecovering = true;
+			reconnectStats_.disconnects++;
+			// Connection that keeps dropping right after recovery doesn't get to reconnect at the initial rate
+			int64_t stablePeriod = std::chrono::duration_cast<std::chrono::nanoseconds>(reconnectOptions_.stablePeriod).count();
+			if (lastRecoveryEndTime_ == 0 || Clock::getMonotonicTime() - lastRecoveryEndTime_ > stablePeriod)
+			{
+				backoff_ = reconnectOptions_.initialBackoff;
+			}
+			TMS_LOG_WARNING(caller, deadListenerIds_.size(), " listeners have lost their calls, recovering...");
+		}
+		std::chrono::milliseconds delay = getJitteredBackoff();
+		std::chrono::milliseconds timeout = backoff_;
+		// Next attempt waits longer, whatever happens to this one
+		backoff_ = std::min(reconnectOptions_.maxBackoff, std::chrono::milliseconds((long long)(backoff_.count()*reconnectOptions_.backoffMultiplier)));
+		if (reconnectCondition_.wait_for(lock, delay, [this] { return isReconnectorStopping_; }))
+		{
+			break;
+		}
+		lock.unlock();
+		bool isConnected = waitForChannels(timeout);
+		lock.lock();
+		bool isLoggedIn = isConnected && logInReconnectedChannels(lock);
+		if (!isLoggedIn)
+		{
+			reconnectStats_.failedAttempts++;
+			TMS_LOG_WARNING(caller, isConnected ? "Login has failed" : "Server is not reachable", ", next attempt in about ", backoff_.count(), "ms");
+			continue;
+		}
+		std::set<int> listenerIds;
+		listenerIds.swap(deadListenerIds_);
+		lock.unlock();
+		for (int listenerId : listenerIds)
+		{
+			restartListener(listenerId, caller);
+		}
+		lock.lock();
+		int64_t now = Clock::getMonotonicTime();
+		int64_t detectionTime = channelLostTime_ != 0 ? std::min(channelLostTime_, disconnectTime_) : disconnectTime_;
+		std::chrono::milliseconds recoveryTime((now - detectionTime)/1000000);
+		reconnectStats_.recoveries++;
+		reconnectStats_.lastRecoveryTime = recoveryTime;
+		reconnectStats_.maxRecoveryTime = std::max(reconnectStats_.maxRecoveryTime, recoveryTime);
+		reconnectStats_.isRecovering = false;
+		lastRecoveryEndTime_ = now;
+		channelLostTime_ = 0;
+		// Listeners that have died while others were being resubscribed start the next recovery
+		disconnectTime_ = deadListenerIds_.empty() ? 0 : now;
+		TMS_LOG_INFO(caller, "Resubscribed ", listenerIds.size(), " listeners, recovered in ", recoveryTime.count(), "ms");
+	}
+}
+
+void AsyncListenersManager::checkChannelStates()
+{
+	static const std::string caller("[Reconnector] ");
+	for (size_t i = 0; i < channels_.size(); i++)
+	{
+		grpc_connectivity_state state = channels_[i]->GetState(false);
+		if (state == channelStates_[i])
+		{
+			continue;
+		}
+		TMS_LOG_INFO(caller, "Channel ", i, " state has changed from ", ChannelPool::getStateName(channelStates_[i]), " to ", ChannelPool::getStateName(state));
+		if (channelStates_[i] == GRPC_CHANNEL_READY)
+		{
+			// Whatever connection the channel gets next, it needs a new login
+			channelLosses_[i]++;
+		}
+		channelStates_[i] = state;
+		if (state == GRPC_CHANNEL_TRANSIENT_FAILURE && channelLostTime_ == 0)
+		{
+			// Listeners' calls are about to die: recovery time counts from here
+			channelLostTime_ = Clock::getMonotonicTime();
+		}
+		else if (state == GRPC_CHANNEL_READY && !reconnectStats_.isRecovering && deadListenerIds_.empty())
+		{
+			// Connection is back before any call has died
+			channelLostTime_ = 0;
+		}
+	}
+}
+
+bool AsyncListenersManager::waitForChannels(const std::chrono::milliseconds& timeout)
+{
+	std::chrono::system_clock::time_point deadline = std::chrono::system_clock::now() + timeout;
+	for (const std::shared_ptr<grpc::Channel>& channel : channels_)
+	{
+		if (!channel->WaitForConnected(deadline))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool AsyncListenersManager::logInReconnectedChannels(std::unique_lock<std::mutex>& lock)
+{
+	static const std::string caller("[Reconnector] ");
+	bool result = true;
+	for (size_t i = 0; i < channels_.size(); i++)
+	{
+		long long losses = channelLosses_[i];
+		if (losses == loggedInLosses_[i])
+		{
+			continue;
+		}
+		if (!reconnectOptions_.login)
+		{
+			loggedInLosses_[i] = losses;
+			continue;
+		}
+		lock.unlock();
+		bool isLoggedIn = reconnectOptions_.login(channels_[i]);
+		lock.lock();
+		if (isLoggedIn)
+		{
+			// Losses counted during the login make the next attempt log in again
+			loggedInLosses_[i] = losses;
+		}
+		else
+		{
+			TMS_LOG_WARNING(caller, "Login on channel ", i, " has failed");
+			result = false;
+		}
+	}
+	return result;
+}
+
+void AsyncListenersManager::restartListener(int listenerId, const std::string& caller)
+{
+	std::shared_ptr<AsyncListenerBase> oldListener;
+	{
+		std::lock_guard<std::mutex> restartLock(restartLock_);
+		ListenerStarter starter;
+		int oldChannel = -1;
+		mapLock_.lock();
+		auto starterIter = idToStarterMap_.find(listenerId);
+		if (starterIter != idToStarterMap_.end())
+		{
+			starter = starterIter->second;
+			auto iter = idToListenerMap_.find(listenerId);
+			oldListener = iter != idToListenerMap_.end() ? iter->second : nullptr;
+			auto channelIter = idToChannelMap_.find(listenerId);
+			if (channelIter != idToChannelMap_.end())
+			{
+				oldChannel = channelIter->second;
+				idToChannelMap_.erase(channelIter);
+			}
+		}
+		mapLock_.unlock();
+		if (!starter)
+		{
+			// Listener has been stopped or removed in the meantime
+			return;
+		}
+		if (oldChannel >= 0)
+		{
+			// Policy may pick another channel for the new call
+			channelPool_->releaseStream(oldChannel);
+		}
+		TMS_LOG_INFO(caller, "Resubscribing listener ", listenerId, oldListener ? " " + oldListener->getName() : std::string());
+		// New listener takes the old one's place in the map and is started before a stop can reach it.
+		// Starter doesn't call the consumer: Reconnected comes from the new listener's thread, which may take restartLock_.
+		starter(listenerId, true);
+	}
+	if (oldListener)
+	{
+		// Old call is dead, so it completes without waiting for the server
+		oldListener->waitForStop(caller);
+		// Freed here, or by the last getListener() caller still using it
+	}
+}
+
+void AsyncListenersManager::runReaper()
+{
+	static const std::string caller("[Reaper] ");
+	std::unique_lock<std::mutex> lock(reaperLock_);
+	while (true)
+	{
+		reaperCondition_.wait(lock, [this] { return isReaperStopping_ || !removedListeners_.empty(); });
+		if (removedListeners_.empty())
+		{
+			return;
+		}
+		RemovedListener removed = removedListeners_.front();
+		removedListeners_.pop_front();
+		isReaping_ = true;
+		lock.unlock();
+		removed.listener->waitForStop(caller);
+		// Freed here, or by the last getListener() caller still using it
+		removed.listener.reset();
+		if (removed.channel >= 0)
+		{
+			channelPool_->releaseStream(removed.channel);
+		}
+		lock.lock();
+		isReaping_ = false;
+		reaperCondition_.notify_all();
+	}
+}
+
+std::chrono::milliseconds AsyncListenersManager::getJitteredBackoff()
+{
+	std::uniform_real_distribution<double> spread(1.0 - reconnectOptions_.jitter, 1.0 + reconnectOptions_.jitter);
+	return std::chrono::milliseconds((long long)(backoff_.count()*spread(random_)));
 }
 
 int AsyncListenersManager::getNextId()
@@ -82,10 +596,33 @@ int AsyncListenersManager::getNextId()
 	return startId + count*increment;
 }
 
-AsyncListenerBase *AsyncListenersManager::getListener(int listenerId)
+TMSRemote::Stub *AsyncListenersManager::acquireStub(ChannelTraffic traffic, int *channel)
+{
+	if (!channelPool_)
+	{
+		*channel = -1;
+		// Generated stub methods are non-const, but calling them doesn't change the stub
+		return const_cast<TMSRemote::Stub *>(stub_);
+	}
+	*channel = channelPool_->acquireStream(traffic);
+	return &channelPool_->getStub(*channel);
+}
+
+std::vector<std::shared_ptr<AsyncListenerBase>> AsyncListenersManager::getListeners()
+{
+	std::vector<std::shared_ptr<AsyncListenerBase>> result;
+	mapLock_.lock();
+	std::for_each(idToListenerMap_.begin(), idToListenerMap_.end(), [&result](const std::pair<const int, std::shared_ptr<AsyncListenerBase>>& element) {result.push_back(element.second); });
+	mapLock_.unlock();
+	return result;
+}
+
+std::shared_ptr<AsyncListenerBase> AsyncListenersManager::getListener(int listenerId)
 {
 	mapLock_.lock();
-	AsyncListenerBase *result = idToListenerMap_[listenerId];
+	// Don't use operator[]: querying unknown ID would leave NULL listener in the map
+	auto iter = idToListenerMap_.find(listenerId);
+	std::shared_ptr<AsyncListenerBase> result = iter != idToListenerMap_.end() ? iter->second : nullptr;
 	mapLock_.unlock();
 	return result;
 }
@@ -1,7 +1,20 @@
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
 #include <tmsapigrpc/TMSRemote.grpc.pb.h>
 
+#include "ChannelPool.h"
+
 /*
 Usage example:
 
@@ -12,27 +25,120 @@ AsyncListenersManager manager = AsyncListenersManager::getInstance();
 int orderListenerId = manager.startListening(TMSRemote::Stub::PrepareAsyncsubscribeForOrders, ordersRequest, ordersConsumer);
 int targetListenerId = manager.startListening(TMSRemote::Stub::PrepareAsyncsubscribeForMarketTargets, targetsRequest, targetsConsumer);
 
+LatencyStats transit, processing;
+manager.getLatencyStats(orderListenerId, &transit, &processing); // Server-to-client latency and time spent in ordersConsumer
+manager.setLatencyDumpInterval(std::chrono::seconds(10)); // Logs latency statistics of all listeners every 10 seconds
+
 manager.stopListener(orderListenerId);
+manager.removeListener(targetListenerId); // Stops listener and frees its resources, e.g. when subscriptions come and go. Consumers may call it too.
 manager.stopAllListeners();
 manager.terminate();
+
+To serve all listeners from a fixed pool of threads instead of a thread per listener:
+
+AsyncListenersManager::setup(stub, ListenerMode::SharedCompletionQueues); // One queue and poller thread per CPU core
+AsyncListenersManager::setup(stub, ListenerMode::SharedCompletionQueues, 4); // Exactly 4 queues and poller threads
+
+To use gRPC callback API instead (no listener threads and no polling in any mode), pass callback flavor of the stub method:
+
+int orderListenerId = manager.startListening(&TMSRemote::Stub::async::subscribeForOrders, ordersRequest, ordersConsumer);
+
+To spread subscriptions over several connections, set up the manager with a channel pool instead of a stub:
+
+ChannelPool channels(address, credentials, 4, std::unique_ptr<ChannelPolicy>(new SeparateMarketDataChannelPolicy(2)));
+AsyncListenersManager::setup(channels, ListenerMode::SharedCompletionQueues); // Each subscription is assigned a channel by the pool's policy
+
+To survive network blips, let the manager resubscribe listeners whose calls die, keeping their IDs:
+
+ReconnectOptions reconnectOptions;
+// Server wants a new login on each new connection: called for each channel that has reconnected
+reconnectOptions.login = [&](const std::shared_ptr<grpc::Channel>& channel) { return TMSRemoteClient::login(*TMSRemote::NewStub(channel), user, password); };
+manager.enableReconnect(reconnectOptions, channel); // Channel of the stub, not needed with a channel pool
+...
+ReconnectStats stats = manager.getReconnectStats(); // Disconnects, recoveries and how long they took
 */
 
 class AsyncListenerBase;
+class CompletionQueuePool;
+struct LatencyStats;
+
+enum class ListenerMode
+{
+	// Each listener owns its completion queue and thread (see AsyncListener)
+	ThreadPerListener,
+	// All listeners share a fixed pool of completion queues and poller threads (see PooledAsyncListener)
+	SharedCompletionQueues
+};
+
+// Backoff and login of supervised reconnection, see AsyncListenersManager::enableReconnect()
+struct ReconnectOptions
+{
+	ReconnectOptions();
+
+	// Delay before the first attempt to recover, multiplied by backoffMultiplier after each failed attempt, up to maxBackoff
+	std::chrono::milliseconds initialBackoff;
+	std::chrono::milliseconds maxBackoff;
+	double backoffMultiplier;
+	// Each delay is randomly spread by up to this fraction either way, so that many clients don't reconnect in lockstep
+	double jitter;
+	// Disconnect within this time after a recovery continues with the grown backoff instead of starting over
+	std::chrono::milliseconds stablePeriod;
+	// Called once channels are connected and before listeners are resubscribed, for each channel that has lost its connection
+	// since it last logged in. false fails the attempt, the channel is logged in again by the next one. Empty means no login.
+	std::function<bool(const std::shared_ptr<grpc::Channel>&)> login;
+};
+
+struct ReconnectStats
+{
+	// Disconnects that needed a recovery (several listeners dying together count once)
+	long long disconnects;
+	long long recoveries;
+	// Attempts that found channels not connected or failed to log in
+	long long failedAttempts;
+	// From disconnect detection (channel leaving READY or first dead call, whichever comes first) to resubscribed listeners
+	std::chrono::milliseconds lastRecoveryTime;
+	std::chrono::milliseconds maxRecoveryTime;
+	bool isRecovering;
+};
 
 class AsyncListenersManager
 {
 public:
 	// Call setup(stub) before calling getInstance()
-	static void setup(const TMSRemote::Stub &stub);
+	// pollerThreads is used in SharedCompletionQueues mode only, 0 means one poller thread per CPU core
+	static void setup(const TMSRemote::Stub &stub, ListenerMode mode = ListenerMode::ThreadPerListener, int pollerThreads = 0);
+	// Subscriptions are assigned channels of the pool, which must outlive the manager. Periodic latency dump includes channels' load.
+	static void setup(ChannelPool &channelPool, ListenerMode mode = ListenerMode::ThreadPerListener, int pollerThreads = 0);
 	static AsyncListenersManager &getInstance();
 
 	template <class Request, class Event>
 	int startListening(std::unique_ptr<grpc::ClientAsyncReaderWriter<Request, Event>> (TMSRemote::Stub::* stub_member_function)(::grpc::ClientContext* context, ::grpc::CompletionQueue* cq), Request request, std::function< bool(const Event&, const std::string&)> consumer, const std::string &name, bool initialDebug = false);
+	template <class Request, class Event>
+	int startListening(void (TMSRemote::Stub::async::* stub_member_function)(::grpc::ClientContext* context, ::grpc::ClientBidiReactor<Request, Event>* reactor), Request request, std::function< bool(const Event&, const std::string&)> consumer, const std::string &name, bool initialDebug = false);
 	void setDebug(int listenerId, bool debug);
+	// How long stopping listeners wait for server to close their streams before cancelling the calls.
+	// Since all listeners stop in parallel, it also bounds the time terminate() takes after stopAllListeners().
+	void setStopTimeout(const std::chrono::milliseconds& timeout);
 	void stopListener(int listenerId, const std::string &caller);
 	void terminateListener(int listenerId, const std::string& caller);
+	// Stops listener, waits for it and releases it: listenerId is not valid anymore. Listener is freed once no other call uses it.
+	// Called from a consumer, it only signals the stop: a listener thread can't wait for itself or for listeners sharing its thread,
+	// so the wait and release are left to a background thread.
+	void removeListener(int listenerId, const std::string& caller);
 	void stopAllListeners(const std::string &caller);
+	// Waits for all listeners, including the ones removed by consumers, so it must not be called from a consumer
 	void terminate(const std::string &caller);
+	// Latency statistics of listener's events since it was started, false if there's no such listener
+	bool getLatencyStats(int listenerId, LatencyStats* transit, LatencyStats* processing);
+	// Logs latency statistics of all listeners
+	void dumpLatencyStats(const std::string &caller);
+	// Logs latency statistics of all listeners every interval, zero interval stops it
+	void setLatencyDumpInterval(const std::chrono::seconds& interval);
+	// Supervised reconnection: a listener whose call dies is resubscribed with its original request, consumer and ID
+	// once channels are connected again and login has succeeded, with jittered exponential backoff between attempts.
+	// Consumer gets a Reconnected event on the new listener's delivery thread, before the new call replays the state. Stopped and removed listeners are not resubscribed. channel is the one of the stub passed to setup(), ignored with a channel pool.
+	void enableReconnect(const ReconnectOptions& options, std::shared_ptr<grpc::Channel> channel = nullptr);
+	ReconnectStats getReconnectStats();
 
 public:
 	// non-API methods to support Singleton pattern
@@ -40,14 +146,108 @@ public:
 	void operator=(const AsyncListenersManager&) = delete;
 
 private:
-	static AsyncListenersManager& createImpl(const TMSRemote::Stub *stub);
-	AsyncListenersManager(const TMSRemote::Stub &stub);
+	static AsyncListenersManager& createImpl(const TMSRemote::Stub *stub, ChannelPool *channelPool, ListenerMode mode, int pollerThreads);
+	AsyncListenersManager(const TMSRemote::Stub *stub, ChannelPool *channelPool, ListenerMode mode, int pollerThreads);
+	// Creates listener with given ID, registers it with registerListener() and starts it. isRestart is true when it replaces a dead listener.
+	typedef std::function<void(int listenerId, bool isRestart)> ListenerStarter;
 	~AsyncListenersManager();
-	AsyncListenerBase *getListener(int listenerId);
+	// Listeners are shared with their callers, so that removing or restarting one never frees it under a caller's feet
+	std::shared_ptr<AsyncListenerBase> getListener(int listenerId);
+	std::vector<std::shared_ptr<AsyncListenerBase>> getListeners();
 	int getNextId();
+	// Stub for a new listener: pool's channel chosen for this kind of traffic, or the only stub. channel is -1 without a pool.
+	TMSRemote::Stub *acquireStub(ChannelTraffic traffic, int *channel);
+	// Counts received events of the pool's channel and marks the thread as delivering an event while consumer runs
+	template <class Event>
+	std::function< bool(const Event&, const std::string&)> wrapConsumer(int channel, std::function< bool(const Event&, const std::string&)> consumer);
+	struct DispatchScope
+	{
+		DispatchScope()
+		{
+			dispatchDepth_++;
+		}
+		~DispatchScope()
+		{
+			dispatchDepth_--;
+		}
+	};
+	// Consumer of a resubscribed listener that gets a synthetic Reconnected event first: the new call replays the whole state,
+	// just like the server does after its own reconnects, and consumers such as RecordCache track the replay from this event.
+	// It's delivered by the new listener, on the thread that delivers its events, right before its first event (or Disconnected),
+	// so the consumer may call the manager from it, like from any other event. false from it stops the listener.
+	template <class Event>
+	static std::function< bool(const Event&, const std::string&)> withReconnected(std::function< bool(const Event&, const std::string&)> consumer);
+	void runLatencyDumper();
+	void startListener(int listenerId, const ListenerStarter& starter);
+	// Replaces listener with the same ID, if there's one
+	void registerListener(int listenerId, const std::shared_ptr<AsyncListenerBase>& listener, int channel);
+	void onListenerDisconnected(int listenerId);
+	void runReconnector();
+	// Must be called with reconnectLock_ held
+	void checkChannelStates();
+	bool waitForChannels(const std::chrono::milliseconds& timeout);
+	// Logs in on channels that have lost their connection since they last logged in, false if any login has failed
+	bool logInReconnectedChannels(std::unique_lock<std::mutex>& lock);
+	void restartListener(int listenerId, const std::string& caller);
+	void runReaper();
+	std::chrono::milliseconds getJitteredBackoff();
 private:
-	const TMSRemote::Stub &stub_;
-	std::map<int, AsyncListenerBase *> idToListenerMap_;
+	const TMSRemote::Stub *stub_;
+	ChannelPool *channelPool_;
+	const ListenerMode mode_;
+	std::unique_ptr<CompletionQueuePool> queuePool_;
+	std::map<int, std::shared_ptr<AsyncListenerBase>> idToListenerMap_;
+	// Pool's channel of each listener, released when the listener is removed
+	std::map<int, int> idToChannelMap_;
+	// Listeners that may be resubscribed: stopped and removed ones have no starter
+	std::map<int, ListenerStarter> idToStarterMap_;
+	// Makes checking a starter and replacing its listener atomic with stopping and removing listeners, taken before mapLock_
+	std::mutex restartLock_;
+	std::chrono::milliseconds stopTimeout_;
 	std::mutex mapLock_;
 	std::atomic<int> counter_;
+	// Consumer calls in progress on this thread: whatever thread delivers events, it mustn't wait for listeners
+	static thread_local int dispatchDepth_;
+
+	// Listeners removed by consumers, waited for and released by the reaper thread, guarded by reaperLock_
+	struct RemovedListener
+	{
+		std::shared_ptr<AsyncListenerBase> listener;
+		int channel;
+	};
+	std::mutex reaperLock_;
+	std::condition_variable reaperCondition_;
+	std::thread reaper_;
+	std::deque<RemovedListener> removedListeners_;
+	// Reaper is waiting for a listener it has taken off removedListeners_
+	bool isReaping_;
+	bool isReaperStopping_;
+
+	// Periodic latency dump: dumperLock_ serializes starting and stopping the thread, dumpLock_ guards the interval
+	std::mutex dumperLock_;
+	std::thread latencyDumper_;
+	std::mutex dumpLock_;
+	std::condition_variable dumpCondition_;
+	std::chrono::seconds dumpInterval_;
+
+	// Supervised reconnection, guarded by reconnectLock_
+	std::mutex reconnectLock_;
+	std::condition_variable reconnectCondition_;
+	std::thread reconnector_;
+	bool isReconnectEnabled_;
+	bool isReconnectorStopping_;
+	ReconnectOptions reconnectOptions_;
+	std::vector<std::shared_ptr<grpc::Channel>> channels_;
+	std::vector<grpc_connectivity_state> channelStates_;
+	// Connection losses of each channel (left READY or one of its calls died), and their count at the channel's last login
+	std::vector<long long> channelLosses_;
+	std::vector<long long> loggedInLosses_;
+	std::set<int> deadListenerIds_;
+	std::chrono::milliseconds backoff_;
+	std::mt19937 random_;
+	// Monotonic times, zero when not set
+	int64_t channelLostTime_;
+	int64_t disconnectTime_;
+	int64_t lastRecoveryEndTime_;
+	ReconnectStats reconnectStats_;
 };
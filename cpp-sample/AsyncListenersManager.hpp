@@ -1,26 +1,110 @@
 #include "AsyncListenersManager.h"
+#include "CallbackAsyncListener.hpp"
+#include "CompletionQueuePool.h"
+#include "PooledAsyncListener.hpp"
 
 template <class Request, class Event>
 int AsyncListenersManager::startListening(std::unique_ptr<grpc::ClientAsyncReaderWriter<Request, Event>>(TMSRemote::Stub::* stub_member_function)(::grpc::ClientContext* context, ::grpc::CompletionQueue* cq), Request request, std::function< bool(const Event&, const std::string&)> consumer, const std::string& name, bool initialDebug)
 {
 	int baseRequestId = getNextId();
 
-	// Create async listener for events
-	AsyncListener<Request, Event>* listener = new AsyncListener<Request, Event>(name, baseRequestId);
-	listener->setDebug(initialDebug);
+	// Listener is created by its starter, so that supervised reconnection can create it again with the same ID
+	startListener(baseRequestId, [this, stub_member_function, request, consumer, name, initialDebug](int listenerId, bool isRestart) {
+		int channel;
+		TMSRemote::Stub* stub = acquireStub(ChannelTrafficTraits<Event>::Traffic, &channel);
 
-	// Bind stub member function to our instance of the stub
-	using std::placeholders::_1;
-	using std::placeholders::_2;
-	std::function< std::unique_ptr< ::grpc::ClientAsyncReaderWriter<Request, Event>>(grpc::ClientContext*, grpc::CompletionQueue*) > streamSupplier = std::bind(stub_member_function, stub_, _1, _2);
+		// Bind stub member function to our instance of the stub
+		using std::placeholders::_1;
+		using std::placeholders::_2;
+		std::function< std::unique_ptr< ::grpc::ClientAsyncReaderWriter<Request, Event>>(grpc::ClientContext*, grpc::CompletionQueue*) > streamSupplier = std::bind(stub_member_function, stub, _1, _2);
 
-	// Store listener in the map
-	mapLock_.lock();
-	idToListenerMap_[baseRequestId] = listener;
-	mapLock_.unlock();
+		if (mode_ == ListenerMode::SharedCompletionQueues)
+		{
+			// Create async listener driven by one of the shared poller threads
+			std::shared_ptr<PooledAsyncListener<Request, Event>> listener = std::make_shared<PooledAsyncListener<Request, Event>>(name, queuePool_->nextQueue());
+			listener->setDebug(initialDebug);
 
-	// Start listening
-	listener->start(streamSupplier, request, consumer);
+			// Store listener in the map
+			registerListener(listenerId, listener, channel);
+
+			// Start listening
+			listener->start(streamSupplier, request, wrapConsumer(channel, isRestart ? withReconnected(consumer) : consumer));
+		}
+		else
+		{
+			// Create async listener for events
+			std::shared_ptr<AsyncListener<Request, Event>> listener = std::make_shared<AsyncListener<Request, Event>>(name, listenerId);
+			listener->setDebug(initialDebug);
+
+			// Store listener in the map
+			registerListener(listenerId, listener, channel);
+
+			// Start listening
+			listener->start(streamSupplier, request, wrapConsumer(channel, isRestart ? withReconnected(consumer) : consumer));
+		}
+	});
 
 	return baseRequestId;
 }
+
+template <class Request, class Event>
+int AsyncListenersManager::startListening(void (TMSRemote::Stub::async::* stub_member_function)(::grpc::ClientContext* context, ::grpc::ClientBidiReactor<Request, Event>* reactor), Request request, std::function< bool(const Event&, const std::string&)> consumer, const std::string& name, bool initialDebug)
+{
+	int baseRequestId = getNextId();
+
+	startListener(baseRequestId, [this, stub_member_function, request, consumer, name, initialDebug](int listenerId, bool isRestart) {
+		int channel;
+		TMSRemote::Stub* stub = acquireStub(ChannelTrafficTraits<Event>::Traffic, &channel);
+
+		// Create callback listener: it's driven by gRPC library threads, so the manager's mode doesn't matter
+		std::shared_ptr<CallbackAsyncListener<Request, Event>> listener = std::make_shared<CallbackAsyncListener<Request, Event>>(name);
+		listener->setDebug(initialDebug);
+
+		// Bind stub member function to callback API of our instance of the stub
+		using std::placeholders::_1;
+		using std::placeholders::_2;
+		std::function< void(grpc::ClientContext*, grpc::ClientBidiReactor<Request, Event>*) > streamStarter = std::bind(stub_member_function, stub->async(), _1, _2);
+
+		// Store listener in the map
+		registerListener(listenerId, listener, channel);
+
+		// Start listening
+		listener->start(streamStarter, request, wrapConsumer(channel, isRestart ? withReconnected(consumer) : consumer));
+	});
+
+	return baseRequestId;
+}
+
+template <class Event>
+std::function< bool(const Event&, const std::string&)> AsyncListenersManager::wrapConsumer(int channel, std::function< bool(const Event&, const std::string&)> consumer)
+{
+	ChannelPool* channelPool = channelPool_;
+	return [channelPool, channel, consumer](const Event& event, const std::string& caller) {
+		if (channel >= 0)
+		{
+			channelPool->addReceivedEvents(channel, 1);
+		}
+		DispatchScope scope;
+		return consumer(event, caller);
+	};
+}
+
+template <class Event>
+std::function< bool(const Event&, const std::string&)> AsyncListenersManager::withReconnected(std::function< bool(const Event&, const std::string&)> consumer)
+{
+	// Listener delivers its events one at a time, so the flag needs no synchronization
+	std::shared_ptr<bool> isReconnectedPending = std::make_shared<bool>(true);
+	return [consumer, isReconnectedPending](const Event& event, const std::string& caller) {
+		if (*isReconnectedPending)
+		{
+			*isReconnectedPending = false;
+			Event reconnected;
+			reconnected.set_feedstatus(FeedStatus::Reconnected);
+			if (!consumer(reconnected, caller))
+			{
+				return false;
+			}
+		}
+		return consumer(event, caller);
+	};
+}
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <grpcpp/grpcpp.h>
+#include <tmsapigrpc/TMSRemote.grpc.pb.h>
+
+#include "ChannelPool.h"
+#include "CompletionQueuePool.h"
+#include "Logger.h"
+
+// Outcome of one unary call
+template <class Response> struct UnaryResult
+{
+    grpc::Status status;
+    Response response;
+    // Server's trailing metadata, filled in only for failed calls: TMS puts exception details there
+    std::multimap<std::string, std::string> trailingMetadata;
+};
+
+/**
+Asynchronous facade for unary TMSRemote calls.
+Calls are started with PrepareAsync*() stub methods and complete on a shared completion queue, so any number of requests can be
+in flight over one channel at the same time: a batch of independent requests takes about one round trip instead of one per request.
+
+Result is delivered either through a future or to a callback. Callbacks are invoked on the client's poller thread,
+so they should not block: other calls' completions wait for them.
+
+With a ChannelPool every call goes to the channel picked by the pool's policy as order flow.
+
+Usage:
+    AsyncUnaryClient asyncClient(*stub);
+    std::future<UnaryResult<Void>> created = asyncClient.call(&TMSRemote::Stub::PrepareAsynccreateMarketPortfolio, request);
+    asyncClient.call(&TMSRemote::Stub::PrepareAsyncaddMarketTargets, targetsRequest, [](UnaryResult<TargetIds>& result) {
+        ...
+    });
+...
+    if (!created.get().status.ok()) ...
+...
+    asyncClient.shutdown(); // Waits for calls in flight, later calls fail with UNAVAILABLE
+*/
+class AsyncUnaryClient
+{
+public:
+    template <class Request, class Response>
+    using PrepareAsyncMethod = std::unique_ptr<grpc::ClientAsyncResponseReader<Response>> (TMSRemote::Stub::*)(grpc::ClientContext*, const Request&, grpc::CompletionQueue*);
+
+    // queueCount is the number of completion queues and poller threads, <= 0 means one per CPU core
+    explicit AsyncUnaryClient(TMSRemote::Stub& stub, int queueCount = 1) :
+        stub_(&stub),
+        channelPool_(nullptr),
+        queuePool_(queueCount),
+        inFlightCount_(0),
+        isShutdown_(false),
+        timeout_(0)
+    {
+    }
+
+    explicit AsyncUnaryClient(ChannelPool& channelPool, int queueCount = 1) :
+        stub_(nullptr),
+        channelPool_(&channelPool),
+        queuePool_(queueCount),
+        inFlightCount_(0),
+        isShutdown_(false),
+        timeout_(0)
+    {
+    }
+
+    ~AsyncUnaryClient()
+    {
+        shutdown();
+    }
+
+    AsyncUnaryClient(const AsyncUnaryClient&) = delete;
+    void operator=(const AsyncUnaryClient&) = delete;
+
+    // Deadline of every call started afterwards, zero means no deadline
+    void setTimeout(const std::chrono::milliseconds& timeout)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        timeout_ = timeout;
+    }
+
+    // Starts the call, callback(UnaryResult<Response>&) is invoked on poller thread when it completes
+    template <class Request, class Response, class Callback>
+    void call(PrepareAsyncMethod<Request, Response> method, const Request& request, Callback callback)
+    {
+        std::chrono::milliseconds timeout;
+        if (!beginCall(&timeout))
+        {
+            UnaryResult<Response> result;
+            result.status = grpc::Status(grpc::StatusCode::UNAVAILABLE, "async client is shut down");
+            callback(result);
+            return;
+        }
+        UnaryCall<Response>* call = new UnaryCall<Response>(*this, callback);
+        if (timeout.count() > 0)
+        {
+            call->context_.set_deadline(std::chrono::system_clock::now() + timeout);
+        }
+        TMSRemote::Stub& stub = channelPool_ ? channelPool_->getStub(channelPool_->acquireUnaryCall(ChannelTraffic::OrderFlow)) : *stub_;
+        call->reader_ = (stub.*method)(&call->context_, request, queuePool_.nextQueue());
+        call->reader_->StartCall();
+        // Unary call has a single completion: the call object deletes itself when it's delivered
+        call->reader_->Finish(&call->result_.response, &call->result_.status, call);
+    }
+
+    // Starts the call, the future becomes ready when it completes
+    template <class Request, class Response>
+    std::future<UnaryResult<Response>> call(PrepareAsyncMethod<Request, Response> method, const Request& request)
+    {
+        std::shared_ptr<std::promise<UnaryResult<Response>>> promise = std::make_shared<std::promise<UnaryResult<Response>>>();
+        std::future<UnaryResult<Response>> result = promise->get_future();
+        call(method, request, [promise](UnaryResult<Response>& completed) { promise->set_value(std::move(completed)); });
+        return result;
+    }
+
+    int getInFlightCount()
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        return inFlightCount_;
+    }
+
+    // Waits for calls in flight to complete and stops poller threads. Safe to call more than once.
+    void shutdown()
+    {
+        {
+            std::unique_lock<std::mutex> lock(lock_);
+            isShutdown_ = true;
+            idleCondition_.wait(lock, [this] { return inFlightCount_ == 0; });
+        }
+        queuePool_.shutdown();
+    }
+
+private:
+    template <class Response> class UnaryCall : public CompletionQueueTag
+    {
+    public:
+        UnaryCall(AsyncUnaryClient& client, const std::function<void(UnaryResult<Response>&)>& callback) :
+            client_(client),
+            callback_(callback)
+        {
+        }
+
+        virtual void proceed(bool ok)
+        {
+            if (!result_.status.ok())
+            {
+                for (const auto& entry : context_.GetServerTrailingMetadata())
+                {
+                    result_.trailingMetadata.emplace(std::string(entry.first.data(), entry.first.size()), std::string(entry.second.data(), entry.second.size()));
+                }
+            }
+            try
+            {
+                callback_(result_);
+            }
+            catch (const std::exception& e)
+            {
+                // Poller thread must keep going, or other calls would never complete
+                TMS_LOG_ERROR("[Async Unary Client] Callback has thrown: ", e.what());
+            }
+            AsyncUnaryClient& client = client_;
+            delete this;
+            client.endCall();
+        }
+
+        AsyncUnaryClient& client_;
+        std::function<void(UnaryResult<Response>&)> callback_;
+        grpc::ClientContext context_;
+        std::unique_ptr<grpc::ClientAsyncResponseReader<Response>> reader_;
+        UnaryResult<Response> result_;
+    };
+
+    bool beginCall(std::chrono::milliseconds* timeout)
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        if (isShutdown_)
+        {
+            return false;
+        }
+        inFlightCount_++;
+        *timeout = timeout_;
+        return true;
+    }
+
+    void endCall()
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        if (--inFlightCount_ == 0)
+        {
+            idleCondition_.notify_all();
+        }
+    }
+
+private:
+    TMSRemote::Stub* stub_;
+    ChannelPool* channelPool_;
+    CompletionQueuePool queuePool_;
+    std::mutex lock_;
+    std::condition_variable idleCondition_;
+    int inFlightCount_;
+    bool isShutdown_;
+    std::chrono::milliseconds timeout_;
+};
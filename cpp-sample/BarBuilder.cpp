@@ -0,0 +1,389 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "Clock.h"
+#include "FieldsView.h"
+
+#include "BarBuilder.h"
+
+namespace
+{
+	const std::string FieldName_LastPx("LastPx");
+	const std::string FieldName_LastSize("LastSize");
+	const std::string FieldName_AccumSize("AccumSize");
+	const std::string FieldName_BidPx("BidPx");
+	const std::string FieldName_AskPx("AskPx");
+};
+
+BarBuilderOptions::BarBuilderOptions() :
+	tick(100),
+	wheelSize(512),
+	isEmptyBarPublished(true)
+{
+}
+
+struct BarBuilder::Series
+{
+	std::string instrument;
+	std::chrono::seconds interval;
+	int64_t intervalMs;
+
+	// Bar being built and series' running state, guarded by lock
+	std::mutex lock;
+	int64_t startTime;
+	int64_t endTime;
+	double openPx;
+	double highPx;
+	double lowPx;
+	double closePx;
+	double volume;
+	double tradedValue;
+	long long trades;
+	double quotedSpreadSum;
+	long long quotes;
+	double effectiveSpreadSum;
+	long long effectiveSpreads;
+	double returnSum;
+	double returnSquareSum;
+	long long returns;
+
+	// Carried over from bar to bar. Negative AccumSize means its baseline is not known.
+	double lastAccumSize;
+	double lastPx;
+	double bidPx;
+	double askPx;
+	double previousClosePx;
+
+	// Must be called with lock held
+	void resetBar()
+	{
+		openPx = highPx = lowPx = closePx = 0;
+		volume = tradedValue = 0;
+		trades = 0;
+		quotedSpreadSum = effectiveSpreadSum = 0;
+		quotes = effectiveSpreads = 0;
+		returnSum = returnSquareSum = 0;
+		returns = 0;
+	}
+
+	// Must be called with lock held
+	void addTrade(double px, double size)
+	{
+		if (trades == 0)
+		{
+			openPx = highPx = lowPx = px;
+		}
+		else
+		{
+			highPx = std::max(highPx, px);
+			lowPx = std::min(lowPx, px);
+			double logReturn = std::log(px/closePx);
+			returnSum += logReturn;
+			returnSquareSum += logReturn*logReturn;
+			returns++;
+		}
+		closePx = px;
+		volume += size;
+		tradedValue += px*size;
+		trades++;
+		if (bidPx > 0 && askPx >= bidPx)
+		{
+			effectiveSpreadSum += 2*std::abs(px - (bidPx + askPx)/2);
+			effectiveSpreads++;
+		}
+	}
+};
+
+BarBuilder::BarBuilder(const BarBuilderOptions& options) :
+	options_(options),
+	tick_(options.tick.count()),
+	wheel_(options.wheelSize > 0 ? options.wheelSize : 0),
+	wheelPosition_(0),
+	isStopping_(false)
+{
+	if (tick_ < 1 || options.wheelSize < 1)
+	{
+		throw std::runtime_error("Bar builder needs positive tick and wheel size");
+	}
+	wheelTime_ = getServerTime()/tick_*tick_;
+}
+
+BarBuilder::~BarBuilder()
+{
+	stop();
+}
+
+int BarBuilder::addSeries(const std::string& instrument, std::chrono::seconds interval)
+{
+	if (interval.count() < 1)
+	{
+		throw std::runtime_error("Bar interval must be positive");
+	}
+	std::unique_ptr<Series> series(new Series());
+	series->instrument = instrument;
+	series->interval = interval;
+	series->intervalMs = interval.count()*1000;
+	series->startTime = getServerTime()/series->intervalMs*series->intervalMs;
+	series->endTime = series->startTime + series->intervalMs;
+	series->resetBar();
+	series->lastAccumSize = -1;
+	series->lastPx = 0;
+	series->bidPx = 0;
+	series->askPx = 0;
+	series->previousClosePx = 0;
+
+	Series* seriesPointer = series.get();
+	int seriesId;
+	{
+		std::lock_guard<std::mutex> lock(seriesLock_);
+		seriesId = (int)series_.size() + 1;
+		series_[seriesId] = std::move(series);
+	}
+	std::lock_guard<std::mutex> lock(wheelLock_);
+	schedule(seriesPointer);
+	return seriesId;
+}
+
+std::function< bool(const MarketDataEvent&, const std::string&)> BarBuilder::asConsumer(int seriesId)
+{
+	std::lock_guard<std::mutex> lock(seriesLock_);
+	auto series = series_.find(seriesId);
+	if (series == series_.end())
+	{
+		throw std::runtime_error("There's no bar series " + std::to_string(seriesId));
+	}
+	Series* seriesPointer = series->second.get();
+	return [seriesPointer](const MarketDataEvent& event, const std::string& caller) {
+		onMarketData(seriesPointer, event);
+		return true;
+	};
+}
+
+bool BarBuilder::getCurrentBar(int seriesId, VolumeCurveResponse::Bar* bar)
+{
+	std::lock_guard<std::mutex> lock(seriesLock_);
+	auto series = series_.find(seriesId);
+	if (series == series_.end())
+	{
+		return false;
+	}
+	std::lock_guard<std::mutex> seriesLock(series->second->lock);
+	fillBar(series->second.get(), bar);
+	return true;
+}
+
+void BarBuilder::subscribe(const BarHandler& handler)
+{
+	std::lock_guard<std::mutex> lock(wheelLock_);
+	if (roller_.joinable())
+	{
+		throw std::runtime_error("Bar handlers must be set before start()");
+	}
+	handlers_.push_back(handler);
+}
+
+void BarBuilder::start()
+{
+	std::lock_guard<std::mutex> lock(wheelLock_);
+	if (roller_.joinable() || isStopping_)
+	{
+		throw std::runtime_error("start() may only be called once");
+	}
+	roller_ = std::thread(&BarBuilder::run, this);
+}
+
+void BarBuilder::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(wheelLock_);
+		isStopping_ = true;
+	}
+	wheelCondition_.notify_all();
+	if (roller_.joinable())
+	{
+		roller_.join();
+	}
+}
+
+void BarBuilder::run()
+{
+	std::unique_lock<std::mutex> lock(wheelLock_);
+	while (!isStopping_)
+	{
+		int64_t now = getServerTime();
+		if (now < wheelTime_ + tick_)
+		{
+			wheelCondition_.wait_for(lock, std::chrono::milliseconds(wheelTime_ + tick_ - now), [this] { return isStopping_; });
+			continue;
+		}
+		// Catch up on ticks missed while we were late
+		std::vector<std::pair<Series*, VolumeCurveResponse::Bar>> completedBars;
+		while (wheelTime_ + tick_ <= now)
+		{
+			advance(&completedBars);
+		}
+		lock.unlock();
+		for (const std::pair<Series*, VolumeCurveResponse::Bar>& completedBar : completedBars)
+		{
+			for (const BarHandler& handler : handlers_)
+			{
+				handler(completedBar.first->instrument, completedBar.first->interval, completedBar.second);
+			}
+		}
+		lock.lock();
+	}
+}
+
+void BarBuilder::schedule(Series* series)
+{
+	int64_t wheelSize = (int64_t)wheel_.size();
+	int64_t ticks = std::max((series->endTime - wheelTime_ + tick_ - 1)/tick_, (int64_t)1);
+	WheelEntry entry;
+	entry.series = series;
+	entry.rounds = (ticks - 1)/wheelSize;
+	wheel_[(wheelPosition_ + ticks) % wheelSize].push_back(entry);
+}
+
+void BarBuilder::advance(std::vector<std::pair<Series*, VolumeCurveResponse::Bar>>* completedBars)
+{
+	wheelPosition_ = (wheelPosition_ + 1) % wheel_.size();
+	wheelTime_ += tick_;
+	std::vector<WheelEntry>& bucket = wheel_[wheelPosition_];
+	std::vector<Series*> dueSeries;
+	size_t kept = 0;
+	for (WheelEntry& entry : bucket)
+	{
+		if (entry.rounds > 0)
+		{
+			entry.rounds--;
+			bucket[kept++] = entry;
+		}
+		else
+		{
+			dueSeries.push_back(entry.series);
+		}
+	}
+	bucket.resize(kept);
+	for (Series* series : dueSeries)
+	{
+		VolumeCurveResponse::Bar bar;
+		bool hasTrades;
+		{
+			std::lock_guard<std::mutex> lock(series->lock);
+			hasTrades = series->trades > 0;
+			closeBar(series, &bar);
+		}
+		if (hasTrades || options_.isEmptyBarPublished)
+		{
+			completedBars->emplace_back(series, bar);
+		}
+		schedule(series);
+	}
+}
+
+void BarBuilder::onMarketData(Series* series, const MarketDataEvent& event)
+{
+	if (event.event_case() == MarketDataEvent::EventCase::kFeedStatus)
+	{
+		if (event.feedstatus() == FeedStatus::Disconnected)
+		{
+			// Volume traded while we were disconnected can't be told from a trade: take the next AccumSize as a new baseline
+			std::lock_guard<std::mutex> lock(series->lock);
+			series->lastAccumSize = -1;
+		}
+		return;
+	}
+	if (event.event_case() != MarketDataEvent::EventCase::kUpdate)
+	{
+		return;
+	}
+	FieldsView fields(&event.update().fields());
+	const double* lastPx = fields.findNumeric(FieldName_LastPx);
+	const double* lastSize = fields.findNumeric(FieldName_LastSize);
+	const double* accumSize = fields.findNumeric(FieldName_AccumSize);
+	const double* bidPx = fields.findNumeric(FieldName_BidPx);
+	const double* askPx = fields.findNumeric(FieldName_AskPx);
+
+	std::lock_guard<std::mutex> lock(series->lock);
+	if (bidPx || askPx)
+	{
+		series->bidPx = bidPx ? *bidPx : series->bidPx;
+		series->askPx = askPx ? *askPx : series->askPx;
+		if (series->bidPx > 0 && series->askPx >= series->bidPx)
+		{
+			series->quotedSpreadSum += series->askPx - series->bidPx;
+			series->quotes++;
+		}
+	}
+	if (lastPx)
+	{
+		series->lastPx = *lastPx;
+	}
+	double size = 0;
+	if (accumSize)
+	{
+		if (series->lastAccumSize >= 0 && *accumSize > series->lastAccumSize)
+		{
+			size = *accumSize - series->lastAccumSize;
+		}
+		series->lastAccumSize = *accumSize;
+	}
+	else if (lastPx && lastSize)
+	{
+		size = *lastSize;
+	}
+	if (size > 0 && series->lastPx > 0)
+	{
+		series->addTrade(series->lastPx, size);
+	}
+}
+
+void BarBuilder::closeBar(Series* series, VolumeCurveResponse::Bar* bar)
+{
+	fillBar(series, bar);
+	if (series->trades > 0)
+	{
+		series->previousClosePx = series->closePx;
+	}
+	series->resetBar();
+	series->startTime = series->endTime;
+	series->endTime += series->intervalMs;
+}
+
+void BarBuilder::fillBar(const Series* series, VolumeCurveResponse::Bar* bar)
+{
+	bar->set_starttime(series->startTime);
+	if (series->trades > 0)
+	{
+		bar->set_openpx(series->openPx);
+		bar->set_highpx(series->highPx);
+		bar->set_lowpx(series->lowPx);
+		bar->set_closepx(series->closePx);
+	}
+	else
+	{
+		// No trades: price stays where it was
+		bar->set_openpx(series->previousClosePx);
+		bar->set_highpx(series->previousClosePx);
+		bar->set_lowpx(series->previousClosePx);
+		bar->set_closepx(series->previousClosePx);
+	}
+	bar->set_volume(series->volume);
+	bar->set_tradedvalue(series->tradedValue);
+	bar->set_numoftrades((double)series->trades);
+	double volatility = 0;
+	if (series->returns > 1)
+	{
+		double n = (double)series->returns;
+		volatility = std::sqrt(std::max((series->returnSquareSum - series->returnSum*series->returnSum/n)/(n - 1), 0.0));
+	}
+	bar->set_volatility(volatility);
+	bar->set_avgquotedspread(series->quotes > 0 ? series->quotedSpreadSum/series->quotes : 0);
+	bar->set_avgeffectivespread(series->effectiveSpreads > 0 ? series->effectiveSpreadSum/series->effectiveSpreads : 0);
+}
+
+int64_t BarBuilder::getServerTime()
+{
+	return (Clock::getWallTime() + Clock::getServerClockOffset())/1000000;
+}
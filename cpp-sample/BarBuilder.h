@@ -0,0 +1,117 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <tmsapigrpc/TMSRemote.grpc.pb.h>
+
+struct BarBuilderOptions
+{
+	BarBuilderOptions();
+
+	// Resolution of bar rollover: a bar is closed at the first tick at or after its end, so intervals should be multiples of it
+	std::chrono::milliseconds tick;
+	// Buckets of the timer wheel: bars ending within wheelSize ticks are found without scanning, longer ones wait a few more turns
+	int wheelSize;
+	// Whether a bar without trades is published, with the previous close as its prices
+	bool isEmptyBarPublished;
+};
+
+// Called on builder's thread with each completed bar. Bar's startTime is in milliseconds since epoch.
+typedef std::function<void(const std::string& instrument, std::chrono::seconds interval, const VolumeCurveResponse::Bar& bar)> BarHandler;
+
+/**
+Builds intraday bars live from market data, with the fields of getVolumeCurve bars (VolumeCurveResponse.Bar), so that they can be compared
+with historical ones: start time, open/high/low/close, volume, traded value, number of trades, volatility and average quoted and effective spreads.
+
+Each series is an instrument with a bar interval; bars are aligned to multiples of the interval since epoch, by server's clock
+when its offset is known (see Clock::getServerClockOffset()). An update is a trade when AccumSize has grown: its growth is the volume
+and LastPx the price, so conflated updates don't lose volume. Without AccumSize, LastSize sent along with LastPx is the trade.
+The first update, and the first after Disconnected, only sets the baseline of AccumSize. Quote fields (BidPx, AskPx) give the spreads:
+quoted spread is averaged over quote updates, effective spread is twice the distance of trade price from the mid.
+Volatility is the standard deviation of log returns between trades of the bar.
+
+Market data consumers only add to the open bar of their series, they never look at the clock. Rollover is done by builder's thread:
+each series waits in a hashed timer wheel for its bar's end, so a tick costs only the bars ending in it.
+Updates received within a tick after the end (or while the thread is late) still go to the closing bar.
+
+Usage:
+	BarBuilder bars;
+	bars.subscribe([](const std::string& instrument, std::chrono::seconds interval, const VolumeCurveResponse::Bar& bar) { ... });
+	int seriesId = bars.addSeries("IBM", std::chrono::minutes(5));
+	manager.startListening(&TMSRemote::Stub::PrepareAsyncsubscribeForMarketData, request, bars.asConsumer(seriesId), "IBM Bars");
+	bars.start();
+...
+	VolumeCurveResponse::Bar bar;
+	bars.getCurrentBar(seriesId, &bar); // Bar being built
+...
+	bars.stop();
+*/
+class BarBuilder
+{
+public:
+	explicit BarBuilder(const BarBuilderOptions& options = BarBuilderOptions());
+	~BarBuilder();
+
+	BarBuilder(const BarBuilder&) = delete;
+	void operator=(const BarBuilder&) = delete;
+
+	// Series' first bar starts at the current interval boundary, so it may be partial
+	int addSeries(const std::string& instrument, std::chrono::seconds interval);
+	// Consumer feeding the series, for a listener or a market data hub stream of its instrument
+	std::function< bool(const MarketDataEvent&, const std::string&)> asConsumer(int seriesId);
+	// False if there's no such series
+	bool getCurrentBar(int seriesId, VolumeCurveResponse::Bar* bar);
+
+	// Completed bars go to all handlers. Set them before start().
+	void subscribe(const BarHandler& handler);
+	void start();
+	// Safe to call more than once, bars being built are not published
+	void stop();
+
+private:
+	struct Series;
+	struct WheelEntry
+	{
+		Series* series;
+		// Turns of the wheel left before the entry is due
+		int64_t rounds;
+	};
+
+	void run();
+	// Must be called with wheelLock_ held
+	void schedule(Series* series);
+	void advance(std::vector<std::pair<Series*, VolumeCurveResponse::Bar>>* completedBars);
+	static void onMarketData(Series* series, const MarketDataEvent& event);
+	// Must be called with series' lock held
+	static void closeBar(Series* series, VolumeCurveResponse::Bar* bar);
+	static void fillBar(const Series* series, VolumeCurveResponse::Bar* bar);
+	// Server's wall time in milliseconds
+	static int64_t getServerTime();
+
+private:
+	const BarBuilderOptions options_;
+	const int64_t tick_;
+	std::vector<BarHandler> handlers_;
+
+	// Series are never removed, so consumers keep pointers to them
+	std::mutex seriesLock_;
+	std::map<int, std::unique_ptr<Series>> series_;
+
+	// Timer wheel: bucket of wheelPosition_ is the one of wheelTime_, guarded by wheelLock_
+	std::mutex wheelLock_;
+	std::condition_variable wheelCondition_;
+	std::vector<std::vector<WheelEntry>> wheel_;
+	size_t wheelPosition_;
+	int64_t wheelTime_;
+	bool isStopping_;
+	std::thread roller_;
+};
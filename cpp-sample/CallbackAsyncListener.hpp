@@ -0,0 +1,259 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+
+#include <grpcpp/grpcpp.h>
+#include <tmsapigrpc/TMSRemote.grpc.pb.h>
+
+#include "Utils.h"
+#include "Logger.h"
+#include "AsyncListenerBase.h"
+#include "AllocationCounter.h"
+#include "ArenaEvent.hpp"
+#include "Clock.h"
+
+using namespace Utils;
+
+/**
+Async listener built on gRPC callback API.
+There's neither a thread nor a completion queue to poll: gRPC calls OnReadDone() as soon as the transport has an event,
+and the consumer callback is invoked right from there, on gRPC's own callback thread.
+If server doesn't close the stream within stop timeout after stop request, waitForStop() cancels the call.
+
+Usage:
+	CallbackAsyncListener<SubscribeForOrdersRequest, OrderEvent> listener("Orders Listener");
+	std::function< void(grpc::ClientContext*, grpc::ClientBidiReactor<SubscribeForOrdersRequest, OrderEvent>*) > streamStarter =
+		std::bind(&TMSRemote::Stub::async::subscribeForOrders, stub.async(), _1, _2);
+	listener.start(streamStarter, request, consumer);
+...
+	listener.signalStop(caller);
+	listener.waitForStop(caller);
+*/
+template <class Request, class Event> class CallbackAsyncListener : public AsyncListenerBase, public grpc::ClientBidiReactor<Request, Event>
+{
+public:
+    CallbackAsyncListener(const std::string name) :
+        name_(name),
+        logPrefix_("["+name+"] "),
+        stopTimeout_(DefaultStopTimeout),
+        isStarted_(false),
+        isStopRequested_(false),
+        isWritePending_(false),
+        isWritesDoneSent_(false),
+        isFinished_(false),
+        eventCount_(0),
+        allocationCount_(0)
+    {
+        isDebug_.store(false);
+    }
+
+    virtual ~CallbackAsyncListener()
+    {
+        signalStop("[~CallbackAsyncListener()] ");
+        waitForStop("[~CallbackAsyncListener()] ");
+    }
+
+    virtual const std::string& getName() const
+    {
+        return name_;
+    }
+
+    virtual void setDebug(bool debug)
+    {
+        isDebug_.store(debug);
+    }
+
+    virtual void setStopTimeout(const std::chrono::milliseconds& timeout)
+    {
+        std::lock_guard<std::mutex> lock(stateLock_);
+        stopTimeout_ = timeout;
+    }
+
+    void start(std::function< void(grpc::ClientContext*, grpc::ClientBidiReactor<Request, Event>*) > streamStarter, const Request &request, std::function< bool(const Event&, const std::string&)> consumer)
+    {
+        {
+            std::lock_guard<std::mutex> lock(stateLock_);
+            if (isStarted_)
+            {
+                throw std::runtime_error("start() may only be called once");
+            }
+            isStarted_ = true;
+            isWritePending_ = true;
+            request_ = request;
+            consumer_ = consumer;
+        }
+        streamStarter(&context_, this);
+        // Subscription request and first Read() are queued before the call is started, so they go out as soon as stream is up
+        this->StartWrite(&request_);
+        this->StartRead(event_.get());
+        TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "Before StartCall()...");
+        this->StartCall();
+    }
+
+    virtual void signalStop(const std::string &caller)
+    {
+        TMS_LOG_DEBUG_IF(isDebug(), caller, name_, "Flagging listener to stop...");
+        std::lock_guard<std::mutex> lock(stateLock_);
+        requestStop();
+        sendWritesDoneIfIdle();
+        TMS_LOG_DEBUG_IF(isDebug(), caller, name_, "Listener stop flag is set");
+    }
+
+    virtual void waitForStop(const std::string& caller)
+    {
+        std::unique_lock<std::mutex> lock(stateLock_);
+        if (!isStarted_ || isFinished_)
+        {
+            return;
+        }
+        TMS_LOG_DEBUG_IF(isDebug(), caller, name_, "Waiting for listener stream to complete...");
+        if (isStopRequested_ && !finishedCondition_.wait_until(lock, stopDeadline_, [this] { return isFinished_; }))
+        {
+            // Cancelled call completes all its pending operations right away
+            TMS_LOG_INFO(caller, name_, " server has not closed the stream in time, cancelling the call");
+            context_.TryCancel();
+        }
+        finishedCondition_.wait(lock, [this] { return isFinished_; });
+        TMS_LOG_INFO(caller, name_, " listener is stopped");
+    }
+
+    virtual void OnWriteDone(bool ok)
+    {
+        std::lock_guard<std::mutex> lock(stateLock_);
+        isWritePending_ = false;
+        if (ok)
+        {
+            TMS_LOG_INFO(logPrefix_, "Subscription is accepted");
+            // Stop might have been requested while subscription request was being written
+            sendWritesDoneIfIdle();
+        }
+    }
+
+    virtual void OnReadDone(bool ok)
+    {
+        if (!ok)
+        {
+            // Server has closed the stream, OnDone() will follow
+            return;
+        }
+        // Heap allocations made by this callback thread for the event: consumer and arena recycling.
+        // Parsing is done by gRPC before OnReadDone(), so it's not included.
+        long long allocationsBefore = AllocationCounter::getThreadCount();
+        std::unique_lock<std::mutex> lock(stateLock_);
+        bool isDelivered = !isStopRequested_;
+        if (!isStopRequested_)
+        {
+            // Process event outside of the lock: consumer is allowed to stop the listener
+            lock.unlock();
+            int64_t receivedTime = Clock::getMonotonicTime();
+            bool result = consumer_(*event_.get(), logPrefix_);
+            recordLatency(event_.get()->sendingtime(), receivedTime);
+            lock.lock();
+            if (!result)
+            {
+                TMS_LOG_INFO(logPrefix_, "Got 'stop' flag from callback");
+                requestStop();
+                sendWritesDoneIfIdle();
+            }
+        }
+        else
+        {
+            TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "Skipping event received after request to stop");
+        }
+        lock.unlock();
+        // Keep reading: after stop it lets us know when server has closed the stream
+        event_.recycle();
+        if (isDelivered)
+        {
+            // Before StartRead(): next OnReadDone() may run on another thread as soon as it's called
+            eventCount_++;
+            allocationCount_ += AllocationCounter::getThreadCount() - allocationsBefore;
+        }
+        this->StartRead(event_.get());
+    }
+
+    virtual void OnWritesDoneDone(bool ok)
+    {
+        TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "WritesDone() is completed, ok==", std::boolalpha, ok);
+    }
+
+    virtual void OnDone(const grpc::Status& status)
+    {
+        std::unique_lock<std::mutex> lock(stateLock_);
+        if (!isStopRequested_)
+        {
+            lock.unlock();
+            TMS_LOG_INFO(logPrefix_, "Subscription call is dead! Status==", status.error_code(), " ", status.error_message());
+            Event disconnectEvent;
+            disconnectEvent.set_feedstatus(FeedStatus::Disconnected);
+            consumer_(disconnectEvent, logPrefix_);
+            notifyDisconnected();
+            lock.lock();
+        }
+        if (AllocationCounter::isEnabled() && eventCount_ > 0)
+        {
+            TMS_LOG_INFO(logPrefix_, "Received ", eventCount_, " events, ", (double)allocationCount_/eventCount_, " heap allocations per event (without parsing), ", event_.getResetCount(), " arena resets");
+        }
+        TMS_LOG_INFO(logPrefix_, "Stream completed");
+        isFinished_ = true;
+        finishedCondition_.notify_all();
+    }
+
+private:
+    bool isDebug()
+    {
+        return isDebug_.load();
+    }
+
+    // Must be called with stateLock_ held
+    void requestStop()
+    {
+        if (!isStopRequested_)
+        {
+            isStopRequested_ = true;
+            stopDeadline_ = std::chrono::system_clock::now() + stopTimeout_;
+        }
+    }
+
+    // Must be called with stateLock_ held
+    void sendWritesDoneIfIdle()
+    {
+        // WritesDone() can't overlap with the subscription request write
+        if (isStarted_ && isStopRequested_ && !isWritePending_ && !isWritesDoneSent_ && !isFinished_)
+        {
+            TMS_LOG_INFO(logPrefix_, "Detected request to stop");
+            TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "Calling WritesDone()");
+            // Let server know we're done with our stream
+            isWritesDoneSent_ = true;
+            this->StartWritesDone();
+        }
+    }
+
+private:
+    const std::string name_;
+    const std::string logPrefix_;
+
+    grpc::ClientContext context_;
+    Request request_;
+    // Events are parsed into arena memory, reused across Read() calls
+    ArenaEvent<Event> event_;
+    std::function< bool(const Event&, const std::string&)> consumer_;
+
+    // Listener state, guarded by stateLock_
+    std::mutex stateLock_;
+    std::condition_variable finishedCondition_;
+    std::chrono::milliseconds stopTimeout_;
+    std::chrono::system_clock::time_point stopDeadline_;
+    bool isStarted_;
+    bool isStopRequested_;
+    bool isWritePending_;
+    bool isWritesDoneSent_;
+    bool isFinished_;
+    // Events delivered to consumer and heap allocations made while handling them, changed by the read callback only
+    long long eventCount_;
+    long long allocationCount_;
+
+    std::atomic<bool> isDebug_;
+};
@@ -0,0 +1,199 @@
+#include <stdexcept>
+
+#include <tmsapigrpc/TMSRemoteRequests.pb.h>
+
+#include "Logger.h"
+
+#include "ChannelPool.h"
+
+namespace
+{
+	// Makes channel arguments of each channel distinct: channels with equal arguments may share a connection
+	const char* const ChannelIndexArgument = "tms.channel_pool_index";
+};
+
+ChannelPolicy::~ChannelPolicy()
+{
+}
+
+RoundRobinChannelPolicy::RoundRobinChannelPolicy()
+{
+	next_.store(0);
+}
+
+int RoundRobinChannelPolicy::selectChannel(ChannelTraffic traffic, bool isStream, const ChannelPool& pool)
+{
+	return (int)(next_++ % (unsigned int)pool.size());
+}
+
+LeastLoadedChannelPolicy::LeastLoadedChannelPolicy()
+{
+	next_.store(0);
+}
+
+int LeastLoadedChannelPolicy::selectChannel(ChannelTraffic traffic, bool isStream, const ChannelPool& pool)
+{
+	if (!isStream)
+	{
+		return (int)(next_++ % (unsigned int)pool.size());
+	}
+	int result = 0;
+	int fewestStreams = pool.getLoad(0).activeStreams;
+	for (int i = 1; i < pool.size(); i++)
+	{
+		int streams = pool.getLoad(i).activeStreams;
+		if (streams < fewestStreams)
+		{
+			result = i;
+			fewestStreams = streams;
+		}
+	}
+	return result;
+}
+
+SeparateMarketDataChannelPolicy::SeparateMarketDataChannelPolicy(int marketDataChannels) :
+	marketDataChannels_(marketDataChannels > 0 ? marketDataChannels : 1)
+{
+	nextMarketData_.store(0);
+	nextOther_.store(0);
+}
+
+int SeparateMarketDataChannelPolicy::selectChannel(ChannelTraffic traffic, bool isStream, const ChannelPool& pool)
+{
+	if (pool.size() <= marketDataChannels_)
+	{
+		return (int)(nextOther_++ % (unsigned int)pool.size());
+	}
+	if (traffic == ChannelTraffic::MarketData)
+	{
+		return (int)(nextMarketData_++ % (unsigned int)marketDataChannels_);
+	}
+	return marketDataChannels_ + (int)(nextOther_++ % (unsigned int)(pool.size() - marketDataChannels_));
+}
+
+ChannelPool::ChannelPool(const std::string& address, std::shared_ptr<grpc::ChannelCredentials> credentials, int channelCount,
+	std::unique_ptr<ChannelPolicy> policy, const grpc::ChannelArguments& baseArguments) :
+	address_(address),
+	policy_(std::move(policy))
+{
+	if (channelCount <= 0 || !policy_)
+	{
+		throw std::runtime_error("channel pool needs at least one channel and a policy");
+	}
+	for (int i = 0; i < channelCount; i++)
+	{
+		grpc::ChannelArguments arguments(baseArguments);
+		arguments.SetInt(ChannelIndexArgument, i);
+		arguments.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+		std::unique_ptr<Slot> slot(new Slot());
+		slot->channel = grpc::CreateCustomChannel(address, credentials, arguments);
+		slot->stub = TMSRemote::NewStub(slot->channel);
+		slot->activeStreams.store(0);
+		slot->openedStreams.store(0);
+		slot->unaryCalls.store(0);
+		slot->receivedEvents.store(0);
+		slots_.push_back(std::move(slot));
+	}
+}
+
+ChannelPool::~ChannelPool()
+{
+}
+
+int ChannelPool::size() const
+{
+	return (int)slots_.size();
+}
+
+std::shared_ptr<grpc::Channel> ChannelPool::getChannel(int channel) const
+{
+	return slots_[channel]->channel;
+}
+
+TMSRemote::Stub& ChannelPool::getStub(int channel) const
+{
+	return *slots_[channel]->stub;
+}
+
+bool ChannelPool::login(const std::string& user, const std::string& password)
+{
+	bool result = true;
+	for (int i = 0; i < size(); i++)
+	{
+		grpc::ClientContext context;
+		LoginRequest request;
+		Void response;
+		request.set_user(user);
+		request.set_password(password);
+		grpc::Status status = slots_[i]->stub->login(&context, request, &response);
+		if (!status.ok())
+		{
+			TMS_LOG_ERROR("[ChannelPool] Unable to login on channel ", i, " to ", address_, ": ", status.error_message());
+			result = false;
+		}
+	}
+	return result;
+}
+
+int ChannelPool::acquireStream(ChannelTraffic traffic)
+{
+	int channel = selectChannel(traffic, true);
+	slots_[channel]->activeStreams.fetch_add(1);
+	slots_[channel]->openedStreams.fetch_add(1);
+	return channel;
+}
+
+void ChannelPool::releaseStream(int channel)
+{
+	slots_[channel]->activeStreams.fetch_sub(1);
+}
+
+int ChannelPool::acquireUnaryCall(ChannelTraffic traffic)
+{
+	int channel = selectChannel(traffic, false);
+	slots_[channel]->unaryCalls.fetch_add(1, std::memory_order_relaxed);
+	return channel;
+}
+
+ChannelLoad ChannelPool::getLoad(int channel) const
+{
+	const Slot& slot = *slots_[channel];
+	ChannelLoad load = ChannelLoad();
+	load.activeStreams = slot.activeStreams.load();
+	load.openedStreams = slot.openedStreams.load();
+	load.unaryCalls = slot.unaryCalls.load(std::memory_order_relaxed);
+	load.receivedEvents = slot.receivedEvents.load(std::memory_order_relaxed);
+	return load;
+}
+
+void ChannelPool::dumpLoad(const std::string& caller) const
+{
+	for (int i = 0; i < size(); i++)
+	{
+		ChannelLoad load = getLoad(i);
+		TMS_LOG_INFO(caller, "Channel ", i, " to ", address_, " (", getStateName(slots_[i]->channel->GetState(false)), "): active streams=", load.activeStreams,
+			", opened streams=", load.openedStreams, ", unary calls=", load.unaryCalls, ", received events=", load.receivedEvents);
+	}
+}
+
+const char* ChannelPool::getStateName(grpc_connectivity_state state)
+{
+	switch (state)
+	{
+	case GRPC_CHANNEL_IDLE: return "IDLE";
+	case GRPC_CHANNEL_CONNECTING: return "CONNECTING";
+	case GRPC_CHANNEL_READY: return "READY";
+	case GRPC_CHANNEL_TRANSIENT_FAILURE: return "TRANSIENT_FAILURE";
+	default: return "SHUTDOWN";
+	}
+}
+
+int ChannelPool::selectChannel(ChannelTraffic traffic, bool isStream)
+{
+	int channel = policy_->selectChannel(traffic, isStream, *this);
+	if (channel < 0 || channel >= size())
+	{
+		throw std::runtime_error("channel policy has selected channel " + std::to_string(channel) + " of " + std::to_string(size()));
+	}
+	return channel;
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+#include <tmsapigrpc/TMSRemote.grpc.pb.h>
+
+class ChannelPool;
+
+// What kind of traffic a subscription or unary call carries, so that a policy can keep heavy market data apart from order flow
+enum class ChannelTraffic
+{
+	MarketData,
+	// Orders, targets, portfolios and trading requests
+	OrderFlow,
+	Other
+};
+
+template <class Event> struct ChannelTrafficTraits
+{
+	static const ChannelTraffic Traffic = ChannelTraffic::Other;
+};
+
+template <> struct ChannelTrafficTraits<MarketDataEvent>
+{
+	static const ChannelTraffic Traffic = ChannelTraffic::MarketData;
+};
+
+template <> struct ChannelTrafficTraits<OrderEvent>
+{
+	static const ChannelTraffic Traffic = ChannelTraffic::OrderFlow;
+};
+
+template <> struct ChannelTrafficTraits<TargetEvent>
+{
+	static const ChannelTraffic Traffic = ChannelTraffic::OrderFlow;
+};
+
+template <> struct ChannelTrafficTraits<PortfolioEvent>
+{
+	static const ChannelTraffic Traffic = ChannelTraffic::OrderFlow;
+};
+
+// Load of one channel since the pool was created
+struct ChannelLoad
+{
+	// Subscriptions currently using the channel (until their listeners are removed)
+	int activeStreams;
+	long long openedStreams;
+	long long unaryCalls;
+	long long receivedEvents;
+};
+
+// Picks a channel for each new subscription or unary call. Called concurrently from any thread.
+class ChannelPolicy
+{
+public:
+	virtual ~ChannelPolicy();
+	virtual int selectChannel(ChannelTraffic traffic, bool isStream, const ChannelPool& pool) = 0;
+};
+
+// Spreads everything evenly, regardless of traffic kind
+class RoundRobinChannelPolicy : public ChannelPolicy
+{
+public:
+	RoundRobinChannelPolicy();
+	virtual int selectChannel(ChannelTraffic traffic, bool isStream, const ChannelPool& pool);
+
+private:
+	std::atomic<unsigned int> next_;
+};
+
+// Subscriptions go to the channel with the fewest active streams, unary calls are spread round robin
+class LeastLoadedChannelPolicy : public ChannelPolicy
+{
+public:
+	LeastLoadedChannelPolicy();
+	virtual int selectChannel(ChannelTraffic traffic, bool isStream, const ChannelPool& pool);
+
+private:
+	std::atomic<unsigned int> next_;
+};
+
+// First marketDataChannels channels carry market data only, the rest carry everything else, round robin within each group.
+// If the pool has no more channels than that, all traffic shares them.
+class SeparateMarketDataChannelPolicy : public ChannelPolicy
+{
+public:
+	explicit SeparateMarketDataChannelPolicy(int marketDataChannels);
+	virtual int selectChannel(ChannelTraffic traffic, bool isStream, const ChannelPool& pool);
+
+private:
+	const int marketDataChannels_;
+	std::atomic<unsigned int> nextMarketData_;
+	std::atomic<unsigned int> nextOther_;
+};
+
+/**
+Fixed set of channels to the same server, so that traffic isn't limited by one HTTP/2 connection's flow-control window and I/O thread.
+Each channel gets distinct channel arguments and its own subchannel pool, so gRPC opens a separate connection for each of them.
+
+Subscriptions and unary calls are assigned to channels by ChannelPolicy (round robin by default), the pool keeps per-channel load:
+active and opened streams, unary calls and received events. AsyncListenersManager and AsyncUnaryClient can be set up with a pool
+instead of a single stub.
+
+Usage:
+	ChannelPool channels("localhost:8083", credentials, 4, std::unique_ptr<ChannelPolicy>(new SeparateMarketDataChannelPolicy(2)));
+	channels.login(user, password); // Before any subscription or call goes over the channels
+	AsyncListenersManager::setup(channels, ListenerMode::SharedCompletionQueues); // Market data subscriptions go to channels 0 and 1
+	AsyncUnaryClient asyncClient(channels); // Unary calls are order flow: channels 2 and 3
+...
+	channels.dumpLoad("[Main] ");
+*/
+class ChannelPool
+{
+public:
+	// baseArguments apply to all channels, e.g. message size limits or keepalive
+	ChannelPool(const std::string& address, std::shared_ptr<grpc::ChannelCredentials> credentials, int channelCount,
+		std::unique_ptr<ChannelPolicy> policy = std::unique_ptr<ChannelPolicy>(new RoundRobinChannelPolicy()),
+		const grpc::ChannelArguments& baseArguments = grpc::ChannelArguments());
+	~ChannelPool();
+
+	ChannelPool(const ChannelPool&) = delete;
+	void operator=(const ChannelPool&) = delete;
+
+	int size() const;
+	std::shared_ptr<grpc::Channel> getChannel(int channel) const;
+	TMSRemote::Stub& getStub(int channel) const;
+	// Server expects a login on each new connection: logs in on every channel, false if any login has failed
+	bool login(const std::string& user, const std::string& password);
+
+	// Picks channel for a new subscription and counts it as active until releaseStream()
+	int acquireStream(ChannelTraffic traffic);
+	void releaseStream(int channel);
+	// Picks channel for a unary call
+	int acquireUnaryCall(ChannelTraffic traffic);
+	void addReceivedEvents(int channel, long long count)
+	{
+		slots_[channel]->receivedEvents.fetch_add(count, std::memory_order_relaxed);
+	}
+
+	ChannelLoad getLoad(int channel) const;
+	// Logs load and connectivity state of every channel
+	void dumpLoad(const std::string& caller) const;
+
+	static const char* getStateName(grpc_connectivity_state state);
+
+private:
+	int selectChannel(ChannelTraffic traffic, bool isStream);
+
+	// Counters of each channel are allocated separately, so channels' hot counters don't share cache lines
+	struct Slot
+	{
+		std::shared_ptr<grpc::Channel> channel;
+		std::unique_ptr<TMSRemote::Stub> stub;
+		std::atomic<int> activeStreams;
+		std::atomic<long long> openedStreams;
+		std::atomic<long long> unaryCalls;
+		std::atomic<long long> receivedEvents;
+	};
+
+private:
+	const std::string address_;
+	std::unique_ptr<ChannelPolicy> policy_;
+	std::vector<std::unique_ptr<Slot>> slots_;
+};
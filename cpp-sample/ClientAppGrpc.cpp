@@ -3,6 +3,7 @@
 #include <fstream>
 #include <ctime>
 #include <chrono>
+#include <future>
 #include <thread>
 
 #include <grpcpp/grpcpp.h>
@@ -12,11 +13,25 @@
 #include <tmsapigrpc/TMSRemote.grpc.pb.h>
 
 #include "Utils.h"
+#include "Logger.h"
 #include "AsyncListener.hpp"
 #include "AsyncListenersManager.h"
 #include "AsyncListenersManager.hpp"
+#include "AsyncUnaryClient.hpp"
+#include "BarBuilder.h"
+#include "ChannelPool.h"
+#include "ConnectivityMonitor.h"
+#include "DecoupledConsumer.hpp"
+#include "EventView.hpp"
+#include "FieldRegistry.h"
+#include "FieldSchema.h"
+#include "MarketDataHub.h"
+#include "OrderActionBatcher.h"
+#include "RecordCache.hpp"
+#include "SecurityMaster.h"
 #include "StatefulSubscriber.h"
 #include "StatelessSubscriber.h"
+#include "TradeAnalytics.h"
 
 using namespace Utils;
 
@@ -38,7 +53,17 @@ class TMSRemoteClient
 {
 public:
     TMSRemoteClient(std::shared_ptr<::grpc::Channel> channel) :
-        client_(TMSRemote::NewStub(channel))
+        client_(TMSRemote::NewStub(channel)),
+        asyncClient_(*client_)
+    {
+        keepProcessingOrders_.store(true);
+        isDebug_.store(false);
+    }
+
+    // Blocking calls go over the pool's last channel, pipelined calls are spread by the pool's policy
+    TMSRemoteClient(ChannelPool& channelPool) :
+        client_(TMSRemote::NewStub(channelPool.getChannel(channelPool.size() - 1))),
+        asyncClient_(channelPool)
     {
         keepProcessingOrders_.store(true);
         isDebug_.store(false);
@@ -58,13 +83,40 @@ public:
 
         if (!status.ok())
         {
-            std::cout << "unable to create market portfolio: " << status.error_message() << std::endl;
+            TMS_LOG_ERROR("unable to create market portfolio: ", status.error_message());
         }
 
         return status.ok();
     }
 //END SNIPPET: Create Market Portfolio
 
+//START SNIPPET: Pipelined Requests
+    // All requests are sent before waiting for any reply, so creating many portfolios takes about one round trip instead of one per portfolio
+    bool create_market_portfolios(const std::vector<std::string>& portfolio_names)
+    {
+        std::vector<std::future<UnaryResult<::Void>>> replies;
+        for (const std::string& portfolio_name : portfolio_names)
+        {
+            ::CreateMarketPortfolioRequest request;
+            request.set_name(portfolio_name);
+            request.set_type(::PortfolioType::Market);
+            replies.push_back(asyncClient_.call(&TMSRemote::Stub::PrepareAsynccreateMarketPortfolio, request));
+        }
+
+        bool result = true;
+        for (size_t i = 0; i < replies.size(); i++)
+        {
+            UnaryResult<::Void> reply = replies[i].get();
+            if (!reply.status.ok())
+            {
+                TMS_LOG_ERROR("unable to create market portfolio ", portfolio_names[i], ": ", reply.status.error_message());
+                result = false;
+            }
+        }
+        return result;
+    }
+//END SNIPPET: Pipelined Requests
+
 //START SNIPPET: Modify Portfolio
     bool modify_market_portfolio(const std::string& portfolio_name)
     {
@@ -81,7 +133,7 @@ public:
 
         if (!status.ok())
         {
-            std::cout << "unable to modify market portfolio: " << status.error_message() << std::endl;
+            TMS_LOG_ERROR("unable to modify market portfolio: ", status.error_message());
         }
 
         return status.ok();
@@ -101,7 +153,7 @@ public:
 
         if (!status.ok())
         {
-            std::cout << "ping failed: " << status.error_message() << std::endl;
+            TMS_LOG_ERROR("ping failed: ", status.error_message());
         }
 
         return status.ok();
@@ -121,7 +173,7 @@ public:
 
         if (!status.ok())
         {
-            std::cout << "unable to modify market portfolio: " << status.error_message() << std::endl;
+            TMS_LOG_ERROR("unable to modify market portfolio: ", status.error_message());
         }
 
         return status.ok();
@@ -144,11 +196,19 @@ public:
         (*numericfields)["TgtQty"] = qty;
         (*numericfields)["TgtOrdType"] = ::OrdType::OrdType_Market;
 
+        // Fields the server would reject don't cost a round trip
+        std::string error;
+        if (!FieldSchema::getInstance().validate(FieldDomain::MarketTarget, *fields, false, &error))
+        {
+            TMS_LOG_ERROR("unable to add market target: ", error);
+            return -1;
+        }
+
         auto status = client_->addMarketTargets(&context, request, &response);
 
         if (!status.ok())
         {
-            std::cout << "unable to add market target: " << status.error_message() << std::endl;
+            TMS_LOG_ERROR("unable to add market target: ", status.error_message());
         }
 
         return (response.targetid_size() > 0) ? response.targetid(0) : -1;
@@ -168,7 +228,7 @@ public:
 
         if (!status.ok())
         {
-            std::cout << "unable to remove market target: " << status.error_message() << std::endl;
+            TMS_LOG_ERROR("unable to remove market target: ", status.error_message());
         }
 
         return status.ok();
@@ -198,7 +258,7 @@ public:
 
         if (!status.ok())
         {
-            std::cout << "unable to " << (pause ? "pause" : "resume") << " market target: " << status.error_message() << std::endl;
+            TMS_LOG_ERROR("unable to ", (pause ? "pause" : "resume"), " market target: ", status.error_message());
         }
 
         return status.ok();
@@ -218,7 +278,7 @@ public:
 
         if (!status.ok())
         {
-            std::cout << "unable to terminate market target: " << status.error_message() << std::endl;
+            TMS_LOG_ERROR("unable to terminate market target: ", status.error_message());
         }
 
         return status.ok();
@@ -240,11 +300,18 @@ public:
         (*numericfields)["WaveSizeType"] = wave_size_type;
         (*numericfields)["WaveSize"] = wave_size;
 
+        std::string error;
+        if (!FieldSchema::getInstance().validate(FieldDomain::MarketTarget, *fields, true, &error))
+        {
+            TMS_LOG_ERROR("unable to modify market target: ", error);
+            return false;
+        }
+
         auto status = client_->modifyMarketTargets(&context, request, &response);
 
         if (!status.ok())
         {
-            std::cout << "unable to modify market target: " << status.error_message() << std::endl;
+            TMS_LOG_ERROR("unable to modify market target: ", status.error_message());
         }
 
         return status.ok();
@@ -264,7 +331,7 @@ public:
 
         if (!status.ok())
         {
-            std::cout << "unable to get market target: " << status.error_message() << std::endl;
+            TMS_LOG_ERROR("unable to get market target: ", status.error_message());
         }
 
         return status.ok();
@@ -285,46 +352,46 @@ public:
         auto stream = client_->subscribeForOrders(&context);
         stream->Write(request);
 
-        std::cout << get_timestamp() << caller << "Calling first Read()..." << std::endl;
+        TMS_LOG_INFO(caller, "Calling first Read()...");
         while (stream->Read(&event))
         {
-            if (isDebug()) std::cout << get_timestamp() << caller << "After Read(), checking if continue..." << std::endl;
+            TMS_LOG_DEBUG_IF(isDebug(), caller, "After Read(), checking if continue...");
             bool goOn = keepProcessingOrders_.load();
-            std::cout << get_timestamp() << caller << "Read() completed, continue==" << std::boolalpha << goOn << std::endl;
+            TMS_LOG_INFO(caller, "Read() completed, continue==", std::boolalpha, goOn);
             if (!goOn)
             {
-                std::cout << get_timestamp() << caller << "Detected request to stop" << std::endl;
-                if (isDebug()) std::cout << get_timestamp() << caller << "Calling WritesDone()" << std::endl;
+                TMS_LOG_INFO(caller, "Detected request to stop");
+                TMS_LOG_DEBUG_IF(isDebug(), caller, "Calling WritesDone()");
                 // Let server know we're done with our stream
                 stream->WritesDone();
                 // Wait for server to close the stream on its side
                 do
                 {
-                    if (isDebug()) std::cout << get_timestamp() << caller << "Waiting for server to close stream..." << std::endl;
+                    TMS_LOG_DEBUG_IF(isDebug(), caller, "Waiting for server to close stream...");
                 } while (stream->Read(&event));
                 break;
             }
-            if (isDebug()) std::cout << get_timestamp() << caller << "Before process_order()" << std::endl;
+            TMS_LOG_DEBUG_IF(isDebug(), caller, "Before process_order()");
             process_order(event, caller);
-            if (isDebug()) std::cout << get_timestamp() << caller << "After process_order()" << std::endl;
+            TMS_LOG_DEBUG_IF(isDebug(), caller, "After process_order()");
             /*
             Unexpected behavior: Setting deadline does nothing.
             */
             std::chrono::system_clock::time_point deadline = std::chrono::system_clock::now() + std::chrono::seconds(1);
             context.set_deadline(deadline);
-            std::cout << get_timestamp() << caller << "Calling next Read()..." << std::endl;
+            TMS_LOG_INFO(caller, "Calling next Read()...");
         }
-        std::cout << get_timestamp() << caller << "Terminating stream..." << std::endl;
+        TMS_LOG_INFO(caller, "Terminating stream...");
         auto status = stream->Finish();
         if (status.ok())
         {
-            std::cout << get_timestamp() << caller << "Stream termination successful" << std::endl;
+            TMS_LOG_INFO(caller, "Stream termination successful");
         }
         else
         {
-            std::cout << get_timestamp() << caller << "Stream termination error: Received status " << status.error_message() << std::endl;
+            TMS_LOG_INFO(caller, "Stream termination error: Received status ", status.error_message());
         }
-        std::cout << get_timestamp() << caller << "Stream completed" << std::endl;
+        TMS_LOG_INFO(caller, "Stream completed");
     }
 
     bool process_order(const ::OrderEvent& event, const std::string &caller)
@@ -336,27 +403,35 @@ public:
         // Process newly added orders
         case ::OrderEvent::EventCase::kAdded:
             {
-                if (isDebug()) std::cout << get_timestamp() << caller << "process_order(kAdded) " << std::endl;
-                auto added = event.added();
+                TMS_LOG_DEBUG_IF(isDebug(), caller, "process_order(kAdded) ");
+                OrderEventView added(event);
 
-                std::string order_id = added.orderid();
-                auto fields = added.fields();
-                auto numericfields = fields.numericfields();
-                double orderQty = numericfields["OrdQty"];
-                double cumQty = numericfields["FillQty"];
+                const std::string& order_id = added.getKey();
+                FieldsView fields = added.getFields();
+                double orderQty = fields.getNumeric("OrdQty", 0);
+                double cumQty = fields.getNumeric("FillQty", 0);
 
-                std::cout << get_timestamp() << caller << "Received New Order notification: order ID=" << order_id << ", OrderQty=" << orderQty << ", CumQty=" << cumQty << std::endl;
+                TMS_LOG_INFO(caller, "Received New Order notification: order ID=", order_id, ", OrderQty=", orderQty, ", CumQty=", cumQty);
 
                 double leavesQty = orderQty - cumQty;
                 if (leavesQty <= 300)
                 {
                     if (leavesQty > 0)
                     {
-                        cancel_order(order_id, caller);
+                        if (orderActions_)
+                        {
+                            // Queued for the next cancelOrders() batch, failures are logged by the batcher
+                            orderActions_->cancelOrder(order_id);
+                            TMS_LOG_INFO(caller, "Canceling order with ID=", order_id, "...queued");
+                        }
+                        else
+                        {
+                            cancel_order(order_id, caller);
+                        }
                     }
                     else
                     {
-                        std::cout << get_timestamp() << caller << "Will not cancel order with ID=" << order_id << ": it's completely filled." << std::endl;
+                        TMS_LOG_INFO(caller, "Will not cancel order with ID=", order_id, ": it's completely filled.");
                     }
                 }
                 else
@@ -364,28 +439,39 @@ public:
                     double newQty = orderQty - 100;
                     if (newQty >= cumQty)
                     {
-                        modify_order(order_id, "FILL_100", newQty, caller);
+                        if (orderActions_)
+                        {
+                            ::FIXFields message;
+                            (*message.mutable_stringfields())[::FIXTag::FIXTag_Text] = "FILL_100";
+                            (*message.mutable_numericfields())[::FIXTag::FIXTag_OrderQty] = newQty;
+                            orderActions_->modifyOrder(order_id, message);
+                            TMS_LOG_INFO(caller, "Modifying order with ID=", order_id, "...queued");
+                        }
+                        else
+                        {
+                            modify_order(order_id, "FILL_100", newQty, caller);
+                        }
                     }
                     else
                     {
-                        std::cout << get_timestamp() << caller << "Will not modify order with ID=" << order_id << ": its CumQty is too close to OrderQty." << std::endl;
+                        TMS_LOG_INFO(caller, "Will not modify order with ID=", order_id, ": its CumQty is too close to OrderQty.");
                     }
                 }
             }
             break;
 
         case ::OrderEvent::EventCase::kFeedStatus:
-            if (isDebug()) std::cout << get_timestamp() << caller << "process_order(kFeedStatus) " << std::endl;
+            TMS_LOG_DEBUG_IF(isDebug(), caller, "process_order(kFeedStatus) ");
             switch (event.feedstatus())
             {
             case ::FeedStatus::Disconnected:
-                if (isDebug()) std::cout << get_timestamp() << caller << "Stream Disconnected" << std::endl;
+                TMS_LOG_DEBUG_IF(isDebug(), caller, "Stream Disconnected");
                 break;
             case ::FeedStatus::InitialStateReceived:
-                if (isDebug()) std::cout << get_timestamp() << caller << "Stream InitialStateReceived" << std::endl;
+                TMS_LOG_DEBUG_IF(isDebug(), caller, "Stream InitialStateReceived");
                 break;
             case ::FeedStatus::Reconnected:
-                if (isDebug()) std::cout << get_timestamp() << caller << "Stream Reconnected" << std::endl;
+                TMS_LOG_DEBUG_IF(isDebug(), caller, "Stream Reconnected");
                 break;
             default:
                 break;
@@ -393,19 +479,18 @@ public:
             break;
         case ::OrderEvent::EventCase::kUpdated:
             {
-                auto updated = event.updated();
-                std::string order_id = updated.orderid();
-                std::cout << get_timestamp() << caller << "Order " << order_id << " is updated " << std::endl;
+                const std::string& order_id = OrderEventView(event).getKey();
+                TMS_LOG_INFO(caller, "Order ", order_id, " is updated ");
             }
             break;
         case ::OrderEvent::EventCase::kFilteredOut:
-            if (isDebug()) std::cout << get_timestamp() << caller << "process_order(kFilteredOut) " << std::endl;
+            TMS_LOG_DEBUG_IF(isDebug(), caller, "process_order(kFilteredOut) ");
             break;
         case ::OrderEvent::EventCase::EVENT_NOT_SET:
-            if (isDebug()) std::cout << get_timestamp() << caller << "process_order(EVENT_NOT_SET) " << std::endl;
+            TMS_LOG_DEBUG_IF(isDebug(), caller, "process_order(EVENT_NOT_SET) ");
             break;
         default:
-            if (isDebug()) std::cout << get_timestamp() << caller << "process_order(WTF?) " << std::endl;
+            TMS_LOG_DEBUG_IF(isDebug(), caller, "process_order(WTF?) ");
             break;
         }
         return keepProcessingOrders_.load();
@@ -419,16 +504,15 @@ public:
 
         request.add_orderid(order_id);
 
-        std::cout << get_timestamp() << caller << "Canceling order with ID=" << order_id << "...";
         auto status = client_->cancelOrders(&context, request, &response);
 
         if (status.ok())
         {
-            std::cout << "OK" << std::endl;
+            TMS_LOG_INFO(caller, "Canceling order with ID=", order_id, "...OK");
         }
         else
         {
-            std::cout << std::endl << get_timestamp() << caller << "Unable to cancel order with ID=" << order_id << ": " << status.error_message() << std::endl;
+            TMS_LOG_INFO(caller, "Unable to cancel order with ID=", order_id, ": ", status.error_message());
         }
 
         return status.ok();
@@ -448,16 +532,15 @@ public:
         (*stringfields)[::FIXTag::FIXTag_Text] = text;
         (*numericfields)[::FIXTag::FIXTag_OrderQty] = newQty;
 
-        std::cout << get_timestamp() << caller << "Modifying order with ID=" << order_id << "...";
         auto status = client_->modifyOrders(&context, request, &response);
 
         if (status.ok())
         {
-            std::cout << "OK" << std::endl;
+            TMS_LOG_INFO(caller, "Modifying order with ID=", order_id, "...OK");
         }
         else
         {
-            std::cout << std::endl << get_timestamp() << caller << "Unable to modify order with ID=" << order_id << " to new qty=" << newQty << ": " << status.error_message() << std::endl;
+            TMS_LOG_INFO(caller, "Unable to modify order with ID=", order_id, " to new qty=", newQty, ": ", status.error_message());
         }
 
         return status.ok();
@@ -478,12 +561,12 @@ public:
         (*numericfields)[::FIXTag::FIXTag_LastQty] = fillQty;
         (*numericfields)[::FIXTag::FIXTag_LastPx] = fillPx;
 
-        std::cout << get_timestamp() << "Filling order with ID=" << order_id << " with " << fillQty << "@" << fillPx << "..." << std::endl;
+        TMS_LOG_INFO("Filling order with ID=", order_id, " with ", fillQty, "@", fillPx, "...");
         auto status = client_->fillOrders(&context, request, &response);
 
         if (!status.ok())
         {
-            std::cout << std::endl << get_timestamp() << "Unable to fill order with ID=" << order_id << ": " << status.error_message() << std::endl;
+            TMS_LOG_INFO("Unable to fill order with ID=", order_id, ": ", status.error_message());
         }
 
         return status.ok();
@@ -508,7 +591,7 @@ public:
         availableRequest.set_domainmanagername(managerName);
         availableRequest.set_reportname(reportName);
         ReportAvailableResponse availableResponse;
-        std::cout << get_timestamp() << "Checking for presense of report '" << reportName << "' on manager '" << managerName << "'..." << std::endl;
+        TMS_LOG_INFO("Checking for presense of report '", reportName, "' on manager '", managerName, "'...");
         grpc::Status status = client_->isReportAvailable(&context, availableRequest, &availableResponse);
         if (status.ok())
         {
@@ -520,19 +603,19 @@ public:
                 createRequest.set_domainmanagername(managerName);
                 createRequest.set_reportspecresource(reportLocation);
                 Void createResponse;
-                std::cout << get_timestamp() << "Loading report from resource '" << reportLocation << "'..." << std::endl;
+                TMS_LOG_INFO("Loading report from resource '", reportLocation, "'...");
                 // Reusing status might be OK, but I don't want to gamble
                 grpc::Status anotherStatus = client_->createReport(&anotherContext, createRequest, &createResponse);
                 if (!anotherStatus.ok())
                 {
-                    std::cout << std::endl << get_timestamp() << "Unable to load report: " << anotherStatus.error_message() << std::endl;
+                    TMS_LOG_INFO("Unable to load report: ", anotherStatus.error_message());
                 }
                 return anotherStatus.ok();
             }
         }
         else
         {
-            std::cout << std::endl << get_timestamp() << "Unable to check report availability: " << status.error_message() << std::endl;
+            TMS_LOG_INFO("Unable to check report availability: ", status.error_message());
         }
         return false;
     }
@@ -541,6 +624,11 @@ public:
 //START SNIPPET: Use Security Master
     double get_close_price(const std::string& instrumentName)
     {
+        // Instruments of the cache are answered from memory, others take a getInstrumentInfos round trip
+        if (securityMaster_ && securityMaster_->hasInstrument(instrumentName))
+        {
+            return securityMaster_->getClosePx(instrumentName);
+        }
         double result = std::numeric_limits<double>::quiet_NaN();
         grpc::ClientContext context;
         InstrumentInfosRequest request;
@@ -560,7 +648,7 @@ public:
         }
         else
         {
-            std::cout << std::endl << get_timestamp() << "Unable to check report availability: " << status.error_message() << std::endl;
+            TMS_LOG_INFO("Unable to check report availability: ", status.error_message());
         }
         return result;
     }
@@ -578,7 +666,7 @@ public:
 
         if (!status.ok())
         {
-            std::cout << "unable to send target order: " << status.error_message() << std::endl;
+            TMS_LOG_ERROR("unable to send target order: ", status.error_message());
             printErrorDetails(context);
         }
 
@@ -601,7 +689,7 @@ public:
 
         if (!status.ok())
         {
-            std::cout << "unable to send target order: " << status.error_message() << std::endl;
+            TMS_LOG_ERROR("unable to send target order: ", status.error_message());
         }
 
         return status.ok();
@@ -615,30 +703,26 @@ public:
         {
             case ::TargetEvent::EventCase::kAdded:
             {
-                auto added = event.added();
-                auto fields = added.fields();
-                auto stringfields = fields.stringfields();
-                auto numericfields = fields.numericfields();
-
-                std::cout
-                    << get_timestamp() << caller
-                    << numericfields["TgtID"] << ", "
-                    << stringfields["Portfolio"] << ", "
-                    << stringfields["Instrument"] << ", "
-                    << numericfields["TgtQty"] << ", "
-                    << numericfields["FillQty"] << std::endl;
+                FieldsView fields = TargetEventView(event).getFields();
+
+                TMS_LOG_INFO(caller,
+                    fields.getNumeric("TgtID", 0), ", ",
+                    fields.getString("Portfolio"), ", ",
+                    fields.getString("Instrument"), ", ",
+                    fields.getNumeric("TgtQty", 0), ", ",
+                    fields.getNumeric("FillQty", 0));
             }
             break;
 
             case ::TargetEvent::EventCase::kFeedStatus:
-                if (isDebug()) std::cout << get_timestamp() << caller << "Received feed status " << event.feedstatus() << ", waiting for " << ::FeedStatus::InitialStateReceived << std::endl;
+                TMS_LOG_DEBUG_IF(isDebug(), caller, "Received feed status ", event.feedstatus(), ", waiting for ", ::FeedStatus::InitialStateReceived);
                 if (event.feedstatus() == ::FeedStatus::InitialStateReceived)
                 {
                     /*
                     We have received initial targets snapshot
                     We don't want to receive streaming target updates, so let's signal to cancel the stream
                     */
-                    std::cout << get_timestamp() << caller << "Market Targets snapshot completed" << std::endl;
+                    TMS_LOG_INFO(caller, "Market Targets snapshot completed");
                     return false;
                 }
                 break;
@@ -660,7 +744,7 @@ public:
         auto status = client_->sendCommandToCustomDataProviders(&context, request, &response);
         if (!status.ok())
         {
-            std::cout << "unable to set update rate: " << status.error_message() << std::endl;
+            TMS_LOG_ERROR("unable to set update rate: ", status.error_message());
         }
     }
 
@@ -680,7 +764,7 @@ public:
         auto stream = client_->subscribeForMarketTargets(&context);
         stream->Write(request);
 
-        std::cout << std::endl << std::endl << get_timestamp() << caller << "Reqest sent" << std::endl;
+        TMS_LOG_INFO(caller, "Reqest sent");
         int count = 0;
 
 //START SNIPPET: Detecting unsubscription from Market Target events by server
@@ -690,35 +774,41 @@ public:
             if (!process_target(event, caller))
             {
 //START SNIPPET: Terminating subscription to Market Target events
-                std::cout << get_timestamp() << caller << "Received total of " << count << " market targets in sync snapshot" << std::endl;
-                if (isDebug()) std::cout << get_timestamp() << caller << "Calling WritesDone()" << std::endl;
+                TMS_LOG_INFO(caller, "Received total of ", count, " market targets in sync snapshot");
+                TMS_LOG_DEBUG_IF(isDebug(), caller, "Calling WritesDone()");
                 // Let server know we're done with our stream
                 stream->WritesDone();
                 // Wait for server to close the stream on its side
                 do
                 {
-                    if (isDebug()) std::cout << get_timestamp() << caller << "Waiting for server to close stream..." << std::endl;
+                    TMS_LOG_DEBUG_IF(isDebug(), caller, "Waiting for server to close stream...");
                 } while (stream->Read(&event));
 //END SNIPPET: Terminating subscription to Market Target events
             }
             count++;
         }
-        std::cout << get_timestamp() << caller << "Terminating stream..." << std::endl;
+        TMS_LOG_INFO(caller, "Terminating stream...");
         auto status = stream->Finish();
         if (status.ok())
         {
-            std::cout << get_timestamp() << caller << "Stream termination successful" << std::endl;
+            TMS_LOG_INFO(caller, "Stream termination successful");
         }
         else
         {
-            std::cout << get_timestamp() << caller << "Stream termination error: Received status " << status.error_message() << std::endl;
+            TMS_LOG_INFO(caller, "Stream termination error: Received status ", status.error_message());
         }
-        std::cout << get_timestamp() << caller << "Stream completed" << std::endl;
+        TMS_LOG_INFO(caller, "Stream completed");
     }
 //END SNIPPET: Subscribe to Market Target events
 
 //START SNIPPET: Login
     bool login(const std::string& user, const std::string& password)
+    {
+        return login(*client_, user, password);
+    }
+
+    // Server expects a login on each new connection, so a client with several channels logs in on each of them
+    static bool login(TMSRemote::Stub& stub, const std::string& user, const std::string& password)
     {
         ::grpc::ClientContext context;
         ::LoginRequest login_request;
@@ -727,11 +817,11 @@ public:
         login_request.set_user(user);
         login_request.set_password(password);
 
-        auto status = client_->login(&context, login_request, &response);
+        auto status = stub.login(&context, login_request, &response);
 
         if (!status.ok())
         {
-            std::cout << "unable to login: " << status.error_message() << std::endl;
+            TMS_LOG_ERROR("unable to login: ", status.error_message());
         }
 
         return status.ok();
@@ -740,9 +830,9 @@ public:
 
     void stopProcessingOrders(const std::string &caller)
     {
-        if (isDebug()) std::cout << get_timestamp() << caller<< "Marking order processor as inactive..." << std::endl;
+        TMS_LOG_DEBUG_IF(isDebug(), caller, "Marking order processor as inactive...");
         keepProcessingOrders_.store(false);
-        if (isDebug()) std::cout << get_timestamp() << caller << "Order processor stop flag is set" << std::endl;
+        TMS_LOG_DEBUG_IF(isDebug(), caller, "Order processor stop flag is set");
     }
 
     void printErrorDetails(const grpc::ClientContext& context)
@@ -752,12 +842,12 @@ public:
         auto iter = trailing_metadata.find("exceptionclass");
         if (iter != trailing_metadata.end())
         {
-            std::cout << "ExceptionClass: " << iter->second << std::endl;
+            TMS_LOG_ERROR("ExceptionClass: ", iter->second);
         }
         iter = trailing_metadata.find("errorcode");
         if (iter != trailing_metadata.end())
         {
-            std::cout << "ErrorCode: " << iter->second << std::endl;
+            TMS_LOG_ERROR("ErrorCode: ", iter->second);
         }
 
         iter = trailing_metadata.find("childexceptionscount");
@@ -769,7 +859,7 @@ public:
                 iter = trailing_metadata.find("childexceptionmessage_" + std::to_string(i));
                 if (iter != trailing_metadata.end())
                 {
-                    std::cout << "\tChildException: " << iter->second << std::endl;
+                    TMS_LOG_ERROR("\tChildException: ", iter->second);
                 }
             }
         }
@@ -785,11 +875,35 @@ public:
         return isDebug_.load();
     }
 
+    // process_order() queues its cancels and modifies to the batcher instead of sending them one by one on the listener thread
+    void enableOrderActionBatching()
+    {
+        orderActions_.reset(new OrderActionBatcher(*client_));
+    }
+
+    // get_close_price() looks instruments up in the security master first, it must outlive the client's use
+    void setSecurityMaster(const SecurityMaster* securityMaster)
+    {
+        securityMaster_ = securityMaster;
+    }
+
+    // Sends queued order actions and waits for replies
+    void stopOrderActionBatching()
+    {
+        if (orderActions_)
+        {
+            orderActions_->shutdown();
+        }
+    }
+
 public:
      std::unique_ptr<TMSRemote::Stub> client_;
 private:
     std::atomic<bool> keepProcessingOrders_;
     std::atomic<bool> isDebug_;
+    AsyncUnaryClient asyncClient_;
+    std::unique_ptr<OrderActionBatcher> orderActions_;
+    const SecurityMaster* securityMaster_ = nullptr;
 };
 
 
@@ -797,18 +911,83 @@ int main()
 {
     static const bool debug = false;
     static const bool useSyncOrderListener = false; // Set to true to reproduce the problem with synchronous stream: blocking Read() call in subscribe_for_orders() method
+    static const ListenerMode listenerMode = ListenerMode::ThreadPerListener; // Set to SharedCompletionQueues to serve all managed listeners from a fixed pool of poller threads
+    static const bool decoupleOrderProcessing = false; // Set to true to process order events on a separate thread, so blocking RPCs in process_order() don't stall reading of the orders stream
+    static const bool batchOrderActions = false; // Set to true to send cancels and modifies of process_order() from a background thread, coalesced into multi-order RPCs
+    static const bool reconnectListeners = false; // Set to true to log in again and resubscribe managed listeners when their calls die, e.g. after a network blip
+    static const bool monitorConnectivity = true; // Ping server every second: RTT statistics, early warning of degraded connection and server clock offset for latency measurements
+    static const bool useMarketDataHub = true; // Set to false to give each VWAP calculator its own market data listener instead of sharing the hub's streams
+    static const bool conflateMarketData = true; // Set to false to make VWAP calculators process every market data update on the listener thread: conflation merges quote updates they haven't caught up with yet
+    static const bool useSecurityMaster = true; // Set to false to make get_close_price() call getInstrumentInfos every time instead of looking up the security master cache
+    static const bool buildBars = false; // Set to true to log 5-second bars of the VWAP calculators' names, built from market data hub's streams
+    static const int channelCount = 1; // Set to more than 1 to open several connections: market data subscriptions get the first one, everything else shares the rest
     static const std::string caller = "[Main] ";
 
     auto ssl_options = grpc::SslCredentialsOptions();
     ssl_options.pem_root_certs = get_file_contents("cert.pem");
-    auto channel = ::grpc::CreateChannel("localhost:8083", ::grpc::SslCredentials(ssl_options));
-    TMSRemoteClient client(channel);
+    auto credentials = ::grpc::SslCredentials(ssl_options);
+    // Static, so that the pool is destroyed after AsyncListenersManager singleton, which keeps using it
+    static std::unique_ptr<ChannelPool> channelPool;
+    if (channelCount > 1)
+    {
+        channelPool.reset(new ChannelPool("localhost:8083", credentials, channelCount, std::unique_ptr<ChannelPolicy>(new SeparateMarketDataChannelPolicy(1))));
+    }
+    auto channel = channelPool ? channelPool->getChannel(channelCount - 1) : ::grpc::CreateChannel("localhost:8083", credentials);
+    std::unique_ptr<TMSRemoteClient> clientHolder(channelPool ? new TMSRemoteClient(*channelPool) : new TMSRemoteClient(channel));
+    TMSRemoteClient& client = *clientHolder;
     client.setDebug(debug);
+    if (batchOrderActions)
+    {
+        client.enableOrderActionBatching();
+    }
 
     const std::string PORTFOLIO = "Test " + std::to_string(std::time(nullptr));
     const std::string TMP_PORTFOLIO = PORTFOLIO+" - tmp";
 
-    client.login("demo", "");
+    if (channelPool)
+    {
+        // Server expects a login on each new connection, and each channel of the pool has its own
+        if (!channelPool->login("demo", ""))
+        {
+            TMS_LOG_ERROR(caller, "Login has failed on some of ", channelCount, " channels");
+            return 1;
+        }
+    }
+    else
+    {
+        client.login("demo", "");
+    }
+
+    // Measure server clock offset before listeners start measuring transit latency
+    ConnectivityMonitor connectivityMonitor(*client.client_);
+    if (monitorConnectivity)
+    {
+        connectivityMonitor.start();
+    }
+
+    // Fetch field types once per session: they validate targets before they're sent, and map field names to dense IDs before any listener starts converting received fields
+    FieldSchema& fieldSchema = FieldSchema::getInstance();
+    fieldSchema.load(*client.client_);
+    for (FieldDomain domain : { FieldDomain::MarketTarget, FieldDomain::Order, FieldDomain::MarketPortfolio, FieldDomain::StagedTarget, FieldDomain::MarketData })
+    {
+        if (std::shared_ptr<const RecordDecoder> decoder = fieldSchema.getDecoder(domain))
+        {
+            FieldRegistry::getInstance().addFieldTypes(decoder->getFieldTypes());
+        }
+    }
+
+    // Warm start from the image saved by an earlier run of this session, then refresh it in the background: lookups use the mapped image until the new one is loaded.
+    // Image of an earlier session is not opened, get_close_price() asks the server until the load is done.
+    SecurityMasterOptions securityMasterOptions;
+    securityMasterOptions.path = "security_master.bin";
+    SecurityMaster securityMaster(securityMasterOptions);
+    std::future<bool> securityMasterLoaded;
+    if (useSecurityMaster)
+    {
+        securityMaster.open(securityMasterOptions.path);
+        securityMasterLoaded = std::async(std::launch::async, [&securityMaster, &client] { return securityMaster.load(*client.client_, { "IBM", "MSFT", "VOD LN" }); });
+        client.setSecurityMaster(&securityMaster);
+    }
 
     using std::placeholders::_1;
     using std::placeholders::_2;
@@ -836,26 +1015,74 @@ int main()
 
 #ifdef USE_MANAGED_LISTENERS
 //START SNIPPET: Get Market Targets - setup listeners manager
-    AsyncListenersManager::setup(*client.client_);
+    if (channelPool)
+    {
+        AsyncListenersManager::setup(*channelPool, listenerMode);
+    }
+    else
+    {
+        AsyncListenersManager::setup(*client.client_, listenerMode);
+    }
     AsyncListenersManager& manager = AsyncListenersManager::getInstance();
 //END SNIPPET: Get Market Targets - setup listeners manager
-    int orderListenerId = manager.startListening(&TMSRemote::Stub::PrepareAsyncsubscribeForOrders, ordersRequest, ordersConsumer, "Managed Orders Listener", debug);
+    if (reconnectListeners)
+    {
+        // Server expects a new login on each new connection
+        ReconnectOptions reconnectOptions;
+        reconnectOptions.login = [](const std::shared_ptr<::grpc::Channel>& channel) { return TMSRemoteClient::login(*TMSRemote::NewStub(channel), "demo", ""); };
+        manager.enableReconnect(reconnectOptions, channel);
+    }
+    // process_order() calls blocking cancel_order()/modify_order(), so it's a good candidate for decoupled delivery
+    std::unique_ptr< DecoupledConsumer<OrderEvent>> ordersDispatcher(decoupleOrderProcessing ? new DecoupledConsumer<OrderEvent>(ordersConsumer) : NULL);
+    // After TMS failover, orders are replayed as Added events: pass on only the ones that have changed, so process_order() doesn't cancel or modify the same orders again
+    RecordCache<OrderEvent> ordersCache;
+    int orderListenerId = manager.startListening(&TMSRemote::Stub::PrepareAsyncsubscribeForOrders, ordersRequest, ordersCache.asResyncingConsumer(ordersDispatcher ? ordersDispatcher->asConsumer() : ordersConsumer), "Managed Orders Listener", debug);
+    // Targets cache keeps up-to-date map of target ID to target fields, and passes events on to targetsConsumer
+    RecordCache<TargetEvent> targetsCache;
 //START SNIPPET: Get Market Targets - send subscription request
-    int targetListenerId = manager.startListening(&TMSRemote::Stub::PrepareAsyncsubscribeForMarketTargets, targetsRequest, targetsConsumer, "Managed Targets Listener", debug);
+    int targetListenerId = manager.startListening(&TMSRemote::Stub::PrepareAsyncsubscribeForMarketTargets, targetsRequest, targetsCache.asConsumer(targetsConsumer), "Managed Targets Listener", debug);
 //END SNIPPET: Get Market Targets - send subscription request
 
+    // Market data hub packs subscriptions for any number of names into a few shared streams
+    MarketDataHubOptions marketDataHubOptions;
+    marketDataHubOptions.streamCount = 2;
+    marketDataHubOptions.fields = { "LastPx", "LastSize", "AccumSize", "TradeTime", "BidPx", "AskPx" };
+    std::unique_ptr<MarketDataHub> marketDataHub;
+    if (useMarketDataHub)
+    {
+        marketDataHub.reset(channelPool ? new MarketDataHub(*channelPool, marketDataHubOptions) : new MarketDataHub(*client.client_, marketDataHubOptions));
+    }
+
     // Check StatefulSubscriber class for an example of stateful listener
-    StatefulSubscriber vwapCalculator_IBM("IBM");
-    StatefulSubscriber vwapCalculator_MSFT("MSFT");
+    StatefulSubscriber vwapCalculator_IBM("IBM", marketDataHub.get(), conflateMarketData);
+    StatefulSubscriber vwapCalculator_MSFT("MSFT", marketDataHub.get(), conflateMarketData);
     vwapCalculator_IBM.start();
     vwapCalculator_MSFT.start();
 
+    // Bars have the fields of getVolumeCurve bars, so live ones can be compared with historical ones
+    BarBuilder barBuilder;
+    if (buildBars && marketDataHub)
+    {
+        barBuilder.subscribe([](const std::string& instrument, std::chrono::seconds interval, const VolumeCurveResponse::Bar& bar) {
+            TMS_LOG_INFO(caller, "Bar of ", instrument, ": ", bar.ShortDebugString());
+        });
+        for (const std::string& instrument : { vwapCalculator_IBM.getName(), vwapCalculator_MSFT.getName() })
+        {
+            std::function< bool(const MarketDataEvent&, const std::string&)> barConsumer = barBuilder.asConsumer(barBuilder.addSeries(instrument, std::chrono::seconds(5)));
+            marketDataHub->subscribe(instrument, [barConsumer](const MarketDataEvent& event, const std::string& caller) { barConsumer(event, caller); });
+        }
+        barBuilder.start();
+    }
+
     // Increase simulated update rate so our VWAP calculators have something to crunch on
     client.setUpdateRate(10);
 
     // Check StatelessSubscriber class for an example of stateless listener
     int statelessPortfolioListenerId1 = StatelessSubscriber::start("Stateless Portfolio Listener 1", debug);
     int statelessPortfolioListenerId2 = StatelessSubscriber::start("Stateless Portfolio Listener 2", debug);
+
+    // Log server-to-client and consumer latencies of all listeners every 5 seconds
+    manager.setLatencyDumpInterval(std::chrono::seconds(5));
 #else
     // Create async listener for order events
     AsyncListener< SubscribeForOrdersRequest, OrderEvent> ordersListener("Async Orders Listener", 11000);
@@ -886,19 +1113,18 @@ int main()
     Send second wave with "NOFILL" parameter - another order of 400 shares will be sent, but it will not be filled.
     Every time our order listener is notified of a new order, it tries to decrease its quantity by 100 or to cancel it, depending on order original quantity and filled quantity.
     */
-    client.create_market_portfolio(PORTFOLIO);
+    // Both portfolios are created concurrently, see create_market_portfolio() for a single blocking call
+    client.create_market_portfolios({ PORTFOLIO, TMP_PORTFOLIO });
     long long target_id = client.add_market_target(PORTFOLIO, "VOD LN", ::Side::Side_Buy, 800);
     client.modify_market_target(target_id, "Simulator1", ::WaveSizeType::WaveSizeType_PctTgtQty, 50);
 
-    client.create_market_portfolio(TMP_PORTFOLIO);
-
 #ifdef USE_MANAGED_LISTENERS
     // Stop one of the interval VWAP calculators before another
     vwapCalculator_IBM.stop(caller);
 #endif // USE_MANAGED_LISTENERS
 
     std::this_thread::sleep_for(std::chrono::seconds(1));
-    std::cout << std::endl << get_timestamp() << caller << "Sending first order..." << std::endl;
+    TMS_LOG_INFO(caller, "Sending first order...");
     client.send_target_order(target_id);
     client.modify_market_portfolio(TMP_PORTFOLIO);
     client.remove_market_target(target_id); // This should fail because target has open orders
@@ -908,7 +1134,7 @@ int main()
     double ibm_close_px = client.get_close_price(vwapCalculator_IBM.getName());
 
     std::this_thread::sleep_for(std::chrono::seconds(1));
-    std::cout << std::endl << get_timestamp() << caller << "Sending second order..." << std::endl;
+    TMS_LOG_INFO(caller, "Sending second order...");
     client.send_target_order_with_params(target_id, "NOFILL");
 
     std::this_thread::sleep_for(std::chrono::seconds(1));
@@ -920,12 +1146,17 @@ int main()
     // NOTE: if there's no other interaction with the system, this listener will find one extra target compared to async targets listener because we've created a new target after async target listener has finished listening.
     client.list_market_targets_sync(caller+"Sync Targets Listener: ");
 
-    std::cout << std::endl << get_timestamp() << caller << "Terminating..." << std::endl;
+    TMS_LOG_INFO(caller, "Terminating...");
 
 #ifdef USE_MANAGED_LISTENERS
     // Stateful subscriber - stop
     vwapCalculator_IBM.stop(caller);
     vwapCalculator_MSFT.stop(caller);
+    if (marketDataHub)
+    {
+        marketDataHub->stop(caller);
+        marketDataHub->dumpStats(caller);
+    }
 
     // Explicitly stopping stateless susbcriber is not necessary: it uses managed susbcriber and will be stopped when manager.stopAllListeners() is called.
     // Stateless subscriber - stop
@@ -940,9 +1171,35 @@ int main()
 
     // Wait for all managed listener threads to terminate
     manager.terminate(caller);
+    manager.setLatencyDumpInterval(std::chrono::seconds(0));
+    manager.dumpLatencyStats(caller);
+    if (reconnectListeners)
+    {
+        ReconnectStats reconnectStats = manager.getReconnectStats();
+        TMS_LOG_INFO(caller, "Reconnects: disconnects=", reconnectStats.disconnects, ", recoveries=", reconnectStats.recoveries, ", failed attempts=", reconnectStats.failedAttempts,
+            ", last recovery=", reconnectStats.lastRecoveryTime.count(), "ms, max recovery=", reconnectStats.maxRecoveryTime.count(), "ms");
+    }
+
+    // Conflating VWAP calculators process the updates they still have pending
+    vwapCalculator_IBM.terminate(caller);
+    vwapCalculator_MSFT.terminate(caller);
 
-    std::cout << get_timestamp() << caller << "Record " << vwapCalculator_IBM.getName() << ": IntervalVWAP=" << vwapCalculator_IBM.getIntervalVwap() << " compared to ClosePx=" << ibm_close_px << ", IntervalAccumSize=" << vwapCalculator_IBM.getIntervalAccumSize() << std::endl;
-    std::cout << get_timestamp() << caller << "Record " << vwapCalculator_MSFT.getName() << ": IntervalVWAP=" << vwapCalculator_MSFT.getIntervalVwap() << " , IntervalAccumSize=" << vwapCalculator_MSFT.getIntervalAccumSize() << std::endl;
+    if (ordersDispatcher)
+    {
+        // Listeners are stopped, so it's safe to deliver the rest of the events and stop consumer thread
+        TMS_LOG_INFO(caller, "Orders dispatcher: depth=", ordersDispatcher->getQueueDepth(), ", high-water mark=", ordersDispatcher->getHighWaterMark(), " of ", ordersDispatcher->getCapacity(), ", delivered=", ordersDispatcher->getDeliveredCount(), ", producer waits=", ordersDispatcher->getProducerWaitCount());
+        ordersDispatcher->stop();
+    }
+
+    TMS_LOG_INFO(caller, "Targets cache: ", targetsCache.size(), " targets, consistent=", std::boolalpha, targetsCache.isConsistent(), ", events=", targetsCache.getEventCount());
+    TMS_LOG_INFO(caller, "Record ", vwapCalculator_IBM.getName(), ": IntervalVWAP=", vwapCalculator_IBM.getIntervalVwap(), " compared to ClosePx=", ibm_close_px, ", IntervalAccumSize=", vwapCalculator_IBM.getIntervalAccumSize());
+    TMS_LOG_INFO(caller, "Record ", vwapCalculator_MSFT.getName(), ": IntervalVWAP=", vwapCalculator_MSFT.getIntervalVwap(), " , IntervalAccumSize=", vwapCalculator_MSFT.getIntervalAccumSize());
+    // All VWAP calculators keep their trades in shared analytics, which answers for the whole universe in one pass
+    TradeSnapshot tradeSnapshot;
+    TradeAnalytics::getInstance().snapshot(&tradeSnapshot);
+    std::vector<double> intervalVwaps;
+    TradeAnalytics::computeVwaps(tradeSnapshot, &intervalVwaps);
+    TMS_LOG_INFO(caller, "Trade analytics: ", intervalVwaps.size(), " instruments, total volume=", TradeAnalytics::computeTotalVolume(tradeSnapshot));
 #else
     // Use shutdown option 1 for targetsListener: stop async listener thread directly using ordersListener.signalStop()
     ordersListener.signalStop(caller);
@@ -954,23 +1211,42 @@ int main()
     targetsListener.waitForStop(caller);
 #endif // USE_MANAGED_LISTENERS
 
+    // Listeners and dispatcher are stopped, so nothing queues order actions anymore
+    client.stopOrderActionBatching();
+
     if (useSyncOrderListener)
     {
-        std::cout << std::endl << get_timestamp() << caller << "Creating sync Orders subscriber to reproduce blocking Read() call..." << std::endl;
+        TMS_LOG_INFO(caller, "Creating sync Orders subscriber to reproduce blocking Read() call...");
         auto orderListenerThread = std::thread(&TMSRemoteClient::subscribe_for_orders, std::ref(client));
         const int waitTime = 5;
-        std::cout << get_timestamp() << caller << "Sleeping for " << waitTime << " seconds to allow sync Orders subscriber to read all existing events..." << std::endl;
+        TMS_LOG_INFO(caller, "Sleeping for ", waitTime, " seconds to allow sync Orders subscriber to read all existing events...");
         std::this_thread::sleep_for(std::chrono::seconds(waitTime));
         client.stopProcessingOrders(caller);
-        std::cout << std::endl << get_timestamp() << caller << "Signaled sync Orders subscriber to stop, waiting for it to terminate..." << std::endl;
+        TMS_LOG_INFO(caller, "Signaled sync Orders subscriber to stop, waiting for it to terminate...");
         // join() call might take minutes or not return at all - because orderListenerThread is blocked in Read() call
         // The sample still can be terminated with BREAK signal (Ctrl+C), but this will cause server exception:
         // io.grpc.StatusRuntimeException: CANCELLED: cancelled before receiving half close
         orderListenerThread.join();
-        std::cout << get_timestamp() << caller << "Sync Orders subscriber thread is terminated" << std::endl;
+        TMS_LOG_INFO(caller, "Sync Orders subscriber thread is terminated");
+    }
+
+    if (monitorConnectivity)
+    {
+        connectivityMonitor.stop();
+        ConnectivityStats connectivityStats = connectivityMonitor.getStats();
+        TMS_LOG_INFO(caller, "Connectivity: ", ConnectivityMonitor::getStateName(connectivityStats.state), ", ", connectivityStats.failures, " of ", connectivityStats.pings, " pings failed, RTT ", connectivityStats.rtt.format());
+        if (connectivityStats.hasClockOffset)
+        {
+            TMS_LOG_INFO(caller, "Server clock offset: ", connectivityStats.clockOffset/1000, "us +/- ", connectivityStats.clockOffsetError/1000, "us");
+        }
+    }
+
+    if (securityMasterLoaded.valid())
+    {
+        securityMasterLoaded.wait();
     }
 
     client.stop_all_trading();
-    std::cout << std::endl << get_timestamp() << caller << "Completed" << std::endl;
+    TMS_LOG_INFO(caller, "Completed");
     return 0;
 }
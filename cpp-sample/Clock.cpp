@@ -0,0 +1,107 @@
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <time.h>
+
+#include "Clock.h"
+
+namespace
+{
+	// Wall time minus monotonic time. Reads of the two clocks are bracketed by monotonic reads,
+	// and the pair taken in the shortest interval wins, so preemption between the reads doesn't skew the offset.
+	int64_t measureOffset()
+	{
+		static const int attempts = 5;
+		int64_t bestInterval = INT64_MAX;
+		int64_t offset = 0;
+		for (int i = 0; i < attempts; i++)
+		{
+			int64_t before = Clock::getMonotonicTime();
+			int64_t wallTime = Clock::getWallTime();
+			int64_t after = Clock::getMonotonicTime();
+			if (after - before < bestInterval)
+			{
+				bestInterval = after - before;
+				offset = wallTime - (before + (after - before)/2);
+			}
+		}
+		return offset;
+	}
+
+	std::atomic<int64_t>& getOffset()
+	{
+		static std::atomic<int64_t> offset(measureOffset());
+		return offset;
+	}
+
+	// Formatted date and time of the last second seen by this thread
+	struct SecondCache
+	{
+		int64_t second = INT64_MIN;
+		char prefix[Clock::TimestampSize];
+		size_t length = 0;
+	};
+
+	thread_local SecondCache secondCache;
+};
+
+std::atomic<int64_t> Clock::serverClockOffset_(0);
+
+int64_t Clock::toMonotonicTime(int64_t wallTime)
+{
+	return wallTime - getOffset().load(std::memory_order_relaxed);
+}
+
+int64_t Clock::toWallTime(int64_t monotonicTime)
+{
+	return monotonicTime + getOffset().load(std::memory_order_relaxed);
+}
+
+void Clock::calibrate()
+{
+	getOffset().store(measureOffset(), std::memory_order_relaxed);
+}
+
+size_t Clock::formatTimestamp(int64_t wallTime, char* buffer)
+{
+	int64_t second = wallTime/1000000000;
+	int64_t nanoseconds = wallTime%1000000000;
+	if (nanoseconds < 0)
+	{
+		second--;
+		nanoseconds += 1000000000;
+	}
+	SecondCache& cache = secondCache;
+	if (second != cache.second)
+	{
+		time_t rawtime = (time_t)second;
+		struct tm timeinfo;
+#ifdef WIN32
+		localtime_s(&timeinfo, &rawtime);
+#else
+		localtime_r(&rawtime, &timeinfo);
+#endif
+		cache.length = strftime(cache.prefix, sizeof(cache.prefix), "[%F %T.", &timeinfo);
+		cache.second = second;
+	}
+	memcpy(buffer, cache.prefix, cache.length);
+	char* pos = buffer + cache.length;
+	int microseconds = (int)(nanoseconds/1000);
+	for (int i = 5; i >= 0; i--)
+	{
+		pos[i] = (char)('0' + microseconds%10);
+		microseconds /= 10;
+	}
+	pos += 6;
+	*pos++ = ']';
+	*pos++ = ' ';
+	*pos = '\0';
+	return pos - buffer;
+}
+
+std::string Clock::getTimestamp()
+{
+	char buffer[TimestampSize];
+	size_t length = formatTimestamp(getWallTime(), buffer);
+	return std::string(buffer, length);
+}
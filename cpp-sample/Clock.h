@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+Nanosecond timestamps that are cheap enough to take on every event.
+Both clocks are read through std::chrono, which on Linux is a vDSO clock_gettime() call (no system call, ~20ns).
+Monotonic time never goes back and is what latencies should be measured with; wall time is nanoseconds since epoch (UTC).
+
+Server's sendingTime (milliseconds since epoch) can be converted to wall time and then to monotonic time base,
+using the offset between the two clocks measured at startup (calibrate() re-measures it, e.g. after system clock adjustment).
+Server's clock may be off ours: once its offset is estimated (see ConnectivityMonitor), fromSendingTime() corrects for it.
+
+Formatting keeps date and time up to seconds cached per thread, so only the sub-second part is formatted per call.
+
+Usage:
+	int64_t received = Clock::getMonotonicTime();
+	int64_t latency = received - Clock::toMonotonicTime(Clock::fromSendingTime(event.sendingtime()));
+...
+	char buffer[Clock::TimestampSize];
+	size_t length = Clock::formatTimestamp(Clock::getWallTime(), buffer); // "[2024-01-31 15:04:05.123456] "
+*/
+class Clock
+{
+public:
+	static const size_t TimestampSize = 32;
+
+	// Nanoseconds since unspecified point in time
+	static int64_t getMonotonicTime()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// Nanoseconds since epoch
+	static int64_t getWallTime()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+
+	// Server's sendingTime to our wall time
+	static int64_t fromSendingTime(int64_t sendingTime)
+	{
+		return sendingTime*1000000 - serverClockOffset_.load(std::memory_order_relaxed);
+	}
+
+	// Server's wall clock minus ours in nanoseconds, zero until it's set
+	static int64_t getServerClockOffset()
+	{
+		return serverClockOffset_.load(std::memory_order_relaxed);
+	}
+	static void setServerClockOffset(int64_t offset)
+	{
+		serverClockOffset_.store(offset, std::memory_order_relaxed);
+	}
+
+	// Wall time to monotonic time
+	static int64_t toMonotonicTime(int64_t wallTime);
+	// Monotonic time to wall time
+	static int64_t toWallTime(int64_t monotonicTime);
+	// Re-measures offset between wall and monotonic clocks
+	static void calibrate();
+
+	// Writes "[YYYY-MM-DD HH:MM:SS.uuuuuu] " in local time to buffer of at least TimestampSize chars, returns its length
+	static size_t formatTimestamp(int64_t wallTime, char* buffer);
+	// Current time formatted by formatTimestamp()
+	static std::string getTimestamp();
+
+private:
+	static std::atomic<int64_t> serverClockOffset_;
+};
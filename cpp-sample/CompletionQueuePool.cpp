@@ -0,0 +1,70 @@
+#include "CompletionQueuePool.h"
+
+CompletionQueueTag::~CompletionQueueTag()
+{
+}
+
+CompletionQueuePool::CompletionQueuePool(int queueCount)
+{
+    if (queueCount <= 0)
+    {
+        queueCount = (int)std::thread::hardware_concurrency();
+    }
+    if (queueCount <= 0)
+    {
+        queueCount = 1;
+    }
+    nextQueue_.store(0);
+    isShutdown_.store(false);
+    for (int i = 0; i < queueCount; i++)
+    {
+        queues_.emplace_back(new grpc::CompletionQueue());
+    }
+    for (int i = 0; i < queueCount; i++)
+    {
+        pollers_.emplace_back(&CompletionQueuePool::poll, this, queues_[i].get());
+    }
+}
+
+CompletionQueuePool::~CompletionQueuePool()
+{
+    shutdown();
+}
+
+grpc::CompletionQueue* CompletionQueuePool::nextQueue()
+{
+    unsigned int index = nextQueue_++;
+    return queues_[index % queues_.size()].get();
+}
+
+int CompletionQueuePool::size() const
+{
+    return (int)queues_.size();
+}
+
+void CompletionQueuePool::shutdown()
+{
+    if (isShutdown_.exchange(true))
+    {
+        return;
+    }
+    for (auto& queue : queues_)
+    {
+        queue->Shutdown();
+    }
+    for (auto& poller : pollers_)
+    {
+        poller.join();
+    }
+}
+
+void CompletionQueuePool::poll(grpc::CompletionQueue* queue)
+{
+    void* tag;
+    bool ok;
+    // Next() blocks until there's a completion, and returns false only after Shutdown() once the queue is drained
+    while (queue->Next(&tag, &ok))
+    {
+        static_cast<CompletionQueueTag*>(tag)->proceed(ok);
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+
+/**
+Fixed pool of completion queues, each one served by its own poller thread.
+Instead of owning a queue and a thread per subscription, listeners post their operations to one of the shared queues
+and receive completions through CompletionQueueTag::proceed() on the poller thread.
+
+Usage:
+	CompletionQueuePool pool(0); // 0 means "one queue per CPU core"
+	grpc::CompletionQueue* queue = pool.nextQueue();
+	rpc->StartCall(&startTag); // startTag is a CompletionQueueTag, its proceed() is called when StartCall() completes
+...
+	pool.shutdown();
+*/
+
+class CompletionQueueTag
+{
+public:
+    virtual ~CompletionQueueTag();
+    // Called on poller thread when operation posted with this tag is completed
+    virtual void proceed(bool ok) = 0;
+};
+
+class CompletionQueuePool
+{
+public:
+    // queueCount <= 0 means one queue per CPU core
+    explicit CompletionQueuePool(int queueCount);
+    ~CompletionQueuePool();
+
+    CompletionQueuePool(const CompletionQueuePool&) = delete;
+    void operator=(const CompletionQueuePool&) = delete;
+
+    // Returns queues in round-robin order to spread listeners evenly between poller threads
+    grpc::CompletionQueue* nextQueue();
+    int size() const;
+    // Shuts down all queues and waits for poller threads to drain them. Safe to call more than once.
+    void shutdown();
+
+private:
+    void poll(grpc::CompletionQueue* queue);
+
+private:
+    std::vector<std::unique_ptr<grpc::CompletionQueue>> queues_;
+    std::vector<std::thread> pollers_;
+    std::atomic<unsigned int> nextQueue_;
+    std::atomic<bool> isShutdown_;
+};
@@ -0,0 +1,314 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include <tmsapigrpc/TMSRemote.grpc.pb.h>
+
+/**
+Describes which events of a stream can be conflated and by which key.
+Only "updated" events are conflated; all other events (added, removed, feed status, ...) are delivered as is.
+*/
+template <class Event> struct ConflationTraits;
+
+template <> struct ConflationTraits<MarketDataEvent>
+{
+    typedef std::string Key;
+    static bool isUpdate(const MarketDataEvent& event) { return event.event_case() == MarketDataEvent::EventCase::kUpdate; }
+    static const Key& getKey(const MarketDataEvent& event) { return event.update().instrument(); }
+    static const Fields& getFields(const MarketDataEvent& event) { return event.update().fields(); }
+    static Fields* getMutableFields(MarketDataEvent* event) { return event->mutable_update()->mutable_fields(); }
+};
+
+template <> struct ConflationTraits<TargetEvent>
+{
+    typedef int64_t Key;
+    static bool isUpdate(const TargetEvent& event) { return event.event_case() == TargetEvent::EventCase::kUpdated; }
+    static Key getKey(const TargetEvent& event) { return event.updated().targetid(); }
+    static const Fields& getFields(const TargetEvent& event) { return event.updated().fields(); }
+    static Fields* getMutableFields(TargetEvent* event) { return event->mutable_updated()->mutable_fields(); }
+};
+
+template <> struct ConflationTraits<OrderEvent>
+{
+    typedef std::string Key;
+    static bool isUpdate(const OrderEvent& event) { return event.event_case() == OrderEvent::EventCase::kUpdated; }
+    static const Key& getKey(const OrderEvent& event) { return event.updated().orderid(); }
+    static const Fields& getFields(const OrderEvent& event) { return event.updated().fields(); }
+    static Fields* getMutableFields(OrderEvent* event) { return event->mutable_updated()->mutable_fields(); }
+};
+
+template <> struct ConflationTraits<RecordEvent>
+{
+    typedef std::string Key;
+    static bool isUpdate(const RecordEvent& event) { return event.event_case() == RecordEvent::EventCase::kUpdated; }
+    static const Key& getKey(const RecordEvent& event) { return event.updated().recordid(); }
+    static const Fields& getFields(const RecordEvent& event) { return event.updated().fields(); }
+    static Fields* getMutableFields(RecordEvent* event) { return event->mutable_updated()->mutable_fields(); }
+};
+
+template <> struct ConflationTraits<PortfolioEvent>
+{
+    typedef std::string Key;
+    static bool isUpdate(const PortfolioEvent& event) { return event.event_case() == PortfolioEvent::EventCase::kUpdated; }
+    static const Key& getKey(const PortfolioEvent& event) { return event.updated().portfolioname(); }
+    static const Fields& getFields(const PortfolioEvent& event) { return event.updated().fields(); }
+    static Fields* getMutableFields(PortfolioEvent* event) { return event->mutable_updated()->mutable_fields(); }
+};
+
+/**
+Conflating delivery policy for market data and record update streams.
+Listener thread only queues events, and a dedicated consumer thread delivers them.
+While an update for some key (instrument, target ID, order ID, record ID) is waiting to be delivered,
+newer updates for the same key are merged into it field by field instead of being queued.
+So a slow consumer always gets the latest merged state of each record instead of a growing backlog.
+
+Order of events for the same key is preserved: any non-update event (added, removed, feed status, ...) seals all pending updates,
+and updates that arrive after it are queued behind it.
+
+Fields passed as nonConflatedFields opt out of conflation: two updates that both carry any of these fields are never merged.
+E.g. with "AccumSize" every trade is delivered with its own LastPx and LastSize, while quote updates between trades are still merged.
+
+Usage:
+	ConflatingConsumer<MarketDataEvent> marketDataConflater(marketDataConsumer, {"AccumSize"});
+	int listenerId = manager.startListening(&TMSRemote::Stub::PrepareAsyncsubscribeForMarketData, request, marketDataConflater.asConsumer(), "Market Data Listener");
+...
+	manager.stopListener(listenerId, caller);
+	manager.terminateListener(listenerId, caller);
+	marketDataConflater.stop(); // Delivers pending events, then stops consumer thread
+	std::cout << marketDataConflater.getCoalescedCount() << " of " << marketDataConflater.getReceivedCount() << " events were coalesced" << std::endl;
+*/
+template <class Event> class ConflatingConsumer
+{
+public:
+    typedef ConflationTraits<Event> Traits;
+    typedef typename Traits::Key Key;
+
+    ConflatingConsumer(std::function< bool(const Event&, const std::string&)> consumer, const std::set<std::string>& nonConflatedFields = std::set<std::string>()) :
+        consumer_(consumer),
+        nonConflatedFields_(nonConflatedFields),
+        headSequence_(0),
+        isRunning_(true)
+    {
+        isStopRequested_.store(false);
+        receivedCount_.store(0);
+        coalescedCount_.store(0);
+        deliveredCount_.store(0);
+        consumerThread_ = std::thread(&ConflatingConsumer::drain, this);
+    }
+
+    ~ConflatingConsumer()
+    {
+        stop();
+    }
+
+    ConflatingConsumer(const ConflatingConsumer&) = delete;
+    void operator=(const ConflatingConsumer&) = delete;
+
+    // Consumer to pass to startListening()
+    std::function< bool(const Event&, const std::string&)> asConsumer()
+    {
+        return [this](const Event& event, const std::string& caller) { return push(event, caller); };
+    }
+
+    // Delivers pending events and stops consumer thread.
+    // Call it after listeners that use this consumer are stopped: events pushed after stop() are rejected.
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(queueLock_);
+            if (!isRunning_)
+            {
+                return;
+            }
+            isRunning_ = false;
+        }
+        queueCondition_.notify_all();
+        consumerThread_.join();
+    }
+
+    // Number of events waiting for delivery
+    size_t getQueueDepth()
+    {
+        std::lock_guard<std::mutex> lock(queueLock_);
+        return queue_.size();
+    }
+
+    long long getReceivedCount() const
+    {
+        return receivedCount_.load(std::memory_order_relaxed);
+    }
+
+    // Number of received events that were merged into pending updates instead of being delivered on their own
+    long long getCoalescedCount() const
+    {
+        return coalescedCount_.load(std::memory_order_relaxed);
+    }
+
+    long long getDeliveredCount() const
+    {
+        return deliveredCount_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Entry
+    {
+        Event event;
+        std::string caller;
+        // Entry is still in keyToSequence_, so newer updates for its key can be merged into it
+        bool isIndexed;
+        bool hasNonConflatedFields;
+    };
+
+    // Called on listener thread
+    bool push(const Event& event, const std::string& caller)
+    {
+        receivedCount_.fetch_add(1, std::memory_order_relaxed);
+        bool isUpdate = Traits::isUpdate(event);
+        bool hasNonConflatedFields = isUpdate && containsNonConflatedFields(Traits::getFields(event));
+        {
+            std::lock_guard<std::mutex> lock(queueLock_);
+            if (!isRunning_)
+            {
+                return false;
+            }
+            if (isUpdate)
+            {
+                auto iter = keyToSequence_.find(Traits::getKey(event));
+                if (iter != keyToSequence_.end())
+                {
+                    Entry& pending = queue_[iter->second - headSequence_];
+                    if (!(hasNonConflatedFields && pending.hasNonConflatedFields))
+                    {
+                        merge(event, &pending.event);
+                        pending.hasNonConflatedFields = pending.hasNonConflatedFields || hasNonConflatedFields;
+                        coalescedCount_.fetch_add(1, std::memory_order_relaxed);
+                        return !isStopRequested_.load(std::memory_order_relaxed);
+                    }
+                    // Can't merge: seal pending update and queue this one behind it
+                    pending.isIndexed = false;
+                    keyToSequence_.erase(iter);
+                }
+                keyToSequence_[Traits::getKey(event)] = headSequence_ + queue_.size();
+            }
+            else
+            {
+                // Keep order of events for the same key: updates arriving after this event must not jump ahead of it
+                sealPendingUpdates();
+            }
+            queue_.push_back(Entry());
+            Entry& entry = queue_.back();
+            entry.event = event;
+            entry.caller = caller;
+            entry.isIndexed = isUpdate;
+            entry.hasNonConflatedFields = hasNonConflatedFields;
+        }
+        queueCondition_.notify_one();
+        return !isStopRequested_.load(std::memory_order_relaxed);
+    }
+
+    // Consumer thread body
+    void drain()
+    {
+        Event event;
+        std::string caller;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(queueLock_);
+                queueCondition_.wait(lock, [this] { return !queue_.empty() || !isRunning_; });
+                if (queue_.empty())
+                {
+                    // Stopped and drained
+                    break;
+                }
+                Entry& entry = queue_.front();
+                if (entry.isIndexed)
+                {
+                    keyToSequence_.erase(Traits::getKey(entry.event));
+                }
+                event.Swap(&entry.event);
+                caller.swap(entry.caller);
+                queue_.pop_front();
+                headSequence_++;
+            }
+            // Events after 'stop' from consumer are skipped, same as with direct delivery
+            if (!isStopRequested_.load(std::memory_order_relaxed) && !consumer_(event, caller))
+            {
+                isStopRequested_.store(true);
+            }
+            deliveredCount_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Must be called with queueLock_ held
+    void sealPendingUpdates()
+    {
+        for (auto& keyAndSequence : keyToSequence_)
+        {
+            queue_[keyAndSequence.second - headSequence_].isIndexed = false;
+        }
+        keyToSequence_.clear();
+    }
+
+    bool containsNonConflatedFields(const Fields& fields) const
+    {
+        for (const std::string& name : nonConflatedFields_)
+        {
+            if (fields.numericfields().count(name) > 0 || fields.stringfields().count(name) > 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Newer field values override older ones, fields absent in newer update keep their older values.
+    // A field is either string or numeric in a merged update: any newer value, not only "<NULL>", erases the older value of the other kind.
+    // Unlike RecordCache::mergeFields(), "<NULL>" is kept as a value rather than erasing the field: the merged update is still
+    // an update, and its consumer has to see that the field was cleared.
+    static void merge(const Event& newer, Event* pending)
+    {
+        const Fields& newerFields = Traits::getFields(newer);
+        Fields* pendingFields = Traits::getMutableFields(pending);
+        for (const auto& field : newerFields.stringfields())
+        {
+            pendingFields->mutable_numericfields()->erase(field.first);
+            (*pendingFields->mutable_stringfields())[field.first] = field.second;
+        }
+        for (const auto& field : newerFields.numericfields())
+        {
+            pendingFields->mutable_stringfields()->erase(field.first);
+            (*pendingFields->mutable_numericfields())[field.first] = field.second;
+        }
+        pending->set_sendingtime(newer.sendingtime());
+    }
+
+private:
+    std::function< bool(const Event&, const std::string&)> consumer_;
+    const std::set<std::string> nonConflatedFields_;
+
+    // Pending events, guarded by queueLock_.
+    // Entries are addressed by sequence number: entry with sequence N is at queue_[N - headSequence_]
+    std::mutex queueLock_;
+    std::condition_variable queueCondition_;
+    std::deque<Entry> queue_;
+    std::unordered_map<Key, long long> keyToSequence_;
+    long long headSequence_;
+    bool isRunning_;
+
+    std::thread consumerThread_;
+    std::atomic<bool> isStopRequested_;
+
+    std::atomic<long long> receivedCount_;
+    std::atomic<long long> coalescedCount_;
+    std::atomic<long long> deliveredCount_;
+};
@@ -0,0 +1,214 @@
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+
+#include "Clock.h"
+#include "Logger.h"
+
+#include "ConnectivityMonitor.h"
+
+namespace
+{
+	const std::string Caller = "[Connectivity Monitor] ";
+};
+
+ConnectivityOptions::ConnectivityOptions() :
+	interval(1000),
+	timeout(2000),
+	degradedRtt(200),
+	downAfterFailures(3),
+	offsetSamples(8),
+	isClockOffsetApplied(true)
+{
+}
+
+ConnectivityMonitor::ConnectivityMonitor(TMSRemote::Stub& stub, const ConnectivityOptions& options) :
+	stub_(stub),
+	options_(options),
+	pingId_(0),
+	isStopping_(false),
+	stats_(ConnectivityStats())
+{
+	stats_.state = ConnectivityState::Unknown;
+}
+
+ConnectivityMonitor::~ConnectivityMonitor()
+{
+	stop();
+}
+
+void ConnectivityMonitor::setStateHandler(const std::function<void(ConnectivityState, ConnectivityState)>& handler)
+{
+	stateHandler_ = handler;
+}
+
+void ConnectivityMonitor::start()
+{
+	std::lock_guard<std::mutex> lock(lock_);
+	if (pinger_.joinable() || isStopping_)
+	{
+		throw std::runtime_error("start() may only be called once");
+	}
+	pinger_ = std::thread(&ConnectivityMonitor::run, this);
+}
+
+void ConnectivityMonitor::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		isStopping_ = true;
+	}
+	condition_.notify_all();
+	if (pinger_.joinable())
+	{
+		pinger_.join();
+	}
+}
+
+ConnectivityState ConnectivityMonitor::getState()
+{
+	std::lock_guard<std::mutex> lock(lock_);
+	return stats_.state;
+}
+
+ConnectivityStats ConnectivityMonitor::getStats()
+{
+	std::lock_guard<std::mutex> lock(lock_);
+	ConnectivityStats result = stats_;
+	result.rtt = rttHistogram_.getStats();
+	return result;
+}
+
+const char* ConnectivityMonitor::getStateName(ConnectivityState state)
+{
+	switch (state)
+	{
+	case ConnectivityState::Healthy: return "Healthy";
+	case ConnectivityState::Degraded: return "Degraded";
+	case ConnectivityState::Down: return "Down";
+	default: return "Unknown";
+	}
+}
+
+void ConnectivityMonitor::run()
+{
+	std::unique_lock<std::mutex> lock(lock_);
+	std::chrono::steady_clock::time_point nextPing = std::chrono::steady_clock::now();
+	while (!isStopping_)
+	{
+		lock.unlock();
+		ping();
+		lock.lock();
+		// Fixed rate: time the ping took is not added to the interval
+		nextPing = std::max(nextPing + options_.interval, std::chrono::steady_clock::now());
+		condition_.wait_until(lock, nextPing, [this] { return isStopping_; });
+	}
+}
+
+void ConnectivityMonitor::ping()
+{
+	grpc::ClientContext context;
+	context.set_deadline(std::chrono::system_clock::now() + options_.timeout);
+	PingInfo request, response;
+	request.set_pingid(++pingId_);
+	int64_t sendWallTime = Clock::getWallTime();
+	request.add_sendingtime(sendWallTime/1000000);
+	int64_t start = Clock::getMonotonicTime();
+	grpc::Status status = stub_.ping(&context, request, &response);
+	int64_t rtt = Clock::getMonotonicTime() - start;
+
+	ConnectivityState previous;
+	ConnectivityState current;
+	int64_t smoothedRtt;
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		previous = stats_.state;
+		stats_.pings++;
+		if (status.ok())
+		{
+			// Server appends its time after ours, a server that only echoes the request gives us no offset
+			int64_t serverTime = response.sendingtime_size() > request.sendingtime_size() ? response.sendingtime(response.sendingtime_size() - 1) : 0;
+			onPingCompleted(rtt, sendWallTime, serverTime);
+		}
+		else
+		{
+			onPingFailed();
+		}
+		current = updateState();
+		stats_.state = current;
+		smoothedRtt = stats_.smoothedRtt;
+	}
+	if (current != previous)
+	{
+		if (current == ConnectivityState::Degraded || current == ConnectivityState::Down)
+		{
+			TMS_LOG_WARNING(Caller, "Connectivity is ", getStateName(current), " (was ", getStateName(previous), "): ", status.ok() ? "smoothed RTT " + std::to_string(smoothedRtt/1000) + "us" : status.error_message());
+		}
+		else
+		{
+			TMS_LOG_INFO(Caller, "Connectivity is ", getStateName(current), " (was ", getStateName(previous), ")");
+		}
+		if (stateHandler_)
+		{
+			stateHandler_(previous, current);
+		}
+	}
+}
+
+void ConnectivityMonitor::onPingCompleted(int64_t rtt, int64_t sendWallTime, int64_t serverTime)
+{
+	rttHistogram_.record(rtt);
+	stats_.consecutiveFailures = 0;
+	stats_.lastRtt = rtt;
+	if (stats_.smoothedRtt == 0)
+	{
+		stats_.smoothedRtt = rtt;
+		stats_.rttVariation = rtt/2;
+	}
+	else
+	{
+		stats_.rttVariation = (3*stats_.rttVariation + std::abs(stats_.smoothedRtt - rtt))/4;
+		stats_.smoothedRtt = (7*stats_.smoothedRtt + rtt)/8;
+	}
+	if (serverTime == 0)
+	{
+		return;
+	}
+	// Server's millisecond is truncated, so its time is taken in the middle of it
+	static const int64_t halfMillisecond = 500000;
+	OffsetSample sample;
+	sample.offset = serverTime*1000000 + halfMillisecond - (sendWallTime + rtt/2);
+	sample.rtt = rtt;
+	offsetSamples_.push_back(sample);
+	while ((int)offsetSamples_.size() > std::max(options_.offsetSamples, 1))
+	{
+		offsetSamples_.pop_front();
+	}
+	const OffsetSample& best = *std::min_element(offsetSamples_.begin(), offsetSamples_.end(), [](const OffsetSample& a, const OffsetSample& b) { return a.rtt < b.rtt; });
+	stats_.hasClockOffset = true;
+	stats_.clockOffset = best.offset;
+	stats_.clockOffsetError = best.rtt/2 + halfMillisecond;
+	if (options_.isClockOffsetApplied)
+	{
+		Clock::setServerClockOffset(best.offset);
+	}
+}
+
+void ConnectivityMonitor::onPingFailed()
+{
+	stats_.failures++;
+	stats_.consecutiveFailures++;
+}
+
+ConnectivityState ConnectivityMonitor::updateState()
+{
+	if (stats_.consecutiveFailures >= options_.downAfterFailures)
+	{
+		return ConnectivityState::Down;
+	}
+	if (stats_.consecutiveFailures > 0 || stats_.smoothedRtt > std::chrono::duration_cast<std::chrono::nanoseconds>(options_.degradedRtt).count())
+	{
+		return ConnectivityState::Degraded;
+	}
+	return stats_.pings > stats_.failures ? ConnectivityState::Healthy : ConnectivityState::Unknown;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <grpcpp/grpcpp.h>
+#include <tmsapigrpc/TMSRemote.grpc.pb.h>
+
+#include "LatencyHistogram.h"
+
+enum class ConnectivityState
+{
+	// No ping has completed yet
+	Unknown,
+	Healthy,
+	// Pings fail or take longer than degradedRtt: streams may be about to die
+	Degraded,
+	// downAfterFailures pings in a row have failed
+	Down
+};
+
+struct ConnectivityOptions
+{
+	ConnectivityOptions();
+
+	std::chrono::milliseconds interval;
+	// Ping that takes longer fails
+	std::chrono::milliseconds timeout;
+	// Smoothed round-trip time above this is degradation
+	std::chrono::milliseconds degradedRtt;
+	int downAfterFailures;
+	// Clock offset is taken from the fastest of this many last pings: the shorter the trip, the smaller the error
+	int offsetSamples;
+	// Whether estimated offset is passed to Clock::setServerClockOffset(), which corrects latencies measured with server's sendingTime
+	bool isClockOffsetApplied;
+};
+
+struct ConnectivityStats
+{
+	ConnectivityState state;
+	long long pings;
+	long long failures;
+	int consecutiveFailures;
+	// Round-trip times in nanoseconds: all completed pings, the last one, smoothed and its mean deviation (as in TCP, RFC 6298)
+	LatencyStats rtt;
+	int64_t lastRtt;
+	int64_t smoothedRtt;
+	int64_t rttVariation;
+	// Server's wall clock minus ours in nanoseconds, known once server has stamped a ping with its time.
+	// The true offset is within clockOffsetError of it: half the round trip plus server's millisecond precision.
+	bool hasClockOffset;
+	int64_t clockOffset;
+	int64_t clockOffsetError;
+};
+
+/**
+Pings the server at a fixed rate on its own thread, keeps round-trip time statistics and flags degradation:
+pings that time out or slow down usually come before subscription streams die.
+
+Every ping carries our send time in PingInfo.sendingTime and the server appends its own time to it (milliseconds since epoch,
+like events' sendingTime). As in NTP, server's time minus the midpoint of our send and receive times is the clock offset,
+with half the round trip as its error bound; the fastest recent ping gives the best estimate.
+The estimate is passed on to Clock, so that transit latencies of all listeners are measured against server's clock.
+
+Usage:
+	ConnectivityMonitor monitor(*stub);
+	monitor.setStateHandler([](ConnectivityState previous, ConnectivityState current) { ... }); // On monitor's thread
+	monitor.start();
+...
+	ConnectivityStats stats = monitor.getStats();
+	TMS_LOG_INFO("RTT: ", stats.rtt.format(), ", clock offset: ", stats.clockOffset/1000, "us");
+...
+	monitor.stop();
+*/
+class ConnectivityMonitor
+{
+public:
+	explicit ConnectivityMonitor(TMSRemote::Stub& stub, const ConnectivityOptions& options = ConnectivityOptions());
+	~ConnectivityMonitor();
+
+	ConnectivityMonitor(const ConnectivityMonitor&) = delete;
+	void operator=(const ConnectivityMonitor&) = delete;
+
+	// Called on monitor's thread whenever state changes. Set it before start().
+	void setStateHandler(const std::function<void(ConnectivityState, ConnectivityState)>& handler);
+	void start();
+	// Safe to call more than once
+	void stop();
+
+	ConnectivityState getState();
+	ConnectivityStats getStats();
+
+	static const char* getStateName(ConnectivityState state);
+
+private:
+	struct OffsetSample
+	{
+		int64_t offset;
+		int64_t rtt;
+	};
+
+	void run();
+	void ping();
+	// Must be called with lock_ held
+	void onPingCompleted(int64_t rtt, int64_t sendWallTime, int64_t serverTime);
+	void onPingFailed();
+	ConnectivityState updateState();
+
+private:
+	TMSRemote::Stub& stub_;
+	const ConnectivityOptions options_;
+	std::function<void(ConnectivityState, ConnectivityState)> stateHandler_;
+	int64_t pingId_;
+	LatencyHistogram rttHistogram_;
+
+	std::mutex lock_;
+	std::condition_variable condition_;
+	std::thread pinger_;
+	bool isStopping_;
+	ConnectivityStats stats_;
+	std::deque<OffsetSample> offsetSamples_;
+};
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "EventRingBuffer.hpp"
+
+/**
+Decouples event delivery from the listener's network thread.
+Listener only copies each event into a bounded lock-free ring buffer and goes on with the next Read(),
+while dedicated consumer thread(s) drain the buffer and call the actual consumer.
+So a slow consumer (e.g. one that issues blocking RPCs) doesn't stall reading of the stream until the buffer is full.
+If the buffer is full, listener waits for free space: events are never dropped.
+
+With more than one consumer thread, events may be processed out of order: use it only for consumers that don't depend on event order.
+One DecoupledConsumer may be shared by several listeners of the same event type.
+
+Usage:
+	DecoupledConsumer<OrderEvent> ordersDispatcher(ordersConsumer, 4096);
+	int listenerId = manager.startListening(&TMSRemote::Stub::PrepareAsyncsubscribeForOrders, ordersRequest, ordersDispatcher.asConsumer(), "Orders Listener");
+...
+	std::cout << ordersDispatcher.getQueueDepth() << " " << ordersDispatcher.getHighWaterMark() << std::endl;
+...
+	manager.stopListener(listenerId, caller);
+	manager.terminateListener(listenerId, caller);
+	ordersDispatcher.stop(); // Delivers remaining events, then stops consumer threads
+*/
+template <class Event> class DecoupledConsumer
+{
+public:
+    DecoupledConsumer(std::function< bool(const Event&, const std::string&)> consumer, size_t capacity = 4096, int consumerThreads = 1) :
+        consumer_(consumer),
+        ring_(capacity)
+    {
+        isRunning_.store(true);
+        isStopRequested_.store(false);
+        parkedConsumers_.store(0);
+        deliveredCount_.store(0);
+        producerWaitCount_.store(0);
+        for (int i = 0; i < (consumerThreads > 0 ? consumerThreads : 1); i++)
+        {
+            consumerThreads_.emplace_back(&DecoupledConsumer::drain, this);
+        }
+    }
+
+    ~DecoupledConsumer()
+    {
+        stop();
+    }
+
+    DecoupledConsumer(const DecoupledConsumer&) = delete;
+    void operator=(const DecoupledConsumer&) = delete;
+
+    // Consumer to pass to startListening()
+    std::function< bool(const Event&, const std::string&)> asConsumer()
+    {
+        return [this](const Event& event, const std::string& caller) { return push(event, caller); };
+    }
+
+    // Delivers events that are already in the buffer and stops consumer threads.
+    // Call it after listeners that use this consumer are stopped: events pushed after stop() are rejected.
+    void stop()
+    {
+        if (!isRunning_.exchange(false))
+        {
+            return;
+        }
+        wakeUpConsumers();
+        for (auto& thread : consumerThreads_)
+        {
+            thread.join();
+        }
+    }
+
+    size_t getQueueDepth() const
+    {
+        return ring_.size();
+    }
+
+    size_t getHighWaterMark() const
+    {
+        return ring_.highWaterMark();
+    }
+
+    size_t getCapacity() const
+    {
+        return ring_.capacity();
+    }
+
+    long long getDeliveredCount() const
+    {
+        return deliveredCount_.load(std::memory_order_relaxed);
+    }
+
+    // Number of times listener has found the buffer full and had to wait for consumer
+    long long getProducerWaitCount() const
+    {
+        return producerWaitCount_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Slot
+    {
+        Event event;
+        std::string caller;
+    };
+
+    // Called on listener thread
+    bool push(const Event& event, const std::string& caller)
+    {
+        auto fill = [&event, &caller](Slot& slot) { slot.event = event; slot.caller.assign(caller); };
+        while (!isStopRequested_.load(std::memory_order_relaxed) && isRunning_.load(std::memory_order_relaxed))
+        {
+            if (ring_.tryPush(fill))
+            {
+                // Consumers only park after finding the buffer empty, so this wakes them when it's no longer empty.
+                // Fence pairs with the one in drain(): either we see a parked consumer, or it sees our event and doesn't sleep.
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (parkedConsumers_.load() > 0)
+                {
+                    wakeUpConsumers();
+                }
+                break;
+            }
+            // Buffer is full: make sure consumers are awake and wait for them to free some space
+            producerWaitCount_.fetch_add(1, std::memory_order_relaxed);
+            wakeUpConsumers();
+            std::this_thread::yield();
+        }
+        // Returning false stops the listener: actual consumer has asked to stop, or we're shut down
+        return !isStopRequested_.load(std::memory_order_relaxed) && isRunning_.load(std::memory_order_relaxed);
+    }
+
+    // Consumer thread body
+    void drain()
+    {
+        static const int spinCount = 100;
+        auto deliver = [this](Slot& slot) {
+            // Events after 'stop' from consumer are skipped, same as with direct delivery
+            if (!isStopRequested_.load(std::memory_order_relaxed) && !consumer_(slot.event, slot.caller))
+            {
+                isStopRequested_.store(true);
+            }
+            deliveredCount_.fetch_add(1, std::memory_order_relaxed);
+        };
+        int idleCount = 0;
+        while (true)
+        {
+            if (ring_.tryPop(deliver))
+            {
+                idleCount = 0;
+                continue;
+            }
+            if (!isRunning_.load())
+            {
+                // Buffer is drained and no more events are coming
+                break;
+            }
+            if (++idleCount < spinCount)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            // Nothing to do for a while: park until producer pushes an event or stop() is called, an idle consumer doesn't wake up otherwise
+            std::unique_lock<std::mutex> lock(parkLock_);
+            parkedConsumers_++;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            parkCondition_.wait(lock, [this] { return !ring_.empty() || !isRunning_.load(); });
+            parkedConsumers_--;
+        }
+    }
+
+    void wakeUpConsumers()
+    {
+        std::lock_guard<std::mutex> lock(parkLock_);
+        parkCondition_.notify_all();
+    }
+
+private:
+    std::function< bool(const Event&, const std::string&)> consumer_;
+    EventRingBuffer<Slot> ring_;
+    std::vector<std::thread> consumerThreads_;
+
+    std::atomic<bool> isRunning_;
+    std::atomic<bool> isStopRequested_;
+
+    // Slow path only: consumers park here when the buffer stays empty
+    std::mutex parkLock_;
+    std::condition_variable parkCondition_;
+    std::atomic<int> parkedConsumers_;
+
+    std::atomic<long long> deliveredCount_;
+    std::atomic<long long> producerWaitCount_;
+};
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/**
+Bounded lock-free ring buffer (D. Vyukov's bounded MPMC queue).
+Safe for any number of producers and consumers, so it covers both SPSC and MPSC hand-off.
+Elements are constructed once and reused: producer fills a slot in place and consumer processes it in place, so there's no copy out of the buffer.
+
+Usage:
+	EventRingBuffer<OrderEvent> ring(1024);
+	ring.tryPush([&](OrderEvent& slot) { slot = event; }); // false if the buffer is full
+...
+	ring.tryPop([&](OrderEvent& slot) { process(slot); }); // false if the buffer is empty
+*/
+template <class T> class EventRingBuffer
+{
+public:
+    // Capacity is rounded up to a power of two
+    explicit EventRingBuffer(size_t capacity) :
+        mask_(roundUpToPowerOfTwo(capacity) - 1),
+        cells_(new Cell[mask_ + 1])
+    {
+        for (size_t i = 0; i <= mask_; i++)
+        {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        enqueuePos_.store(0, std::memory_order_relaxed);
+        dequeuePos_.store(0, std::memory_order_relaxed);
+        highWaterMark_.store(0, std::memory_order_relaxed);
+    }
+
+    EventRingBuffer(const EventRingBuffer&) = delete;
+    void operator=(const EventRingBuffer&) = delete;
+
+    template <class Fill> bool tryPush(Fill fill)
+    {
+        Cell* cell;
+        size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        while (true)
+        {
+            cell = &cells_[pos & mask_];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+        fill(cell->data);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        updateHighWaterMark(pos + 1 - dequeuePos_.load(std::memory_order_relaxed));
+        return true;
+    }
+
+    template <class Consume> bool tryPop(Consume consume)
+    {
+        Cell* cell;
+        size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+        while (true)
+        {
+            cell = &cells_[pos & mask_];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+            if (diff == 0)
+            {
+                if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = dequeuePos_.load(std::memory_order_relaxed);
+            }
+        }
+        consume(cell->data);
+        cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t capacity() const
+    {
+        return mask_ + 1;
+    }
+
+    // Approximate number of elements in the buffer: exact only when there are no concurrent pushes or pops
+    size_t size() const
+    {
+        size_t enqueuePos = enqueuePos_.load(std::memory_order_relaxed);
+        size_t dequeuePos = dequeuePos_.load(std::memory_order_relaxed);
+        return enqueuePos > dequeuePos ? enqueuePos - dequeuePos : 0;
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    // Maximum number of elements ever observed in the buffer
+    size_t highWaterMark() const
+    {
+        return highWaterMark_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    static size_t roundUpToPowerOfTwo(size_t value)
+    {
+        size_t result = 2;
+        while (result < value)
+        {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    void updateHighWaterMark(size_t depth)
+    {
+        size_t current = highWaterMark_.load(std::memory_order_relaxed);
+        while (depth > current && depth <= capacity() && !highWaterMark_.compare_exchange_weak(current, depth, std::memory_order_relaxed))
+        {
+        }
+    }
+
+private:
+    static const size_t CacheLineSize = 64;
+
+    const size_t mask_;
+    std::unique_ptr<Cell[]> cells_;
+    // Producers and consumers update different positions, keep them on different cache lines
+    alignas(CacheLineSize) std::atomic<size_t> enqueuePos_;
+    alignas(CacheLineSize) std::atomic<size_t> dequeuePos_;
+    alignas(CacheLineSize) std::atomic<size_t> highWaterMark_;
+};
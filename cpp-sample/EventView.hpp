@@ -0,0 +1,253 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <tmsapigrpc/TMSRemoteEvents.pb.h>
+
+#include "FieldsView.h"
+
+// What happened to the record, as far as record collections are concerned
+enum class EventKind
+{
+    // Feed status or empty event: there's no record
+    Status,
+    Added,
+    Updated,
+    Removed,
+    // Record doesn't match subscription filter anymore: same as removed for the subscriber
+    FilteredOut,
+    // Record is still there but its fields are not sent (e.g. target paused/resumed/terminated)
+    Other
+};
+
+/**
+Describes where record key and fields are in each kind of event.
+Key is returned by reference where it's a string, so it's never copied.
+Events that carry no fields (removed, filtered out, feed status, ...) have no fields, events that carry no record have empty key.
+*/
+template <class Event> struct EventViewTraits;
+
+template <> struct EventViewTraits<OrderEvent>
+{
+    typedef const std::string& Key;
+    static Key getKey(const OrderEvent& event)
+    {
+        switch (event.event_case())
+        {
+        case OrderEvent::EventCase::kAdded: return event.added().orderid();
+        case OrderEvent::EventCase::kUpdated: return event.updated().orderid();
+        case OrderEvent::EventCase::kFilteredOut: return event.filteredout().orderid();
+        default: return OrderEvent::OrderAddedEvent::default_instance().orderid();
+        }
+    }
+    static EventKind getKind(const OrderEvent& event)
+    {
+        switch (event.event_case())
+        {
+        case OrderEvent::EventCase::kAdded: return EventKind::Added;
+        case OrderEvent::EventCase::kUpdated: return EventKind::Updated;
+        case OrderEvent::EventCase::kFilteredOut: return EventKind::FilteredOut;
+        default: return EventKind::Status;
+        }
+    }
+    static const Fields* findFields(const OrderEvent& event)
+    {
+        switch (event.event_case())
+        {
+        case OrderEvent::EventCase::kAdded: return &event.added().fields();
+        case OrderEvent::EventCase::kUpdated: return &event.updated().fields();
+        default: return NULL;
+        }
+    }
+};
+
+template <> struct EventViewTraits<TargetEvent>
+{
+    typedef int64_t Key;
+    static Key getKey(const TargetEvent& event)
+    {
+        switch (event.event_case())
+        {
+        case TargetEvent::EventCase::kAdded: return event.added().targetid();
+        case TargetEvent::EventCase::kUpdated: return event.updated().targetid();
+        case TargetEvent::EventCase::kRemoved: return event.removed().targetid();
+        case TargetEvent::EventCase::kFilteredOut: return event.filteredout().targetid();
+        case TargetEvent::EventCase::kPaused: return event.paused().targetid();
+        case TargetEvent::EventCase::kResumed: return event.resumed().targetid();
+        case TargetEvent::EventCase::kTerminated: return event.terminated().targetid();
+        default: return 0;
+        }
+    }
+    static EventKind getKind(const TargetEvent& event)
+    {
+        switch (event.event_case())
+        {
+        case TargetEvent::EventCase::kAdded: return EventKind::Added;
+        case TargetEvent::EventCase::kUpdated: return EventKind::Updated;
+        case TargetEvent::EventCase::kRemoved: return EventKind::Removed;
+        case TargetEvent::EventCase::kFilteredOut: return EventKind::FilteredOut;
+        case TargetEvent::EventCase::kPaused: return EventKind::Other;
+        case TargetEvent::EventCase::kResumed: return EventKind::Other;
+        case TargetEvent::EventCase::kTerminated: return EventKind::Other;
+        default: return EventKind::Status;
+        }
+    }
+    static const Fields* findFields(const TargetEvent& event)
+    {
+        switch (event.event_case())
+        {
+        case TargetEvent::EventCase::kAdded: return &event.added().fields();
+        case TargetEvent::EventCase::kUpdated: return &event.updated().fields();
+        default: return NULL;
+        }
+    }
+};
+
+template <> struct EventViewTraits<MarketDataEvent>
+{
+    typedef const std::string& Key;
+    static Key getKey(const MarketDataEvent& event)
+    {
+        // Returns default instance's empty instrument if event is not an update
+        return event.update().instrument();
+    }
+    static EventKind getKind(const MarketDataEvent& event)
+    {
+        return event.event_case() == MarketDataEvent::EventCase::kUpdate ? EventKind::Updated : EventKind::Status;
+    }
+    static const Fields* findFields(const MarketDataEvent& event)
+    {
+        return event.event_case() == MarketDataEvent::EventCase::kUpdate ? &event.update().fields() : NULL;
+    }
+};
+
+template <> struct EventViewTraits<PortfolioEvent>
+{
+    typedef const std::string& Key;
+    static Key getKey(const PortfolioEvent& event)
+    {
+        switch (event.event_case())
+        {
+        case PortfolioEvent::EventCase::kAdded: return event.added().portfolioname();
+        case PortfolioEvent::EventCase::kUpdated: return event.updated().portfolioname();
+        case PortfolioEvent::EventCase::kRemoved: return event.removed().portfolioname();
+        case PortfolioEvent::EventCase::kFilteredOut: return event.filteredout().portfolioname();
+        default: return PortfolioEvent::PortfolioAddedEvent::default_instance().portfolioname();
+        }
+    }
+    static EventKind getKind(const PortfolioEvent& event)
+    {
+        switch (event.event_case())
+        {
+        case PortfolioEvent::EventCase::kAdded: return EventKind::Added;
+        case PortfolioEvent::EventCase::kUpdated: return EventKind::Updated;
+        case PortfolioEvent::EventCase::kRemoved: return EventKind::Removed;
+        case PortfolioEvent::EventCase::kFilteredOut: return EventKind::FilteredOut;
+        default: return EventKind::Status;
+        }
+    }
+    static const Fields* findFields(const PortfolioEvent& event)
+    {
+        switch (event.event_case())
+        {
+        case PortfolioEvent::EventCase::kAdded: return &event.added().fields();
+        case PortfolioEvent::EventCase::kUpdated: return &event.updated().fields();
+        default: return NULL;
+        }
+    }
+};
+
+template <> struct EventViewTraits<RecordEvent>
+{
+    typedef const std::string& Key;
+    static Key getKey(const RecordEvent& event)
+    {
+        switch (event.event_case())
+        {
+        case RecordEvent::EventCase::kAdded: return event.added().recordid();
+        case RecordEvent::EventCase::kUpdated: return event.updated().recordid();
+        case RecordEvent::EventCase::kRemoved: return event.removed().recordid();
+        case RecordEvent::EventCase::kFilteredOut: return event.filteredout().recordid();
+        default: return RecordEvent::RecordAddedEvent::default_instance().recordid();
+        }
+    }
+    static EventKind getKind(const RecordEvent& event)
+    {
+        switch (event.event_case())
+        {
+        case RecordEvent::EventCase::kAdded: return EventKind::Added;
+        case RecordEvent::EventCase::kUpdated: return EventKind::Updated;
+        case RecordEvent::EventCase::kRemoved: return EventKind::Removed;
+        case RecordEvent::EventCase::kFilteredOut: return EventKind::FilteredOut;
+        default: return EventKind::Status;
+        }
+    }
+    static const Fields* findFields(const RecordEvent& event)
+    {
+        switch (event.event_case())
+        {
+        case RecordEvent::EventCase::kAdded: return &event.added().fields();
+        case RecordEvent::EventCase::kUpdated: return &event.updated().fields();
+        default: return NULL;
+        }
+    }
+};
+
+/**
+Non-owning, read-only view over an event: gives its record key and fields by reference, whatever kind of event it is.
+Use it instead of copying event's parts, e.g. 'auto fields = event.added().fields();' copies both field maps.
+View must not outlive the event it was taken from.
+
+Usage:
+	OrderEventView view(event);
+	const std::string& orderId = view.getKey();
+	double orderQty = view.getFields().getNumeric("OrdQty", 0);
+*/
+template <class Event> class EventView
+{
+public:
+    typedef EventViewTraits<Event> Traits;
+    typedef typename Traits::Key Key;
+
+    explicit EventView(const Event& event) :
+        event_(event)
+    {
+    }
+
+    // Order ID, target ID, instrument, portfolio name or record ID
+    Key getKey() const
+    {
+        return Traits::getKey(event_);
+    }
+
+    EventKind getKind() const
+    {
+        return Traits::getKind(event_);
+    }
+
+    bool hasFields() const
+    {
+        return Traits::findFields(event_) != NULL;
+    }
+
+    // Empty view if event carries no fields
+    FieldsView getFields() const
+    {
+        return FieldsView(Traits::findFields(event_));
+    }
+
+    const Event& getEvent() const
+    {
+        return event_;
+    }
+
+private:
+    const Event& event_;
+};
+
+typedef EventView<OrderEvent> OrderEventView;
+typedef EventView<TargetEvent> TargetEventView;
+typedef EventView<MarketDataEvent> MarketDataEventView;
+typedef EventView<PortfolioEvent> PortfolioEventView;
+typedef EventView<RecordEvent> RecordEventView;
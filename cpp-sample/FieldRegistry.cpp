@@ -0,0 +1,224 @@
+#include <mutex>
+
+#include "FieldsView.h"
+#include "Utils.h"
+
+#include "FieldRegistry.h"
+
+using namespace Utils;
+
+namespace
+{
+	const std::string emptyString;
+};
+
+FieldRegistry &FieldRegistry::getInstance()
+{
+	static FieldRegistry instance;
+	return instance;
+}
+
+FieldRegistry::FieldRegistry()
+{
+}
+
+void FieldRegistry::addFieldTypes(const FieldToType& fieldTypes)
+{
+	for (const auto& field : fieldTypes.fieldmap())
+	{
+		internImpl(field.first, field.second.numeric());
+	}
+}
+
+FieldId FieldRegistry::intern(const std::string& name)
+{
+	return internImpl(name, false);
+}
+
+FieldId FieldRegistry::internImpl(const std::string& name, bool isNumeric)
+{
+	{
+		std::shared_lock<std::shared_timed_mutex> lock(registryLock_);
+		auto iter = nameToId_.find(name);
+		if (iter != nameToId_.end() && (!isNumeric || isNumeric_[iter->second]))
+		{
+			return iter->second;
+		}
+	}
+	std::unique_lock<std::shared_timed_mutex> lock(registryLock_);
+	auto iter = nameToId_.find(name);
+	if (iter != nameToId_.end())
+	{
+		// Same field may be reported by several sources
+		if (isNumeric)
+		{
+			isNumeric_[iter->second] = true;
+		}
+		return iter->second;
+	}
+	FieldId id = (FieldId)names_.size();
+	names_.push_back(name);
+	isNumeric_.push_back(isNumeric);
+	nameToId_.emplace(name, id);
+	return id;
+}
+
+FieldId FieldRegistry::getFieldId(const std::string& name) const
+{
+	std::shared_lock<std::shared_timed_mutex> lock(registryLock_);
+	auto iter = nameToId_.find(name);
+	return iter != nameToId_.end() ? iter->second : UnknownFieldId;
+}
+
+const std::string& FieldRegistry::getFieldName(FieldId id) const
+{
+	std::shared_lock<std::shared_timed_mutex> lock(registryLock_);
+	return (id >= 0 && id < (FieldId)names_.size()) ? names_[id] : emptyString;
+}
+
+bool FieldRegistry::isNumeric(FieldId id) const
+{
+	std::shared_lock<std::shared_timed_mutex> lock(registryLock_);
+	return id >= 0 && id < (FieldId)isNumeric_.size() && isNumeric_[id];
+}
+
+size_t FieldRegistry::size() const
+{
+	std::shared_lock<std::shared_timed_mutex> lock(registryLock_);
+	return names_.size();
+}
+
+FlatFields::FlatFields(const FieldRegistry& registry) :
+	unknownFieldCount_(0)
+{
+	std::shared_lock<std::shared_timed_mutex> lock(registry.registryLock_);
+	for (const auto& field : registry.nameToId_)
+	{
+		addField(field.first, field.second);
+	}
+}
+
+FlatFields::FlatFields(FieldRegistry& registry, const std::vector<std::string>& fields) :
+	unknownFieldCount_(0)
+{
+	for (const std::string& name : fields)
+	{
+		addField(name, registry.intern(name));
+	}
+}
+
+void FlatFields::addField(const std::string& name, FieldId id)
+{
+	nameToId_.emplace(name, id);
+	if ((size_t)id >= states_.size())
+	{
+		states_.resize(id + 1, FieldState::Absent);
+		kinds_.resize(id + 1, ValueKind::Numeric);
+		numericValues_.resize(id + 1);
+		stringValues_.resize(id + 1);
+	}
+}
+
+void FlatFields::assign(const Fields& fields)
+{
+	clear();
+	applyImpl(fields);
+}
+
+void FlatFields::apply(const Fields& fields)
+{
+	applyImpl(fields);
+}
+
+void FlatFields::clear()
+{
+	// Only fields of the previous event are reset, not the whole arrays
+	for (FieldId id : fieldIds_)
+	{
+		states_[id] = FieldState::Absent;
+	}
+	fieldIds_.clear();
+}
+
+void FlatFields::applyImpl(const Fields& fields)
+{
+	for (const auto& field : fields.numericfields())
+	{
+		auto iter = nameToId_.find(field.first);
+		if (iter == nameToId_.end())
+		{
+			unknownFieldCount_++;
+			continue;
+		}
+		numericValues_[iter->second] = field.second;
+		set(iter->second, FieldState::Present, ValueKind::Numeric);
+	}
+	for (const auto& field : fields.stringfields())
+	{
+		auto iter = nameToId_.find(field.first);
+		if (iter == nameToId_.end())
+		{
+			unknownFieldCount_++;
+			continue;
+		}
+		if (field.second == FieldsView::NullValue)
+		{
+			set(iter->second, FieldState::Null, ValueKind::String);
+		}
+		else
+		{
+			stringValues_[iter->second].assign(field.second);
+			set(iter->second, FieldState::Present, ValueKind::String);
+		}
+	}
+}
+
+void FlatFields::set(FieldId id, FieldState state, ValueKind kind)
+{
+	if (states_[id] == FieldState::Absent)
+	{
+		fieldIds_.push_back(id);
+	}
+	states_[id] = state;
+	kinds_[id] = kind;
+}
+
+FieldState FlatFields::getState(FieldId id) const
+{
+	return (id >= 0 && id < (FieldId)states_.size()) ? states_[id] : FieldState::Absent;
+}
+
+bool FlatFields::isPresent(FieldId id) const
+{
+	return getState(id) == FieldState::Present;
+}
+
+bool FlatFields::isNull(FieldId id) const
+{
+	return getState(id) == FieldState::Null;
+}
+
+bool FlatFields::isNumeric(FieldId id) const
+{
+	return isPresent(id) && kinds_[id] == ValueKind::Numeric;
+}
+
+double FlatFields::getNumeric(FieldId id, double defaultValue) const
+{
+	return isNumeric(id) ? numericValues_[id] : defaultValue;
+}
+
+const std::string& FlatFields::getString(FieldId id) const
+{
+	return isPresent(id) && kinds_[id] == ValueKind::String ? stringValues_[id] : emptyString;
+}
+
+const std::vector<FieldId>& FlatFields::getFieldIds() const
+{
+	return fieldIds_;
+}
+
+long long FlatFields::getUnknownFieldCount() const
+{
+	return unknownFieldCount_;
+}
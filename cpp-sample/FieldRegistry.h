@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <tmsapigrpc/TMSRemote.grpc.pb.h>
+
+/**
+Interns field names into dense integer IDs, so downstream code reads field values by array index instead of hashing field names.
+Registry is seeded once at startup with the field types FieldSchema fetches from the server (market targets, orders, market data, ...).
+Field names that server doesn't report can be interned later: IDs are never reused or changed.
+
+FlatFields converts incoming Fields into flat arrays indexed by field ID: it takes one hash lookup per received field,
+and every read after that is an array access. It resolves IDs of its fields once, when it's created, so decoding events doesn't
+touch the registry or its lock. It suits consumers that read the same few fields of every event, FieldsView suits one-off lookups.
+
+Usage:
+	FieldRegistry& registry = FieldRegistry::getInstance();
+	FieldSchema::getInstance().load(*client.client_);
+	for (FieldDomain domain : { FieldDomain::MarketTarget, FieldDomain::Order, FieldDomain::MarketData })
+	{
+		if (std::shared_ptr<const RecordDecoder> decoder = FieldSchema::getInstance().getDecoder(domain))
+		{
+			registry.addFieldTypes(decoder->getFieldTypes());
+		}
+	}
+	FieldId lastPxId = registry.intern("LastPx");
+...
+	FlatFields fields(registry, { "LastPx", "LastSize" }); // One per consumer thread, reused for every event
+	fields.assign(event.update().fields());
+	double lastPx = fields.getNumeric(lastPxId, 0);
+*/
+
+typedef int FieldId;
+
+class FieldRegistry
+{
+public:
+	static const FieldId UnknownFieldId = -1;
+
+	static FieldRegistry &getInstance();
+
+	FieldRegistry();
+
+	FieldRegistry(const FieldRegistry&) = delete;
+	void operator=(const FieldRegistry&) = delete;
+
+	// Interns fields of a *FieldTypes reply, e.g. RecordDecoder::getFieldTypes() of FieldSchema
+	void addFieldTypes(const FieldToType& fieldTypes);
+
+	// Returns ID of the field, registers the field if it's new
+	FieldId intern(const std::string& name);
+	// Returns UnknownFieldId if the field is not registered
+	FieldId getFieldId(const std::string& name) const;
+	const std::string& getFieldName(FieldId id) const;
+	// True if server has reported the field as numeric
+	bool isNumeric(FieldId id) const;
+	size_t size() const;
+
+private:
+	friend class FlatFields;
+
+	FieldId internImpl(const std::string& name, bool isNumeric);
+
+private:
+	// Readers take shared lock, interning new names takes exclusive one
+	mutable std::shared_timed_mutex registryLock_;
+	std::unordered_map<std::string, FieldId> nameToId_;
+	// Deque keeps references returned by getFieldName() valid as new names are added
+	std::deque<std::string> names_;
+	std::vector<bool> isNumeric_;
+};
+
+enum class FieldState : uint8_t
+{
+	// Not sent in the event
+	Absent,
+	// Sent as "<NULL>", i.e. cleared
+	Null,
+	Present
+};
+
+// Values of one event's fields, indexed by field ID. Not thread-safe: use one instance per consumer thread.
+class FlatFields
+{
+public:
+	// Decodes fields registered by the time it's created, fields registered later are counted as unknown
+	explicit FlatFields(const FieldRegistry& registry);
+	// Decodes only the listed fields, registering those that are new: others are counted as unknown
+	FlatFields(FieldRegistry& registry, const std::vector<std::string>& fields);
+
+	// Replaces current values with values of fields. Fields that are not registered are skipped.
+	void assign(const Fields& fields);
+	// Applies update on top of current values: fields absent in update keep their values
+	void apply(const Fields& fields);
+	void clear();
+
+	FieldState getState(FieldId id) const;
+	bool isPresent(FieldId id) const;
+	bool isNull(FieldId id) const;
+	// True if field is present with a numeric value, false if it's absent, cleared or sent as string
+	bool isNumeric(FieldId id) const;
+	// Returns defaultValue if numeric field is absent, cleared or sent as string
+	double getNumeric(FieldId id, double defaultValue) const;
+	// Returns empty string if string field is absent, cleared or sent as numeric
+	const std::string& getString(FieldId id) const;
+
+	// IDs of fields that are present or cleared, in order of arrival
+	const std::vector<FieldId>& getFieldIds() const;
+	// Number of received fields skipped because they were not registered
+	long long getUnknownFieldCount() const;
+
+private:
+	enum class ValueKind : uint8_t
+	{
+		Numeric,
+		String
+	};
+
+	void addField(const std::string& name, FieldId id);
+	void applyImpl(const Fields& fields);
+	void set(FieldId id, FieldState state, ValueKind kind);
+
+private:
+	// IDs of decoded fields, copied from the registry
+	std::unordered_map<std::string, FieldId> nameToId_;
+	std::vector<FieldState> states_;
+	// Kind of value of each present field: a field may be sent either as numeric or as string
+	std::vector<ValueKind> kinds_;
+	std::vector<double> numericValues_;
+	// Strings keep their capacity between events, so assigning a value usually doesn't allocate
+	std::vector<std::string> stringValues_;
+	std::vector<FieldId> fieldIds_;
+	long long unknownFieldCount_;
+};
@@ -0,0 +1,458 @@
+#include <algorithm>
+#include <cstdlib>
+#include <future>
+#include <map>
+#include <sstream>
+
+#include "AsyncUnaryClient.hpp"
+#include "FieldsView.h"
+#include "Logger.h"
+
+#include "FieldSchema.h"
+
+namespace
+{
+	const std::string emptyString;
+
+	// Whole string is a number
+	bool parseNumber(const std::string& text, double* value)
+	{
+		if (text.empty())
+		{
+			return false;
+		}
+		char* end;
+		*value = std::strtod(text.c_str(), &end);
+		return *end == '\0';
+	}
+
+	void addError(std::string* error, const std::string& reason)
+	{
+		if (error)
+		{
+			error->append(error->empty() ? "" : "; ").append(reason);
+		}
+	}
+};
+
+const int TypedRecord::InvalidEnum;
+const int RecordDecoder::UnknownSlot;
+
+TypedRecord::TypedRecord() :
+	unknownFieldCount_(0)
+{
+}
+
+FieldState TypedRecord::getState(int slot) const
+{
+	return (slot >= 0 && slot < (int)states_.size()) ? states_[slot] : FieldState::Absent;
+}
+
+bool TypedRecord::isPresent(int slot) const
+{
+	return getState(slot) == FieldState::Present;
+}
+
+bool TypedRecord::isNull(int slot) const
+{
+	return getState(slot) == FieldState::Null;
+}
+
+double TypedRecord::getNumeric(int slot, double defaultValue) const
+{
+	return isPresent(slot) ? numericValues_[slot] : defaultValue;
+}
+
+const std::string& TypedRecord::getString(int slot) const
+{
+	return isPresent(slot) ? stringValues_[slot] : emptyString;
+}
+
+int TypedRecord::getEnum(int slot) const
+{
+	return isPresent(slot) ? enumValues_[slot] : InvalidEnum;
+}
+
+const std::vector<int>& TypedRecord::getSlots() const
+{
+	return slots_;
+}
+
+long long TypedRecord::getUnknownFieldCount() const
+{
+	return unknownFieldCount_;
+}
+
+void TypedRecord::clear()
+{
+	// Only fields of the previous record are reset, not the whole arrays
+	for (int slot : slots_)
+	{
+		states_[slot] = FieldState::Absent;
+	}
+	slots_.clear();
+}
+
+void TypedRecord::set(int slot, FieldState state)
+{
+	if (states_[slot] == FieldState::Absent)
+	{
+		slots_.push_back(slot);
+	}
+	states_[slot] = state;
+}
+
+RecordDecoder::RecordDecoder(const FieldToType& fieldTypes, const std::vector<std::string>& fields) :
+	fieldTypes_(fieldTypes)
+{
+	// Slots in name order, so that a decoder built from the same types always has the same slots
+	std::map<std::string, const FieldType*> types;
+	for (const auto& field : fieldTypes.fieldmap())
+	{
+		if (fields.empty() || std::find(fields.begin(), fields.end(), field.first) != fields.end())
+		{
+			types.emplace(field.first, &field.second);
+		}
+	}
+	slots_.resize(types.size());
+	for (const auto& type : types)
+	{
+		Slot& slot = slots_[nameToSlot_.size()];
+		nameToSlot_.emplace(type.first, (int)nameToSlot_.size());
+		slot.name = type.first;
+		slot.isNumeric = type.second->numeric();
+		slot.isEditable = type.second->editable();
+		slot.validation = type.second->validation();
+		slot.kind = slot.isNumeric ? FieldKind::Numeric : FieldKind::String;
+		if (type.second->validvalues().empty())
+		{
+			continue;
+		}
+		std::map<std::string, std::string> validValues(type.second->validvalues().begin(), type.second->validvalues().end());
+		for (const auto& validValue : validValues)
+		{
+			double number;
+			if (slot.isNumeric && !parseNumber(validValue.first, &number))
+			{
+				break;
+			}
+			int value = (int)slot.enumValues.size();
+			slot.enumValues.push_back(validValue.first);
+			slot.enumDescriptions.push_back(validValue.second);
+			if (slot.isNumeric)
+			{
+				slot.numericEnum.emplace_back(number, value);
+			}
+			else
+			{
+				slot.stringEnum.emplace(validValue.first, value);
+			}
+		}
+		if (slot.enumValues.size() < validValues.size())
+		{
+			TMS_LOG_INFO("[RecordDecoder] Valid values of numeric field ", slot.name, " are not numbers, it's decoded as a number");
+			slot.enumValues.clear();
+			slot.enumDescriptions.clear();
+			slot.numericEnum.clear();
+			continue;
+		}
+		std::sort(slot.numericEnum.begin(), slot.numericEnum.end());
+		slot.kind = FieldKind::Enum;
+	}
+}
+
+int RecordDecoder::getSlot(const std::string& name) const
+{
+	auto iter = nameToSlot_.find(name);
+	return iter != nameToSlot_.end() ? iter->second : UnknownSlot;
+}
+
+size_t RecordDecoder::size() const
+{
+	return slots_.size();
+}
+
+const std::string& RecordDecoder::getName(int slot) const
+{
+	return slots_.at(slot).name;
+}
+
+FieldKind RecordDecoder::getKind(int slot) const
+{
+	return slots_.at(slot).kind;
+}
+
+bool RecordDecoder::isNumeric(int slot) const
+{
+	return slots_.at(slot).isNumeric;
+}
+
+bool RecordDecoder::isEditable(int slot) const
+{
+	return slots_.at(slot).isEditable;
+}
+
+int RecordDecoder::getValidation(int slot) const
+{
+	return slots_.at(slot).validation;
+}
+
+const std::vector<std::string>& RecordDecoder::getEnumValues(int slot) const
+{
+	return slots_.at(slot).enumValues;
+}
+
+const std::string& RecordDecoder::getEnumDescription(int slot, int value) const
+{
+	const Slot& decoderSlot = slots_.at(slot);
+	return (value >= 0 && value < (int)decoderSlot.enumDescriptions.size()) ? decoderSlot.enumDescriptions[value] : emptyString;
+}
+
+const FieldToType& RecordDecoder::getFieldTypes() const
+{
+	return fieldTypes_;
+}
+
+void RecordDecoder::decode(const Fields& fields, TypedRecord* record) const
+{
+	record->clear();
+	applyImpl(fields, record);
+}
+
+void RecordDecoder::apply(const Fields& fields, TypedRecord* record) const
+{
+	applyImpl(fields, record);
+}
+
+void RecordDecoder::applyImpl(const Fields& fields, TypedRecord* record) const
+{
+	if (record->states_.size() < slots_.size())
+	{
+		record->states_.resize(slots_.size(), FieldState::Absent);
+		record->numericValues_.resize(slots_.size());
+		record->stringValues_.resize(slots_.size());
+		record->enumValues_.resize(slots_.size(), TypedRecord::InvalidEnum);
+	}
+	for (const auto& field : fields.numericfields())
+	{
+		auto iter = nameToSlot_.find(field.first);
+		if (iter == nameToSlot_.end() || !slots_[iter->second].isNumeric)
+		{
+			record->unknownFieldCount_++;
+			continue;
+		}
+		const Slot& slot = slots_[iter->second];
+		record->numericValues_[iter->second] = field.second;
+		record->enumValues_[iter->second] = slot.kind == FieldKind::Enum ? findEnum(slot, field.second) : TypedRecord::InvalidEnum;
+		record->set(iter->second, FieldState::Present);
+	}
+	for (const auto& field : fields.stringfields())
+	{
+		auto iter = nameToSlot_.find(field.first);
+		// Numeric fields are sent as strings only when they're cleared
+		if (iter == nameToSlot_.end() || (slots_[iter->second].isNumeric && field.second != FieldsView::NullValue))
+		{
+			record->unknownFieldCount_++;
+			continue;
+		}
+		if (field.second == FieldsView::NullValue)
+		{
+			record->set(iter->second, FieldState::Null);
+			continue;
+		}
+		const Slot& slot = slots_[iter->second];
+		record->stringValues_[iter->second].assign(field.second);
+		record->enumValues_[iter->second] = slot.kind == FieldKind::Enum ? findEnum(slot, field.second) : TypedRecord::InvalidEnum;
+		record->set(iter->second, FieldState::Present);
+	}
+}
+
+bool RecordDecoder::validate(const Fields& fields, bool isModify, std::string* error) const
+{
+	bool isValid = true;
+	auto check = [this, isModify, error, &isValid](const std::string& name, bool isNumeric, bool isNull) -> const Slot* {
+		auto iter = nameToSlot_.find(name);
+		if (iter == nameToSlot_.end())
+		{
+			addError(error, "unknown field " + name);
+			isValid = false;
+			return nullptr;
+		}
+		const Slot& slot = slots_[iter->second];
+		if (slot.isNumeric != isNumeric && !isNull)
+		{
+			addError(error, name + (slot.isNumeric ? " is numeric" : " is not numeric"));
+			isValid = false;
+			return nullptr;
+		}
+		if (isModify && !slot.isEditable)
+		{
+			addError(error, name + " is not editable");
+			isValid = false;
+			return nullptr;
+		}
+		return &slot;
+	};
+	for (const auto& field : fields.numericfields())
+	{
+		const Slot* slot = check(field.first, true, false);
+		if (slot && slot->kind == FieldKind::Enum && findEnum(*slot, field.second) == TypedRecord::InvalidEnum)
+		{
+			std::ostringstream value;
+			value << field.second;
+			addError(error, value.str() + " is not a valid value of " + field.first);
+			isValid = false;
+		}
+	}
+	for (const auto& field : fields.stringfields())
+	{
+		bool isNull = field.second == FieldsView::NullValue;
+		const Slot* slot = check(field.first, false, isNull);
+		if (slot && !isNull && slot->kind == FieldKind::Enum && findEnum(*slot, field.second) == TypedRecord::InvalidEnum)
+		{
+			addError(error, field.second + " is not a valid value of " + field.first);
+			isValid = false;
+		}
+	}
+	return isValid;
+}
+
+int RecordDecoder::findEnum(const Slot& slot, double value) const
+{
+	auto iter = std::lower_bound(slot.numericEnum.begin(), slot.numericEnum.end(), value, [](const std::pair<double, int>& entry, double value) { return entry.first < value; });
+	return (iter != slot.numericEnum.end() && iter->first == value) ? iter->second : TypedRecord::InvalidEnum;
+}
+
+int RecordDecoder::findEnum(const Slot& slot, const std::string& value) const
+{
+	auto iter = slot.stringEnum.find(value);
+	return iter != slot.stringEnum.end() ? iter->second : TypedRecord::InvalidEnum;
+}
+
+FieldSchema& FieldSchema::getInstance()
+{
+	static FieldSchema instance;
+	return instance;
+}
+
+FieldSchema::FieldSchema()
+{
+}
+
+bool FieldSchema::load(TMSRemote::Stub& stub)
+{
+	static const AsyncUnaryClient::PrepareAsyncMethod<Void, FieldToType> methods[DomainCount] = {
+		&TMSRemote::Stub::PrepareAsyncgetMarketTargetFieldTypes,
+		&TMSRemote::Stub::PrepareAsyncgetOrderFieldTypes,
+		&TMSRemote::Stub::PrepareAsyncgetMarketPortfolioFieldTypes,
+		&TMSRemote::Stub::PrepareAsyncgetStagedTargetFieldTypes,
+		&TMSRemote::Stub::PrepareAsyncgetMarketDataFieldTypes
+	};
+	// All domains in one round trip
+	AsyncUnaryClient asyncClient(stub);
+	std::future<UnaryResult<FieldToType>> replies[DomainCount];
+	for (int domain = 0; domain < DomainCount; domain++)
+	{
+		replies[domain] = asyncClient.call(methods[domain], Void());
+	}
+	std::string missingDomains;
+	for (int domain = 0; domain < DomainCount; domain++)
+	{
+		UnaryResult<FieldToType> reply = replies[domain].get();
+		if (!reply.status.ok())
+		{
+			TMS_LOG_WARNING("[FieldSchema] Field types of ", getDomainName((FieldDomain)domain), " are not available: ", reply.status.error_message());
+			missingDomains += (missingDomains.empty() ? "" : ", ") + std::string(getDomainName((FieldDomain)domain));
+			continue;
+		}
+		std::shared_ptr<const RecordDecoder> decoder = std::make_shared<RecordDecoder>(reply.response);
+		std::lock_guard<std::mutex> lock(schemaLock_);
+		decoders_[domain] = decoder;
+	}
+	if (!missingDomains.empty())
+	{
+		TMS_LOG_WARNING("[FieldSchema] Field types are loaded except for ", missingDomains, ": their fields are not validated before they are sent");
+		return false;
+	}
+	TMS_LOG_INFO("[FieldSchema] Field types are loaded");
+	return true;
+}
+
+std::shared_ptr<const RecordDecoder> FieldSchema::getDecoder(FieldDomain domain) const
+{
+	std::lock_guard<std::mutex> lock(schemaLock_);
+	return decoders_[(int)domain];
+}
+
+std::shared_ptr<const RecordDecoder> FieldSchema::getReportDecoder(TMSRemote::Stub& stub, const std::string& domainManagerName, const std::string& reportName, const std::string& level)
+{
+	std::tuple<std::string, std::string, std::string> key(domainManagerName, reportName, level);
+	{
+		std::lock_guard<std::mutex> lock(schemaLock_);
+		auto iter = reportDecoders_.find(key);
+		if (iter != reportDecoders_.end())
+		{
+			return iter->second;
+		}
+	}
+	// Not under the lock: other lookups don't wait for the round trip
+	grpc::ClientContext context;
+	ReportFieldTypesRequest request;
+	request.set_domainmanagername(domainManagerName);
+	request.set_reportname(reportName);
+	request.set_level(level);
+	ManagerToReportToLevelToFieldToType response;
+	grpc::Status status = stub.getReportFieldTypes(&context, request, &response);
+	if (!status.ok())
+	{
+		TMS_LOG_WARNING("[FieldSchema] Field types of report ", reportName, " are not available: ", status.error_message());
+		return nullptr;
+	}
+	const FieldToType* fieldTypes = nullptr;
+	auto manager = response.managermap().find(domainManagerName);
+	if (manager != response.managermap().end())
+	{
+		auto report = manager->second.reportmap().find(reportName);
+		if (report != manager->second.reportmap().end())
+		{
+			auto levelTypes = report->second.levelmap().find(level);
+			if (levelTypes != report->second.levelmap().end())
+			{
+				fieldTypes = &levelTypes->second;
+			}
+		}
+	}
+	if (!fieldTypes)
+	{
+		// Not cached: the report may not be loaded yet, the next call asks again
+		TMS_LOG_WARNING("[FieldSchema] Server has no field types for level ", level, " of report ", reportName, " of ", domainManagerName);
+		return nullptr;
+	}
+	std::lock_guard<std::mutex> lock(schemaLock_);
+	// First decoder wins if the level was requested concurrently
+	return reportDecoders_.emplace(key, std::make_shared<RecordDecoder>(*fieldTypes)).first->second;
+}
+
+bool FieldSchema::validate(FieldDomain domain, const Fields& fields, bool isModify, std::string* error) const
+{
+	std::shared_ptr<const RecordDecoder> decoder = getDecoder(domain);
+	return !decoder || decoder->validate(fields, isModify, error);
+}
+
+const char* FieldSchema::getDomainName(FieldDomain domain)
+{
+	switch (domain)
+	{
+	case FieldDomain::MarketTarget:
+		return "market targets";
+	case FieldDomain::Order:
+		return "orders";
+	case FieldDomain::MarketPortfolio:
+		return "market portfolios";
+	case FieldDomain::StagedTarget:
+		return "staged targets";
+	case FieldDomain::MarketData:
+		return "market data";
+	}
+	return "unknown domain";
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include <tmsapigrpc/TMSRemote.grpc.pb.h>
+
+#include "FieldRegistry.h"
+
+// Kinds of records whose field types server reports, each by its get*FieldTypes RPC
+enum class FieldDomain
+{
+	MarketTarget,
+	Order,
+	MarketPortfolio,
+	StagedTarget,
+	MarketData
+};
+
+enum class FieldKind : uint8_t
+{
+	Numeric,
+	String,
+	// Numeric or string field with valid values: decoded to the position of its value in RecordDecoder::getEnumValues()
+	Enum
+};
+
+// Values of one record decoded by a RecordDecoder, indexed by decoder's slots. Not thread-safe: use one instance per consumer thread.
+class TypedRecord
+{
+public:
+	static const int InvalidEnum = -1;
+
+	TypedRecord();
+
+	FieldState getState(int slot) const;
+	bool isPresent(int slot) const;
+	bool isNull(int slot) const;
+	// Returns defaultValue if numeric field is absent or cleared
+	double getNumeric(int slot, double defaultValue) const;
+	// Returns empty string if string field is absent or cleared
+	const std::string& getString(int slot) const;
+	// Position in the decoder's valid values, InvalidEnum if field is absent, cleared or its value is not a valid one
+	int getEnum(int slot) const;
+	// Slots of fields that are present or cleared, in order of decoding
+	const std::vector<int>& getSlots() const;
+	// Number of decoded fields that the decoder doesn't know
+	long long getUnknownFieldCount() const;
+
+	void clear();
+
+private:
+	friend class RecordDecoder;
+
+	void set(int slot, FieldState state);
+
+private:
+	std::vector<FieldState> states_;
+	std::vector<double> numericValues_;
+	std::vector<std::string> stringValues_;
+	std::vector<int> enumValues_;
+	std::vector<int> slots_;
+	long long unknownFieldCount_;
+};
+
+/**
+Decoder of one record type, compiled once from its FieldToType: every field gets a slot, a kind and, for fields with valid values,
+a table of them. Decoding takes one hash lookup per received field and one more per enum value; reading a decoded value is an array access.
+Numeric valid values are parsed once, when the decoder is built: they are then compared as numbers. Numeric fields whose valid values
+are not numbers stay numeric.
+
+The same tables validate fields before they're sent: names must be known, numeric and string values must be sent as such, values of fields
+with valid values must be one of them, and modified fields must be editable. Server's validation codes (FieldType.validation) are kept
+for callers, but not interpreted: their constants are not part of the API definition.
+
+Decoder is immutable once built, so it can be shared by any number of threads.
+*/
+class RecordDecoder
+{
+public:
+	static const int UnknownSlot = -1;
+
+	// Decodes all fields of fieldTypes, or only those listed: others are counted as unknown
+	explicit RecordDecoder(const FieldToType& fieldTypes, const std::vector<std::string>& fields = {});
+
+	RecordDecoder(const RecordDecoder&) = delete;
+	void operator=(const RecordDecoder&) = delete;
+
+	// Returns UnknownSlot if the decoder doesn't know the field
+	int getSlot(const std::string& name) const;
+	size_t size() const;
+	const std::string& getName(int slot) const;
+	FieldKind getKind(int slot) const;
+	bool isNumeric(int slot) const;
+	bool isEditable(int slot) const;
+	int getValidation(int slot) const;
+	// Valid values as server has reported them, empty for fields without valid values
+	const std::vector<std::string>& getEnumValues(int slot) const;
+	const std::string& getEnumDescription(int slot, int value) const;
+	// Field types the decoder was built from
+	const FieldToType& getFieldTypes() const;
+
+	// Replaces values of record with those of fields
+	void decode(const Fields& fields, TypedRecord* record) const;
+	// Applies update on top of record's values: fields absent in update keep their values
+	void apply(const Fields& fields, TypedRecord* record) const;
+	// False with the reasons in error if server would reject the fields. Modifications can't set fields that are not editable.
+	bool validate(const Fields& fields, bool isModify, std::string* error) const;
+
+private:
+	struct Slot
+	{
+		std::string name;
+		FieldKind kind;
+		bool isNumeric;
+		bool isEditable;
+		int validation;
+		std::vector<std::string> enumValues;
+		std::vector<std::string> enumDescriptions;
+		// Numeric valid values sorted, with their positions in enumValues
+		std::vector<std::pair<double, int>> numericEnum;
+		std::unordered_map<std::string, int> stringEnum;
+	};
+
+	void applyImpl(const Fields& fields, TypedRecord* record) const;
+	int findEnum(const Slot& slot, double value) const;
+	int findEnum(const Slot& slot, const std::string& value) const;
+
+private:
+	const FieldToType fieldTypes_;
+	std::vector<Slot> slots_;
+	std::unordered_map<std::string, int> nameToSlot_;
+};
+
+/**
+Field types of every record type, fetched from the server once per session: getMarketTargetFieldTypes, getOrderFieldTypes,
+getMarketPortfolioFieldTypes, getStagedTargetFieldTypes and getMarketDataFieldTypes are requested together at startup.
+Report levels have their own types, getReportFieldTypes is called on the first request for a level and its decoder is kept.
+
+Decoders are shared: the schema hands out pointers that stay valid however long they're kept.
+
+Usage:
+	FieldSchema& schema = FieldSchema::getInstance();
+	schema.load(*client.client_);
+...
+	std::string error;
+	if (!schema.validate(FieldDomain::MarketTarget, fields, false, &error)) ... // Don't send it
+...
+	std::shared_ptr<const RecordDecoder> decoder = schema.getDecoder(FieldDomain::Order);
+	int sideSlot = decoder->getSlot("Side");
+	TypedRecord order; // One per consumer thread, reused for every event
+	decoder->decode(event.fields(), &order);
+	if (order.getEnum(sideSlot) >= 0) ... decoder->getEnumDescription(sideSlot, order.getEnum(sideSlot))
+*/
+class FieldSchema
+{
+public:
+	static FieldSchema& getInstance();
+
+	FieldSchema();
+
+	FieldSchema(const FieldSchema&) = delete;
+	void operator=(const FieldSchema&) = delete;
+
+	// Requests field types of all domains at once. Returns false if any of the calls has failed: domains of successful calls are loaded anyway.
+	bool load(TMSRemote::Stub& stub);
+	// Null if the domain is not loaded
+	std::shared_ptr<const RecordDecoder> getDecoder(FieldDomain domain) const;
+	// Fetches field types of the report level on first use, null if that has failed or server doesn't know the level: failures are not cached
+	std::shared_ptr<const RecordDecoder> getReportDecoder(TMSRemote::Stub& stub, const std::string& domainManagerName, const std::string& reportName, const std::string& level);
+	// True if the domain is not loaded: there's nothing to check the fields against
+	bool validate(FieldDomain domain, const Fields& fields, bool isModify, std::string* error) const;
+
+	static const char* getDomainName(FieldDomain domain);
+
+private:
+	static const int DomainCount = 5;
+
+	mutable std::mutex schemaLock_;
+	std::shared_ptr<const RecordDecoder> decoders_[DomainCount];
+	// (domain manager, report, level)
+	std::map<std::tuple<std::string, std::string, std::string>, std::shared_ptr<const RecordDecoder>> reportDecoders_;
+};
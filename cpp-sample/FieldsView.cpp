@@ -0,0 +1,77 @@
+#include <tmsapigrpc/TMSRemoteCommon.pb.h>
+
+#include "FieldsView.h"
+
+const std::string FieldsView::NullValue("<NULL>");
+
+namespace
+{
+	const std::string emptyString;
+};
+
+FieldsView::FieldsView() :
+	fields_(NULL)
+{
+}
+
+FieldsView::FieldsView(const Fields* fields) :
+	fields_(fields)
+{
+}
+
+bool FieldsView::isEmpty() const
+{
+	return fields_ == NULL || (fields_->numericfields().empty() && fields_->stringfields().empty());
+}
+
+bool FieldsView::contains(const std::string& name) const
+{
+	return fields_ != NULL && (fields_->numericfields().count(name) > 0 || fields_->stringfields().count(name) > 0);
+}
+
+bool FieldsView::isNull(const std::string& name) const
+{
+	if (fields_ == NULL)
+	{
+		return false;
+	}
+	auto iter = fields_->stringfields().find(name);
+	return iter != fields_->stringfields().end() && iter->second == NullValue;
+}
+
+const double* FieldsView::findNumeric(const std::string& name) const
+{
+	if (fields_ == NULL)
+	{
+		return NULL;
+	}
+	auto iter = fields_->numericfields().find(name);
+	return iter != fields_->numericfields().end() ? &iter->second : NULL;
+}
+
+const std::string* FieldsView::findString(const std::string& name) const
+{
+	if (fields_ == NULL)
+	{
+		return NULL;
+	}
+	auto iter = fields_->stringfields().find(name);
+	return (iter != fields_->stringfields().end() && iter->second != NullValue) ? &iter->second : NULL;
+}
+
+double FieldsView::getNumeric(const std::string& name, double defaultValue) const
+{
+	const double* value = findNumeric(name);
+	return value ? *value : defaultValue;
+}
+
+const std::string& FieldsView::getString(const std::string& name) const
+{
+	const std::string* value = findString(name);
+	return value ? *value : emptyString;
+}
+
+const Fields* FieldsView::getFields() const
+{
+	return fields_;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <string>
+
+/**
+Non-owning, read-only view over event's Fields.
+Fields are looked up in place: nothing is copied, and looking up a missing field doesn't insert it (unlike map's operator[]).
+Field may be absent (not sent in this event) or null: since gRPC can't send null values,
+"Updated" events carry "<NULL>" string value for cleared fields, both string and numeric ones.
+
+View must not outlive the event it was taken from.
+
+Usage:
+	FieldsView fields = OrderEventView(event).getFields();
+	const double* orderQty = fields.findNumeric("OrdQty"); // NULL if absent
+	double fillQty = fields.getNumeric("FillQty", 0); // 0 if absent
+	if (fields.isNull("Text")) ... // Text is cleared
+	const std::string* text = fields.findString("Text"); // NULL if absent or cleared
+*/
+
+class Fields;
+
+class FieldsView
+{
+public:
+	// Value sent for cleared fields
+	static const std::string NullValue;
+
+	// View without fields, e.g. for removed or feed status events
+	FieldsView();
+	// fields may be NULL
+	explicit FieldsView(const Fields* fields);
+
+	bool isEmpty() const;
+	// Field is present in the event, either with a value or as null
+	bool contains(const std::string& name) const;
+	// Field is present in the event and is cleared
+	bool isNull(const std::string& name) const;
+
+	// Returns NULL if numeric field is absent
+	const double* findNumeric(const std::string& name) const;
+	// Returns NULL if string field is absent or cleared
+	const std::string* findString(const std::string& name) const;
+
+	// Returns defaultValue if numeric field is absent
+	double getNumeric(const std::string& name, double defaultValue) const;
+	// Returns empty string if string field is absent or cleared
+	const std::string& getString(const std::string& name) const;
+
+	// Underlying message, NULL for view without fields
+	const Fields* getFields() const;
+
+private:
+	const Fields* fields_;
+};
@@ -0,0 +1,164 @@
+#include <cstdio>
+
+#include "LatencyHistogram.h"
+
+namespace
+{
+	// Index of the most significant bit set, value must be positive
+	int getHighestBit(int64_t value)
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		return 63 - __builtin_clzll((unsigned long long)value);
+#else
+		int result = 0;
+		while (value >>= 1)
+		{
+			result++;
+		}
+		return result;
+#endif
+	}
+
+	double toMicroseconds(int64_t nanoseconds)
+	{
+		return nanoseconds/1000.0;
+	}
+};
+
+std::string LatencyStats::format() const
+{
+	char buffer[256];
+	snprintf(buffer, sizeof(buffer), "count=%lld min=%.1fus mean=%.1fus p50=%.1fus p90=%.1fus p99=%.1fus p99.9=%.1fus max=%.1fus",
+		count, toMicroseconds(min), mean/1000.0, toMicroseconds(p50), toMicroseconds(p90), toMicroseconds(p99), toMicroseconds(p999), toMicroseconds(max));
+	return buffer;
+}
+
+LatencyHistogram::LatencyHistogram()
+{
+	for (int i = 0; i < BucketCount; i++)
+	{
+		buckets_[i].store(0, std::memory_order_relaxed);
+	}
+	count_.store(0);
+	sum_.store(0);
+	min_.store(INT64_MAX);
+	max_.store(INT64_MIN);
+}
+
+void LatencyHistogram::record(int64_t nanoseconds)
+{
+	buckets_[getBucketIndex(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+	sum_.fetch_add(nanoseconds, std::memory_order_relaxed);
+	int64_t current = min_.load(std::memory_order_relaxed);
+	while (nanoseconds < current && !min_.compare_exchange_weak(current, nanoseconds, std::memory_order_relaxed))
+	{
+	}
+	current = max_.load(std::memory_order_relaxed);
+	while (nanoseconds > current && !max_.compare_exchange_weak(current, nanoseconds, std::memory_order_relaxed))
+	{
+	}
+	// Count goes last, so readers that see it don't miss the value in buckets
+	count_.fetch_add(1, std::memory_order_release);
+}
+
+void LatencyHistogram::add(const LatencyHistogram& other)
+{
+	long long count = other.getCount();
+	if (count == 0)
+	{
+		return;
+	}
+	for (int i = 0; i < BucketCount; i++)
+	{
+		buckets_[i].fetch_add(other.buckets_[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+	}
+	sum_.fetch_add(other.sum_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	int64_t otherMin = other.min_.load(std::memory_order_relaxed);
+	int64_t current = min_.load(std::memory_order_relaxed);
+	while (otherMin < current && !min_.compare_exchange_weak(current, otherMin, std::memory_order_relaxed))
+	{
+	}
+	int64_t otherMax = other.max_.load(std::memory_order_relaxed);
+	current = max_.load(std::memory_order_relaxed);
+	while (otherMax > current && !max_.compare_exchange_weak(current, otherMax, std::memory_order_relaxed))
+	{
+	}
+	count_.fetch_add(count, std::memory_order_release);
+}
+
+long long LatencyHistogram::getCount() const
+{
+	return count_.load(std::memory_order_acquire);
+}
+
+int64_t LatencyHistogram::getPercentile(double percentile) const
+{
+	long long count = getCount();
+	if (count == 0)
+	{
+		return 0;
+	}
+	long long rank = (long long)(percentile/100.0*count + 0.5);
+	rank = rank < 1 ? 1 : (rank > count ? count : rank);
+	long long seen = 0;
+	for (int i = 0; i < BucketCount; i++)
+	{
+		seen += buckets_[i].load(std::memory_order_relaxed);
+		if (seen >= rank)
+		{
+			// Don't report more than the largest value actually recorded
+			int64_t max = max_.load(std::memory_order_relaxed);
+			int64_t upperBound = getBucketUpperBound(i);
+			return upperBound < max ? upperBound : max;
+		}
+	}
+	return max_.load(std::memory_order_relaxed);
+}
+
+LatencyStats LatencyHistogram::getStats() const
+{
+	LatencyStats stats = LatencyStats();
+	stats.count = getCount();
+	if (stats.count == 0)
+	{
+		return stats;
+	}
+	stats.min = min_.load(std::memory_order_relaxed);
+	stats.max = max_.load(std::memory_order_relaxed);
+	stats.mean = (double)sum_.load(std::memory_order_relaxed)/stats.count;
+	stats.p50 = getPercentile(50);
+	stats.p90 = getPercentile(90);
+	stats.p99 = getPercentile(99);
+	stats.p999 = getPercentile(99.9);
+	return stats;
+}
+
+int LatencyHistogram::getBucketIndex(int64_t nanoseconds)
+{
+	if (nanoseconds <= 0)
+	{
+		return 0;
+	}
+	if (nanoseconds >= ((int64_t)1 << MaxValueBits))
+	{
+		return BucketCount - 1;
+	}
+	// Values below 2*SubBucketCount have a bucket each, above that each power of two is split into SubBucketCount buckets
+	int shift = getHighestBit(nanoseconds) - SubBucketBits;
+	if (shift < 0)
+	{
+		shift = 0;
+	}
+	return (shift << SubBucketBits) + (int)(nanoseconds >> shift);
+}
+
+int64_t LatencyHistogram::getBucketUpperBound(int index)
+{
+	if (index < 2*SubBucketCount)
+	{
+		return index;
+	}
+	int shift = (index >> SubBucketBits) - 1;
+	int64_t subBucket = index - (shift << SubBucketBits);
+	return ((subBucket + 1) << shift) - 1;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Summary of LatencyHistogram, all times in nanoseconds
+struct LatencyStats
+{
+	long long count;
+	int64_t min;
+	int64_t max;
+	double mean;
+	int64_t p50;
+	int64_t p90;
+	int64_t p99;
+	int64_t p999;
+
+	// "count=... min=...us mean=...us p50=...us ... max=...us"
+	std::string format() const;
+};
+
+/**
+HDR-style latency histogram: log-linear buckets (32 per power of two) keep every recorded value within ~3% relative error
+from 1ns up to ~1 hour, with a fixed amount of memory and no allocation on record().
+Recording is a couple of relaxed atomic increments, so it's cheap enough for every event; statistics may be read concurrently
+with recording, they are consistent once recording has stopped.
+
+Negative values (e.g. server's clock ahead of ours) are counted in the lowest bucket, but min reports them as is.
+
+Usage:
+	LatencyHistogram histogram;
+	histogram.record(Clock::getMonotonicTime() - start);
+...
+	TMS_LOG_INFO(histogram.getStats().format());
+*/
+class LatencyHistogram
+{
+public:
+	LatencyHistogram();
+
+	LatencyHistogram(const LatencyHistogram&) = delete;
+	void operator=(const LatencyHistogram&) = delete;
+
+	void record(int64_t nanoseconds);
+	// Adds all values recorded by other histogram, e.g. to get percentiles across listeners
+	void add(const LatencyHistogram& other);
+
+	long long getCount() const;
+	// Upper bound of the bucket that holds given percentile (0..100) of recorded values
+	int64_t getPercentile(double percentile) const;
+	LatencyStats getStats() const;
+
+private:
+	static const int SubBucketBits = 5;
+	static const int SubBucketCount = 1 << SubBucketBits;
+	// Values up to 2^42ns (~73 minutes) get their own buckets, larger ones are counted in the last bucket
+	static const int MaxValueBits = 42;
+	static const int BucketCount = (MaxValueBits - SubBucketBits + 1)*SubBucketCount;
+
+	static int getBucketIndex(int64_t nanoseconds);
+	static int64_t getBucketUpperBound(int index);
+
+private:
+	std::atomic<long long> buckets_[BucketCount];
+	std::atomic<long long> count_;
+	std::atomic<long long> sum_;
+	std::atomic<int64_t> min_;
+	std::atomic<int64_t> max_;
+};
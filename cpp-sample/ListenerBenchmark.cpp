@@ -0,0 +1,480 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+#include <tmsapigrpc/TMSRemote.grpc.pb.h>
+
+#include "AllocationCounter.h"
+#include "AsyncListener.hpp"
+#include "AsyncListenersManager.h"
+#include "AsyncListenersManager.hpp"
+#include "ChannelPool.h"
+#include "Clock.h"
+#include "EventView.hpp"
+#include "LatencyHistogram.h"
+#include "Logger.h"
+#include "StandInServer.h"
+
+/*
+Streaming throughput benchmark of the listener stack: AsyncListenersManager with one of its listener designs,
+subscribed for orders of a stand-in server (see StandInServer.h) over loopback.
+
+Every combination of stream count, fields per record and consumer cost is one measurement:
+listeners are started, wait for their initial state, warm up, events are counted for the measured period, then listeners are removed.
+Each measurement is written out as soon as it's done, as a CSV row or a JSON object per line; output file is appended to,
+so results of different releases, listener modes and machines can be collected into one file.
+
+Reported per measurement:
+	events_per_second       Events received by all streams during the measured period
+	latency_*_us            Delivery latency percentiles: from server's Write() to the consumer (StandInSendTime field), same host only
+	cpu_ns_per_event        Process CPU time per event
+	allocations_per_event   Heap allocations per event, only when built with TMS_COUNT_ALLOCATIONS (cmake -DTMS_COUNT_ALLOCATIONS=ON)
+	fields                  Fields in the last update received
+With the in-process server (default) CPU time and allocations include the server's; to measure the client alone run
+"tms_standin_server --stamp-send-time --numeric-fields N" and pass its address with --server (fields are then set by the server).
+
+Listener mode is chosen once per process (AsyncListenersManager is set up once), run the benchmark once per mode to compare them.
+
+Usage:
+	tms_listener_benchmark [options]
+		--mode thread|pool|callback  AsyncListener, PooledAsyncListener or CallbackAsyncListener, default thread
+		--pollers N                  Poller threads in pool mode, default 0 (one per CPU core)
+		--channels N                 Connections to the server, streams go to the least loaded one (see ChannelPool), default 1
+		--streams N,N,...            Stream counts, default 1,10,100,1000
+		--fields N,N,...             Extra numeric fields per record of in-process server, default 0,20,100
+		--consumer-cost NS,NS,...    CPU time each consumer call burns, default 0,1000,10000
+		--records N                  Records per stream, default 100
+		--rate N                     Updates per second per stream of in-process server, 0 means as fast as listeners read them, default 0
+		--warmup MS                  Time between initial state and measurement, default 1000
+		--duration MS                Measured time, default 3000
+		--server host:port           External stand-in server (insecure) instead of the in-process one
+		--format csv|json            Output format, default csv
+		--output file                Append results to file instead of writing them to standard output
+		--log file                   Log file, default tms_listener_benchmark.log
+
+Examples:
+	tms_listener_benchmark --mode pool --output results.csv
+	tms_listener_benchmark --streams 100 --fields 10 --consumer-cost 0 --rate 1000 --format json
+*/
+
+namespace
+{
+	const std::string Caller = "[Benchmark] ";
+
+	struct BenchmarkOptions
+	{
+		BenchmarkOptions() :
+			mode("thread"),
+			pollerThreads(0),
+			channelCount(1),
+			streamCounts({ 1, 10, 100, 1000 }),
+			fieldCounts({ 0, 20, 100 }),
+			consumerCosts({ 0, 1000, 10000 }),
+			recordCount(100),
+			updatesPerSecond(0),
+			warmupMs(1000),
+			durationMs(3000),
+			isJson(false),
+			logFile("tms_listener_benchmark.log")
+		{
+		}
+
+		std::string mode;
+		int pollerThreads;
+		int channelCount;
+		std::vector<int> streamCounts;
+		std::vector<int> fieldCounts;
+		std::vector<int> consumerCosts;
+		int recordCount;
+		int updatesPerSecond;
+		int warmupMs;
+		int durationMs;
+		std::string serverAddress;
+		bool isJson;
+		std::string outputFile;
+		std::string logFile;
+	};
+
+	// Updated by one listener's consumer, read by benchmark thread
+	struct StreamStats
+	{
+		StreamStats()
+		{
+			eventCount.store(0);
+			fieldCount.store(0);
+			isReady.store(false);
+		}
+
+		std::atomic<long long> eventCount;
+		std::atomic<int> fieldCount;
+		std::atomic<bool> isReady;
+		LatencyHistogram latency;
+	};
+
+	struct BenchmarkResult
+	{
+		int streamCount;
+		int fieldCount;
+		int consumerCostNs;
+		int readyStreamCount;
+		long long eventCount;
+		double seconds;
+		LatencyStats latency;
+		double cpuNsPerEvent;
+		// Negative if allocations are not counted
+		double allocationsPerEvent;
+	};
+
+	std::vector<int> parseList(const std::string& value)
+	{
+		std::vector<int> result;
+		std::istringstream stream(value);
+		std::string item;
+		while (std::getline(stream, item, ','))
+		{
+			result.push_back(std::stoi(item));
+		}
+		if (result.empty())
+		{
+			throw std::invalid_argument("empty list");
+		}
+		return result;
+	}
+
+	// Simulated consumer work, busy so that it costs CPU time
+	void burnCpu(int nanoseconds)
+	{
+		if (nanoseconds <= 0)
+		{
+			return;
+		}
+		int64_t deadline = Clock::getMonotonicTime() + nanoseconds;
+		while (Clock::getMonotonicTime() < deadline)
+		{
+		}
+	}
+
+	double getCpuTimeNs()
+	{
+		// Process CPU time of all threads on POSIX systems
+		return (double)std::clock()*1e9/CLOCKS_PER_SEC;
+	}
+
+	std::function< bool(const OrderEvent&, const std::string&)> makeConsumer(StreamStats* stats, const std::atomic<bool>& isMeasuring, int consumerCostNs)
+	{
+		return [stats, &isMeasuring, consumerCostNs](const OrderEvent& event, const std::string& caller) {
+			int64_t receivedTime = Clock::getMonotonicTime();
+			if (event.event_case() == OrderEvent::EventCase::kFeedStatus)
+			{
+				if (event.feedstatus() == FeedStatus::InitialStateReceived)
+				{
+					stats->isReady.store(true);
+				}
+				return true;
+			}
+			if (isMeasuring.load(std::memory_order_relaxed))
+			{
+				const Fields* fields = EventViewTraits<OrderEvent>::findFields(event);
+				if (fields)
+				{
+					stats->fieldCount.store(fields->numericfields_size() + fields->stringfields_size(), std::memory_order_relaxed);
+					auto iter = fields->numericfields().find(StandInServer::SendTimeField);
+					if (iter != fields->numericfields().end())
+					{
+						stats->latency.record(receivedTime - (int64_t)iter->second);
+					}
+				}
+				stats->eventCount.fetch_add(1, std::memory_order_relaxed);
+			}
+			burnCpu(consumerCostNs);
+			return true;
+		};
+	}
+
+	BenchmarkResult runBenchmark(const BenchmarkOptions& options, ChannelPool& channelPool, int streamCount, int consumerCostNs)
+	{
+		AsyncListenersManager& manager = AsyncListenersManager::getInstance();
+		for (int i = 0; i < channelPool.size(); i++)
+		{
+			if (!channelPool.getChannel(i)->WaitForConnected(std::chrono::system_clock::now() + std::chrono::seconds(10)))
+			{
+				throw std::runtime_error("unable to connect to stand-in server");
+			}
+		}
+
+		std::atomic<bool> isMeasuring(false);
+		std::vector<std::unique_ptr<StreamStats>> streamStats;
+		std::vector<int> listenerIds;
+		for (int i = 0; i < streamCount; i++)
+		{
+			streamStats.emplace_back(new StreamStats());
+			std::function< bool(const OrderEvent&, const std::string&)> consumer = makeConsumer(streamStats.back().get(), isMeasuring, consumerCostNs);
+			std::string name = "[Stream " + std::to_string(i + 1) + "] ";
+			if (options.mode == "callback")
+			{
+				listenerIds.push_back(manager.startListening(&TMSRemote::Stub::async::subscribeForOrders, SubscribeForOrdersRequest(), consumer, name));
+			}
+			else
+			{
+				listenerIds.push_back(manager.startListening(&TMSRemote::Stub::PrepareAsyncsubscribeForOrders, SubscribeForOrdersRequest(), consumer, name));
+			}
+		}
+
+		// All streams should be in their real-time phase before we start counting
+		auto countReady = [&streamStats] {
+			return (int)std::count_if(streamStats.begin(), streamStats.end(), [](const std::unique_ptr<StreamStats>& stats) { return stats->isReady.load(); });
+		};
+		int64_t readyDeadline = Clock::getMonotonicTime() + (10000 + 10*(int64_t)streamCount)*1000000;
+		while (countReady() < streamCount && Clock::getMonotonicTime() < readyDeadline)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		BenchmarkResult result = BenchmarkResult();
+		result.streamCount = streamCount;
+		result.consumerCostNs = consumerCostNs;
+		result.readyStreamCount = countReady();
+		if (result.readyStreamCount < streamCount)
+		{
+			TMS_LOG_WARNING(Caller, "Only ", result.readyStreamCount, " of ", streamCount, " streams have received initial state");
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(options.warmupMs));
+
+		double cpuBefore = getCpuTimeNs();
+		long long allocationsBefore = AllocationCounter::getCount();
+		int64_t start = Clock::getMonotonicTime();
+		isMeasuring.store(true);
+		std::this_thread::sleep_for(std::chrono::milliseconds(options.durationMs));
+		isMeasuring.store(false);
+		int64_t end = Clock::getMonotonicTime();
+		double cpuTime = getCpuTimeNs() - cpuBefore;
+		long long allocationCount = AllocationCounter::getCount() - allocationsBefore;
+		channelPool.dumpLoad(Caller);
+
+		// Listeners go away before their stats do
+		manager.stopAllListeners(Caller);
+		for (int listenerId : listenerIds)
+		{
+			manager.removeListener(listenerId, Caller);
+		}
+
+		LatencyHistogram latency;
+		for (const std::unique_ptr<StreamStats>& stats : streamStats)
+		{
+			result.eventCount += stats->eventCount.load();
+			result.fieldCount = std::max(result.fieldCount, stats->fieldCount.load());
+			latency.add(stats->latency);
+		}
+		result.seconds = (end - start)/1e9;
+		result.latency = latency.getStats();
+		result.cpuNsPerEvent = result.eventCount > 0 ? cpuTime/result.eventCount : 0;
+		result.allocationsPerEvent = !AllocationCounter::isEnabled() ? -1 : (result.eventCount > 0 ? (double)allocationCount/result.eventCount : 0);
+		return result;
+	}
+
+	void writeHeader(std::ostream& out, const BenchmarkOptions& options)
+	{
+		if (!options.isJson)
+		{
+			out << "mode,server,channels,streams,fields,consumer_cost_ns,rate,ready_streams,events,seconds,events_per_second,"
+				<< "latency_p50_us,latency_p99_us,latency_p999_us,latency_max_us,cpu_ns_per_event,allocations_per_event" << std::endl;
+		}
+	}
+
+	void writeResult(std::ostream& out, const BenchmarkOptions& options, const BenchmarkResult& result)
+	{
+		const std::string server = options.serverAddress.empty() ? "in-process" : options.serverAddress;
+		const bool hasLatency = result.latency.count > 0;
+		const bool hasAllocations = result.allocationsPerEvent >= 0;
+		char buffer[512];
+		if (options.isJson)
+		{
+			// Missing measurements are null
+			char latency[160] = "\"latency_p50_us\":null,\"latency_p99_us\":null,\"latency_p999_us\":null,\"latency_max_us\":null";
+			if (hasLatency)
+			{
+				snprintf(latency, sizeof(latency), "\"latency_p50_us\":%.1f,\"latency_p99_us\":%.1f,\"latency_p999_us\":%.1f,\"latency_max_us\":%.1f",
+					result.latency.p50/1000.0, result.latency.p99/1000.0, result.latency.p999/1000.0, result.latency.max/1000.0);
+			}
+			char allocations[32] = "null";
+			if (hasAllocations)
+			{
+				snprintf(allocations, sizeof(allocations), "%.2f", result.allocationsPerEvent);
+			}
+			snprintf(buffer, sizeof(buffer), "{\"mode\":\"%s\",\"server\":\"%s\",\"channels\":%d,\"streams\":%d,\"fields\":%d,\"consumer_cost_ns\":%d,\"rate\":%d,\"ready_streams\":%d,"
+				"\"events\":%lld,\"seconds\":%.3f,\"events_per_second\":%.0f,%s,\"cpu_ns_per_event\":%.0f,\"allocations_per_event\":%s}",
+				options.mode.c_str(), server.c_str(), options.channelCount, result.streamCount, result.fieldCount, result.consumerCostNs, options.updatesPerSecond, result.readyStreamCount,
+				result.eventCount, result.seconds, result.eventCount/result.seconds, latency, result.cpuNsPerEvent, allocations);
+		}
+		else
+		{
+			// Missing measurements are empty
+			char latency[96] = ",,,";
+			if (hasLatency)
+			{
+				snprintf(latency, sizeof(latency), "%.1f,%.1f,%.1f,%.1f", result.latency.p50/1000.0, result.latency.p99/1000.0, result.latency.p999/1000.0, result.latency.max/1000.0);
+			}
+			char allocations[32] = "";
+			if (hasAllocations)
+			{
+				snprintf(allocations, sizeof(allocations), "%.2f", result.allocationsPerEvent);
+			}
+			snprintf(buffer, sizeof(buffer), "%s,%s,%d,%d,%d,%d,%d,%d,%lld,%.3f,%.0f,%s,%.0f,%s",
+				options.mode.c_str(), server.c_str(), options.channelCount, result.streamCount, result.fieldCount, result.consumerCostNs, options.updatesPerSecond, result.readyStreamCount,
+				result.eventCount, result.seconds, result.eventCount/result.seconds, latency, result.cpuNsPerEvent, allocations);
+		}
+		out << buffer << std::endl;
+	}
+
+	bool parseOptions(int argc, char** argv, BenchmarkOptions* options)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			std::string name = argv[i];
+			if (i + 1 >= argc)
+			{
+				return false;
+			}
+			std::string value = argv[++i];
+			try
+			{
+				if (name == "--mode" && (value == "thread" || value == "pool" || value == "callback")) options->mode = value;
+				else if (name == "--pollers") options->pollerThreads = std::stoi(value);
+				else if (name == "--channels" && std::stoi(value) > 0) options->channelCount = std::stoi(value);
+				else if (name == "--streams") options->streamCounts = parseList(value);
+				else if (name == "--fields") options->fieldCounts = parseList(value);
+				else if (name == "--consumer-cost") options->consumerCosts = parseList(value);
+				else if (name == "--records") options->recordCount = std::stoi(value);
+				else if (name == "--rate") options->updatesPerSecond = std::stoi(value);
+				else if (name == "--warmup") options->warmupMs = std::stoi(value);
+				else if (name == "--duration") options->durationMs = std::stoi(value);
+				else if (name == "--server") options->serverAddress = value;
+				else if (name == "--format" && (value == "csv" || value == "json")) options->isJson = value == "json";
+				else if (name == "--output") options->outputFile = value;
+				else if (name == "--log") options->logFile = value;
+				else return false;
+			}
+			catch (const std::exception&)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void printUsage()
+	{
+		std::cerr << "Usage: tms_listener_benchmark [--mode thread|pool|callback] [--pollers N] [--channels N] [--streams N,...] [--fields N,...] [--consumer-cost NS,...]"
+			<< " [--records N] [--rate N] [--warmup MS] [--duration MS] [--server host:port] [--format csv|json] [--output file] [--log file]" << std::endl;
+	}
+};
+
+int main(int argc, char** argv)
+{
+	BenchmarkOptions options;
+	if (!parseOptions(argc, argv, &options))
+	{
+		printUsage();
+		return 1;
+	}
+	// Standard output is for results only
+	Logger::getInstance().setOutputFile(options.logFile);
+
+	std::ofstream outputFile;
+	if (!options.outputFile.empty())
+	{
+		// Header goes only to a new file, so runs can be appended to each other
+		bool isNewFile = std::ifstream(options.outputFile).peek() == std::ifstream::traits_type::eof();
+		outputFile.open(options.outputFile, std::ios::app);
+		if (!outputFile)
+		{
+			std::cerr << "Unable to open " << options.outputFile << std::endl;
+			return 1;
+		}
+		if (isNewFile)
+		{
+			writeHeader(outputFile, options);
+		}
+	}
+	else
+	{
+		writeHeader(std::cout, options);
+	}
+	std::ostream& out = outputFile.is_open() ? outputFile : std::cout;
+
+	try
+	{
+		// In-process server is restarted for each field count on the same port, the channel reconnects to it
+		std::unique_ptr<StandInServer> server;
+		int serverPort = 0;
+		auto startServer = [&options, &server, &serverPort](int fieldCount) {
+			if (server)
+			{
+				server->shutdown();
+			}
+			StandInServerOptions serverOptions;
+			serverOptions.recordCount = options.recordCount;
+			serverOptions.updatesPerSecond = options.updatesPerSecond;
+			serverOptions.extraNumericFields = fieldCount;
+			serverOptions.stampSendTime = true;
+			server.reset(new StandInServer(serverOptions));
+			serverPort = server->start("127.0.0.1:" + std::to_string(serverPort));
+		};
+		std::vector<int> fieldCounts = options.fieldCounts;
+		if (options.serverAddress.empty())
+		{
+			startServer(fieldCounts.front());
+		}
+		else
+		{
+			// External server decides which fields it sends
+			fieldCounts.resize(1);
+		}
+
+		std::string address = options.serverAddress.empty() ? "127.0.0.1:" + std::to_string(serverPort) : options.serverAddress;
+		// Static, so that the pool is destroyed after AsyncListenersManager singleton, which keeps using it
+		static std::unique_ptr<ChannelPool> channelPool;
+		channelPool.reset(new ChannelPool(address, grpc::InsecureChannelCredentials(), options.channelCount, std::unique_ptr<ChannelPolicy>(new LeastLoadedChannelPolicy())));
+		AsyncListenersManager::setup(*channelPool, options.mode == "pool" ? ListenerMode::SharedCompletionQueues : ListenerMode::ThreadPerListener, options.pollerThreads);
+
+		for (size_t i = 0; i < fieldCounts.size(); i++)
+		{
+			if (options.serverAddress.empty() && i > 0)
+			{
+				startServer(fieldCounts[i]);
+			}
+			for (int streamCount : options.streamCounts)
+			{
+				for (int consumerCost : options.consumerCosts)
+				{
+					TMS_LOG_INFO(Caller, "Measuring ", streamCount, " streams, ", fieldCounts[i], " extra fields, ", consumerCost, "ns consumer cost");
+					writeResult(out, options, runBenchmark(options, *channelPool, streamCount, consumerCost));
+				}
+			}
+		}
+		if (server)
+		{
+			server->shutdown();
+		}
+	}
+	catch (const std::exception& e)
+	{
+		TMS_LOG_ERROR(Caller, e.what());
+		std::cerr << e.what() << std::endl;
+		Logger::getInstance().flush();
+		return 1;
+	}
+	Logger::getInstance().flush();
+	return 0;
+}
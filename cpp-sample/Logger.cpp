@@ -0,0 +1,386 @@
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+#include "Clock.h"
+#include "Logger.h"
+
+void LogRecordWriter::putString(const char* value, size_t length)
+{
+	static const size_t headerSize = 1 + sizeof(uint16_t);
+	size_t available = LogRecord::Capacity - record_.size;
+	if (available <= headerSize)
+	{
+		record_.isTruncated = true;
+		return;
+	}
+	if (length > available - headerSize)
+	{
+		length = available - headerSize;
+		record_.isTruncated = true;
+	}
+	uint8_t tag = Tag_String;
+	uint16_t encodedLength = (uint16_t)length;
+	putBytes(&tag, sizeof(tag));
+	putBytes(&encodedLength, sizeof(encodedLength));
+	putBytes(value, length);
+}
+
+void LogRecordWriter::putTagged(Tag tag, const void* bytes, size_t size)
+{
+	if (LogRecord::Capacity - record_.size < 1 + size)
+	{
+		record_.isTruncated = true;
+		return;
+	}
+	uint8_t encodedTag = tag;
+	putBytes(&encodedTag, sizeof(encodedTag));
+	putBytes(bytes, size);
+}
+
+bool LogRecordWriter::putBytes(const void* bytes, size_t size)
+{
+	if (LogRecord::Capacity - record_.size < size)
+	{
+		record_.isTruncated = true;
+		return false;
+	}
+	memcpy(record_.data + record_.size, bytes, size);
+	record_.size += (uint16_t)size;
+	return true;
+}
+
+// Owned by each logging thread, lets writer know when the thread is gone so its buffer can be released
+struct ThreadBufferOwner
+{
+	~ThreadBufferOwner()
+	{
+		if (buffer)
+		{
+			buffer->isThreadAlive.store(false);
+		}
+	}
+
+	std::shared_ptr<Logger::ThreadBuffer> buffer;
+};
+
+namespace
+{
+	thread_local ThreadBufferOwner threadBufferOwner;
+};
+
+// Turns encoded message into text. Not thread-safe: writer thread has its own, synchronous writes make a new one.
+class LogFormatter
+{
+public:
+	void format(const LogRecord& record, std::string* out);
+
+private:
+	std::ostringstream stream_;
+};
+
+void LogFormatter::format(const LogRecord& record, std::string* out)
+{
+	stream_.str(std::string());
+	stream_.clear();
+	stream_.flags(std::ios_base::dec | std::ios_base::skipws);
+	stream_.precision(6);
+	size_t pos = 0;
+	while (pos < record.size)
+	{
+		uint8_t tag = (uint8_t)record.data[pos++];
+		switch (tag)
+		{
+		case LogRecordWriter::Tag_Int:
+			{
+				int64_t value;
+				memcpy(&value, record.data + pos, sizeof(value));
+				pos += sizeof(value);
+				stream_ << value;
+			}
+			break;
+		case LogRecordWriter::Tag_UInt:
+			{
+				uint64_t value;
+				memcpy(&value, record.data + pos, sizeof(value));
+				pos += sizeof(value);
+				stream_ << value;
+			}
+			break;
+		case LogRecordWriter::Tag_Double:
+			{
+				double value;
+				memcpy(&value, record.data + pos, sizeof(value));
+				pos += sizeof(value);
+				stream_ << value;
+			}
+			break;
+		case LogRecordWriter::Tag_Bool:
+			{
+				bool value;
+				memcpy(&value, record.data + pos, sizeof(value));
+				pos += sizeof(value);
+				stream_ << value;
+			}
+			break;
+		case LogRecordWriter::Tag_Char:
+			stream_ << record.data[pos++];
+			break;
+		case LogRecordWriter::Tag_String:
+			{
+				uint16_t length;
+				memcpy(&length, record.data + pos, sizeof(length));
+				pos += sizeof(length);
+				stream_.write(record.data + pos, length);
+				pos += length;
+			}
+			break;
+		case LogRecordWriter::Tag_Manipulator:
+			{
+				LogRecordWriter::Manipulator value;
+				memcpy(&value, record.data + pos, sizeof(value));
+				pos += sizeof(value);
+				stream_ << value;
+			}
+			break;
+		default:
+			// Can't happen: writer only puts the tags above
+			pos = record.size;
+			break;
+		}
+	}
+	if (record.isTruncated)
+	{
+		stream_ << "...";
+	}
+	stream_ << '\n';
+	char timestamp[Clock::TimestampSize];
+	out->assign(timestamp, Clock::formatTimestamp(record.time, timestamp));
+	*out += stream_.str();
+}
+
+Logger::ThreadBuffer::ThreadBuffer() :
+	records(Capacity)
+{
+	droppedCount.store(0);
+	isThreadAlive.store(true);
+}
+
+Logger &Logger::getInstance()
+{
+	// Never destroyed: threads may still log while static objects are being destroyed
+	static Logger* instance = new Logger();
+	return *instance;
+}
+
+Logger::Logger() :
+	flushRequests_(0),
+	flushedRequests_(0),
+	output_(&std::cout),
+	formatter_(new LogFormatter()),
+	reportedDroppedCount_(0)
+{
+	droppedCount_.store(0);
+	isRunning_.store(true);
+	isWriterIdle_.store(false);
+	isWakeUpRequested_.store(false);
+	writer_ = std::thread(&Logger::run, this);
+	std::atexit(&Logger::stopAtExit);
+}
+
+Logger::~Logger()
+{
+	stop();
+}
+
+void Logger::stopAtExit()
+{
+	getInstance().stop();
+}
+
+void Logger::flush()
+{
+	std::unique_lock<std::mutex> lock(writerLock_);
+	if (!isRunning_.load())
+	{
+		return;
+	}
+	long long request = ++flushRequests_;
+	writerCondition_.notify_all();
+	flushedCondition_.wait(lock, [this, request] { return flushedRequests_ >= request; });
+}
+
+bool Logger::setOutputFile(const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(writerLock_);
+	std::ofstream file(path, std::ios::out | std::ios::app);
+	if (!file.is_open())
+	{
+		return false;
+	}
+	output_->flush();
+	outputFile_ = std::move(file);
+	output_ = &outputFile_;
+	return true;
+}
+
+long long Logger::getDroppedCount() const
+{
+	return droppedCount_.load();
+}
+
+Logger::ThreadBuffer* Logger::getThreadBuffer()
+{
+	if (!isRunning_.load(std::memory_order_acquire))
+	{
+		return NULL;
+	}
+	if (!threadBufferOwner.buffer)
+	{
+		// First message from this thread
+		threadBufferOwner.buffer = std::make_shared<ThreadBuffer>();
+		std::lock_guard<std::mutex> lock(buffersLock_);
+		buffers_.push_back(threadBufferOwner.buffer);
+	}
+	return threadBufferOwner.buffer.get();
+}
+
+void Logger::wakeUpWriter()
+{
+	// Notifying under the lock: writer can't be between checking for a wake-up request and going to sleep
+	std::lock_guard<std::mutex> lock(writerLock_);
+	writerCondition_.notify_one();
+}
+
+bool Logger::hasPendingRecords()
+{
+	std::lock_guard<std::mutex> lock(buffersLock_);
+	for (const auto& buffer : buffers_)
+	{
+		if (!buffer->records.empty())
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void Logger::stop()
+{
+	if (!isRunning_.exchange(false))
+	{
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(writerLock_);
+		writerCondition_.notify_all();
+	}
+	// Writer drains all buffers before it exits
+	writer_.join();
+	std::lock_guard<std::mutex> lock(writerLock_);
+	flushedRequests_ = flushRequests_;
+	flushedCondition_.notify_all();
+}
+
+void Logger::run()
+{
+	while (true)
+	{
+		bool isRunning = isRunning_.load();
+		long long flushRequests;
+		{
+			std::lock_guard<std::mutex> lock(writerLock_);
+			flushRequests = flushRequests_;
+		}
+		bool isWritten = writeBatch();
+		bool isIdle = false;
+		if (!isWritten && isRunning)
+		{
+			// Messages logged after writeBatch() has passed their buffers either show up here, or their threads see us idle and wake us up
+			isWriterIdle_.store(true);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			isIdle = !hasPendingRecords();
+		}
+		{
+			std::unique_lock<std::mutex> lock(writerLock_);
+			flushedRequests_ = flushRequests;
+			flushedCondition_.notify_all();
+			if (!isRunning)
+			{
+				break;
+			}
+			if (isIdle)
+			{
+				writerCondition_.wait(lock, [this] { return flushRequests_ > flushedRequests_ || !isRunning_.load() || isWakeUpRequested_.exchange(false); });
+			}
+		}
+		isWriterIdle_.store(false);
+	}
+}
+
+bool Logger::writeBatch()
+{
+	std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+	{
+		std::lock_guard<std::mutex> lock(buffersLock_);
+		buffers = buffers_;
+	}
+	std::vector<std::pair<int64_t, std::string>> lines;
+	bool hasDeadBuffers = false;
+	for (const auto& buffer : buffers)
+	{
+		// Read the flag before draining: if thread is gone, all its messages are in the buffer already
+		bool isThreadAlive = buffer->isThreadAlive.load();
+		while (buffer->records.tryPop([this, &lines](LogRecord& record) {
+			lines.emplace_back(record.time, std::string());
+			formatter_->format(record, &lines.back().second);
+		}))
+		{
+		}
+		droppedCount_.fetch_add(buffer->droppedCount.exchange(0));
+		hasDeadBuffers = hasDeadBuffers || !isThreadAlive;
+	}
+	if (hasDeadBuffers)
+	{
+		std::lock_guard<std::mutex> lock(buffersLock_);
+		buffers_.erase(std::remove_if(buffers_.begin(), buffers_.end(), [](const std::shared_ptr<ThreadBuffer>& buffer) { return !buffer->isThreadAlive.load() && buffer->records.empty(); }), buffers_.end());
+	}
+	long long droppedCount = droppedCount_.load();
+	if (droppedCount > reportedDroppedCount_)
+	{
+		LogRecord record;
+		record.time = lines.empty() ? Clock::getWallTime() : lines.back().first;
+		record.level = LogLevel_Warning;
+		LogRecordWriter writer(record);
+		writer.putAll("[Logger] ", droppedCount - reportedDroppedCount_, " messages were dropped: logging threads were producing them faster than they could be written");
+		lines.emplace_back(record.time, std::string());
+		formatter_->format(record, &lines.back().second);
+		reportedDroppedCount_ = droppedCount;
+	}
+	if (lines.empty())
+	{
+		return false;
+	}
+	// Each thread's messages are in order already, merge them by time
+	std::stable_sort(lines.begin(), lines.end(), [](const std::pair<int64_t, std::string>& left, const std::pair<int64_t, std::string>& right) { return left.first < right.first; });
+	std::string out;
+	for (const auto& line : lines)
+	{
+		out += line.second;
+	}
+	std::lock_guard<std::mutex> lock(writerLock_);
+	output_->write(out.data(), out.size());
+	output_->flush();
+	return true;
+}
+
+void Logger::writeSync(const LogRecord& record)
+{
+	// Writer thread may still be finishing its last batch with its own formatter
+	LogFormatter formatter;
+	std::string line;
+	formatter.format(record, &line);
+	std::lock_guard<std::mutex> lock(writerLock_);
+	output_->write(line.data(), line.size());
+	output_->flush();
+}
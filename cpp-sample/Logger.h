@@ -0,0 +1,266 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "Clock.h"
+#include "EventRingBuffer.hpp"
+
+/**
+Asynchronous logger for hot paths (listener threads, event consumers).
+Logging thread only copies the timestamp and raw arguments into its own lock-free buffer: no formatting, no I/O, and no lock
+except when the message is the first one since the writer went idle and has to wake it up.
+Background writer thread formats messages and writes them out in batches, with one flush per batch, and sleeps while there's nothing to write.
+If thread's buffer is full, message is dropped and counted rather than blocking the thread; writer reports the number of dropped messages.
+
+Log levels are compile-time: statements below TMS_LOG_LEVEL (cmake -DTMS_LOG_LEVEL=INFO) compile to nothing,
+including evaluation of their arguments and of the runtime debug flag.
+
+Arguments are captured by value: numbers, bools, chars, enums and strings are copied into the message as is,
+stream manipulators (std::boolalpha, std::dec, ...) are applied when message is formatted, anything else is formatted to a string right away.
+Message is truncated if its arguments don't fit into LogRecord::Capacity bytes.
+
+Usage:
+	TMS_LOG_INFO(logPrefix_, "Subscription is accepted");
+	TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "After Next(), responseTag==", std::dec, (long long)responseTag);
+...
+	Logger::getInstance().setOutputFile("client.log"); // Optional, std::cout by default
+	Logger::getInstance().flush(); // Waits until everything logged so far is written
+*/
+
+enum LogLevel
+{
+	LogLevel_Debug = 0,
+	LogLevel_Info = 1,
+	LogLevel_Warning = 2,
+	LogLevel_Error = 3
+};
+
+// Lowest level that is compiled in
+#ifndef TMS_LOG_LEVEL
+#define TMS_LOG_LEVEL LogLevel_Debug
+#endif
+
+#define TMS_LOG(level, ...) do { if ((level) >= TMS_LOG_LEVEL) Logger::getInstance().log((level), __VA_ARGS__); } while (0)
+#define TMS_LOG_DEBUG_IF(condition, ...) do { if (LogLevel_Debug >= TMS_LOG_LEVEL && (condition)) Logger::getInstance().log(LogLevel_Debug, __VA_ARGS__); } while (0)
+#define TMS_LOG_INFO(...) TMS_LOG(LogLevel_Info, __VA_ARGS__)
+#define TMS_LOG_WARNING(...) TMS_LOG(LogLevel_Warning, __VA_ARGS__)
+#define TMS_LOG_ERROR(...) TMS_LOG(LogLevel_Error, __VA_ARGS__)
+
+// One message with its arguments in encoded form
+struct LogRecord
+{
+	static const size_t Capacity = 240;
+
+	int64_t time;
+	uint16_t size;
+	uint8_t level;
+	bool isTruncated;
+	char data[Capacity];
+};
+
+// Encodes message arguments into LogRecord
+class LogRecordWriter
+{
+public:
+	enum Tag : uint8_t
+	{
+		Tag_Int,
+		Tag_UInt,
+		Tag_Double,
+		Tag_Bool,
+		Tag_Char,
+		Tag_String,
+		Tag_Manipulator
+	};
+
+	typedef std::ios_base& (*Manipulator)(std::ios_base&);
+
+	explicit LogRecordWriter(LogRecord& record) :
+		record_(record)
+	{
+		record_.size = 0;
+		record_.isTruncated = false;
+	}
+
+	void putAll()
+	{
+	}
+
+	template <class T, class... Args> void putAll(const T& value, const Args&... args)
+	{
+		put(value);
+		putAll(args...);
+	}
+
+	void put(bool value) { putTagged(Tag_Bool, &value, sizeof(value)); }
+	void put(char value) { putTagged(Tag_Char, &value, sizeof(value)); }
+	void put(const char* value) { putString(value, value ? strlen(value) : 0); }
+	void put(const std::string& value) { putString(value.data(), value.size()); }
+	void put(Manipulator value) { putTagged(Tag_Manipulator, &value, sizeof(value)); }
+
+	template <class T> void put(const T& value)
+	{
+		putValue(value, Category<T>());
+	}
+
+private:
+	enum CategoryId { Category_Signed, Category_Unsigned, Category_Floating, Category_Enum, Category_Other };
+	template <class T> struct Category : std::integral_constant<CategoryId,
+		std::is_enum<T>::value ? Category_Enum :
+		std::is_floating_point<T>::value ? Category_Floating :
+		(std::is_integral<T>::value && std::is_signed<T>::value) ? Category_Signed :
+		std::is_integral<T>::value ? Category_Unsigned : Category_Other> {};
+
+	template <class T> void putValue(const T& value, std::integral_constant<CategoryId, Category_Signed>)
+	{
+		int64_t encoded = value;
+		putTagged(Tag_Int, &encoded, sizeof(encoded));
+	}
+
+	template <class T> void putValue(const T& value, std::integral_constant<CategoryId, Category_Unsigned>)
+	{
+		uint64_t encoded = value;
+		putTagged(Tag_UInt, &encoded, sizeof(encoded));
+	}
+
+	template <class T> void putValue(const T& value, std::integral_constant<CategoryId, Category_Floating>)
+	{
+		double encoded = value;
+		putTagged(Tag_Double, &encoded, sizeof(encoded));
+	}
+
+	template <class T> void putValue(const T& value, std::integral_constant<CategoryId, Category_Enum>)
+	{
+		// Enums are printed as numbers, same as std::ostream does for unscoped ones
+		int64_t encoded = (int64_t)value;
+		putTagged(Tag_Int, &encoded, sizeof(encoded));
+	}
+
+	template <class T> void putValue(const T& value, std::integral_constant<CategoryId, Category_Other>)
+	{
+		// Slow path: type we don't know how to copy, format it right away
+		std::ostringstream stream;
+		stream << value;
+		put(stream.str());
+	}
+
+	void putString(const char* value, size_t length);
+	void putTagged(Tag tag, const void* bytes, size_t size);
+	bool putBytes(const void* bytes, size_t size);
+
+private:
+	LogRecord& record_;
+};
+
+class LogFormatter;
+
+class Logger
+{
+public:
+	// Logger lives until process exit, it's stopped and flushed by atexit() handler
+	static Logger &getInstance();
+
+	template <class... Args> void log(LogLevel level, const Args&... args)
+	{
+		int64_t time = Clock::getWallTime();
+		auto fill = [&](LogRecord& record) {
+			record.time = time;
+			record.level = (uint8_t)level;
+			LogRecordWriter writer(record);
+			writer.putAll(args...);
+		};
+		ThreadBuffer* buffer = getThreadBuffer();
+		if (buffer == NULL)
+		{
+			// Writer thread is stopped, e.g. we're called from static destructors: write synchronously
+			LogRecord record;
+			fill(record);
+			writeSync(record);
+		}
+		else if (!buffer->records.tryPush(fill))
+		{
+			buffer->droppedCount.fetch_add(1, std::memory_order_relaxed);
+		}
+		else
+		{
+			// Fence pairs with the one in run(): either we see the writer idle, or it sees our message and doesn't sleep
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (isWriterIdle_.load(std::memory_order_relaxed) && !isWakeUpRequested_.exchange(true))
+			{
+				// Only the first message since the writer went idle takes the lock
+				wakeUpWriter();
+			}
+		}
+	}
+
+	// Waits until messages logged so far are written out
+	void flush();
+	// Writes log to file instead of std::cout
+	bool setOutputFile(const std::string& path);
+	// Number of messages dropped because logging thread's buffer was full
+	long long getDroppedCount() const;
+
+private:
+	struct ThreadBuffer
+	{
+		static const size_t Capacity = 1024;
+
+		ThreadBuffer();
+
+		EventRingBuffer<LogRecord> records;
+		std::atomic<long long> droppedCount;
+		std::atomic<bool> isThreadAlive;
+	};
+
+	Logger();
+	~Logger();
+
+	ThreadBuffer* getThreadBuffer();
+	void wakeUpWriter();
+	// True if any logging thread has messages to write
+	bool hasPendingRecords();
+	void stop();
+	void run();
+	// Returns true if anything was written
+	bool writeBatch();
+	void writeSync(const LogRecord& record);
+
+	friend struct ThreadBufferOwner;
+	static void stopAtExit();
+
+private:
+	// Buffers of all logging threads, guarded by buffersLock_
+	std::mutex buffersLock_;
+	std::vector<std::shared_ptr<ThreadBuffer>> buffers_;
+
+	// Writer thread state, guarded by writerLock_
+	std::mutex writerLock_;
+	std::condition_variable writerCondition_;
+	std::condition_variable flushedCondition_;
+	long long flushRequests_;
+	long long flushedRequests_;
+	std::thread writer_;
+	std::atomic<bool> isRunning_;
+	// Writer has found nothing to write and is about to sleep, or sleeps: logging threads wake it up
+	std::atomic<bool> isWriterIdle_;
+	std::atomic<bool> isWakeUpRequested_;
+
+	// Accessed by writer thread, or under writerLock_ after writer is stopped
+	std::ostream* output_;
+	std::ofstream outputFile_;
+	std::unique_ptr<LogFormatter> formatter_;
+	std::atomic<long long> droppedCount_;
+	long long reportedDroppedCount_;
+};
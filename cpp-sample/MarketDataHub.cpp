@@ -0,0 +1,521 @@
+#include <condition_variable>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "ArenaEvent.hpp"
+#include "AsyncListenerBase.h"
+#include "ChannelPool.h"
+#include "Logger.h"
+
+#include "MarketDataHub.h"
+
+namespace
+{
+	const std::string Caller = "[Market Data Hub] ";
+	// Dispatches in progress on this thread, of any stream of any hub: a handler can't wait for a dispatch,
+	// since the one it waits for may be waiting for this one, e.g. handlers of two streams unsubscribing each other's instruments
+	thread_local int dispatchDepth = 0;
+};
+
+MarketDataHubOptions::MarketDataHubOptions() :
+	streamCount(4),
+	stopTimeout(AsyncListenerBase::DefaultStopTimeout)
+{
+}
+
+/**
+One shared subscribeForMarketData stream of the hub with its dispatch table.
+Handlers of an instrument are an immutable vector replaced on each change, so dispatch copies a pointer under the lock
+and calls handlers outside of it: handlers may subscribe and unsubscribe. Dispatches are counted, so that removing a handler
+can wait for the one that may still be calling it: gRPC never runs two callbacks of a stream at once.
+*/
+class MarketDataHub::Stream : public grpc::ClientBidiReactor<SubscribeForMarketDataRequest, MarketDataEvent>
+{
+public:
+	Stream(int index, TMSRemote::Stub* stub, ChannelPool* channelPool, const MarketDataHubOptions& options) :
+		logPrefix_("[Market Data Hub Stream " + std::to_string(index) + "] "),
+		stub_(stub),
+		channelPool_(channelPool),
+		channel_(-1),
+		options_(options),
+		subscriptions_(0),
+		requests_(0),
+		events_(0),
+		unroutedEvents_(0),
+		startedDispatches_(0),
+		finishedDispatches_(0),
+		isStarted_(false),
+		isRequestDirty_(false),
+		isWritePending_(false),
+		isStopRequested_(false),
+		isWritesDoneSent_(false),
+		isFinished_(false),
+		isDead_(false)
+	{
+	}
+
+	~Stream()
+	{
+		signalStop();
+		waitForStop("[~Stream()] ");
+		if (channel_ >= 0)
+		{
+			channelPool_->releaseStream(channel_);
+		}
+	}
+
+	// False if the stream is dead: its call is over and handler would never get any data
+	bool addHandler(const std::string& instrument, int subscriptionId, const MarketDataHandler& handler)
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		if (isFinished_)
+		{
+			return false;
+		}
+		std::shared_ptr<const Handlers>& handlers = routes_[instrument];
+		std::shared_ptr<Handlers> newHandlers = handlers ? std::make_shared<Handlers>(*handlers) : std::make_shared<Handlers>();
+		newHandlers->emplace_back(subscriptionId, handler);
+		if (!handlers)
+		{
+			isRequestDirty_ = true;
+		}
+		handlers = newHandlers;
+		subscriptions_++;
+		if (!isStarted_ && !isStopRequested_)
+		{
+			start();
+		}
+		else
+		{
+			writeRequestIfIdle();
+		}
+		return true;
+	}
+
+	// Once it returns, handler is not called anymore: a dispatch that may still be calling it is waited for,
+	// unless handler removes itself, or another handler of this stream, from that very dispatch
+	bool removeHandler(const std::string& instrument, int subscriptionId)
+	{
+		std::unique_lock<std::mutex> lock(lock_);
+		auto route = routes_.find(instrument);
+		if (route == routes_.end())
+		{
+			return false;
+		}
+		std::shared_ptr<Handlers> newHandlers = std::make_shared<Handlers>();
+		for (const std::pair<int, MarketDataHandler>& handler : *route->second)
+		{
+			if (handler.first != subscriptionId)
+			{
+				newHandlers->push_back(handler);
+			}
+		}
+		if (newHandlers->size() == route->second->size())
+		{
+			return false;
+		}
+		subscriptions_--;
+		if (newHandlers->empty())
+		{
+			routes_.erase(route);
+			isRequestDirty_ = true;
+			writeRequestIfIdle();
+		}
+		else
+		{
+			route->second = newHandlers;
+		}
+		if (dispatchDepth == 0)
+		{
+			// Dispatches started from now on don't see the handler
+			long long lastDispatch = startedDispatches_;
+			dispatchCondition_.wait(lock, [this, lastDispatch] { return finishedDispatches_ >= lastDispatch; });
+		}
+		return true;
+	}
+
+	void signalStop()
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		if (!isStopRequested_)
+		{
+			isStopRequested_ = true;
+			stopDeadline_ = std::chrono::system_clock::now() + options_.stopTimeout;
+		}
+		sendWritesDoneIfIdle();
+	}
+
+	void waitForStop(const std::string& caller)
+	{
+		std::unique_lock<std::mutex> lock(lock_);
+		if (!isStarted_ || isFinished_)
+		{
+			return;
+		}
+		if (isStopRequested_ && !finishedCondition_.wait_until(lock, stopDeadline_, [this] { return isFinished_; }))
+		{
+			TMS_LOG_INFO(caller, logPrefix_, "Server has not closed the stream in time, cancelling the call");
+			context_.TryCancel();
+		}
+		finishedCondition_.wait(lock, [this] { return isFinished_; });
+	}
+
+	MarketDataStreamStats getStats()
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		MarketDataStreamStats stats;
+		stats.instruments = (int)routes_.size();
+		stats.subscriptions = subscriptions_;
+		stats.requests = requests_;
+		stats.events = events_;
+		stats.unroutedEvents = unroutedEvents_;
+		stats.isDead = isDead_;
+		return stats;
+	}
+
+	virtual void OnWriteDone(bool ok)
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		isWritePending_ = false;
+		if (ok)
+		{
+			// Instruments might have been added or removed, or stop requested, while request was being written
+			writeRequestIfIdle();
+			sendWritesDoneIfIdle();
+		}
+	}
+
+	virtual void OnReadDone(bool ok)
+	{
+		if (!ok)
+		{
+			// Server has closed the stream, OnDone() will follow
+			return;
+		}
+		const MarketDataEvent& event = *event_.get();
+		std::unique_lock<std::mutex> lock(lock_);
+		events_++;
+		if (!isStopRequested_)
+		{
+			if (event.event_case() == MarketDataEvent::EventCase::kUpdate)
+			{
+				auto route = routes_.find(event.update().instrument());
+				if (route != routes_.end())
+				{
+					std::shared_ptr<const Handlers> handlers = route->second;
+					beginDispatch();
+					lock.unlock();
+					callHandlers(*handlers, event);
+					endDispatch();
+				}
+				else
+				{
+					unroutedEvents_++;
+					lock.unlock();
+				}
+			}
+			else
+			{
+				std::vector<std::shared_ptr<const Handlers>> allHandlers = getAllHandlers();
+				beginDispatch();
+				lock.unlock();
+				TMS_LOG_INFO(logPrefix_, "Feed status ", FeedStatus_Name(event.feedstatus()), " for ", allHandlers.size(), " instruments");
+				for (const std::shared_ptr<const Handlers>& handlers : allHandlers)
+				{
+					callHandlers(*handlers, event);
+				}
+				endDispatch();
+			}
+		}
+		else
+		{
+			lock.unlock();
+		}
+		if (channel_ >= 0)
+		{
+			channelPool_->addReceivedEvents(channel_, 1);
+		}
+		// Keep reading: after stop it lets us know when server has closed the stream
+		event_.recycle();
+		StartRead(event_.get());
+	}
+
+	virtual void OnDone(const grpc::Status& status)
+	{
+		std::unique_lock<std::mutex> lock(lock_);
+		if (!isStopRequested_)
+		{
+			isDead_ = true;
+			std::vector<std::shared_ptr<const Handlers>> allHandlers = getAllHandlers();
+			beginDispatch();
+			lock.unlock();
+			TMS_LOG_WARNING(logPrefix_, "Subscription call is dead! Status==", status.error_code(), " ", status.error_message());
+			MarketDataEvent disconnectEvent;
+			disconnectEvent.set_feedstatus(FeedStatus::Disconnected);
+			for (const std::shared_ptr<const Handlers>& handlers : allHandlers)
+			{
+				callHandlers(*handlers, disconnectEvent);
+			}
+			endDispatch();
+			lock.lock();
+		}
+		TMS_LOG_INFO(logPrefix_, "Stream completed");
+		isFinished_ = true;
+		finishedCondition_.notify_all();
+	}
+
+private:
+	typedef std::vector<std::pair<int, MarketDataHandler>> Handlers;
+
+	// Must be called with lock_ held
+	void start()
+	{
+		TMSRemote::Stub* stub = stub_;
+		if (channelPool_)
+		{
+			channel_ = channelPool_->acquireStream(ChannelTraffic::MarketData);
+			stub = &channelPool_->getStub(channel_);
+		}
+		isStarted_ = true;
+		stub->async()->subscribeForMarketData(&context_, this);
+		// First request and Read() are queued before the call is started, so they go out as soon as stream is up
+		writeRequestIfIdle();
+		StartRead(event_.get());
+		StartCall();
+	}
+
+	// Must be called with lock_ held
+	void writeRequestIfIdle()
+	{
+		// Only one write may be pending, changes made meanwhile are sent with the next one.
+		// With no instruments left the last request stays in effect: an empty one would subscribe to everything.
+		if (!isStarted_ || !isRequestDirty_ || isWritePending_ || isStopRequested_ || isFinished_ || routes_.empty())
+		{
+			return;
+		}
+		request_.Clear();
+		for (const std::string& field : options_.fields)
+		{
+			request_.add_field(field);
+		}
+		for (const auto& route : routes_)
+		{
+			request_.add_instrument(route.first);
+		}
+		isRequestDirty_ = false;
+		isWritePending_ = true;
+		requests_++;
+		StartWrite(&request_);
+	}
+
+	// Must be called with lock_ held
+	void sendWritesDoneIfIdle()
+	{
+		// WritesDone() can't overlap with a request write
+		if (isStarted_ && isStopRequested_ && !isWritePending_ && !isWritesDoneSent_ && !isFinished_)
+		{
+			isWritesDoneSent_ = true;
+			StartWritesDone();
+		}
+	}
+
+	// Must be called with lock_ held
+	std::vector<std::shared_ptr<const Handlers>> getAllHandlers()
+	{
+		std::vector<std::shared_ptr<const Handlers>> allHandlers;
+		allHandlers.reserve(routes_.size());
+		for (const auto& route : routes_)
+		{
+			allHandlers.push_back(route.second);
+		}
+		return allHandlers;
+	}
+
+	// Must be called with lock_ held
+	void beginDispatch()
+	{
+		startedDispatches_++;
+		dispatchDepth++;
+	}
+
+	void endDispatch()
+	{
+		{
+			std::lock_guard<std::mutex> lock(lock_);
+			dispatchDepth--;
+			finishedDispatches_++;
+		}
+		dispatchCondition_.notify_all();
+	}
+
+	void callHandlers(const Handlers& handlers, const MarketDataEvent& event)
+	{
+		for (const std::pair<int, MarketDataHandler>& handler : handlers)
+		{
+			handler.second(event, logPrefix_);
+		}
+	}
+
+private:
+	const std::string logPrefix_;
+	TMSRemote::Stub* const stub_;
+	ChannelPool* const channelPool_;
+	// Pool's channel of the stream, -1 without a pool or before start
+	int channel_;
+	const MarketDataHubOptions& options_;
+
+	grpc::ClientContext context_;
+	SubscribeForMarketDataRequest request_;
+	// Events are parsed into arena memory, reused across Read() calls
+	ArenaEvent<MarketDataEvent> event_;
+
+	// Dispatch table and stream state, guarded by lock_
+	std::mutex lock_;
+	std::condition_variable finishedCondition_;
+	// Signalled when a dispatch is over
+	std::condition_variable dispatchCondition_;
+	std::unordered_map<std::string, std::shared_ptr<const Handlers>> routes_;
+	int subscriptions_;
+	long long requests_;
+	long long events_;
+	long long unroutedEvents_;
+	// Dispatches of the stream run one at a time
+	long long startedDispatches_;
+	long long finishedDispatches_;
+	std::chrono::system_clock::time_point stopDeadline_;
+	bool isStarted_;
+	// Instrument list has changed since the last request was written
+	bool isRequestDirty_;
+	bool isWritePending_;
+	bool isStopRequested_;
+	bool isWritesDoneSent_;
+	bool isFinished_;
+	bool isDead_;
+};
+
+MarketDataHub::MarketDataHub(TMSRemote::Stub& stub, const MarketDataHubOptions& options) :
+	stub_(&stub),
+	channelPool_(nullptr),
+	options_(options),
+	nextId_(0),
+	isStopped_(false)
+{
+	createStreams();
+}
+
+MarketDataHub::MarketDataHub(ChannelPool& channelPool, const MarketDataHubOptions& options) :
+	stub_(nullptr),
+	channelPool_(&channelPool),
+	options_(options),
+	nextId_(0),
+	isStopped_(false)
+{
+	createStreams();
+}
+
+MarketDataHub::~MarketDataHub()
+{
+	stop("[~MarketDataHub()] ");
+}
+
+void MarketDataHub::createStreams()
+{
+	if (options_.streamCount < 1)
+	{
+		throw std::runtime_error("Market data hub needs at least one stream");
+	}
+	for (int i = 0; i < options_.streamCount; i++)
+	{
+		streams_.emplace_back(new Stream(i, stub_, channelPool_, options_));
+	}
+}
+
+int MarketDataHub::getStreamIndex(const std::string& instrument) const
+{
+	return (int)(std::hash<std::string>()(instrument) % streams_.size());
+}
+
+int MarketDataHub::subscribe(const std::string& instrument, const MarketDataHandler& handler)
+{
+	int subscriptionId;
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		if (isStopped_)
+		{
+			throw std::runtime_error("Market data hub is stopped");
+		}
+		subscriptionId = ++nextId_;
+		idToInstrumentMap_[subscriptionId] = instrument;
+	}
+	if (!streams_[getStreamIndex(instrument)]->addHandler(instrument, subscriptionId, handler))
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		idToInstrumentMap_.erase(subscriptionId);
+		TMS_LOG_WARNING(Caller, "Stream of ", instrument, " is dead, subscription is refused");
+		return 0;
+	}
+	return subscriptionId;
+}
+
+bool MarketDataHub::unsubscribe(int subscriptionId)
+{
+	std::string instrument;
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		auto subscription = idToInstrumentMap_.find(subscriptionId);
+		if (subscription == idToInstrumentMap_.end())
+		{
+			return false;
+		}
+		instrument = subscription->second;
+		idToInstrumentMap_.erase(subscription);
+	}
+	return streams_[getStreamIndex(instrument)]->removeHandler(instrument, subscriptionId);
+}
+
+void MarketDataHub::stop(const std::string& caller)
+{
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		isStopped_ = true;
+	}
+	// All streams stop in parallel, so stopping takes one stop timeout at most
+	for (std::unique_ptr<Stream>& stream : streams_)
+	{
+		stream->signalStop();
+	}
+	for (std::unique_ptr<Stream>& stream : streams_)
+	{
+		stream->waitForStop(caller);
+	}
+}
+
+int MarketDataHub::getStreamCount() const
+{
+	return (int)streams_.size();
+}
+
+int MarketDataHub::getInstrumentCount()
+{
+	int count = 0;
+	for (std::unique_ptr<Stream>& stream : streams_)
+	{
+		count += stream->getStats().instruments;
+	}
+	return count;
+}
+
+MarketDataStreamStats MarketDataHub::getStreamStats(int stream)
+{
+	return streams_.at(stream)->getStats();
+}
+
+void MarketDataHub::dumpStats(const std::string& caller)
+{
+	for (size_t i = 0; i < streams_.size(); i++)
+	{
+		MarketDataStreamStats stats = streams_[i]->getStats();
+		TMS_LOG_INFO(caller, Caller, "Stream ", i, ": instruments=", stats.instruments, ", subscriptions=", stats.subscriptions, ", requests=", stats.requests,
+			", events=", stats.events, ", unrouted=", stats.unroutedEvents, stats.isDead ? ", dead" : "");
+	}
+}
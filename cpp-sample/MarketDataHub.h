@@ -0,0 +1,110 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <grpcpp/grpcpp.h>
+#include <tmsapigrpc/TMSRemote.grpc.pb.h>
+
+class ChannelPool;
+
+struct MarketDataHubOptions
+{
+	MarketDataHubOptions();
+
+	// Number of shared subscription streams, instruments are spread over them by hash
+	int streamCount;
+	// Fields requested for all instruments, empty means all fields
+	std::vector<std::string> fields;
+	// How long stop() waits for server to close the streams before cancelling the calls
+	std::chrono::milliseconds stopTimeout;
+};
+
+struct MarketDataStreamStats
+{
+	int instruments;
+	int subscriptions;
+	// Subscription requests written: the first one and follow-ups after instruments were added or removed
+	long long requests;
+	long long events;
+	// Updates for instruments nobody is subscribed to anymore, e.g. arriving before server has processed a follow-up request
+	long long unroutedEvents;
+	bool isDead;
+};
+
+// Called on gRPC callback threads, handlers of one stream are never called concurrently
+typedef std::function<void(const MarketDataEvent& event, const std::string& caller)> MarketDataHandler;
+
+/**
+Market data subscriptions for thousands of instruments over a few shared streams, instead of a stream (and a listener thread) per instrument.
+Each instrument is assigned one of streamCount subscribeForMarketData streams by hash, and its updates are routed to its handlers
+through the stream's hash table of instrument to handlers. Streams are driven by gRPC callback API, so the hub has no threads of its own.
+
+Instruments are added and removed at runtime by writing a follow-up SubscribeForMarketDataRequest on the stream that is already open.
+Since the request can't say "remove", every follow-up carries the stream's complete instrument list and replaces the previous one.
+Changes made while a request is being written are coalesced into the next one, so subscribing to thousands of instruments in a loop
+takes a few requests per stream. Stream stays open when its last instrument is removed: an empty list would mean all instruments,
+so the last list is left with the server and its updates are dropped.
+
+Feed statuses (InitialStateReceived, Disconnected, Reconnected) are per stream and go to all handlers of the stream, so a handler may
+get InitialStateReceived after each follow-up. A dead stream is reported with a synthetic Disconnected event and is not resubscribed:
+subscriptions to its instruments are refused from then on.
+
+Usage:
+	MarketDataHubOptions options;
+	options.streamCount = 4;
+	options.fields = { "LastPx", "LastSize" };
+	MarketDataHub hub(stub, options); // Or MarketDataHub hub(channelPool, options): streams are assigned pool's market data channels
+	int subscriptionId = hub.subscribe("IBM", [](const MarketDataEvent& event, const std::string& caller) { ... });
+...
+	hub.unsubscribe(subscriptionId);
+	hub.stop("[Main] ");
+*/
+class MarketDataHub
+{
+public:
+	explicit MarketDataHub(TMSRemote::Stub& stub, const MarketDataHubOptions& options = MarketDataHubOptions());
+	explicit MarketDataHub(ChannelPool& channelPool, const MarketDataHubOptions& options = MarketDataHubOptions());
+	~MarketDataHub();
+
+	MarketDataHub(const MarketDataHub&) = delete;
+	void operator=(const MarketDataHub&) = delete;
+
+	// Instrument's stream is started by its first subscription. Returns subscription ID for unsubscribe(), 0 if instrument's stream is dead.
+	int subscribe(const std::string& instrument, const MarketDataHandler& handler);
+	// Waits for the handler to return if it's being called right now, so it's not called after this returns.
+	// Handlers may unsubscribe themselves or any other subscription: nothing is waited for then, so a handler of another stream
+	// may still be running or be called once more after this returns. False if there's no such subscription.
+	bool unsubscribe(int subscriptionId);
+	// Closes all streams and waits for them, safe to call more than once. Subscribing after stop() throws.
+	void stop(const std::string& caller);
+
+	int getStreamCount() const;
+	int getInstrumentCount();
+	MarketDataStreamStats getStreamStats(int stream);
+	// Logs statistics of every stream
+	void dumpStats(const std::string& caller);
+
+private:
+	class Stream;
+
+	void createStreams();
+	int getStreamIndex(const std::string& instrument) const;
+
+private:
+	TMSRemote::Stub* stub_;
+	ChannelPool* channelPool_;
+	const MarketDataHubOptions options_;
+	std::vector<std::unique_ptr<Stream>> streams_;
+
+	// Subscription ID to its instrument, guarded by lock_
+	std::mutex lock_;
+	std::map<int, std::string> idToInstrumentMap_;
+	int nextId_;
+	bool isStopped_;
+};
@@ -0,0 +1,286 @@
+#include <algorithm>
+
+#include "Clock.h"
+#include "Logger.h"
+
+#include "OrderActionBatcher.h"
+
+namespace
+{
+	const std::string Caller = "[Order Action Batcher] ";
+};
+
+const std::chrono::microseconds OrderActionBatcher::DefaultMaxDelay(500);
+
+OrderActionBatcher::OrderActionBatcher(TMSRemote::Stub& stub, size_t maxBatchSize, const std::chrono::microseconds& maxDelay) :
+	stub_(stub),
+	maxBatchSize_(std::max(maxBatchSize, (size_t)1)),
+	maxDelay_(std::chrono::duration_cast<std::chrono::nanoseconds>(maxDelay).count()),
+	isShutdown_(false)
+{
+	actionCount_.store(0);
+	rpcCount_.store(0);
+	sender_ = std::thread(&OrderActionBatcher::run, this);
+}
+
+OrderActionBatcher::~OrderActionBatcher()
+{
+	shutdown();
+}
+
+std::future<grpc::Status> OrderActionBatcher::cancelOrder(const std::string& orderId)
+{
+	return submit(Action_Cancel, orderId, false, [&orderId](google::protobuf::Message* request) {
+		static_cast<CancelOrdersRequest*>(request)->add_orderid(orderId);
+	});
+}
+
+std::future<grpc::Status> OrderActionBatcher::cancelOrder(const std::string& orderId, const FIXFields& message)
+{
+	return submit(Action_Cancel, orderId, true, [&orderId, &message](google::protobuf::Message* request) {
+		static_cast<CancelOrdersRequest*>(request)->add_orderid(orderId);
+		*static_cast<CancelOrdersRequest*>(request)->add_message() = message;
+	});
+}
+
+std::future<grpc::Status> OrderActionBatcher::modifyOrder(const std::string& orderId, const FIXFields& message)
+{
+	return submit(Action_Modify, orderId, true, [&orderId, &message](google::protobuf::Message* request) {
+		static_cast<ModifyOrdersRequest*>(request)->add_orderid(orderId);
+		*static_cast<ModifyOrdersRequest*>(request)->add_message() = message;
+	});
+}
+
+std::future<grpc::Status> OrderActionBatcher::fillOrder(const FIXFields& message)
+{
+	static const std::string noOrderId;
+	auto iter = message.stringfields().find(FIXTag::FIXTag_SingleOrderTransactionId);
+	const std::string& orderId = iter != message.stringfields().end() ? iter->second : noOrderId;
+	return submit(Action_Fill, orderId, true, [&message](google::protobuf::Message* request) {
+		*static_cast<FIXMessagesRequest*>(request)->add_message() = message;
+	});
+}
+
+std::future<grpc::Status> OrderActionBatcher::sendOrder(int64_t targetId)
+{
+	return submit(Action_Send, std::string(), false, [targetId](google::protobuf::Message* request) {
+		static_cast<SendOrdersRequest*>(request)->add_targetid(targetId);
+	});
+}
+
+std::future<grpc::Status> OrderActionBatcher::sendOrder(int64_t targetId, const FIXFields& message)
+{
+	return submit(Action_Send, std::string(), true, [targetId, &message](google::protobuf::Message* request) {
+		static_cast<SendOrdersRequest*>(request)->add_targetid(targetId);
+		*static_cast<SendOrdersRequest*>(request)->add_message() = message;
+	});
+}
+
+void OrderActionBatcher::flush()
+{
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		closeAllBatches();
+	}
+	condition_.notify_one();
+}
+
+void OrderActionBatcher::shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		if (isShutdown_)
+		{
+			return;
+		}
+		isShutdown_ = true;
+		closeAllBatches();
+	}
+	condition_.notify_one();
+	sender_.join();
+	TMS_LOG_INFO(Caller, "Stopped, ", getActionCount(), " actions sent in ", getRpcCount(), " RPCs");
+}
+
+long long OrderActionBatcher::getActionCount() const
+{
+	return actionCount_.load();
+}
+
+long long OrderActionBatcher::getRpcCount() const
+{
+	return rpcCount_.load();
+}
+
+std::future<grpc::Status> OrderActionBatcher::submit(Action action, const std::string& orderId, bool hasMessage, const std::function<void(google::protobuf::Message*)>& addItem)
+{
+	std::promise<grpc::Status> promise;
+	std::future<grpc::Status> result = promise.get_future();
+	bool isSenderNeeded = false;
+	{
+		std::lock_guard<std::mutex> lock(lock_);
+		if (isShutdown_)
+		{
+			promise.set_value(grpc::Status(grpc::StatusCode::UNAVAILABLE, "order action batcher is shut down"));
+			return result;
+		}
+		if (!orderId.empty())
+		{
+			// Different kind of action on the same order must not overtake the pending one
+			auto iter = openOrders_.find(orderId);
+			if (iter != openOrders_.end() && iter->second != action)
+			{
+				closeAllBatches();
+				isSenderNeeded = true;
+			}
+		}
+		std::unique_ptr<Batch>& batch = openBatches_[action];
+		if (batch && batch->hasMessages != hasMessage)
+		{
+			closeBatch(action);
+			isSenderNeeded = true;
+		}
+		if (!batch)
+		{
+			batch.reset(new Batch());
+			batch->action = action;
+			batch->hasMessages = hasMessage;
+			batch->deadline = Clock::getMonotonicTime() + maxDelay_;
+			switch (action)
+			{
+			case Action_Cancel: batch->request.reset(new CancelOrdersRequest()); break;
+			case Action_Modify: batch->request.reset(new ModifyOrdersRequest()); break;
+			case Action_Fill: batch->request.reset(new FIXMessagesRequest()); break;
+			default: batch->request.reset(new SendOrdersRequest()); break;
+			}
+			// Sender has to learn the new deadline
+			isSenderNeeded = true;
+		}
+		addItem(batch->request.get());
+		batch->promises.push_back(std::move(promise));
+		if (!orderId.empty())
+		{
+			batch->orderIds.push_back(orderId);
+			openOrders_[orderId] = action;
+		}
+		actionCount_.fetch_add(1, std::memory_order_relaxed);
+		if (batch->promises.size() >= maxBatchSize_)
+		{
+			closeBatch(action);
+			isSenderNeeded = true;
+		}
+	}
+	if (isSenderNeeded)
+	{
+		condition_.notify_one();
+	}
+	return result;
+}
+
+void OrderActionBatcher::closeBatch(Action action)
+{
+	std::unique_ptr<Batch>& batch = openBatches_[action];
+	if (!batch)
+	{
+		return;
+	}
+	for (const std::string& orderId : batch->orderIds)
+	{
+		openOrders_.erase(orderId);
+	}
+	closedBatches_.push_back(std::move(batch));
+}
+
+void OrderActionBatcher::closeAllBatches()
+{
+	// Open batches never share an order, so they may go in any order
+	for (int action = 0; action < ActionCount; action++)
+	{
+		closeBatch((Action)action);
+	}
+}
+
+void OrderActionBatcher::run()
+{
+	std::unique_lock<std::mutex> lock(lock_);
+	while (true)
+	{
+		int64_t now = Clock::getMonotonicTime();
+		int64_t nextDeadline = INT64_MAX;
+		for (int action = 0; action < ActionCount; action++)
+		{
+			if (openBatches_[action] && openBatches_[action]->deadline <= now)
+			{
+				closeBatch((Action)action);
+			}
+			else if (openBatches_[action])
+			{
+				nextDeadline = std::min(nextDeadline, openBatches_[action]->deadline);
+			}
+		}
+		if (!closedBatches_.empty())
+		{
+			std::unique_ptr<Batch> batch = std::move(closedBatches_.front());
+			closedBatches_.pop_front();
+			// Actions submitted while RPC is in flight join the next batches
+			lock.unlock();
+			send(*batch);
+			lock.lock();
+			continue;
+		}
+		if (isShutdown_)
+		{
+			// shutdown() has closed all batches and no more can be opened, so everything has been sent
+			break;
+		}
+		if (nextDeadline == INT64_MAX)
+		{
+			condition_.wait(lock);
+		}
+		else
+		{
+			condition_.wait_for(lock, std::chrono::nanoseconds(nextDeadline - now));
+		}
+	}
+}
+
+void OrderActionBatcher::send(Batch& batch)
+{
+	grpc::ClientContext context;
+	Void response;
+	grpc::Status status;
+	switch (batch.action)
+	{
+	case Action_Cancel:
+		status = stub_.cancelOrders(&context, static_cast<const CancelOrdersRequest&>(*batch.request), &response);
+		break;
+	case Action_Modify:
+		status = stub_.modifyOrders(&context, static_cast<const ModifyOrdersRequest&>(*batch.request), &response);
+		break;
+	case Action_Fill:
+		status = stub_.fillOrders(&context, static_cast<const FIXMessagesRequest&>(*batch.request), &response);
+		break;
+	default:
+		status = stub_.sendOrders(&context, static_cast<const SendOrdersRequest&>(*batch.request), &response);
+		break;
+	}
+	rpcCount_.fetch_add(1, std::memory_order_relaxed);
+	if (!status.ok())
+	{
+		TMS_LOG_WARNING(Caller, getActionName(batch.action), " of ", batch.promises.size(), " items failed: ", status.error_message());
+	}
+	for (std::promise<grpc::Status>& promise : batch.promises)
+	{
+		promise.set_value(status);
+	}
+}
+
+const char* OrderActionBatcher::getActionName(Action action)
+{
+	switch (action)
+	{
+	case Action_Cancel: return "cancelOrders";
+	case Action_Modify: return "modifyOrders";
+	case Action_Fill: return "fillOrders";
+	default: return "sendOrders";
+	}
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include <grpcpp/grpcpp.h>
+#include <tmsapigrpc/TMSRemote.grpc.pb.h>
+
+/**
+Coalesces order actions submitted from any thread into multi-item RPCs: cancels into one cancelOrders(), modifies into one modifyOrders(),
+fills into one fillOrders() and target orders into one sendOrders() call per micro-batch.
+Submitting only queues the action and returns a future, RPCs are sent by the batcher's own thread, so listener threads never block on them.
+
+A batch is sent when it reaches maxBatchSize actions or maxDelay after its first action, whichever comes first.
+While an RPC is in flight new actions keep accumulating, so under load batches grow on their own even with zero maxDelay.
+
+Actions on the same order are sent in the order they were submitted: an action on an order that has a different kind of action pending
+closes the current batches first. Actions of the same kind on different orders may be sent before earlier actions of other kinds.
+
+The server replies once per RPC, so every action of a batch gets the batch's status.
+
+Usage:
+	OrderActionBatcher batcher(*stub);
+	std::future<grpc::Status> cancelled = batcher.cancelOrder(orderId); // From listener thread, doesn't block
+	batcher.modifyOrder(otherOrderId, message);
+...
+	for (const std::string& orderId : orderIds) // Mass cancel: a few RPCs instead of one per order
+	{
+		futures.push_back(batcher.cancelOrder(orderId));
+	}
+...
+	batcher.shutdown(); // Sends what's queued and waits for replies, later actions fail with UNAVAILABLE
+*/
+class OrderActionBatcher
+{
+public:
+	static const size_t DefaultMaxBatchSize = 1000;
+	static const std::chrono::microseconds DefaultMaxDelay;
+
+	explicit OrderActionBatcher(TMSRemote::Stub& stub, size_t maxBatchSize = DefaultMaxBatchSize, const std::chrono::microseconds& maxDelay = DefaultMaxDelay);
+	~OrderActionBatcher();
+
+	OrderActionBatcher(const OrderActionBatcher&) = delete;
+	void operator=(const OrderActionBatcher&) = delete;
+
+	std::future<grpc::Status> cancelOrder(const std::string& orderId);
+	std::future<grpc::Status> cancelOrder(const std::string& orderId, const FIXFields& message);
+	std::future<grpc::Status> modifyOrder(const std::string& orderId, const FIXFields& message);
+	// Order is identified by FIXTag_SingleOrderTransactionId of the message
+	std::future<grpc::Status> fillOrder(const FIXFields& message);
+	std::future<grpc::Status> sendOrder(int64_t targetId);
+	std::future<grpc::Status> sendOrder(int64_t targetId, const FIXFields& message);
+
+	// Sends all queued actions without waiting for their batches to fill up, doesn't wait for replies
+	void flush();
+	// Sends all queued actions and waits for replies. Actions submitted afterwards fail with UNAVAILABLE. Safe to call more than once.
+	void shutdown();
+
+	// Actions submitted and RPCs sent so far: their ratio is the average batch size
+	long long getActionCount() const;
+	long long getRpcCount() const;
+
+private:
+	enum Action
+	{
+		Action_Cancel,
+		Action_Modify,
+		Action_Fill,
+		Action_Send,
+		ActionCount
+	};
+
+	// Request of one RPC and promises of the actions it carries
+	struct Batch
+	{
+		Action action;
+		// Requests either have a message per item or none at all, so items with and without messages go to different batches
+		bool hasMessages;
+		int64_t deadline;
+		std::unique_ptr<google::protobuf::Message> request;
+		std::vector<std::promise<grpc::Status>> promises;
+		std::vector<std::string> orderIds;
+	};
+
+	// orderId may be empty if action doesn't refer to an order
+	std::future<grpc::Status> submit(Action action, const std::string& orderId, bool hasMessage, const std::function<void(google::protobuf::Message*)>& addItem);
+	// Must be called with lock_ held
+	void closeBatch(Action action);
+	void closeAllBatches();
+	void run();
+	void send(Batch& batch);
+	static const char* getActionName(Action action);
+
+private:
+	TMSRemote::Stub& stub_;
+	const size_t maxBatchSize_;
+	const int64_t maxDelay_;
+
+	std::mutex lock_;
+	std::condition_variable condition_;
+	std::unique_ptr<Batch> openBatches_[ActionCount];
+	// Closed batches waiting to be sent, in the order they were closed
+	std::deque<std::unique_ptr<Batch>> closedBatches_;
+	// Orders that have actions in open batches
+	std::unordered_map<std::string, Action> openOrders_;
+	bool isShutdown_;
+	std::thread sender_;
+
+	std::atomic<long long> actionCount_;
+	std::atomic<long long> rpcCount_;
+};
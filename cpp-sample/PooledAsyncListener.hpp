@@ -0,0 +1,351 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+
+#include <grpcpp/grpcpp.h>
+#include <tmsapigrpc/TMSRemote.grpc.pb.h>
+
+#include "Utils.h"
+#include "Logger.h"
+#include "AsyncListenerBase.h"
+#include "AllocationCounter.h"
+#include "ArenaEvent.hpp"
+#include "Clock.h"
+#include "CompletionQueuePool.h"
+
+using namespace Utils;
+
+/**
+Async listener that has no thread of its own.
+It posts its stream operations to a completion queue shared with other listeners (see CompletionQueuePool)
+and is driven by the pool's poller thread: every operation has its own tag, and completion of the tag moves
+the listener to its next state:
+
+	StartCall() -> Write(request) -> Read() -> Read() -> ... -> WritesDone() -> Read() until server closes -> Finish()
+
+Consumer callback is invoked on the poller thread, so it should not block for long: other listeners sharing the same queue wait for it.
+If server doesn't close the stream within stop timeout after stop request, waitForStop() cancels the call.
+*/
+template <class Request, class Event> class PooledAsyncListener : public AsyncListenerBase
+{
+public:
+    PooledAsyncListener(const std::string name, grpc::CompletionQueue* queue) :
+        name_(name),
+        logPrefix_("["+name+"] "),
+        queue_(queue),
+        startTag_(this, &PooledAsyncListener::onStarted),
+        writeTag_(this, &PooledAsyncListener::onWritten),
+        readTag_(this, &PooledAsyncListener::onRead),
+        writesDoneTag_(this, &PooledAsyncListener::onWritesDone),
+        finishTag_(this, &PooledAsyncListener::onFinished),
+        stopTimeout_(DefaultStopTimeout),
+        isStarted_(false),
+        isStopRequested_(false),
+        isReadPending_(false),
+        isWritePending_(false),
+        isWritesDoneSent_(false),
+        isReadsDone_(false),
+        isFinishing_(false),
+        isFinished_(false),
+        eventCount_(0),
+        allocationCount_(0)
+    {
+        isDebug_.store(false);
+    }
+
+    virtual ~PooledAsyncListener()
+    {
+        signalStop("[~PooledAsyncListener()] ");
+        waitForStop("[~PooledAsyncListener()] ");
+    }
+
+    virtual const std::string& getName() const
+    {
+        return name_;
+    }
+
+    virtual void setDebug(bool debug)
+    {
+        isDebug_.store(debug);
+    }
+
+    virtual void setStopTimeout(const std::chrono::milliseconds& timeout)
+    {
+        std::lock_guard<std::mutex> lock(stateLock_);
+        stopTimeout_ = timeout;
+    }
+
+    void start(std::function< std::unique_ptr< ::grpc::ClientAsyncReaderWriter< Request, Event>>(grpc::ClientContext*, grpc::CompletionQueue*) > streamSupplier, const Request &request, std::function< bool(const Event&, const std::string&)> consumer)
+    {
+        std::lock_guard<std::mutex> lock(stateLock_);
+        if (isStarted_)
+        {
+            throw std::runtime_error("start() may only be called once");
+        }
+        isStarted_ = true;
+        request_ = request;
+        consumer_ = consumer;
+        rpc_ = streamSupplier(&context_, queue_);
+        TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "Before StartCall()...");
+        rpc_->StartCall(&startTag_);
+    }
+
+    virtual void signalStop(const std::string &caller)
+    {
+        TMS_LOG_DEBUG_IF(isDebug(), caller, name_, "Flagging listener to stop...");
+        std::lock_guard<std::mutex> lock(stateLock_);
+        requestStop();
+        // If subscription is already accepted, there's only a pending Read(): let server know we're done right away.
+        // Otherwise the stop flag will be picked up by the next completion.
+        sendWritesDoneIfIdle();
+        TMS_LOG_DEBUG_IF(isDebug(), caller, name_, "Listener stop flag is set");
+    }
+
+    virtual void waitForStop(const std::string& caller)
+    {
+        std::unique_lock<std::mutex> lock(stateLock_);
+        if (!isStarted_ || isFinished_)
+        {
+            return;
+        }
+        TMS_LOG_DEBUG_IF(isDebug(), caller, name_, "Waiting for listener stream to complete...");
+        if (isStopRequested_ && !finishedCondition_.wait_until(lock, stopDeadline_, [this] { return isFinished_; }))
+        {
+            // Cancelled call completes all its pending operations right away
+            TMS_LOG_INFO(caller, name_, " server has not closed the stream in time, cancelling the call");
+            context_.TryCancel();
+        }
+        finishedCondition_.wait(lock, [this] { return isFinished_; });
+        TMS_LOG_INFO(caller, name_, " listener is stopped");
+    }
+
+private:
+    // Completion queue tag that forwards completion to the listener's handler for that operation
+    class OperationTag : public CompletionQueueTag
+    {
+    public:
+        OperationTag(PooledAsyncListener* owner, void (PooledAsyncListener::*handler)(bool)) :
+            owner_(owner),
+            handler_(handler)
+        {
+        }
+
+        virtual void proceed(bool ok)
+        {
+            (owner_->*handler_)(ok);
+        }
+
+    private:
+        PooledAsyncListener* owner_;
+        void (PooledAsyncListener::*handler_)(bool);
+    };
+
+    bool isDebug()
+    {
+        return isDebug_.load();
+    }
+
+    void onStarted(bool ok)
+    {
+        std::unique_lock<std::mutex> lock(stateLock_);
+        if (!ok)
+        {
+            isReadsDone_ = true;
+            lock.unlock();
+            notifyCallIsDead();
+            lock.lock();
+            finishIfIdle();
+            return;
+        }
+        // StartCall() is completed, time to write subscription request to our bidirectional rpc call
+        TMS_LOG_INFO(logPrefix_, "Stream is up");
+        isWritePending_ = true;
+        TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "Before Write()...");
+        rpc_->Write(request_, &writeTag_);
+    }
+
+    void onWritten(bool ok)
+    {
+        std::unique_lock<std::mutex> lock(stateLock_);
+        isWritePending_ = false;
+        if (!ok)
+        {
+            isReadsDone_ = true;
+            lock.unlock();
+            notifyCallIsDead();
+            lock.lock();
+            finishIfIdle();
+            return;
+        }
+        // Write() is completed, time to start calling Read() to get data server generates for our subscription
+        TMS_LOG_INFO(logPrefix_, "Subscription is accepted");
+        startRead();
+        sendWritesDoneIfIdle();
+    }
+
+    void onRead(bool ok)
+    {
+        std::unique_lock<std::mutex> lock(stateLock_);
+        isReadPending_ = false;
+        if (!ok)
+        {
+            // Server has closed the stream: either in response to our WritesDone() or because the call is dead
+            isReadsDone_ = true;
+            bool isStopRequested = isStopRequested_;
+            lock.unlock();
+            if (!isStopRequested)
+            {
+                notifyCallIsDead();
+            }
+            lock.lock();
+            finishIfIdle();
+            return;
+        }
+        // Heap allocations made by this poller thread for the event: consumer, arena recycling and the next Read().
+        // Parsing is done before, by the poller thread serving whichever listener, so it's not included.
+        long long allocationsBefore = AllocationCounter::getThreadCount();
+        bool isDelivered = !isStopRequested_;
+        if (!isStopRequested_)
+        {
+            // We've received data for previous Read() call, process it outside of the lock: consumer is allowed to stop the listener
+            lock.unlock();
+            int64_t receivedTime = Clock::getMonotonicTime();
+            bool result = consumer_(*event_.get(), logPrefix_);
+            recordLatency(event_.get()->sendingtime(), receivedTime);
+            lock.lock();
+            if (!result)
+            {
+                TMS_LOG_INFO(logPrefix_, "Got 'stop' flag from callback");
+                requestStop();
+            }
+        }
+        else
+        {
+            TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "Skipping event received after request to stop");
+        }
+        // Keep calling Read(): after stop it lets us know when server has closed the stream
+        startRead();
+        if (isDelivered)
+        {
+            eventCount_++;
+            allocationCount_ += AllocationCounter::getThreadCount() - allocationsBefore;
+        }
+        sendWritesDoneIfIdle();
+    }
+
+    void onWritesDone(bool ok)
+    {
+        std::lock_guard<std::mutex> lock(stateLock_);
+        isWritePending_ = false;
+        TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "WritesDone() is completed, ok==", std::boolalpha, ok);
+        finishIfIdle();
+    }
+
+    void onFinished(bool ok)
+    {
+        std::lock_guard<std::mutex> lock(stateLock_);
+        TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "Finish() is completed, status==", status_.error_code(), " ", status_.error_message());
+        if (AllocationCounter::isEnabled() && eventCount_ > 0)
+        {
+            TMS_LOG_INFO(logPrefix_, "Received ", eventCount_, " events, ", (double)allocationCount_/eventCount_, " heap allocations per event (without parsing), ", event_.getResetCount(), " arena resets");
+        }
+        TMS_LOG_INFO(logPrefix_, "Stream completed");
+        isFinished_ = true;
+        finishedCondition_.notify_all();
+    }
+
+    // Must be called with stateLock_ held
+    void startRead()
+    {
+        // No Read() is pending here, so it's safe to release memory of previous events
+        event_.recycle();
+        isReadPending_ = true;
+        TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "Before Read()...");
+        rpc_->Read(event_.get(), &readTag_);
+    }
+
+    // Must be called with stateLock_ held
+    void requestStop()
+    {
+        if (!isStopRequested_)
+        {
+            isStopRequested_ = true;
+            stopDeadline_ = std::chrono::system_clock::now() + stopTimeout_;
+        }
+    }
+
+    // Must be called with stateLock_ held
+    void sendWritesDoneIfIdle()
+    {
+        // WritesDone() can't be posted before stream is up or while subscription request is still being written
+        if (isStopRequested_ && isReadPending_ && !isWritePending_ && !isWritesDoneSent_)
+        {
+            TMS_LOG_INFO(logPrefix_, "Detected request to stop");
+            TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "Calling WritesDone()");
+            // Let server know we're done with our stream
+            isWritesDoneSent_ = true;
+            isWritePending_ = true;
+            rpc_->WritesDone(&writesDoneTag_);
+        }
+    }
+
+    // Must be called with stateLock_ held
+    void finishIfIdle()
+    {
+        if (isReadsDone_ && !isReadPending_ && !isWritePending_ && !isFinishing_)
+        {
+            isFinishing_ = true;
+            TMS_LOG_DEBUG_IF(isDebug(), logPrefix_, "Calling Finish()");
+            rpc_->Finish(&status_, &finishTag_);
+        }
+    }
+
+    void notifyCallIsDead()
+    {
+        TMS_LOG_INFO(logPrefix_, "Subscription call is dead!");
+        Event disconnectEvent;
+        disconnectEvent.set_feedstatus(FeedStatus::Disconnected);
+        consumer_(disconnectEvent, logPrefix_);
+        notifyDisconnected();
+    }
+
+private:
+    const std::string name_;
+    const std::string logPrefix_;
+
+    grpc::CompletionQueue* queue_;
+    grpc::ClientContext context_;
+    grpc::Status status_;
+    std::unique_ptr< ::grpc::ClientAsyncReaderWriter< Request, Event>> rpc_;
+    Request request_;
+    // Events are parsed into arena memory, reused across Read() calls
+    ArenaEvent<Event> event_;
+    std::function< bool(const Event&, const std::string&)> consumer_;
+
+    OperationTag startTag_;
+    OperationTag writeTag_;
+    OperationTag readTag_;
+    OperationTag writesDoneTag_;
+    OperationTag finishTag_;
+
+    // Listener state, guarded by stateLock_
+    std::mutex stateLock_;
+    std::condition_variable finishedCondition_;
+    std::chrono::milliseconds stopTimeout_;
+    std::chrono::system_clock::time_point stopDeadline_;
+    bool isStarted_;
+    bool isStopRequested_;
+    bool isReadPending_;
+    bool isWritePending_;
+    bool isWritesDoneSent_;
+    bool isReadsDone_;
+    bool isFinishing_;
+    bool isFinished_;
+    // Events delivered to consumer and heap allocations made while handling them
+    long long eventCount_;
+    long long allocationCount_;
+
+    std::atomic<bool> isDebug_;
+};
@@ -0,0 +1,519 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <tmsapigrpc/TMSRemote.grpc.pb.h>
+
+#include "EventView.hpp"
+#include "FieldsView.h"
+
+/**
+Builds events that RecordCache sends to resyncing consumer in place of replayed ones.
+Market data has no removed event: instruments that weren't replayed are dropped from the cache silently.
+*/
+template <class Event> struct ResyncTraits;
+
+template <> struct ResyncTraits<OrderEvent>
+{
+    static void setUpdated(OrderEvent* event, const std::string& key, Fields* fields) { event->mutable_updated()->set_orderid(key); event->mutable_updated()->mutable_fields()->Swap(fields); }
+    // Orders are never removed, they disappear from subscription by being filtered out
+    static bool setRemoved(OrderEvent* event, const std::string& key) { event->mutable_filteredout()->set_orderid(key); return true; }
+};
+
+template <> struct ResyncTraits<TargetEvent>
+{
+    static void setUpdated(TargetEvent* event, int64_t key, Fields* fields) { event->mutable_updated()->set_targetid(key); event->mutable_updated()->mutable_fields()->Swap(fields); }
+    static bool setRemoved(TargetEvent* event, int64_t key) { event->mutable_removed()->set_targetid(key); return true; }
+};
+
+template <> struct ResyncTraits<MarketDataEvent>
+{
+    static void setUpdated(MarketDataEvent* event, const std::string& key, Fields* fields) { event->mutable_update()->set_instrument(key); event->mutable_update()->mutable_fields()->Swap(fields); }
+    static bool setRemoved(MarketDataEvent* event, const std::string& key) { return false; }
+};
+
+template <> struct ResyncTraits<PortfolioEvent>
+{
+    static void setUpdated(PortfolioEvent* event, const std::string& key, Fields* fields) { event->mutable_updated()->set_portfolioname(key); event->mutable_updated()->mutable_fields()->Swap(fields); }
+    static bool setRemoved(PortfolioEvent* event, const std::string& key) { event->mutable_removed()->set_portfolioname(key); return true; }
+};
+
+template <> struct ResyncTraits<RecordEvent>
+{
+    static void setUpdated(RecordEvent* event, const std::string& key, Fields* fields) { event->mutable_updated()->set_recordid(key); event->mutable_updated()->mutable_fields()->Swap(fields); }
+    static bool setRemoved(RecordEvent* event, const std::string& key) { event->mutable_removed()->set_recordid(key); return true; }
+};
+
+/**
+Materialized view of a subscription: up-to-date map of record key (target ID, order ID, portfolio name, record ID) to record fields,
+maintained from Added, Updated, Removed and FilteredOut events as TMSRemote.proto recommends.
+Updated events are merged into stored records field by field, "<NULL>" values remove the field from the record.
+
+Readers never see a record or the map change under them:
+- getRecord() returns a record that stays as it was when it was read, while cache goes on with newer updates;
+- getSnapshot() returns the whole map as of one point of the stream.
+Cache is updated in place as long as nobody holds the data being changed. Data held by readers is copied on write,
+so readers never block the listener for longer than it takes to copy a pointer.
+Note that the first update after getSnapshot() copies the map of pointers (not the records), so take snapshots as often as you need them, not more.
+
+After Reconnected the server replays the whole state. The cache keeps serving the records it has during the replay,
+records are refreshed in place as they are replayed, and on InitialStateReceived records that weren't replayed are removed.
+
+Consumer attached with asResyncingConsumer() is told only what the replay has changed, instead of getting the whole state again:
+- replayed record that is the same as the cached one is not delivered at all;
+- replayed record that differs is delivered as Updated event with changed fields only ("<NULL>" for fields that are gone);
+- record that is new is delivered as is, i.e. as Added;
+- record that wasn't replayed is delivered as Removed (FilteredOut for orders) right before InitialStateReceived.
+Feed status events are always delivered.
+
+Usage:
+	RecordCache<TargetEvent> targets;
+	int listenerId = manager.startListening(&TMSRemote::Stub::PrepareAsyncsubscribeForMarketTargets, request, targets.asConsumer(targetsConsumer), "Targets Listener");
+...
+	if (auto target = targets.getRecord(targetId)) std::cout << target->getFields().getNumeric("FillQty", 0) << std::endl;
+	auto snapshot = targets.getSnapshot();
+	for (const auto& keyAndRecord : *snapshot) ...
+
+	RecordCache<OrderEvent> orders;
+	// process_order() is not called again for orders that are replayed unchanged after Reconnected
+	int listenerId = manager.startListening(&TMSRemote::Stub::PrepareAsyncsubscribeForOrders, request, orders.asResyncingConsumer(ordersConsumer), "Orders Listener");
+*/
+template <class Event> class RecordCache
+{
+public:
+    typedef EventViewTraits<Event> Traits;
+    // Value type of the key: int64_t for targets, std::string for others
+    typedef typename std::decay<typename Traits::Key>::type Key;
+
+    class Record
+    {
+    public:
+        FieldsView getFields() const
+        {
+            return FieldsView(&fields_);
+        }
+
+        // Number of Added/Updated events applied to the record
+        long long getVersion() const
+        {
+            return version_;
+        }
+
+    private:
+        friend class RecordCache;
+
+        Fields fields_;
+        long long version_;
+        // Replay generation the record was last received in, see applyFeedStatus()
+        long long generation_;
+    };
+
+    typedef std::unordered_map<Key, std::shared_ptr<const Record>> Map;
+
+    RecordCache() :
+        records_(std::make_shared<Map>()),
+        generation_(0),
+        isReplaying_(false),
+        isConsistent_(false)
+    {
+        eventCount_.store(0);
+        suppressedCount_.store(0);
+    }
+
+    RecordCache(const RecordCache&) = delete;
+    void operator=(const RecordCache&) = delete;
+
+    // Consumer to pass to startListening(). Events are passed on to nextConsumer, if any, after they are applied to the cache.
+    std::function< bool(const Event&, const std::string&)> asConsumer(std::function< bool(const Event&, const std::string&)> nextConsumer = nullptr)
+    {
+        return [this, nextConsumer](const Event& event, const std::string& caller) {
+            apply(event);
+            return nextConsumer ? nextConsumer(event, caller) : true;
+        };
+    }
+
+    // Consumer to pass to startListening(). Events are applied to the cache, and only changes made by replay after Reconnected are passed on to nextConsumer.
+    std::function< bool(const Event&, const std::string&)> asResyncingConsumer(std::function< bool(const Event&, const std::string&)> nextConsumer)
+    {
+        return [this, nextConsumer](const Event& event, const std::string& caller) {
+            return applyAndResync(event, caller, nextConsumer);
+        };
+    }
+
+    // Applies event to the cache. Events of the same subscription must be applied in order, from one thread at a time.
+    void apply(const Event& event)
+    {
+        std::lock_guard<std::mutex> writeLock(writeLock_);
+        applyImpl(event, NULL);
+    }
+
+    // Returns NULL if there's no such record
+    std::shared_ptr<const Record> getRecord(const Key& key) const
+    {
+        std::lock_guard<std::mutex> lock(publishLock_);
+        auto iter = records_->find(key);
+        return iter != records_->end() ? iter->second : std::shared_ptr<const Record>();
+    }
+
+    // Whole map as of one point of the stream. It's never changed: the cache copies it on the next update.
+    std::shared_ptr<const Map> getSnapshot() const
+    {
+        std::lock_guard<std::mutex> lock(publishLock_);
+        return records_;
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(publishLock_);
+        return records_->size();
+    }
+
+    // False until initial state is received, and from Disconnected until state is received again
+    bool isConsistent() const
+    {
+        std::lock_guard<std::mutex> lock(publishLock_);
+        return isConsistent_;
+    }
+
+    long long getEventCount() const
+    {
+        return eventCount_.load(std::memory_order_relaxed);
+    }
+
+    // Number of replayed events that were not passed on to resyncing consumer because they didn't change anything
+    long long getSuppressedCount() const
+    {
+        return suppressedCount_.load(std::memory_order_relaxed);
+    }
+
+private:
+    typedef std::shared_ptr<Record> RecordPtr;
+    typedef ResyncTraits<Event> Resync;
+
+    // Must be called with writeLock_ held.
+    // Keys of records removed because they weren't replayed are added to removedKeys, if it's not NULL.
+    void applyImpl(const Event& event, std::vector<Key>* removedKeys)
+    {
+        eventCount_.fetch_add(1, std::memory_order_relaxed);
+        if (event.event_case() == Event::EventCase::kFeedStatus)
+        {
+            applyFeedStatus(event.feedstatus(), removedKeys);
+            return;
+        }
+        EventView<Event> view(event);
+        switch (view.getKind())
+        {
+        case EventKind::Added:
+            // Added event carries the whole record
+            upsert(view.getKey(), view.getFields(), true);
+            break;
+        case EventKind::Updated:
+            upsert(view.getKey(), view.getFields(), false);
+            break;
+        case EventKind::Removed:
+        case EventKind::FilteredOut:
+            remove(view.getKey());
+            break;
+        default:
+            break;
+        }
+    }
+
+    bool applyAndResync(const Event& event, const std::string& caller, const std::function< bool(const Event&, const std::string&)>& nextConsumer)
+    {
+        // Events to deliver instead of this one. Delivered outside of writeLock_: consumer may take as long as it needs.
+        std::vector<Event> replacements;
+        bool isDelivered = true;
+        {
+            std::lock_guard<std::mutex> writeLock(writeLock_);
+            if (!isReplaying_)
+            {
+                applyImpl(event, NULL);
+            }
+            else if (event.event_case() == Event::EventCase::kFeedStatus)
+            {
+                std::vector<Key> removedKeys;
+                applyImpl(event, &removedKeys);
+                for (const Key& key : removedKeys)
+                {
+                    Event removed;
+                    if (Resync::setRemoved(&removed, key))
+                    {
+                        replacements.push_back(std::move(removed));
+                    }
+                }
+            }
+            else
+            {
+                EventView<Event> view(event);
+                EventKind kind = view.getKind();
+                // Record can't change under us: we're the only writer
+                std::shared_ptr<const Record> known = getRecord(view.getKey());
+                if (known && (kind == EventKind::Added || kind == EventKind::Updated))
+                {
+                    // Deliver the difference instead, if there's any
+                    isDelivered = false;
+                    Fields changes;
+                    diffFields(view.getFields(), known->fields_, kind == EventKind::Added, &changes);
+                    if (!changes.numericfields().empty() || !changes.stringfields().empty())
+                    {
+                        Event updated;
+                        updated.set_sendingtime(event.sendingtime());
+                        Resync::setUpdated(&updated, view.getKey(), &changes);
+                        replacements.push_back(std::move(updated));
+                    }
+                }
+                else if (!known && (kind == EventKind::Removed || kind == EventKind::FilteredOut))
+                {
+                    // Nothing to remove
+                    isDelivered = false;
+                }
+                // Holding the record would make applyImpl() copy it instead of updating it in place
+                known.reset();
+                if (!isDelivered && replacements.empty())
+                {
+                    suppressedCount_.fetch_add(1, std::memory_order_relaxed);
+                }
+                applyImpl(event, NULL);
+            }
+        }
+        // Stop delivering as soon as consumer asks to stop, same as listener would
+        bool result = true;
+        for (size_t i = 0; i < replacements.size() && result; i++)
+        {
+            result = nextConsumer(replacements[i], caller);
+        }
+        if (isDelivered && result)
+        {
+            result = nextConsumer(event, caller);
+        }
+        return result;
+    }
+
+    // Fields of the update that differ from the record. If update is the whole record, fields it doesn't have are reported as cleared.
+    static void diffFields(const FieldsView& update, const Fields& record, bool isWholeRecord, Fields* changes)
+    {
+        if (update.getFields() != NULL)
+        {
+            for (const auto& field : update.getFields()->numericfields())
+            {
+                auto iter = record.numericfields().find(field.first);
+                if (iter == record.numericfields().end() || iter->second != field.second)
+                {
+                    (*changes->mutable_numericfields())[field.first] = field.second;
+                }
+            }
+            for (const auto& field : update.getFields()->stringfields())
+            {
+                auto iter = record.stringfields().find(field.first);
+                bool isCleared = field.second == FieldsView::NullValue;
+                bool isKnown = iter != record.stringfields().end() || (isCleared && record.numericfields().count(field.first) > 0);
+                if (isCleared ? isKnown : (!isKnown || iter->second != field.second))
+                {
+                    (*changes->mutable_stringfields())[field.first] = field.second;
+                }
+            }
+        }
+        if (isWholeRecord)
+        {
+            for (const auto& field : record.numericfields())
+            {
+                if (!update.contains(field.first))
+                {
+                    (*changes->mutable_stringfields())[field.first] = FieldsView::NullValue;
+                }
+            }
+            for (const auto& field : record.stringfields())
+            {
+                if (!update.contains(field.first))
+                {
+                    (*changes->mutable_stringfields())[field.first] = FieldsView::NullValue;
+                }
+            }
+        }
+    }
+
+    // Must be called with writeLock_ held
+    void applyFeedStatus(FeedStatus status, std::vector<Key>* removedKeys)
+    {
+        switch (status)
+        {
+        case FeedStatus::Disconnected:
+            setConsistent(false);
+            break;
+        case FeedStatus::Reconnected:
+            // Whole state is about to be replayed: mark records we have as not replayed yet
+            generation_++;
+            isReplaying_ = true;
+            setConsistent(false);
+            break;
+        case FeedStatus::InitialStateReceived:
+            if (isReplaying_)
+            {
+                removeNotReplayed(removedKeys);
+                isReplaying_ = false;
+            }
+            setConsistent(true);
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Must be called with writeLock_ held
+    void upsert(const Key& key, const FieldsView& fields, bool isReplace)
+    {
+        // Only the writer changes the map, so it may look it up without publishLock_.
+        // New record is built before the lock is taken: nobody else can see it yet.
+        RecordPtr created;
+        if (records_->find(key) == records_->end())
+        {
+            created = std::make_shared<Record>();
+            mergeFields(fields, &created->fields_);
+            created->version_ = 1;
+            created->generation_ = generation_;
+        }
+        std::unique_lock<std::mutex> lock(publishLock_);
+        Map* records = getWritableMap(lock);
+        if (created)
+        {
+            records->emplace(key, created);
+            publish(records);
+            return;
+        }
+        auto iter = records->find(key);
+        if (iter->second.use_count() > 1)
+        {
+            // Someone holds the record: update a copy and let them keep the old one.
+            // Readers only get records under publishLock_, so nobody can grab the record while we hold it.
+            RecordPtr copy = isReplace ? std::make_shared<Record>() : std::make_shared<Record>(*iter->second);
+            copy->version_ = iter->second->version_;
+            iter->second = copy;
+        }
+        // Record is ours only: update it in place
+        Record* record = const_cast<Record*>(iter->second.get());
+        if (isReplace)
+        {
+            record->fields_.Clear();
+        }
+        mergeFields(fields, &record->fields_);
+        record->version_++;
+        record->generation_ = generation_;
+        publish(records);
+    }
+
+    // Must be called with writeLock_ held
+    void remove(const Key& key)
+    {
+        std::unique_lock<std::mutex> lock(publishLock_);
+        Map* records = getWritableMap(lock);
+        records->erase(key);
+        publish(records);
+    }
+
+    // Must be called with writeLock_ held
+    void removeNotReplayed(std::vector<Key>* removedKeys)
+    {
+        std::unique_lock<std::mutex> lock(publishLock_);
+        Map* records = getWritableMap(lock);
+        for (auto iter = records->begin(); iter != records->end(); )
+        {
+            if (iter->second->generation_ != generation_)
+            {
+                if (removedKeys)
+                {
+                    removedKeys->push_back(iter->first);
+                }
+                iter = records->erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
+        }
+        publish(records);
+    }
+
+    // Must be called with writeLock_ held and lock holding publishLock_, which is held again on return.
+    // Returns the map to change before lock is released: current one if nobody holds a snapshot of it, otherwise its copy,
+    // which stays private until publish(). Uniqueness is checked and the map is changed in one critical section,
+    // so a snapshot taken in between can't see the change.
+    Map* getWritableMap(std::unique_lock<std::mutex>& lock)
+    {
+        if (records_.use_count() == 1)
+        {
+            return records_.get();
+        }
+        std::shared_ptr<Map> records = records_;
+        // Copy outside of publishLock_: readers go on with current map, and there's no other writer to change it.
+        // Records are shared with the snapshot, so they will be copied on write as well.
+        lock.unlock();
+        pendingRecords_ = std::make_shared<Map>(*records);
+        lock.lock();
+        return pendingRecords_.get();
+    }
+
+    // Must be called with writeLock_ and publishLock_ held
+    void publish(Map* records)
+    {
+        if (pendingRecords_ && records == pendingRecords_.get())
+        {
+            records_ = std::move(pendingRecords_);
+            pendingRecords_.reset();
+        }
+    }
+
+    // Must be called with writeLock_ held
+    void setConsistent(bool isConsistent)
+    {
+        std::lock_guard<std::mutex> lock(publishLock_);
+        isConsistent_ = isConsistent;
+    }
+
+    static void mergeFields(const FieldsView& update, Fields* record)
+    {
+        if (update.getFields() == NULL)
+        {
+            return;
+        }
+        for (const auto& field : update.getFields()->numericfields())
+        {
+            (*record->mutable_numericfields())[field.first] = field.second;
+        }
+        for (const auto& field : update.getFields()->stringfields())
+        {
+            if (field.second == FieldsView::NullValue)
+            {
+                // Cleared value, it may be either string or numeric field
+                record->mutable_stringfields()->erase(field.first);
+                record->mutable_numericfields()->erase(field.first);
+            }
+            else
+            {
+                (*record->mutable_stringfields())[field.first] = field.second;
+            }
+        }
+    }
+
+private:
+    // Serializes writers
+    std::mutex writeLock_;
+    // Guards published state: the map pointer, contents of the map while it's not shared, and flags
+    mutable std::mutex publishLock_;
+    std::shared_ptr<Map> records_;
+    // Copy of the map being prepared by writer, accessed under writeLock_ only
+    std::shared_ptr<Map> pendingRecords_;
+
+    long long generation_;
+    bool isReplaying_;
+    bool isConsistent_;
+    std::atomic<long long> eventCount_;
+    std::atomic<long long> suppressedCount_;
+};
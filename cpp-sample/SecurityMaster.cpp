@@ -0,0 +1,909 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <map>
+#include <set>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "AsyncUnaryClient.hpp"
+#include "Clock.h"
+#include "Logger.h"
+
+#include "SecurityMaster.h"
+
+namespace
+{
+	const std::string caller("[SecurityMaster] ");
+	const std::string FieldName_ClosePx("ClosePx");
+	const char Magic[8] = { 'T', 'M', 'S', 'S', 'E', 'C', 'M', 'S' };
+	const uint32_t FormatVersion = 1;
+
+	// Image is a header followed by tables: field names, instruments, exchanges, alternate IDs, values and the string pool.
+	// Every table starts at a multiple of 8 bytes from the image start.
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		// Catches images of a build with a different layout of these structs
+		uint32_t headerSize;
+		int64_t loadTime;
+		uint64_t totalSize;
+		uint32_t fieldCount;
+		uint32_t instrumentCount;
+		uint32_t exchangeCount;
+		uint32_t alternateIdCount;
+		uint32_t valueCount;
+		uint32_t reserved;
+		uint64_t fieldsOffset;
+		uint64_t instrumentsOffset;
+		uint64_t exchangesOffset;
+		uint64_t alternateIdsOffset;
+		uint64_t valuesOffset;
+		uint64_t stringsOffset;
+		uint64_t stringsSize;
+	};
+
+	// String in the string pool
+	struct StringRef
+	{
+		uint32_t offset;
+		uint32_t length;
+	};
+
+	// Instrument or exchange: its values are contiguous in the value table, sorted by field ID
+	struct Record
+	{
+		StringRef key;
+		uint32_t firstValue;
+		uint32_t valueCount;
+	};
+
+	struct Value
+	{
+		uint32_t fieldId;
+		uint32_t isNumeric;
+		StringRef string;
+		double numeric;
+	};
+
+	struct AlternateId
+	{
+		StringRef source;
+		StringRef id;
+		// Index in the instrument table
+		uint32_t instrument;
+		uint32_t reserved;
+	};
+
+	// (source, ID, instrument)
+	typedef std::tuple<std::string, std::string, std::string> AlternateIdEntry;
+
+	size_t align(size_t offset)
+	{
+		return (offset + 7)/8*8;
+	}
+
+	// Strings are stored once however many values share them
+	class StringPool
+	{
+	public:
+		bool add(const std::string& value, StringRef* ref)
+		{
+			auto iter = refs_.find(value);
+			if (iter == refs_.end())
+			{
+				if (pool_.size() + value.size() > UINT32_MAX)
+				{
+					return false;
+				}
+				StringRef newRef{ (uint32_t)pool_.size(), (uint32_t)value.size() };
+				pool_.append(value);
+				iter = refs_.emplace(value, newRef).first;
+			}
+			*ref = iter->second;
+			return true;
+		}
+
+		const std::string& getPool() const
+		{
+			return pool_;
+		}
+
+	private:
+		std::unordered_map<std::string, StringRef> refs_;
+		std::string pool_;
+	};
+
+	// Lays out the image of the infos, empty if it doesn't fit 32-bit offsets
+	std::vector<char> buildImage(const std::map<std::string, Fields>& instruments, const std::map<std::string, Fields>& exchanges,
+		const std::vector<AlternateIdEntry>& alternateIds, int64_t loadTime)
+	{
+		std::map<std::string, uint32_t> fieldIds;
+		for (const std::map<std::string, Fields>* infos : { &instruments, &exchanges })
+		{
+			for (const auto& info : *infos)
+			{
+				for (const auto& field : info.second.stringfields())
+				{
+					fieldIds.emplace(field.first, 0);
+				}
+				for (const auto& field : info.second.numericfields())
+				{
+					fieldIds.emplace(field.first, 0);
+				}
+			}
+		}
+		StringPool strings;
+		std::vector<StringRef> fieldNames;
+		for (auto& fieldId : fieldIds)
+		{
+			fieldId.second = (uint32_t)fieldNames.size();
+			fieldNames.emplace_back();
+			strings.add(fieldId.first, &fieldNames.back());
+		}
+
+		bool fits = true;
+		std::vector<Value> values;
+		auto addRecords = [&fieldIds, &strings, &values, &fits](const std::map<std::string, Fields>& infos, std::vector<Record>* records) {
+			for (const auto& info : infos)
+			{
+				Record record;
+				fits = fits && strings.add(info.first, &record.key);
+				record.firstValue = (uint32_t)values.size();
+				for (const auto& field : info.second.stringfields())
+				{
+					Value value{ fieldIds[field.first], 0, {}, 0 };
+					fits = fits && strings.add(field.second, &value.string);
+					values.push_back(value);
+				}
+				for (const auto& field : info.second.numericfields())
+				{
+					values.push_back(Value{ fieldIds[field.first], 1, {}, field.second });
+				}
+				std::sort(values.begin() + record.firstValue, values.end(), [](const Value& left, const Value& right) { return left.fieldId < right.fieldId; });
+				record.valueCount = (uint32_t)(values.size() - record.firstValue);
+				records->push_back(record);
+			}
+		};
+		std::vector<Record> instrumentRecords;
+		std::vector<Record> exchangeRecords;
+		addRecords(instruments, &instrumentRecords);
+		addRecords(exchanges, &exchangeRecords);
+
+		std::unordered_map<std::string, uint32_t> instrumentIndexes;
+		for (const auto& info : instruments)
+		{
+			instrumentIndexes.emplace(info.first, (uint32_t)instrumentIndexes.size());
+		}
+		std::vector<AlternateId> alternateIdRecords;
+		for (const AlternateIdEntry& entry : alternateIds)
+		{
+			auto instrument = instrumentIndexes.find(std::get<2>(entry));
+			if (instrument != instrumentIndexes.end())
+			{
+				AlternateId alternateId{ {}, {}, instrument->second, 0 };
+				fits = fits && strings.add(std::get<0>(entry), &alternateId.source) && strings.add(std::get<1>(entry), &alternateId.id);
+				alternateIdRecords.push_back(alternateId);
+			}
+		}
+		if (!fits || values.size() > UINT32_MAX)
+		{
+			return std::vector<char>();
+		}
+
+		Header header;
+		std::memset(&header, 0, sizeof(header));
+		std::memcpy(header.magic, Magic, sizeof(Magic));
+		header.version = FormatVersion;
+		header.headerSize = sizeof(Header);
+		header.loadTime = loadTime;
+		header.fieldCount = (uint32_t)fieldNames.size();
+		header.instrumentCount = (uint32_t)instrumentRecords.size();
+		header.exchangeCount = (uint32_t)exchangeRecords.size();
+		header.alternateIdCount = (uint32_t)alternateIdRecords.size();
+		header.valueCount = (uint32_t)values.size();
+		header.fieldsOffset = align(sizeof(Header));
+		header.instrumentsOffset = align(header.fieldsOffset + fieldNames.size()*sizeof(StringRef));
+		header.exchangesOffset = align(header.instrumentsOffset + instrumentRecords.size()*sizeof(Record));
+		header.alternateIdsOffset = align(header.exchangesOffset + exchangeRecords.size()*sizeof(Record));
+		header.valuesOffset = align(header.alternateIdsOffset + alternateIdRecords.size()*sizeof(AlternateId));
+		header.stringsOffset = align(header.valuesOffset + values.size()*sizeof(Value));
+		header.stringsSize = strings.getPool().size();
+		header.totalSize = align(header.stringsOffset + header.stringsSize);
+
+		std::vector<char> image(header.totalSize, 0);
+		std::memcpy(image.data(), &header, sizeof(header));
+		std::memcpy(image.data() + header.fieldsOffset, fieldNames.data(), fieldNames.size()*sizeof(StringRef));
+		std::memcpy(image.data() + header.instrumentsOffset, instrumentRecords.data(), instrumentRecords.size()*sizeof(Record));
+		std::memcpy(image.data() + header.exchangesOffset, exchangeRecords.data(), exchangeRecords.size()*sizeof(Record));
+		std::memcpy(image.data() + header.alternateIdsOffset, alternateIdRecords.data(), alternateIdRecords.size()*sizeof(AlternateId));
+		std::memcpy(image.data() + header.valuesOffset, values.data(), values.size()*sizeof(Value));
+		std::memcpy(image.data() + header.stringsOffset, strings.getPool().data(), strings.getPool().size());
+		return image;
+	}
+
+	// Keys infos by their name field, or by position when the reply has one info per requested name
+	void addInfos(const google::protobuf::RepeatedPtrField<Fields>& infos, const std::vector<std::string>& names, const std::string& nameField,
+		std::map<std::string, Fields>* keyedInfos, const char* kind)
+	{
+		size_t unnamedCount = 0;
+		for (int i = 0; i < infos.size(); i++)
+		{
+			auto name = infos[i].stringfields().find(nameField);
+			if (name != infos[i].stringfields().end() && !name->second.empty())
+			{
+				(*keyedInfos)[name->second] = infos[i];
+			}
+			else if ((size_t)infos.size() == names.size())
+			{
+				(*keyedInfos)[names[i]] = infos[i];
+			}
+			else
+			{
+				unnamedCount++;
+			}
+		}
+		if (unnamedCount > 0)
+		{
+			TMS_LOG_WARNING(caller, unnamedCount, " ", kind, " infos without ", nameField, " field are skipped: reply has ", infos.size(), " infos for ", names.size(), " names");
+		}
+	}
+};
+
+class SecurityMaster::Image
+{
+public:
+	// Takes over image built by buildImage()
+	explicit Image(std::vector<char>&& buffer) :
+		buffer_(std::move(buffer)),
+		data_(nullptr),
+		size_(0),
+		isMapped_(false)
+	{
+		if (!buffer_.empty() && index(buffer_.data(), buffer_.size()))
+		{
+			data_ = buffer_.data();
+			size_ = buffer_.size();
+		}
+	}
+
+	// Maps image file, isValid() tells whether it was mapped and valid
+	explicit Image(const std::string& path) :
+		data_(nullptr),
+		size_(0),
+		isMapped_(true)
+	{
+		const char* data = nullptr;
+		size_t size = 0;
+#ifdef WIN32
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			return;
+		}
+		LARGE_INTEGER fileSize;
+		if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+		{
+			// View keeps the mapping alive after its handles are closed
+			HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (mapping != nullptr)
+			{
+				data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+				size = (size_t)fileSize.QuadPart;
+				CloseHandle(mapping);
+			}
+		}
+		CloseHandle(file);
+#else
+		int file = ::open(path.c_str(), O_RDONLY);
+		if (file < 0)
+		{
+			return;
+		}
+		struct stat fileStat;
+		if (fstat(file, &fileStat) == 0 && fileStat.st_size > 0)
+		{
+			// Mapping stays valid after the file is closed, and after it's replaced by a later save()
+			void* mapped = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_SHARED, file, 0);
+			if (mapped != MAP_FAILED)
+			{
+				data = (const char*)mapped;
+				size = (size_t)fileStat.st_size;
+			}
+		}
+		close(file);
+#endif
+		if (data == nullptr)
+		{
+			return;
+		}
+		if (index(data, size))
+		{
+			data_ = data;
+			size_ = size;
+		}
+		else
+		{
+			unmap(data, size);
+		}
+	}
+
+	~Image()
+	{
+		if (isMapped_ && data_ != nullptr)
+		{
+			unmap(data_, size_);
+		}
+	}
+
+	Image(const Image&) = delete;
+	void operator=(const Image&) = delete;
+
+	bool isValid() const
+	{
+		return data_ != nullptr;
+	}
+
+	const char* getData() const
+	{
+		return data_;
+	}
+
+	size_t getSize() const
+	{
+		return size_;
+	}
+
+	bool isMapped() const
+	{
+		return isMapped_;
+	}
+
+	const Header& getHeader() const
+	{
+		return *header_;
+	}
+
+	const Record* findInstrument(const std::string& instrument) const
+	{
+		auto iter = instruments_.find(instrument);
+		return iter != instruments_.end() ? iter->second : nullptr;
+	}
+
+	const Record* findExchange(const std::string& exchange) const
+	{
+		auto iter = exchanges_.find(exchange);
+		return iter != exchanges_.end() ? iter->second : nullptr;
+	}
+
+	const Record* findAlternateId(const std::string& source, const std::string& id) const
+	{
+		auto ids = alternateIds_.find(source);
+		if (ids == alternateIds_.end())
+		{
+			return nullptr;
+		}
+		auto iter = ids->second.find(id);
+		return iter != ids->second.end() ? iter->second : nullptr;
+	}
+
+	// Null if the record has no such field of that kind
+	const Value* findValue(const Record* record, const std::string& field, bool isNumeric) const
+	{
+		auto fieldId = fieldIds_.find(field);
+		if (record == nullptr || fieldId == fieldIds_.end())
+		{
+			return nullptr;
+		}
+		const Value* first = values_ + record->firstValue;
+		const Value* last = first + record->valueCount;
+		const Value* value = std::lower_bound(first, last, fieldId->second, [](const Value& value, uint32_t id) { return value.fieldId < id; });
+		// A name may have both a string and a numeric value
+		for (; value != last && value->fieldId == fieldId->second; value++)
+		{
+			if ((value->isNumeric != 0) == isNumeric)
+			{
+				return value;
+			}
+		}
+		return nullptr;
+	}
+
+	std::string_view getString(const StringRef& ref) const
+	{
+		return std::string_view(strings_ + ref.offset, ref.length);
+	}
+
+	void getFields(const Record* record, Fields* fields) const
+	{
+		fields->Clear();
+		for (const Value* value = values_ + record->firstValue; value != values_ + record->firstValue + record->valueCount; value++)
+		{
+			std::string name(getString(fieldNames_[value->fieldId]));
+			if (value->isNumeric)
+			{
+				(*fields->mutable_numericfields())[name] = value->numeric;
+			}
+			else
+			{
+				(*fields->mutable_stringfields())[name] = std::string(getString(value->string));
+			}
+		}
+	}
+
+	size_t getAlternateIdCount() const
+	{
+		return header_->alternateIdCount;
+	}
+
+private:
+	// Checks that every table and string is within the image, then builds the indexes
+	bool index(const char* data, size_t size)
+	{
+		if (size < sizeof(Header))
+		{
+			return false;
+		}
+		const Header* header = (const Header*)data;
+		if (std::memcmp(header->magic, Magic, sizeof(Magic)) != 0 || header->version != FormatVersion || header->headerSize != sizeof(Header) || header->totalSize != size)
+		{
+			return false;
+		}
+		auto isTableValid = [size](uint64_t offset, uint64_t count, size_t entrySize) {
+			return offset % 8 == 0 && offset <= size && count <= (size - offset)/entrySize;
+		};
+		if (!isTableValid(header->fieldsOffset, header->fieldCount, sizeof(StringRef))
+			|| !isTableValid(header->instrumentsOffset, header->instrumentCount, sizeof(Record))
+			|| !isTableValid(header->exchangesOffset, header->exchangeCount, sizeof(Record))
+			|| !isTableValid(header->alternateIdsOffset, header->alternateIdCount, sizeof(AlternateId))
+			|| !isTableValid(header->valuesOffset, header->valueCount, sizeof(Value))
+			|| !isTableValid(header->stringsOffset, header->stringsSize, 1))
+		{
+			return false;
+		}
+		header_ = header;
+		fieldNames_ = (const StringRef*)(data + header->fieldsOffset);
+		values_ = (const Value*)(data + header->valuesOffset);
+		strings_ = data + header->stringsOffset;
+		auto isStringValid = [header](const StringRef& ref) {
+			return ref.offset <= header->stringsSize && ref.length <= header->stringsSize - ref.offset;
+		};
+		auto isRecordValid = [header, &isStringValid](const Record& record) {
+			return isStringValid(record.key) && record.firstValue <= header->valueCount && record.valueCount <= header->valueCount - record.firstValue;
+		};
+
+		for (uint32_t i = 0; i < header->fieldCount; i++)
+		{
+			if (!isStringValid(fieldNames_[i]))
+			{
+				return false;
+			}
+			fieldIds_.emplace(getString(fieldNames_[i]), i);
+		}
+		for (uint32_t i = 0; i < header->valueCount; i++)
+		{
+			if (values_[i].fieldId >= header->fieldCount || (!values_[i].isNumeric && !isStringValid(values_[i].string)))
+			{
+				return false;
+			}
+		}
+		const Record* instruments = (const Record*)(data + header->instrumentsOffset);
+		instruments_.reserve(header->instrumentCount);
+		for (uint32_t i = 0; i < header->instrumentCount; i++)
+		{
+			if (!isRecordValid(instruments[i]))
+			{
+				return false;
+			}
+			instruments_.emplace(getString(instruments[i].key), instruments + i);
+		}
+		const Record* exchanges = (const Record*)(data + header->exchangesOffset);
+		for (uint32_t i = 0; i < header->exchangeCount; i++)
+		{
+			if (!isRecordValid(exchanges[i]))
+			{
+				return false;
+			}
+			exchanges_.emplace(getString(exchanges[i].key), exchanges + i);
+		}
+		const AlternateId* alternateIds = (const AlternateId*)(data + header->alternateIdsOffset);
+		for (uint32_t i = 0; i < header->alternateIdCount; i++)
+		{
+			if (!isStringValid(alternateIds[i].source) || !isStringValid(alternateIds[i].id) || alternateIds[i].instrument >= header->instrumentCount)
+			{
+				return false;
+			}
+			alternateIds_[getString(alternateIds[i].source)].emplace(getString(alternateIds[i].id), instruments + alternateIds[i].instrument);
+		}
+		return true;
+	}
+
+	static void unmap(const char* data, size_t size)
+	{
+#ifdef WIN32
+		UnmapViewOfFile(data);
+#else
+		munmap((void*)data, size);
+#endif
+	}
+
+private:
+	std::vector<char> buffer_;
+	const char* data_;
+	size_t size_;
+	bool isMapped_;
+
+	const Header* header_;
+	const StringRef* fieldNames_;
+	const Value* values_;
+	const char* strings_;
+	// Indexes are built when the image is created or mapped, so they're never read while being changed
+	// Keys are views of the string pool
+	std::unordered_map<std::string_view, uint32_t> fieldIds_;
+	std::unordered_map<std::string_view, const Record*> instruments_;
+	std::unordered_map<std::string_view, const Record*> exchanges_;
+	std::unordered_map<std::string_view, std::unordered_map<std::string_view, const Record*>> alternateIds_;
+};
+
+SecurityMasterOptions::SecurityMasterOptions() :
+	batchSize(500),
+	timeout(30000),
+	instrumentField("Instrument"),
+	exchangeField("Exchange"),
+	maxImageAge(std::chrono::hours(12))
+{
+}
+
+SecurityMaster::SecurityMaster(const SecurityMasterOptions& options) :
+	options_(options)
+{
+}
+
+SecurityMaster::~SecurityMaster()
+{
+}
+
+bool SecurityMaster::load(TMSRemote::Stub& stub, const std::vector<std::string>& instruments, const std::vector<std::pair<std::string, std::string>>& alternateIds)
+{
+	int64_t startTime = Clock::getWallTime();
+	size_t batchSize = (size_t)std::max(options_.batchSize, 1);
+	AsyncUnaryClient asyncClient(stub);
+	asyncClient.setTimeout(options_.timeout);
+
+	// Every request is sent before the first reply is waited for
+	std::future<UnaryResult<IdsResponse>> sourcesReply = asyncClient.call(&TMSRemote::Stub::PrepareAsyncgetInstrumentAlternateIdSources, Void());
+	std::vector<std::vector<std::string>> instrumentBatches;
+	std::vector<std::future<UnaryResult<InstrumentInfosResponse>>> instrumentReplies;
+	for (size_t first = 0; first < instruments.size(); first += batchSize)
+	{
+		instrumentBatches.emplace_back(instruments.begin() + first, instruments.begin() + std::min(first + batchSize, instruments.size()));
+		InstrumentInfosRequest request;
+		for (const std::string& instrument : instrumentBatches.back())
+		{
+			request.add_instrument(instrument);
+		}
+		instrumentReplies.push_back(asyncClient.call(&TMSRemote::Stub::PrepareAsyncgetInstrumentInfos, request));
+	}
+	std::vector<std::future<UnaryResult<InstrumentInfosResponse>>> alternateIdReplies;
+	for (const std::pair<std::string, std::string>& alternateId : alternateIds)
+	{
+		InstrumentInfosByAlternateIdRequest request;
+		request.set_alternateidsource(alternateId.first);
+		request.set_alternateinstrid(alternateId.second);
+		alternateIdReplies.push_back(asyncClient.call(&TMSRemote::Stub::PrepareAsyncgetInstrumentInfosByAlternateId, request));
+	}
+
+	bool isComplete = true;
+	std::map<std::string, Fields> instrumentInfos;
+	for (size_t i = 0; i < instrumentReplies.size(); i++)
+	{
+		UnaryResult<InstrumentInfosResponse> reply = instrumentReplies[i].get();
+		if (reply.status.ok())
+		{
+			addInfos(reply.response.instrumentinfo(), instrumentBatches[i], options_.instrumentField, &instrumentInfos, "instrument");
+		}
+		else
+		{
+			TMS_LOG_ERROR(caller, "getInstrumentInfos of ", instrumentBatches[i].size(), " instruments failed: ", reply.status.error_message());
+			isComplete = false;
+		}
+	}
+	std::vector<AlternateIdEntry> alternateIdEntries;
+	for (size_t i = 0; i < alternateIdReplies.size(); i++)
+	{
+		UnaryResult<InstrumentInfosResponse> reply = alternateIdReplies[i].get();
+		if (!reply.status.ok())
+		{
+			TMS_LOG_ERROR(caller, "getInstrumentInfosByAlternateId of ", alternateIds[i].first, " ", alternateIds[i].second, " failed: ", reply.status.error_message());
+			isComplete = false;
+			continue;
+		}
+		for (const Fields& info : reply.response.instrumentinfo())
+		{
+			auto instrument = info.stringfields().find(options_.instrumentField);
+			if (instrument == info.stringfields().end() || instrument->second.empty())
+			{
+				TMS_LOG_WARNING(caller, "Instrument of ", alternateIds[i].first, " ", alternateIds[i].second, " has no ", options_.instrumentField, " field, it's skipped");
+				continue;
+			}
+			instrumentInfos.emplace(instrument->second, info);
+			alternateIdEntries.emplace_back(alternateIds[i].first, alternateIds[i].second, instrument->second);
+		}
+	}
+
+	// Exchanges of the loaded instruments, which are only known now
+	std::set<std::string> exchangeNames(options_.exchanges.begin(), options_.exchanges.end());
+	for (const auto& info : instrumentInfos)
+	{
+		auto exchange = info.second.stringfields().find(options_.exchangeField);
+		if (exchange != info.second.stringfields().end() && !exchange->second.empty())
+		{
+			exchangeNames.insert(exchange->second);
+		}
+	}
+	std::vector<std::vector<std::string>> exchangeBatches;
+	std::vector<std::future<UnaryResult<ExchangeInfosResponse>>> exchangeReplies;
+	for (const std::string& exchange : exchangeNames)
+	{
+		if (exchangeBatches.empty() || exchangeBatches.back().size() >= batchSize)
+		{
+			exchangeBatches.emplace_back();
+		}
+		exchangeBatches.back().push_back(exchange);
+	}
+	for (const std::vector<std::string>& batch : exchangeBatches)
+	{
+		ExchangeInfosRequest request;
+		for (const std::string& exchange : batch)
+		{
+			request.add_exchange(exchange);
+		}
+		exchangeReplies.push_back(asyncClient.call(&TMSRemote::Stub::PrepareAsyncgetExchangeInfos, request));
+	}
+	std::map<std::string, Fields> exchangeInfos;
+	for (size_t i = 0; i < exchangeReplies.size(); i++)
+	{
+		UnaryResult<ExchangeInfosResponse> reply = exchangeReplies[i].get();
+		if (reply.status.ok())
+		{
+			addInfos(reply.response.exchangeinfo(), exchangeBatches[i], options_.exchangeField, &exchangeInfos, "exchange");
+		}
+		else
+		{
+			TMS_LOG_ERROR(caller, "getExchangeInfos of ", exchangeBatches[i].size(), " exchanges failed: ", reply.status.error_message());
+			isComplete = false;
+		}
+	}
+
+	// Instrument's string field named as an alternate ID source is its ID there
+	UnaryResult<IdsResponse> sources = sourcesReply.get();
+	if (sources.status.ok())
+	{
+		for (const std::string& source : sources.response.id())
+		{
+			for (const auto& info : instrumentInfos)
+			{
+				auto id = info.second.stringfields().find(source);
+				if (id != info.second.stringfields().end() && !id->second.empty())
+				{
+					alternateIdEntries.emplace_back(source, id->second, info.first);
+				}
+			}
+		}
+	}
+	else
+	{
+		TMS_LOG_ERROR(caller, "getInstrumentAlternateIdSources failed: ", sources.status.error_message());
+		isComplete = false;
+	}
+
+	if (!isComplete && (isLoaded() || instrumentInfos.empty()))
+	{
+		TMS_LOG_WARNING(caller, "Load is incomplete, ", isLoaded() ? "current image is kept" : "nothing to use");
+		return false;
+	}
+	std::shared_ptr<const Image> image = std::make_shared<Image>(buildImage(instrumentInfos, exchangeInfos, alternateIdEntries, Clock::getWallTime()));
+	if (!image->isValid())
+	{
+		TMS_LOG_ERROR(caller, "Security master of ", instrumentInfos.size(), " instruments doesn't fit in an image");
+		return false;
+	}
+	setImage(image);
+	TMS_LOG_INFO(caller, isComplete ? "Loaded " : "Partially loaded ", instrumentInfos.size(), " of ", instruments.size(), " instruments, ", exchangeInfos.size(), " exchanges and ", image->getAlternateIdCount(),
+		" alternate IDs in ", instrumentReplies.size() + exchangeReplies.size() + alternateIdReplies.size() + 1, " requests, ", (Clock::getWallTime() - startTime)/1000, " us, ", image->getSize(), " bytes");
+	if (isComplete && !options_.path.empty())
+	{
+		// Partial image serves this process until the next load, but must not be a later warm start's image
+		save(options_.path);
+	}
+	return isComplete;
+}
+
+bool SecurityMaster::open(const std::string& path)
+{
+	int64_t startTime = Clock::getWallTime();
+	std::shared_ptr<const Image> image = std::make_shared<Image>(path);
+	if (!image->isValid())
+	{
+		TMS_LOG_INFO(caller, "There's no valid security master image in ", path);
+		return false;
+	}
+	int64_t age = Clock::getWallTime() - image->getHeader().loadTime;
+	int64_t maxAge = std::chrono::duration_cast<std::chrono::nanoseconds>(options_.maxImageAge).count();
+	if (maxAge > 0 && age > maxAge)
+	{
+		TMS_LOG_INFO(caller, "Security master image in ", path, " was loaded ", age/1000000000/60, " minutes ago, it's too old to use");
+		return false;
+	}
+	setImage(image);
+	TMS_LOG_INFO(caller, "Mapped ", path, ": ", image->getHeader().instrumentCount, " instruments, ", image->getHeader().exchangeCount, " exchanges and ",
+		image->getAlternateIdCount(), " alternate IDs in ", (Clock::getWallTime() - startTime)/1000, " us");
+	return true;
+}
+
+bool SecurityMaster::save(const std::string& path) const
+{
+	std::shared_ptr<const Image> image = getImage();
+	if (!image)
+	{
+		return false;
+	}
+	// Written aside and renamed, so that a reader never maps a partial file
+	std::string temporaryPath = path + ".tmp";
+	{
+		std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+		file.write(image->getData(), (std::streamsize)image->getSize());
+		if (!file.flush())
+		{
+			TMS_LOG_ERROR(caller, "Unable to write ", temporaryPath);
+			return false;
+		}
+	}
+#ifdef WIN32
+	// rename() doesn't replace an existing file there, and a file that is mapped can't be removed: image saved by another process stays
+	std::remove(path.c_str());
+#endif
+	if (std::rename(temporaryPath.c_str(), path.c_str()) != 0)
+	{
+		TMS_LOG_ERROR(caller, "Unable to replace ", path);
+		std::remove(temporaryPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool SecurityMaster::isLoaded() const
+{
+	return getImage() != nullptr;
+}
+
+SecurityMasterStats SecurityMaster::getStats() const
+{
+	SecurityMasterStats stats{};
+	std::shared_ptr<const Image> image = getImage();
+	if (image)
+	{
+		stats.instruments = image->getHeader().instrumentCount;
+		stats.exchanges = image->getHeader().exchangeCount;
+		stats.alternateIds = image->getHeader().alternateIdCount;
+		stats.fieldNames = image->getHeader().fieldCount;
+		stats.bytes = image->getSize();
+		stats.isMapped = image->isMapped();
+		stats.loadTime = image->getHeader().loadTime;
+	}
+	return stats;
+}
+
+bool SecurityMaster::hasInstrument(const std::string& instrument) const
+{
+	std::shared_ptr<const Image> image = getImage();
+	return image && image->findInstrument(instrument) != nullptr;
+}
+
+bool SecurityMaster::getNumeric(const std::string& instrument, const std::string& field, double* value) const
+{
+	std::shared_ptr<const Image> image = getImage();
+	const Value* found = image ? image->findValue(image->findInstrument(instrument), field, true) : nullptr;
+	if (found)
+	{
+		*value = found->numeric;
+	}
+	return found != nullptr;
+}
+
+bool SecurityMaster::getString(const std::string& instrument, const std::string& field, std::string* value) const
+{
+	std::shared_ptr<const Image> image = getImage();
+	const Value* found = image ? image->findValue(image->findInstrument(instrument), field, false) : nullptr;
+	if (found)
+	{
+		value->assign(image->getString(found->string));
+	}
+	return found != nullptr;
+}
+
+bool SecurityMaster::getInstrumentInfo(const std::string& instrument, Fields* info) const
+{
+	std::shared_ptr<const Image> image = getImage();
+	const Record* record = image ? image->findInstrument(instrument) : nullptr;
+	if (record)
+	{
+		image->getFields(record, info);
+	}
+	return record != nullptr;
+}
+
+bool SecurityMaster::getExchangeNumeric(const std::string& exchange, const std::string& field, double* value) const
+{
+	std::shared_ptr<const Image> image = getImage();
+	const Value* found = image ? image->findValue(image->findExchange(exchange), field, true) : nullptr;
+	if (found)
+	{
+		*value = found->numeric;
+	}
+	return found != nullptr;
+}
+
+bool SecurityMaster::getExchangeString(const std::string& exchange, const std::string& field, std::string* value) const
+{
+	std::shared_ptr<const Image> image = getImage();
+	const Value* found = image ? image->findValue(image->findExchange(exchange), field, false) : nullptr;
+	if (found)
+	{
+		value->assign(image->getString(found->string));
+	}
+	return found != nullptr;
+}
+
+bool SecurityMaster::getExchangeInfo(const std::string& exchange, Fields* info) const
+{
+	std::shared_ptr<const Image> image = getImage();
+	const Record* record = image ? image->findExchange(exchange) : nullptr;
+	if (record)
+	{
+		image->getFields(record, info);
+	}
+	return record != nullptr;
+}
+
+bool SecurityMaster::findInstrument(const std::string& alternateIdSource, const std::string& alternateId, std::string* instrument) const
+{
+	std::shared_ptr<const Image> image = getImage();
+	const Record* record = image ? image->findAlternateId(alternateIdSource, alternateId) : nullptr;
+	if (record)
+	{
+		instrument->assign(image->getString(record->key));
+	}
+	return record != nullptr;
+}
+
+double SecurityMaster::getClosePx(const std::string& instrument) const
+{
+	double closePx;
+	return getNumeric(instrument, FieldName_ClosePx, &closePx) ? closePx : NAN;
+}
+
+std::shared_ptr<const SecurityMaster::Image> SecurityMaster::getImage() const
+{
+	return std::atomic_load(&image_);
+}
+
+void SecurityMaster::setImage(const std::shared_ptr<const Image>& image)
+{
+	std::atomic_store(&image_, image);
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <tmsapigrpc/TMSRemote.grpc.pb.h>
+
+struct SecurityMasterOptions
+{
+	SecurityMasterOptions();
+
+	// Instruments per getInstrumentInfos and exchanges per getExchangeInfos request
+	int batchSize;
+	// Deadline of each request of a load
+	std::chrono::milliseconds timeout;
+	// String field naming the instrument of an instrument info, and the exchange of an exchange info and of an instrument.
+	// When a reply doesn't have it, its infos are matched to the request by position.
+	std::string instrumentField;
+	std::string exchangeField;
+	// Exchanges loaded in addition to those of the loaded instruments
+	std::vector<std::string> exchanges;
+	// Image is saved there after every successful load, empty to keep it in memory only
+	std::string path;
+	// open() rejects images loaded longer ago: close prices and other infos change every session. Zero accepts images of any age.
+	std::chrono::seconds maxImageAge;
+};
+
+struct SecurityMasterStats
+{
+	size_t instruments;
+	size_t exchanges;
+	size_t alternateIds;
+	size_t fieldNames;
+	// Size of the image, the same in memory and on disk
+	size_t bytes;
+	// True if the image is the mapped file rather than a load from the server
+	bool isMapped;
+	// Wall time the image was loaded from the server, in nanoseconds since epoch
+	int64_t loadTime;
+};
+
+/**
+Local copy of the security master: instrument infos, exchange infos and alternate instrument IDs, loaded from the server in bulk
+so that lookups never make an RPC. A load sends instruments in batches of batchSize per getInstrumentInfos request and exchanges in
+batches per getExchangeInfos request, all of them in flight at the same time, so loading a universe takes a few round trips.
+Alternate IDs come from the instrument infos themselves: a string field named as one of getInstrumentAlternateIdSources is the
+instrument's ID in that source. IDs asked for explicitly are resolved by getInstrumentInfosByAlternateId, which takes one ID per request,
+so they are pipelined as well.
+
+Loaded data is kept as a compact immutable image: tables of records, field values and names, and a single string pool, laid out
+the same way in memory and on disk. Saving writes the image as it is; opening the file maps it and only builds hash indexes over it,
+so a warm start is ready in milliseconds and may be refreshed from the server in the background. Images older than maxImageAge are
+rejected, so a warm start never serves the previous session's data. A lookup is two hash probes and a binary search in the record's
+values, sorted by field, with no copy of the strings. Lookups take the current image with std::atomic_load(), which standard libraries
+implement with a short lock around the pointer copy: lookups never wait for a load, but they're not lock-free.
+
+Loading or opening swaps in the new image atomically: lookups running at that time finish on the old one.
+The file is native-endian and versioned, an image saved by a different build is rejected rather than misread.
+
+Usage:
+	SecurityMasterOptions options;
+	options.path = "security_master.bin";
+	SecurityMaster securityMaster(options);
+	if (!securityMaster.open(options.path)) // Warm start
+	{
+		securityMaster.load(*client.client_, instruments); // Cold start, saves the file
+	}
+...
+	double closePx = securityMaster.getClosePx("IBM"); // Any thread, no RPC
+	std::string currency;
+	securityMaster.getString("VOD LN", "Currency", &currency);
+	std::string instrument;
+	securityMaster.findInstrument("ISIN", "GB00BH4HKS39", &instrument);
+*/
+class SecurityMaster
+{
+public:
+	explicit SecurityMaster(const SecurityMasterOptions& options = SecurityMasterOptions());
+	~SecurityMaster();
+
+	SecurityMaster(const SecurityMaster&) = delete;
+	void operator=(const SecurityMaster&) = delete;
+
+	// Blocking bulk load of instruments, their exchanges and alternate IDs; alternateIds are (source, ID) pairs resolved in addition.
+	// Returns false if any request has failed: the current image is kept then, unless there's none yet and something was loaded.
+	// Only complete loads are saved.
+	bool load(TMSRemote::Stub& stub, const std::vector<std::string>& instruments, const std::vector<std::pair<std::string, std::string>>& alternateIds = {});
+	// Maps image saved earlier, false if it's missing, invalid or older than maxImageAge
+	bool open(const std::string& path);
+	bool save(const std::string& path) const;
+	bool isLoaded() const;
+	SecurityMasterStats getStats() const;
+
+	// Lookups: any thread, never wait for a load. False if the instrument, the exchange or the field is not known.
+	bool hasInstrument(const std::string& instrument) const;
+	bool getNumeric(const std::string& instrument, const std::string& field, double* value) const;
+	bool getString(const std::string& instrument, const std::string& field, std::string* value) const;
+	bool getInstrumentInfo(const std::string& instrument, Fields* info) const;
+	bool getExchangeNumeric(const std::string& exchange, const std::string& field, double* value) const;
+	bool getExchangeString(const std::string& exchange, const std::string& field, std::string* value) const;
+	bool getExchangeInfo(const std::string& exchange, Fields* info) const;
+	bool findInstrument(const std::string& alternateIdSource, const std::string& alternateId, std::string* instrument) const;
+	// NAN if not known
+	double getClosePx(const std::string& instrument) const;
+
+private:
+	class Image;
+
+	std::shared_ptr<const Image> getImage() const;
+	void setImage(const std::shared_ptr<const Image>& image);
+
+private:
+	const SecurityMasterOptions options_;
+	// Replaced with std::atomic_store(), read with std::atomic_load()
+	std::shared_ptr<const Image> image_;
+};
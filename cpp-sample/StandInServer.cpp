@@ -0,0 +1,753 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "Clock.h"
+#include "Logger.h"
+
+#include "StandInServer.h"
+
+namespace
+{
+	const char* const Instruments[] = { "IBM", "MSFT", "AAPL", "GOOG", "AMZN", "ORCL", "INTC", "CSCO" };
+	const int InstrumentCount = sizeof(Instruments)/sizeof(Instruments[0]);
+	const char* const PortfolioName = "Stand-in Portfolio";
+
+	// Streamed record: fields are derived from the record's version, so replaying the state sends the same values again
+	struct StandInRecord
+	{
+		std::string key;
+		int64_t id;
+		std::string instrument;
+		long long version;
+		double accumSize;
+	};
+
+	std::vector<StandInRecord> makeGeneratedRecords(int count, const std::string& keyPrefix)
+	{
+		std::vector<StandInRecord> records(count > 0 ? count : 0);
+		for (size_t i = 0; i < records.size(); i++)
+		{
+			records[i].key = keyPrefix + std::to_string(i + 1);
+			records[i].id = 1000000 + (int64_t)i;
+			records[i].instrument = Instruments[i % InstrumentCount];
+			records[i].version = 0;
+			records[i].accumSize = 0;
+		}
+		return records;
+	}
+
+	void setFieldType(FieldToType* fieldTypes, const std::string& name, bool isNumeric)
+	{
+		FieldType& fieldType = (*fieldTypes->mutable_fieldmap())[name];
+		fieldType.set_numeric(isNumeric);
+	}
+
+	/**
+	How each subscription fills its events and which fields it sends.
+	setRecord() fills event with the whole record (isAdded) or with the fields changed by the latest version.
+	*/
+	template <class Event> struct StandInTraits;
+
+	template <> struct StandInTraits<OrderEvent>
+	{
+		static const bool IsMarketData = false;
+
+		static std::vector<StandInRecord> makeRecords(const SubscribeForOrdersRequest& request, int count)
+		{
+			return makeGeneratedRecords(count, "SI-ORD-");
+		}
+
+		static Fields* setRecord(OrderEvent* event, const StandInRecord& record, bool isAdded)
+		{
+			Fields* fields;
+			if (isAdded)
+			{
+				event->mutable_added()->set_orderid(record.key);
+				fields = event->mutable_added()->mutable_fields();
+				(*fields->mutable_stringfields())["OrderID"] = record.key;
+				(*fields->mutable_stringfields())["Portfolio"] = PortfolioName;
+				(*fields->mutable_stringfields())["Instrument"] = record.instrument;
+				(*fields->mutable_stringfields())["Side"] = record.id % 2 == 0 ? "Buy" : "Sell";
+				(*fields->mutable_numericfields())["OrdQty"] = 1000;
+			}
+			else
+			{
+				event->mutable_updated()->set_orderid(record.key);
+				fields = event->mutable_updated()->mutable_fields();
+			}
+			double fillQty = (double)(record.version % 10)*100;
+			(*fields->mutable_numericfields())["FillQty"] = fillQty;
+			(*fields->mutable_numericfields())["LastPx"] = 100 + (double)(record.version % 50)/100;
+			(*fields->mutable_stringfields())["OrdStatus"] = fillQty == 0 ? "New" : "PartiallyFilled";
+			return fields;
+		}
+
+		static void addFieldTypes(FieldToType* fieldTypes)
+		{
+			for (const char* name : { "OrderID", "Portfolio", "Instrument", "Side", "OrdStatus" })
+			{
+				setFieldType(fieldTypes, name, false);
+			}
+			for (const char* name : { "OrdQty", "FillQty", "LastPx" })
+			{
+				setFieldType(fieldTypes, name, true);
+			}
+		}
+	};
+
+	template <> struct StandInTraits<TargetEvent>
+	{
+		static const bool IsMarketData = false;
+
+		static std::vector<StandInRecord> makeRecords(const SubscribeForTargetsRequest& request, int count)
+		{
+			return makeGeneratedRecords(count, "");
+		}
+
+		static Fields* setRecord(TargetEvent* event, const StandInRecord& record, bool isAdded)
+		{
+			Fields* fields;
+			if (isAdded)
+			{
+				event->mutable_added()->set_targetid(record.id);
+				fields = event->mutable_added()->mutable_fields();
+				(*fields->mutable_numericfields())["TgtID"] = (double)record.id;
+				(*fields->mutable_stringfields())["Portfolio"] = PortfolioName;
+				(*fields->mutable_stringfields())["Instrument"] = record.instrument;
+				(*fields->mutable_stringfields())["TgtStatus"] = "Active";
+				(*fields->mutable_numericfields())["TgtQty"] = 10000;
+			}
+			else
+			{
+				event->mutable_updated()->set_targetid(record.id);
+				fields = event->mutable_updated()->mutable_fields();
+			}
+			(*fields->mutable_numericfields())["FillQty"] = (double)(record.version % 100)*100;
+			return fields;
+		}
+
+		static void addFieldTypes(FieldToType* fieldTypes)
+		{
+			for (const char* name : { "Portfolio", "Instrument", "TgtStatus" })
+			{
+				setFieldType(fieldTypes, name, false);
+			}
+			for (const char* name : { "TgtID", "TgtQty", "FillQty" })
+			{
+				setFieldType(fieldTypes, name, true);
+			}
+		}
+	};
+
+	template <> struct StandInTraits<MarketDataEvent>
+	{
+		static const bool IsMarketData = true;
+
+		static std::vector<StandInRecord> makeRecords(const SubscribeForMarketDataRequest& request, int count)
+		{
+			if (request.instrument_size() == 0)
+			{
+				std::vector<StandInRecord> records = makeGeneratedRecords(count, "SYM");
+				for (size_t i = 0; i < records.size() && i < (size_t)InstrumentCount; i++)
+				{
+					records[i].key = Instruments[i];
+				}
+				return records;
+			}
+			std::vector<StandInRecord> records = makeGeneratedRecords(request.instrument_size(), "");
+			for (int i = 0; i < request.instrument_size(); i++)
+			{
+				records[i].key = request.instrument(i);
+			}
+			return records;
+		}
+
+		// Market data has no Added events: both initial state and real-time data are updates with all fields
+		static Fields* setRecord(MarketDataEvent* event, const StandInRecord& record, bool isAdded)
+		{
+			event->mutable_update()->set_instrument(record.key);
+			Fields* fields = event->mutable_update()->mutable_fields();
+			double lastPx = 100 + (double)((record.id*7 + record.version) % 200)/100;
+			(*fields->mutable_numericfields())["LastPx"] = lastPx;
+			(*fields->mutable_numericfields())["LastSize"] = (double)(100*(1 + record.version % 5));
+			(*fields->mutable_numericfields())["AccumSize"] = record.accumSize;
+			(*fields->mutable_numericfields())["TradeTime"] = (double)(Clock::getWallTime()/1000000);
+			(*fields->mutable_numericfields())["BidPx"] = lastPx - 0.01;
+			(*fields->mutable_numericfields())["AskPx"] = lastPx + 0.01;
+			(*fields->mutable_numericfields())["ClosePx"] = 100;
+			return fields;
+		}
+
+		static void addFieldTypes(FieldToType* fieldTypes)
+		{
+			for (const char* name : { "LastPx", "LastSize", "AccumSize", "TradeTime", "BidPx", "AskPx", "ClosePx" })
+			{
+				setFieldType(fieldTypes, name, true);
+			}
+		}
+	};
+
+	template <> struct StandInTraits<PortfolioEvent>
+	{
+		static const bool IsMarketData = false;
+
+		static std::vector<StandInRecord> makeRecords(const SubscribeForPortfoliosRequest& request, int count)
+		{
+			return makeGeneratedRecords(count, "Stand-in Portfolio ");
+		}
+
+		static Fields* setRecord(PortfolioEvent* event, const StandInRecord& record, bool isAdded)
+		{
+			Fields* fields;
+			if (isAdded)
+			{
+				event->mutable_added()->set_portfolioname(record.key);
+				fields = event->mutable_added()->mutable_fields();
+				(*fields->mutable_stringfields())["Portfolio"] = record.key;
+				(*fields->mutable_stringfields())["PortfolioType"] = "Market";
+			}
+			else
+			{
+				event->mutable_updated()->set_portfolioname(record.key);
+				fields = event->mutable_updated()->mutable_fields();
+			}
+			(*fields->mutable_numericfields())["NumTargets"] = (double)(10 + record.version % 10);
+			(*fields->mutable_numericfields())["FillQty"] = (double)(record.version % 1000)*100;
+			return fields;
+		}
+
+		static void addFieldTypes(FieldToType* fieldTypes)
+		{
+			for (const char* name : { "Portfolio", "PortfolioType" })
+			{
+				setFieldType(fieldTypes, name, false);
+			}
+			for (const char* name : { "NumTargets", "FillQty" })
+			{
+				setFieldType(fieldTypes, name, true);
+			}
+		}
+	};
+
+	void addExtraFields(Fields* fields, const StandInRecord& record, const StandInServerOptions& options)
+	{
+		for (int i = 1; i <= options.extraNumericFields; i++)
+		{
+			(*fields->mutable_numericfields())["Numeric" + std::to_string(i)] = (double)(record.version + i);
+		}
+		for (int i = 1; i <= options.extraStringFields; i++)
+		{
+			(*fields->mutable_stringfields())["String" + std::to_string(i)] = std::string(options.stringFieldSize, (char)('a' + (record.version + i) % 26));
+		}
+	}
+
+	void addExtraFieldTypes(FieldToType* fieldTypes, const StandInServerOptions& options)
+	{
+		for (int i = 1; i <= options.extraNumericFields; i++)
+		{
+			setFieldType(fieldTypes, "Numeric" + std::to_string(i), true);
+		}
+		for (int i = 1; i <= options.extraStringFields; i++)
+		{
+			setFieldType(fieldTypes, "String" + std::to_string(i), false);
+		}
+		if (options.stampSendTime)
+		{
+			setFieldType(fieldTypes, StandInServer::SendTimeField, true);
+		}
+	}
+
+	// Subscription's field list: send only these fields, all fields if it's empty
+	void filterFields(Fields* fields, const google::protobuf::RepeatedPtrField<std::string>& requestedFields)
+	{
+		if (requestedFields.empty())
+		{
+			return;
+		}
+		auto isRequested = [&requestedFields](const std::string& name) { return std::find(requestedFields.begin(), requestedFields.end(), name) != requestedFields.end(); };
+		for (auto iter = fields->mutable_stringfields()->begin(); iter != fields->mutable_stringfields()->end(); )
+		{
+			iter = isRequested(iter->first) ? std::next(iter) : fields->mutable_stringfields()->erase(iter);
+		}
+		for (auto iter = fields->mutable_numericfields()->begin(); iter != fields->mutable_numericfields()->end(); )
+		{
+			iter = isRequested(iter->first) ? std::next(iter) : fields->mutable_numericfields()->erase(iter);
+		}
+	}
+};
+
+StandInServerOptions::StandInServerOptions() :
+	recordCount(100),
+	updatesPerSecond(1000),
+	extraNumericFields(0),
+	extraStringFields(0),
+	stringFieldSize(16),
+	disconnectIntervalMs(0),
+	disconnectDurationMs(1000),
+	unaryDelayUs(0),
+	stampSendTime(false)
+{
+}
+
+const char* const StandInServer::SendTimeField = "StandInSendTime";
+
+StandInServer::StandInServer(const StandInServerOptions& options) :
+	options_(options)
+{
+	isRunning_.store(false);
+	disconnectGeneration_.store(0);
+	marketDataUpdatesPerSecond_.store(-1);
+	nextTargetId_.store(2000000);
+	sentEventCount_.store(0);
+	unaryCallCount_.store(0);
+}
+
+StandInServer::~StandInServer()
+{
+	shutdown();
+}
+
+int StandInServer::start(const std::string& address, std::shared_ptr<grpc::ServerCredentials> credentials)
+{
+	std::lock_guard<std::mutex> lock(serverLock_);
+	if (server_)
+	{
+		throw std::runtime_error("start() may only be called once");
+	}
+	int selectedPort = 0;
+	grpc::ServerBuilder builder;
+	builder.AddListeningPort(address, credentials, &selectedPort);
+	builder.RegisterService(this);
+	isRunning_.store(true);
+	server_ = builder.BuildAndStart();
+	if (!server_ || selectedPort == 0)
+	{
+		isRunning_.store(false);
+		server_.reset();
+		throw std::runtime_error("unable to listen on " + address);
+	}
+	TMS_LOG_INFO("[Stand-in Server] Listening on ", address, ", port ", selectedPort);
+	return selectedPort;
+}
+
+void StandInServer::wait()
+{
+	grpc::Server* server;
+	{
+		std::lock_guard<std::mutex> lock(serverLock_);
+		server = server_.get();
+	}
+	if (server)
+	{
+		server->Wait();
+	}
+}
+
+void StandInServer::shutdown()
+{
+	if (!isRunning_.exchange(false))
+	{
+		return;
+	}
+	std::lock_guard<std::mutex> lock(serverLock_);
+	// Streams notice isRunning_ within a few milliseconds, the deadline covers streams blocked by clients that don't read
+	server_->Shutdown(std::chrono::system_clock::now() + std::chrono::seconds(1));
+	TMS_LOG_INFO("[Stand-in Server] Stopped, ", getSentEventCount(), " events sent, ", getUnaryCallCount(), " unary calls served");
+}
+
+void StandInServer::injectDisconnect()
+{
+	disconnectGeneration_++;
+}
+
+long long StandInServer::getSentEventCount() const
+{
+	return sentEventCount_.load(std::memory_order_relaxed);
+}
+
+long long StandInServer::getUnaryCallCount() const
+{
+	return unaryCallCount_.load(std::memory_order_relaxed);
+}
+
+bool StandInServer::isRunning() const
+{
+	return isRunning_.load(std::memory_order_relaxed);
+}
+
+grpc::Status StandInServer::acknowledge()
+{
+	unaryCallCount_.fetch_add(1, std::memory_order_relaxed);
+	if (options_.unaryDelayUs > 0)
+	{
+		std::this_thread::sleep_for(std::chrono::microseconds(options_.unaryDelayUs));
+	}
+	return grpc::Status::OK;
+}
+
+template <class Event, class Request> grpc::Status StandInServer::serve(grpc::ServerContext* context, grpc::ServerReaderWriter<Event, Request>* stream)
+{
+	typedef StandInTraits<Event> Traits;
+	static const int64_t maxSleep = 10000000;
+
+	Request request;
+	if (!stream->Read(&request))
+	{
+		return grpc::Status::OK;
+	}
+	const std::string logPrefix = "[Stand-in Server] [" + context->peer() + "] ";
+	TMS_LOG_INFO(logPrefix, "Subscription for ", Event::descriptor()->name(), " is accepted");
+
+	// Client ends subscription with WritesDone(): keep reading to notice it.
+	// Follow-up requests replace the subscription, the latest one is picked up by the writing loop below.
+	std::atomic<bool> isClientDone(false);
+	std::mutex followUpLock;
+	std::unique_ptr<Request> followUp;
+	std::thread reader([stream, &isClientDone, &followUpLock, &followUp] {
+		Request next;
+		while (stream->Read(&next))
+		{
+			std::lock_guard<std::mutex> lock(followUpLock);
+			followUp.reset(new Request(next));
+		}
+		isClientDone.store(true);
+	});
+	auto isStreamUp = [this, context, &isClientDone] { return isRunning() && !isClientDone.load() && !context->IsCancelled(); };
+
+	Event event;
+	auto write = [this, stream, &event]() {
+		event.set_sendingtime(Clock::getWallTime()/1000000);
+		bool ok = stream->Write(event);
+		if (ok)
+		{
+			sentEventCount_.fetch_add(1, std::memory_order_relaxed);
+		}
+		event.Clear();
+		return ok;
+	};
+	auto writeRecord = [this, &request, &event, &write](const StandInRecord& record, bool isAdded) {
+		Fields* fields = Traits::setRecord(&event, record, isAdded);
+		addExtraFields(fields, record, options_);
+		filterFields(fields, request.field());
+		if (options_.stampSendTime)
+		{
+			// Last thing before Write(), so the latency covers serialization and transport only
+			(*fields->mutable_numericfields())[SendTimeField] = (double)Clock::getMonotonicTime();
+		}
+		return write();
+	};
+	auto writeFeedStatus = [&event, &write](FeedStatus feedStatus) {
+		event.set_feedstatus(feedStatus);
+		return write();
+	};
+	std::vector<StandInRecord> records = Traits::makeRecords(request, options_.recordCount);
+	auto writeRecords = [&writeRecord, &writeFeedStatus, &isStreamUp](const std::vector<StandInRecord>& records) {
+		for (const StandInRecord& record : records)
+		{
+			if (!isStreamUp() || !writeRecord(record, true))
+			{
+				return false;
+			}
+		}
+		return writeFeedStatus(FeedStatus::InitialStateReceived);
+	};
+	auto writeState = [&records, &writeRecords] {
+		return writeRecords(records);
+	};
+	// Records of the new request keep the state of the same keys in the old one, new records get their initial state
+	auto applyFollowUp = [this, &request, &records, &writeRecords, &logPrefix](const Request& next) {
+		std::vector<StandInRecord> nextRecords = Traits::makeRecords(next, options_.recordCount);
+		std::map<std::string, const StandInRecord*> oldRecords;
+		for (const StandInRecord& record : records)
+		{
+			oldRecords[record.key] = &record;
+		}
+		std::vector<StandInRecord> addedRecords;
+		for (StandInRecord& record : nextRecords)
+		{
+			auto old = oldRecords.find(record.key);
+			if (old != oldRecords.end())
+			{
+				record = *old->second;
+			}
+			else
+			{
+				addedRecords.push_back(record);
+			}
+		}
+		TMS_LOG_INFO(logPrefix, "Subscription is changed: ", nextRecords.size(), " records, ", addedRecords.size(), " added");
+		request = next;
+		records.swap(nextRecords);
+		return addedRecords.empty() || writeRecords(addedRecords);
+	};
+	auto sleepWhileUp = [&isStreamUp](int64_t duration) {
+		int64_t deadline = Clock::getMonotonicTime() + duration;
+		for (int64_t now = Clock::getMonotonicTime(); now < deadline && isStreamUp(); now = Clock::getMonotonicTime())
+		{
+			std::this_thread::sleep_for(std::chrono::nanoseconds(std::min(deadline - now, maxSleep)));
+		}
+	};
+
+	bool ok = writeState();
+	int seenGeneration = disconnectGeneration_.load();
+	const int64_t disconnectInterval = (int64_t)options_.disconnectIntervalMs*1000000;
+	int64_t nextDisconnect = disconnectInterval > 0 ? Clock::getMonotonicTime() + disconnectInterval : INT64_MAX;
+	int64_t nextUpdate = Clock::getMonotonicTime();
+	size_t nextRecord = 0;
+	while (ok && isStreamUp())
+	{
+		std::unique_ptr<Request> next;
+		{
+			std::lock_guard<std::mutex> lock(followUpLock);
+			next.swap(followUp);
+		}
+		if (next)
+		{
+			ok = applyFollowUp(*next);
+			nextRecord = 0;
+			continue;
+		}
+		int64_t now = Clock::getMonotonicTime();
+		if (disconnectGeneration_.load() != seenGeneration || now >= nextDisconnect)
+		{
+			seenGeneration = disconnectGeneration_.load();
+			TMS_LOG_INFO(logPrefix, "Disconnecting for ", options_.disconnectDurationMs, "ms");
+			ok = writeFeedStatus(FeedStatus::Disconnected);
+			sleepWhileUp((int64_t)options_.disconnectDurationMs*1000000);
+			ok = ok && isStreamUp() && writeFeedStatus(FeedStatus::Reconnected) && writeState();
+			nextDisconnect = disconnectInterval > 0 ? Clock::getMonotonicTime() + disconnectInterval : INT64_MAX;
+			nextUpdate = Clock::getMonotonicTime();
+			continue;
+		}
+		int marketDataUpdatesPerSecond = marketDataUpdatesPerSecond_.load(std::memory_order_relaxed);
+		int updatesPerSecond = Traits::IsMarketData && marketDataUpdatesPerSecond >= 0 ? marketDataUpdatesPerSecond : options_.updatesPerSecond;
+		if (records.empty() || (updatesPerSecond > 0 && now < nextUpdate))
+		{
+			// Short sleeps, so stop and disconnect requests are noticed quickly
+			std::this_thread::sleep_for(std::chrono::nanoseconds(records.empty() ? maxSleep : std::min(nextUpdate - now, maxSleep)));
+			continue;
+		}
+		if (updatesPerSecond > 0)
+		{
+			// Catch up after a stall, but don't burst more than a second worth of updates
+			nextUpdate = std::max(nextUpdate + 1000000000/updatesPerSecond, now - 1000000000);
+		}
+		StandInRecord& record = records[nextRecord++ % records.size()];
+		record.version++;
+		record.accumSize += (double)(100*(1 + record.version % 5));
+		ok = writeRecord(record, false);
+	}
+
+	if (!isClientDone.load())
+	{
+		// We're the ones ending the stream: unblock the reader
+		context->TryCancel();
+	}
+	reader.join();
+	TMS_LOG_INFO(logPrefix, "Subscription for ", Event::descriptor()->name(), " is closed");
+	return isRunning() ? grpc::Status::OK : grpc::Status(grpc::StatusCode::UNAVAILABLE, "server is shutting down");
+}
+
+grpc::Status StandInServer::login(grpc::ServerContext* context, const LoginRequest* request, Void* response)
+{
+	return acknowledge();
+}
+
+grpc::Status StandInServer::ping(grpc::ServerContext* context, const PingInfo* request, PingInfo* response)
+{
+	*response = *request;
+	response->add_sendingtime(Clock::getWallTime()/1000000);
+	return acknowledge();
+}
+
+grpc::Status StandInServer::sendCommandToCustomDataProviders(grpc::ServerContext* context, const SendCommandToCustomDataProvidersRequest* request, Void* response)
+{
+	// Same format as the live server's simulated market data: the rate is the name of the only string property
+	if (request->datasourcename() == "MarketData" && request->command() == "setUpdateRate" && !request->commandproperties().stringfields().empty())
+	{
+		try
+		{
+			marketDataUpdatesPerSecond_.store(std::stoi(request->commandproperties().stringfields().begin()->first));
+		}
+		catch (const std::exception&)
+		{
+			return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "update rate is not a number");
+		}
+	}
+	return acknowledge();
+}
+
+grpc::Status StandInServer::getMarketPortfolioFieldTypes(grpc::ServerContext* context, const Void* request, FieldToType* response)
+{
+	StandInTraits<PortfolioEvent>::addFieldTypes(response);
+	addExtraFieldTypes(response, options_);
+	return acknowledge();
+}
+
+grpc::Status StandInServer::getMarketTargetFieldTypes(grpc::ServerContext* context, const Void* request, FieldToType* response)
+{
+	StandInTraits<TargetEvent>::addFieldTypes(response);
+	addExtraFieldTypes(response, options_);
+	return acknowledge();
+}
+
+grpc::Status StandInServer::getOrderFieldTypes(grpc::ServerContext* context, const Void* request, FieldToType* response)
+{
+	StandInTraits<OrderEvent>::addFieldTypes(response);
+	addExtraFieldTypes(response, options_);
+	return acknowledge();
+}
+
+grpc::Status StandInServer::getMarketDataFieldTypes(grpc::ServerContext* context, const Void* request, FieldToType* response)
+{
+	StandInTraits<MarketDataEvent>::addFieldTypes(response);
+	addExtraFieldTypes(response, options_);
+	return acknowledge();
+}
+
+grpc::Status StandInServer::createMarketPortfolio(grpc::ServerContext* context, const CreateMarketPortfolioRequest* request, Void* response)
+{
+	return acknowledge();
+}
+
+grpc::Status StandInServer::modifyMarketPortfolio(grpc::ServerContext* context, const ModifyPortfolioRequest* request, Void* response)
+{
+	return acknowledge();
+}
+
+grpc::Status StandInServer::removeMarketPortfolio(grpc::ServerContext* context, const RemovePortfolioRequest* request, Void* response)
+{
+	return acknowledge();
+}
+
+grpc::Status StandInServer::addMarketTargets(grpc::ServerContext* context, const AddMarketTargetsRequest* request, TargetIds* response)
+{
+	for (int i = 0; i < request->fields_size(); i++)
+	{
+		response->add_targetid(nextTargetId_++);
+	}
+	return acknowledge();
+}
+
+grpc::Status StandInServer::modifyMarketTargets(grpc::ServerContext* context, const ModifyTargetsRequest* request, Void* response)
+{
+	return acknowledge();
+}
+
+grpc::Status StandInServer::removeMarketTargets(grpc::ServerContext* context, const TargetIds* request, Void* response)
+{
+	return acknowledge();
+}
+
+grpc::Status StandInServer::getMarketTargets(grpc::ServerContext* context, const TargetIds* request, Targets* response)
+{
+	for (int64_t targetId : request->targetid())
+	{
+		Fields* fields = response->add_target();
+		(*fields->mutable_numericfields())["TgtID"] = (double)targetId;
+		(*fields->mutable_stringfields())["Portfolio"] = PortfolioName;
+	}
+	return acknowledge();
+}
+
+grpc::Status StandInServer::terminateMarketTargets(grpc::ServerContext* context, const TerminateMarketTargetsRequest* request, Void* response)
+{
+	return acknowledge();
+}
+
+grpc::Status StandInServer::pauseMarketTargets(grpc::ServerContext* context, const PauseMarketTargetsRequest* request, Void* response)
+{
+	return acknowledge();
+}
+
+grpc::Status StandInServer::resumeMarketTargets(grpc::ServerContext* context, const ResumeMarketTargetsRequest* request, Void* response)
+{
+	return acknowledge();
+}
+
+grpc::Status StandInServer::sendPortfolioOrders(grpc::ServerContext* context, const PortfolioNames* request, Void* response)
+{
+	return acknowledge();
+}
+
+grpc::Status StandInServer::sendTargetWave(grpc::ServerContext* context, const SendTargetWaveRequest* request, Void* response)
+{
+	return acknowledge();
+}
+
+grpc::Status StandInServer::sendOrders(grpc::ServerContext* context, const SendOrdersRequest* request, Void* response)
+{
+	return acknowledge();
+}
+
+grpc::Status StandInServer::modifyOrders(grpc::ServerContext* context, const ModifyOrdersRequest* request, Void* response)
+{
+	return acknowledge();
+}
+
+grpc::Status StandInServer::cancelOrders(grpc::ServerContext* context, const CancelOrdersRequest* request, Void* response)
+{
+	return acknowledge();
+}
+
+grpc::Status StandInServer::cancelTargetOpenOrders(grpc::ServerContext* context, const TargetIds* request, Void* response)
+{
+	return acknowledge();
+}
+
+grpc::Status StandInServer::confirmOrders(grpc::ServerContext* context, const ConfirmOrdersRequest* request, Void* response)
+{
+	return acknowledge();
+}
+
+grpc::Status StandInServer::fillOrders(grpc::ServerContext* context, const FIXMessagesRequest* request, Void* response)
+{
+	return acknowledge();
+}
+
+grpc::Status StandInServer::rejectOrders(grpc::ServerContext* context, const FIXMessagesRequest* request, Void* response)
+{
+	return acknowledge();
+}
+
+grpc::Status StandInServer::outOnOrders(grpc::ServerContext* context, const OutOnOrdersRequest* request, Void* response)
+{
+	return acknowledge();
+}
+
+grpc::Status StandInServer::statusOrders(grpc::ServerContext* context, const StatusOrdersRequest* request, Void* response)
+{
+	return acknowledge();
+}
+
+grpc::Status StandInServer::stopAllTrading(grpc::ServerContext* context, const Void* request, Void* response)
+{
+	return acknowledge();
+}
+
+grpc::Status StandInServer::subscribeForMarketPortfolios(grpc::ServerContext* context, grpc::ServerReaderWriter<PortfolioEvent, SubscribeForPortfoliosRequest>* stream)
+{
+	return serve(context, stream);
+}
+
+grpc::Status StandInServer::subscribeForMarketTargets(grpc::ServerContext* context, grpc::ServerReaderWriter<TargetEvent, SubscribeForTargetsRequest>* stream)
+{
+	return serve(context, stream);
+}
+
+grpc::Status StandInServer::subscribeForOrders(grpc::ServerContext* context, grpc::ServerReaderWriter<OrderEvent, SubscribeForOrdersRequest>* stream)
+{
+	return serve(context, stream);
+}
+
+grpc::Status StandInServer::subscribeForMarketData(grpc::ServerContext* context, grpc::ServerReaderWriter<MarketDataEvent, SubscribeForMarketDataRequest>* stream)
+{
+	return serve(context, stream);
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <grpcpp/grpcpp.h>
+#include <tmsapigrpc/TMSRemote.grpc.pb.h>
+
+/**
+Stand-in TMSRemote server for benchmarking and testing the client without a live TMS.
+Market portfolio, market target, order and market data subscriptions stream synthetic records following the documented protocol:
+the whole state as Added events (market data as updates), then InitialStateReceived, then real-time Updated events at a configurable rate.
+Disconnected/Reconnected cycles can be injected periodically or on demand; after Reconnected the current state is sent again, then InitialStateReceived.
+A follow-up request on an open subscription replaces its request: records it no longer names stop, new ones get their state and InitialStateReceived.
+
+Unary trading RPCs (portfolios, targets, orders, order status, stopAllTrading) are accepted and acknowledged, optionally after a simulated delay,
+but they don't change the streamed data. Field type RPCs report the fields the streams send.
+
+Server can run in-process (e.g. in a benchmark) or as tms_standin_server executable.
+
+Usage:
+	StandInServerOptions options;
+	options.updatesPerSecond = 10000;
+	StandInServer server(options);
+	server.start("localhost:50051");
+	auto channel = grpc::CreateChannel("localhost:50051", grpc::InsecureChannelCredentials());
+...
+	server.injectDisconnect(); // All open streams go through Disconnected, Reconnected and state replay
+...
+	server.shutdown();
+*/
+
+struct StandInServerOptions
+{
+	StandInServerOptions();
+
+	// Records sent as initial state of each subscription (market data: instruments, unless subscription names them)
+	int recordCount;
+	// Updated events per second per subscription, 0 means as fast as the client reads them
+	int updatesPerSecond;
+	// Extra fields sent with every record, on top of the fields each record type has
+	int extraNumericFields;
+	int extraStringFields;
+	// Length of extra string field values
+	int stringFieldSize;
+	// Every subscription goes through Disconnected/Reconnected cycle this often, 0 means only when injectDisconnect() is called
+	int disconnectIntervalMs;
+	// Time between Disconnected and Reconnected
+	int disconnectDurationMs;
+	// Simulated processing time of unary RPCs
+	int unaryDelayUs;
+	// Adds StandInServer::SendTimeField to every record: monotonic time of sending in nanoseconds, for precise latency measurement on the same host
+	bool stampSendTime;
+};
+
+class StandInServer : public TMSRemote::Service
+{
+public:
+	// Numeric field with Clock::getMonotonicTime() of the moment record was sent, see StandInServerOptions::stampSendTime
+	static const char* const SendTimeField;
+
+	explicit StandInServer(const StandInServerOptions& options);
+	virtual ~StandInServer();
+
+	StandInServer(const StandInServer&) = delete;
+	void operator=(const StandInServer&) = delete;
+
+	// Starts serving on address, e.g. "0.0.0.0:8083", returns the port (the one picked by the system for port 0).
+	// Throws std::runtime_error if the address can't be bound.
+	int start(const std::string& address, std::shared_ptr<grpc::ServerCredentials> credentials = grpc::InsecureServerCredentials());
+	// Blocks until shutdown() is called
+	void wait();
+	// Ends all open streams and stops the server. Safe to call more than once.
+	void shutdown();
+
+	// Makes all open subscriptions go through Disconnected/Reconnected cycle
+	void injectDisconnect();
+	long long getSentEventCount() const;
+	long long getUnaryCallCount() const;
+
+	// Sessions and diagnostics
+	virtual grpc::Status login(grpc::ServerContext* context, const LoginRequest* request, Void* response);
+	virtual grpc::Status ping(grpc::ServerContext* context, const PingInfo* request, PingInfo* response);
+	virtual grpc::Status sendCommandToCustomDataProviders(grpc::ServerContext* context, const SendCommandToCustomDataProvidersRequest* request, Void* response);
+
+	// Field types
+	virtual grpc::Status getMarketPortfolioFieldTypes(grpc::ServerContext* context, const Void* request, FieldToType* response);
+	virtual grpc::Status getMarketTargetFieldTypes(grpc::ServerContext* context, const Void* request, FieldToType* response);
+	virtual grpc::Status getOrderFieldTypes(grpc::ServerContext* context, const Void* request, FieldToType* response);
+	virtual grpc::Status getMarketDataFieldTypes(grpc::ServerContext* context, const Void* request, FieldToType* response);
+
+	// Portfolios and targets
+	virtual grpc::Status createMarketPortfolio(grpc::ServerContext* context, const CreateMarketPortfolioRequest* request, Void* response);
+	virtual grpc::Status modifyMarketPortfolio(grpc::ServerContext* context, const ModifyPortfolioRequest* request, Void* response);
+	virtual grpc::Status removeMarketPortfolio(grpc::ServerContext* context, const RemovePortfolioRequest* request, Void* response);
+	virtual grpc::Status addMarketTargets(grpc::ServerContext* context, const AddMarketTargetsRequest* request, TargetIds* response);
+	virtual grpc::Status modifyMarketTargets(grpc::ServerContext* context, const ModifyTargetsRequest* request, Void* response);
+	virtual grpc::Status removeMarketTargets(grpc::ServerContext* context, const TargetIds* request, Void* response);
+	virtual grpc::Status getMarketTargets(grpc::ServerContext* context, const TargetIds* request, Targets* response);
+	virtual grpc::Status terminateMarketTargets(grpc::ServerContext* context, const TerminateMarketTargetsRequest* request, Void* response);
+	virtual grpc::Status pauseMarketTargets(grpc::ServerContext* context, const PauseMarketTargetsRequest* request, Void* response);
+	virtual grpc::Status resumeMarketTargets(grpc::ServerContext* context, const ResumeMarketTargetsRequest* request, Void* response);
+
+	// Orders
+	virtual grpc::Status sendPortfolioOrders(grpc::ServerContext* context, const PortfolioNames* request, Void* response);
+	virtual grpc::Status sendTargetWave(grpc::ServerContext* context, const SendTargetWaveRequest* request, Void* response);
+	virtual grpc::Status sendOrders(grpc::ServerContext* context, const SendOrdersRequest* request, Void* response);
+	virtual grpc::Status modifyOrders(grpc::ServerContext* context, const ModifyOrdersRequest* request, Void* response);
+	virtual grpc::Status cancelOrders(grpc::ServerContext* context, const CancelOrdersRequest* request, Void* response);
+	virtual grpc::Status cancelTargetOpenOrders(grpc::ServerContext* context, const TargetIds* request, Void* response);
+	virtual grpc::Status confirmOrders(grpc::ServerContext* context, const ConfirmOrdersRequest* request, Void* response);
+	virtual grpc::Status fillOrders(grpc::ServerContext* context, const FIXMessagesRequest* request, Void* response);
+	virtual grpc::Status rejectOrders(grpc::ServerContext* context, const FIXMessagesRequest* request, Void* response);
+	virtual grpc::Status outOnOrders(grpc::ServerContext* context, const OutOnOrdersRequest* request, Void* response);
+	virtual grpc::Status statusOrders(grpc::ServerContext* context, const StatusOrdersRequest* request, Void* response);
+	virtual grpc::Status stopAllTrading(grpc::ServerContext* context, const Void* request, Void* response);
+
+	// Subscriptions
+	virtual grpc::Status subscribeForMarketPortfolios(grpc::ServerContext* context, grpc::ServerReaderWriter<PortfolioEvent, SubscribeForPortfoliosRequest>* stream);
+	virtual grpc::Status subscribeForMarketTargets(grpc::ServerContext* context, grpc::ServerReaderWriter<TargetEvent, SubscribeForTargetsRequest>* stream);
+	virtual grpc::Status subscribeForOrders(grpc::ServerContext* context, grpc::ServerReaderWriter<OrderEvent, SubscribeForOrdersRequest>* stream);
+	virtual grpc::Status subscribeForMarketData(grpc::ServerContext* context, grpc::ServerReaderWriter<MarketDataEvent, SubscribeForMarketDataRequest>* stream);
+
+private:
+	template <class Event, class Request> grpc::Status serve(grpc::ServerContext* context, grpc::ServerReaderWriter<Event, Request>* stream);
+	// Acknowledges unary call after simulated delay
+	grpc::Status acknowledge();
+	bool isRunning() const;
+
+private:
+	const StandInServerOptions options_;
+	std::mutex serverLock_;
+	std::unique_ptr<grpc::Server> server_;
+	std::atomic<bool> isRunning_;
+	// Incremented by injectDisconnect(), streams compare it with the value they've seen
+	std::atomic<int> disconnectGeneration_;
+	// Set by "setUpdateRate" command of MarketData data source, overrides updatesPerSecond for market data, -1 if not set
+	std::atomic<int> marketDataUpdatesPerSecond_;
+	std::atomic<long long> nextTargetId_;
+	std::atomic<long long> sentEventCount_;
+	std::atomic<long long> unaryCallCount_;
+};
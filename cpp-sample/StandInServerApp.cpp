@@ -0,0 +1,141 @@
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+
+#include "Logger.h"
+#include "StandInServer.h"
+
+/*
+Stand-in TMSRemote server executable, see StandInServer.h.
+
+Usage:
+	tms_standin_server [options]
+		--address host:port     Address to listen on, default 0.0.0.0:8083
+		--tls cert.pem key.pem  Serve over TLS with given certificate chain and private key (sample app connects with TLS), default insecure
+		--records N             Records in initial state of each subscription, default 100
+		--rate N                Updated events per second per subscription, 0 means as fast as client reads them, default 1000
+		--numeric-fields N      Extra numeric fields per record, default 0
+		--string-fields N       Extra string fields per record, default 0
+		--string-size N         Length of extra string field values, default 16
+		--disconnect-every MS   Disconnected/Reconnected cycle period, default 0 (only on "disconnect" command)
+		--disconnect-for MS     Time between Disconnected and Reconnected, default 1000
+		--unary-delay US        Simulated processing time of unary RPCs, default 0
+		--stamp-send-time       Add monotonic send time in nanoseconds to every record (StandInSendTime field), e.g. for tms_listener_benchmark
+		--duration S            Stop after S seconds, default 0 (run until "quit" command)
+
+Commands on standard input: "disconnect" (all open subscriptions go through Disconnected/Reconnected cycle), "stats", "quit".
+*/
+
+namespace
+{
+	std::string get_file_contents(const std::string& file_name)
+	{
+		std::ifstream inf(file_name);
+		return std::string(std::istreambuf_iterator<char>(inf), std::istreambuf_iterator<char>());
+	}
+
+	void printUsage()
+	{
+		std::cerr << "Usage: tms_standin_server [--address host:port] [--tls cert.pem key.pem] [--records N] [--rate N]"
+			<< " [--numeric-fields N] [--string-fields N] [--string-size N] [--disconnect-every MS] [--disconnect-for MS]"
+			<< " [--unary-delay US] [--stamp-send-time] [--duration S]" << std::endl;
+	}
+};
+
+int main(int argc, char** argv)
+{
+	static const std::string caller = "[Main] ";
+
+	std::string address = "0.0.0.0:8083";
+	std::string certFile;
+	std::string keyFile;
+	int duration = 0;
+	StandInServerOptions options;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string name = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (name == "--tls" && i + 2 < argc)
+		{
+			certFile = argv[++i];
+			keyFile = argv[++i];
+		}
+		else if (name == "--stamp-send-time")
+		{
+			options.stampSendTime = true;
+		}
+		else if (name == "--address" && hasValue)
+		{
+			address = argv[++i];
+		}
+		else if (hasValue && (name == "--records" || name == "--rate" || name == "--numeric-fields" || name == "--string-fields" || name == "--string-size"
+			|| name == "--disconnect-every" || name == "--disconnect-for" || name == "--unary-delay" || name == "--duration"))
+		{
+			int value = std::atoi(argv[++i]);
+			if (name == "--records") options.recordCount = value;
+			else if (name == "--rate") options.updatesPerSecond = value;
+			else if (name == "--numeric-fields") options.extraNumericFields = value;
+			else if (name == "--string-fields") options.extraStringFields = value;
+			else if (name == "--string-size") options.stringFieldSize = value;
+			else if (name == "--disconnect-every") options.disconnectIntervalMs = value;
+			else if (name == "--disconnect-for") options.disconnectDurationMs = value;
+			else if (name == "--unary-delay") options.unaryDelayUs = value;
+			else duration = value;
+		}
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+
+	std::shared_ptr<grpc::ServerCredentials> credentials = grpc::InsecureServerCredentials();
+	if (!certFile.empty())
+	{
+		grpc::SslServerCredentialsOptions sslOptions;
+		sslOptions.pem_key_cert_pairs.push_back({ get_file_contents(keyFile), get_file_contents(certFile) });
+		credentials = grpc::SslServerCredentials(sslOptions);
+	}
+
+	StandInServer server(options);
+	try
+	{
+		server.start(address, credentials);
+	}
+	catch (const std::exception& e)
+	{
+		TMS_LOG_ERROR(caller, e.what());
+		return 1;
+	}
+
+	if (duration > 0)
+	{
+		std::this_thread::sleep_for(std::chrono::seconds(duration));
+	}
+	else
+	{
+		std::string command;
+		while (std::getline(std::cin, command) && command != "quit")
+		{
+			if (command == "disconnect")
+			{
+				server.injectDisconnect();
+			}
+			else if (command == "stats")
+			{
+				TMS_LOG_INFO(caller, server.getSentEventCount(), " events sent, ", server.getUnaryCallCount(), " unary calls served");
+			}
+		}
+		if (!std::cin)
+		{
+			// No console (e.g. started in background): serve until killed
+			server.wait();
+		}
+	}
+	server.shutdown();
+	return 0;
+}
@@ -1,6 +1,9 @@
 #include "AsyncListener.hpp"
 #include "AsyncListenersManager.h"
 #include "AsyncListenersManager.hpp"
+#include "Clock.h"
+#include "ConflatingConsumer.hpp"
+#include "MarketDataHub.h"
 
 #include "StatefulSubscriber.h"
 
@@ -10,13 +13,21 @@ const std::string StatefulSubscriber::FieldName_LastSize("LastSize");
 const std::string StatefulSubscriber::FieldName_AccumSize("AccumSize");
 const std::string StatefulSubscriber::FieldName_TradeTime("TradeTime");
 
-StatefulSubscriber::StatefulSubscriber(const std::string& recordName) :
+StatefulSubscriber::StatefulSubscriber(const std::string& recordName, MarketDataHub* hub, bool conflate) :
 	recordName_(recordName),
-	accumulatedVal_(0),
-	accumulatedQty_(0)
+	hub_(hub),
+	conflate_(conflate),
+	analytics_(TradeAnalytics::getInstance()),
+	slot_(analytics_.addInstrument(recordName)),
+	// IDs are resolved here, so that events are decoded without locking the registry
+	fields_(FieldRegistry::getInstance(), { FieldName_LastPx, FieldName_LastSize, FieldName_AccumSize, FieldName_TradeTime }),
+	lastPxId_(FieldRegistry::getInstance().intern(FieldName_LastPx)),
+	lastSizeId_(FieldRegistry::getInstance().intern(FieldName_LastSize)),
+	accumSizeId_(FieldRegistry::getInstance().intern(FieldName_AccumSize)),
+	tradeTimeId_(FieldRegistry::getInstance().intern(FieldName_TradeTime))
 {
 	listenerId_.store(0);
-	lastAccumSize_.store(-1);
+	subscriptionId_.store(0);
 }
 
 StatefulSubscriber::~StatefulSubscriber()
@@ -24,6 +35,7 @@ StatefulSubscriber::~StatefulSubscriber()
 	static const std::string caller("[~StatefulSubscriber()]");
 	stop(caller);
 	terminate(caller);
+	analytics_.removeInstrument(slot_);
 }
 
 // IMPORTANT: some thread should call AsyncListenersManager::setup() before calling StatefulSubscriber::start()
@@ -32,6 +44,20 @@ void StatefulSubscriber::start()
 	// Use processMarketDataEvent() member function as callback method for target events
 	// Since it's non-static method, we'll use lambda to capture this and bind method call to this
 	std::function< bool(const MarketDataEvent&, const std::string&)> marketDataConsumer = [&](const MarketDataEvent& event, const std::string& caller) { return processMarketDataEvent(event, caller); };
+	if (conflate_)
+	{
+		// Every trade must be counted: updates that carry AccumSize are never merged with each other
+		conflater_.reset(new ConflatingConsumer<MarketDataEvent>(marketDataConsumer, { FieldName_AccumSize }));
+		marketDataConsumer = conflater_->asConsumer();
+	}
+
+	if (hub_)
+	{
+		// Fields are requested by the hub for all of its instruments
+		analytics_.startInterval(slot_, (double)(Clock::getWallTime()/1000000));
+		subscriptionId_.store(hub_->subscribe(getName(), [marketDataConsumer](const MarketDataEvent& event, const std::string& caller) { marketDataConsumer(event, caller); }));
+		return;
+	}
 
 	SubscribeForMarketDataRequest request;
 	// Set record name
@@ -43,8 +69,7 @@ void StatefulSubscriber::start()
 	request.add_field(FieldName_TradeTime);
 
     // Save subscription time - we'll use it later in processMarketDataEvent() to check if the first Market Data update is a trade
-	double now = (double)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
-	startTime_.store(now);
+	analytics_.startInterval(slot_, (double)(Clock::getWallTime()/1000000));
 
     // Start listener thread and save listener ID
 	listenerId_.store(AsyncListenersManager::getInstance().startListening(&TMSRemote::Stub::PrepareAsyncsubscribeForMarketData, request, marketDataConsumer, "Market Data Listener for "+getName()));
@@ -52,6 +77,12 @@ void StatefulSubscriber::start()
 
 void StatefulSubscriber::stop(const std::string& caller)
 {
+	int subscriptionId = subscriptionId_.exchange(0);
+	if (subscriptionId > 0)
+	{
+		// Instrument is removed from hub's stream with a follow-up request, the stream stays open for other instruments
+		hub_->unsubscribe(subscriptionId);
+	}
 	int listenerId = listenerId_.load();
 	if (listenerId > 0)
 	{
@@ -66,6 +97,11 @@ void StatefulSubscriber::terminate(const std::string& caller)
 	{
 		AsyncListenersManager::getInstance().terminateListener(listenerId, caller);
 	}
+	if (conflater_)
+	{
+		// Listener has finished, or hub's subscription is gone: process what's left
+		conflater_->stop();
+	}
 }
 
 const std::string& StatefulSubscriber::getName()
@@ -75,22 +111,16 @@ const std::string& StatefulSubscriber::getName()
 
 double StatefulSubscriber::getIntervalVwap()
 {
-	double accVal;
-	long accQty;
-	stateLock_.lock();
-	accVal = accumulatedVal_;
-	accQty = accumulatedQty_;
-	stateLock_.unlock();
-	return (accQty == 0) ? NAN : accVal/(double)accQty;
+	TradeStats stats;
+	analytics_.getStats(slot_, &stats);
+	return stats.vwap;
 }
 
 long StatefulSubscriber::getIntervalAccumSize()
 {
-	long accQty;
-	stateLock_.lock();
-	accQty = accumulatedQty_;
-	stateLock_.unlock();
-	return accQty;
+	TradeStats stats;
+	analytics_.getStats(slot_, &stats);
+	return (long)stats.volume;
 }
 
 bool StatefulSubscriber::processMarketDataEvent(const MarketDataEvent& event, const std::string& caller)
@@ -98,35 +128,14 @@ bool StatefulSubscriber::processMarketDataEvent(const MarketDataEvent& event, co
 	switch (event.event_case())
 	{
 	case MarketDataEvent::EventCase::kUpdate:
+		fields_.assign(event.update().fields());
+		// We cannot apply each update because some of updates are not trades.
+		// And if we apply updates that aren't trades, we'll apply some trades more than once.
+		// Analytics takes an update for a trade if accum size has increased, see TradeAnalytics::onMarketData().
+		if (fields_.isNumeric(accumSizeId_))
 		{
-			auto update = event.update();
-			auto fields = update.fields();
-			auto numericfields = fields.numericfields();
-			// We cannot apply each update because some of updates are not trades.
-			// And if we apply updates that aren't trades, we'll apply some trades more than once.
-			// To check if an update is a trade, let's check if accum size has increased.
-			double currentAccumSize = numericfields[FieldName_AccumSize];
-			double prevAccumSize = lastAccumSize_.exchange(currentAccumSize);
-			if (currentAccumSize > prevAccumSize)
-			{
-				if (prevAccumSize < 0)
-				{
-					// It's first update.
-					// To find out if the first udpate is a trade, let's compare its trade time with our subscription time.
-					double tradeTime = numericfields[FieldName_TradeTime];
-					double startTime = startTime_.load();
-					if (tradeTime > startTime)
-					{
-						// It's a trade.
-						applyUpdate(numericfields[FieldName_LastPx], (long)numericfields[FieldName_LastSize]);
-					}
-				}
-				else
-				{
-					// It's a trade.
-					applyUpdate(numericfields[FieldName_LastPx], (long)numericfields[FieldName_LastSize]);
-				}
-			}
+			analytics_.onMarketData(slot_, fields_.getNumeric(lastPxId_, 0), fields_.getNumeric(lastSizeId_, 0),
+				fields_.getNumeric(accumSizeId_, 0), fields_.getNumeric(tradeTimeId_, 0));
 		}
 		break;
 	default:
@@ -134,14 +143,3 @@ bool StatefulSubscriber::processMarketDataEvent(const MarketDataEvent& event, co
 	}
 	return true;
 }
-
-void StatefulSubscriber::applyUpdate(double lastPx, long lastSize)
-{
-	if ((lastPx != 0) && (lastSize != 0))
-	{
-		stateLock_.lock();
-		accumulatedVal_ += lastPx*lastSize;
-		accumulatedQty_ += lastSize;
-		stateLock_.unlock();
-	}
-}
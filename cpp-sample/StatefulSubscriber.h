@@ -1,11 +1,16 @@
 #pragma once
 
+#include <atomic>
+#include <memory>
 #include <string>
-#include <mutex>
+
+#include "FieldRegistry.h"
+#include "TradeAnalytics.h"
 
 /**
 Example of stateful async subscriber.
 Each instance will susbcribe to market data for a name and calculate interval VWAP for it.
+Trades are accumulated in a slot of shared TradeAnalytics, so VWAPs of all subscribers can also be queried at once from there.
 
 Usage:
 	AsyncListenersManager::setup(...);
@@ -17,14 +22,25 @@ Usage:
 ...
 	double intervalVwap_IBM = vwapCalculator_IBM.getIntervalVwap(); // Interval VWAP from start to stop
 	double intervalAccumSize_IBM = vwapCalculator_IBM.getIntervalAccumSize(); // Interval VWAP from start to stop
+
+To track thousands of names, subscribe through a market data hub instead of a listener per name:
+	MarketDataHub hub(stub);
+	StatefulSubscriber vwapCalculator_IBM("IBM", &hub); // Shares one of the hub's streams with other names
+
+To keep a slow calculator from falling behind a busy stream, conflate its updates:
+	StatefulSubscriber vwapCalculator_IBM("IBM", &hub, true); // Quote updates queued behind a busy calculator are merged, trades never are
 */
 
 class MarketDataEvent;
+class MarketDataHub;
+template <class Event> class ConflatingConsumer;
 
 class StatefulSubscriber
 {
 public:
-	StatefulSubscriber(const std::string& recordName);
+	// Subscribes through hub if it's given, otherwise through AsyncListenersManager.
+	// With conflate, events are processed on a thread of their own and pending updates without a new trade are merged, see ConflatingConsumer.
+	StatefulSubscriber(const std::string& recordName, MarketDataHub* hub = nullptr, bool conflate = false);
 	~StatefulSubscriber();
 
 	// Start listening for market data events for record
@@ -40,20 +56,26 @@ public:
 
 private:
 	bool processMarketDataEvent(const MarketDataEvent& event, const std::string& caller);
-	void applyUpdate(double lastPx, long lastSize);
 
 private:
 	std::string recordName_;
+	MarketDataHub* hub_;
+	const bool conflate_;
+	// Created by start(), stopped by terminate() once no more events can come
+	std::unique_ptr<ConflatingConsumer<MarketDataEvent>> conflater_;
 
-	// Mutex to ensure thread safety
-	std::mutex stateLock_;
-
-	// Internal state
-	double accumulatedVal_;
-	long accumulatedQty_;
+	// Interval state lives in analytics' slot: written by listener thread only, read from anywhere without locks
+	TradeAnalytics& analytics_;
+	const int slot_;
 	std::atomic<int> listenerId_;
-	std::atomic<double> lastAccumSize_;
-	std::atomic<double> startTime_;
+	std::atomic<int> subscriptionId_;
+
+	// Fields of the event being processed, accessed by the thread that processes events only
+	FlatFields fields_;
+	const FieldId lastPxId_;
+	const FieldId lastSizeId_;
+	const FieldId accumSizeId_;
+	const FieldId tradeTimeId_;
 
 	static const std::string FieldName_LastPx;
 	static const std::string FieldName_LastSize;
@@ -1,7 +1,9 @@
 #include "AsyncListener.hpp"
 #include "AsyncListenersManager.h"
 #include "AsyncListenersManager.hpp"
+#include "EventView.hpp"
 #include "Utils.h"
+#include "Logger.h"
 
 #include "StatelessSubscriber.h"
 
@@ -32,23 +34,20 @@ bool StatelessSubscriber::processPortfolioEvent(const PortfolioEvent& event, con
 	{
 	case PortfolioEvent::EventCase::kAdded:
 		{
-			auto update = event.added();
-			std::string pfName = update.portfolioname();
-			std::cout << get_timestamp() << caller << "Portfolio event: added " << pfName << std::endl;
+			const std::string& pfName = PortfolioEventView(event).getKey();
+			TMS_LOG_INFO(caller, "Portfolio event: added ", pfName);
 		}
 		break;
 	case PortfolioEvent::EventCase::kRemoved:
 		{
-			auto update = event.removed();
-			std::string pfName = update.portfolioname();
-			std::cout << get_timestamp() << caller << "Portfolio event: removed " << pfName << std::endl;
+			const std::string& pfName = PortfolioEventView(event).getKey();
+			TMS_LOG_INFO(caller, "Portfolio event: removed ", pfName);
 		}
 		break;
 	case PortfolioEvent::EventCase::kUpdated:
 		{
-			auto update = event.updated();
-			std::string pfName = update.portfolioname();
-			std::cout << get_timestamp() << caller << "Portfolio event: updated " << pfName << std::endl;
+			const std::string& pfName = PortfolioEventView(event).getKey();
+			TMS_LOG_INFO(caller, "Portfolio event: updated ", pfName);
 		}
 		break;
 	default:
@@ -0,0 +1,261 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "TradeAnalytics.h"
+
+TradeAnalytics::TradeAnalytics(int capacity) :
+	capacity_(capacity),
+	slots_(new SlotState[capacity > 0 ? capacity : 0]),
+	value_(capacity),
+	volume_(capacity),
+	trades_(capacity),
+	twapSum_(capacity),
+	twapTime_(capacity),
+	lastPx_(capacity),
+	lastTradeTime_(capacity),
+	instruments_(capacity > 0 ? capacity : 0)
+{
+	if (capacity < 1)
+	{
+		throw std::runtime_error("Trade analytics needs at least one slot");
+	}
+	for (int slot = 0; slot < capacity; slot++)
+	{
+		slots_[slot].sequence.store(0, std::memory_order_relaxed);
+		clearSlot(slot, 0);
+	}
+	slotCount_.store(0);
+}
+
+TradeAnalytics& TradeAnalytics::getInstance()
+{
+	static TradeAnalytics instance;
+	return instance;
+}
+
+int TradeAnalytics::addInstrument(const std::string& instrument)
+{
+	std::lock_guard<std::mutex> lock(registryLock_);
+	int slot;
+	if (slotCount_.load(std::memory_order_relaxed) < capacity_)
+	{
+		// Fresh slots first: a removed slot is reused as late as possible, in case its old writer is still around
+		slot = slotCount_.load(std::memory_order_relaxed);
+		slotCount_.store(slot + 1, std::memory_order_release);
+	}
+	else if (!freeSlots_.empty())
+	{
+		slot = freeSlots_.front();
+		freeSlots_.pop_front();
+	}
+	else
+	{
+		throw std::runtime_error("All " + std::to_string(capacity_) + " trade analytics slots are taken");
+	}
+	instruments_[slot] = instrument;
+	return slot;
+}
+
+void TradeAnalytics::removeInstrument(int slot)
+{
+	checkSlot(slot);
+	std::lock_guard<std::mutex> lock(registryLock_);
+	beginWrite(slot);
+	clearSlot(slot, 0);
+	endWrite(slot);
+	instruments_[slot].clear();
+	freeSlots_.push_back(slot);
+}
+
+std::string TradeAnalytics::getInstrument(int slot) const
+{
+	checkSlot(slot);
+	std::lock_guard<std::mutex> lock(registryLock_);
+	return instruments_[slot];
+}
+
+int TradeAnalytics::getCapacity() const
+{
+	return capacity_;
+}
+
+int TradeAnalytics::getSlotCount() const
+{
+	return slotCount_.load(std::memory_order_acquire);
+}
+
+void TradeAnalytics::startInterval(int slot, double startTime)
+{
+	checkSlot(slot);
+	beginWrite(slot);
+	clearSlot(slot, startTime);
+	endWrite(slot);
+}
+
+bool TradeAnalytics::onMarketData(int slot, double lastPx, double lastSize, double accumSize, double tradeTime)
+{
+	checkSlot(slot);
+	// Writer's own state needs no seqlock: nobody else reads it
+	double previousAccumSize = slots_[slot].lastAccumSize.load(std::memory_order_relaxed);
+	// Stored even if it hasn't grown: after a reset to a lower accum size, the next trade is the one that grows it from there
+	slots_[slot].lastAccumSize.store(accumSize, std::memory_order_relaxed);
+	if (accumSize <= previousAccumSize)
+	{
+		// Accum size hasn't grown, so it's not a trade
+		return false;
+	}
+	if (previousAccumSize < 0 && tradeTime <= slots_[slot].startTime.load(std::memory_order_relaxed))
+	{
+		// First update carries the last trade before the interval
+		return false;
+	}
+	addTrade(slot, lastPx, lastSize, tradeTime);
+	return true;
+}
+
+void TradeAnalytics::addTrade(int slot, double px, double size, double tradeTime)
+{
+	checkSlot(slot);
+	if (px == 0 || size == 0)
+	{
+		return;
+	}
+	// Single writer: plain load and store of each column, the seqlock only has to keep readers out of a half-done update
+	beginWrite(slot);
+	double lastTradeTime = lastTradeTime_[slot].load(std::memory_order_relaxed);
+	if (trades_[slot].load(std::memory_order_relaxed) > 0 && tradeTime > lastTradeTime)
+	{
+		double duration = tradeTime - lastTradeTime;
+		twapSum_[slot].store(twapSum_[slot].load(std::memory_order_relaxed) + lastPx_[slot].load(std::memory_order_relaxed)*duration, std::memory_order_relaxed);
+		twapTime_[slot].store(twapTime_[slot].load(std::memory_order_relaxed) + duration, std::memory_order_relaxed);
+	}
+	value_[slot].store(value_[slot].load(std::memory_order_relaxed) + px*size, std::memory_order_relaxed);
+	volume_[slot].store(volume_[slot].load(std::memory_order_relaxed) + size, std::memory_order_relaxed);
+	trades_[slot].store(trades_[slot].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	lastPx_[slot].store(px, std::memory_order_relaxed);
+	lastTradeTime_[slot].store(std::max(tradeTime, lastTradeTime), std::memory_order_relaxed);
+	endWrite(slot);
+}
+
+void TradeAnalytics::getStats(int slot, TradeStats* stats, double now) const
+{
+	checkSlot(slot);
+	double twapSum, twapTime;
+	readSlot(slot, [this, slot, stats, &twapSum, &twapTime] {
+		stats->value = value_[slot].load(std::memory_order_relaxed);
+		stats->volume = volume_[slot].load(std::memory_order_relaxed);
+		stats->trades = (long long)trades_[slot].load(std::memory_order_relaxed);
+		twapSum = twapSum_[slot].load(std::memory_order_relaxed);
+		twapTime = twapTime_[slot].load(std::memory_order_relaxed);
+		stats->lastPx = lastPx_[slot].load(std::memory_order_relaxed);
+		stats->lastTradeTime = lastTradeTime_[slot].load(std::memory_order_relaxed);
+	});
+	stats->vwap = stats->volume > 0 ? stats->value/stats->volume : NAN;
+	if (stats->trades == 0)
+	{
+		stats->twap = NAN;
+		return;
+	}
+	double tail = now > stats->lastTradeTime ? now - stats->lastTradeTime : 0;
+	stats->twap = twapTime + tail > 0 ? (twapSum + stats->lastPx*tail)/(twapTime + tail) : stats->lastPx;
+}
+
+void TradeAnalytics::snapshot(TradeSnapshot* snapshot) const
+{
+	int count = getSlotCount();
+	for (std::vector<double>* column : { &snapshot->value, &snapshot->volume, &snapshot->trades, &snapshot->twapSum, &snapshot->twapTime, &snapshot->lastPx, &snapshot->lastTradeTime })
+	{
+		column->resize(count);
+	}
+	for (int slot = 0; slot < count; slot++)
+	{
+		readSlot(slot, [this, slot, snapshot] {
+			snapshot->value[slot] = value_[slot].load(std::memory_order_relaxed);
+			snapshot->volume[slot] = volume_[slot].load(std::memory_order_relaxed);
+			snapshot->trades[slot] = trades_[slot].load(std::memory_order_relaxed);
+			snapshot->twapSum[slot] = twapSum_[slot].load(std::memory_order_relaxed);
+			snapshot->twapTime[slot] = twapTime_[slot].load(std::memory_order_relaxed);
+			snapshot->lastPx[slot] = lastPx_[slot].load(std::memory_order_relaxed);
+			snapshot->lastTradeTime[slot] = lastTradeTime_[slot].load(std::memory_order_relaxed);
+		});
+	}
+}
+
+void TradeAnalytics::computeVwaps(const TradeSnapshot& snapshot, std::vector<double>* vwaps)
+{
+	size_t count = snapshot.size();
+	vwaps->resize(count);
+	const double* value = snapshot.value.data();
+	const double* volume = snapshot.volume.data();
+	double* result = vwaps->data();
+	// Division is done for every slot and its result selected, so the loop is branch-free and vectorized (see CMakeLists.txt)
+	for (size_t i = 0; i < count; i++)
+	{
+		double vwap = value[i]/volume[i];
+		result[i] = volume[i] > 0 ? vwap : NAN;
+	}
+}
+
+void TradeAnalytics::computeTwaps(const TradeSnapshot& snapshot, double now, std::vector<double>* twaps)
+{
+	size_t count = snapshot.size();
+	twaps->resize(count);
+	const double* trades = snapshot.trades.data();
+	const double* twapSum = snapshot.twapSum.data();
+	const double* twapTime = snapshot.twapTime.data();
+	const double* lastPx = snapshot.lastPx.data();
+	const double* lastTradeTime = snapshot.lastTradeTime.data();
+	double* result = twaps->data();
+	for (size_t i = 0; i < count; i++)
+	{
+		double tail = std::max(now - lastTradeTime[i], 0.0);
+		double time = twapTime[i] + tail;
+		double twap = (twapSum[i] + lastPx[i]*tail)/time;
+		twap = time > 0 ? twap : lastPx[i];
+		result[i] = trades[i] > 0 ? twap : NAN;
+	}
+}
+
+double TradeAnalytics::computeTotalVolume(const TradeSnapshot& snapshot)
+{
+	double total = 0;
+	for (double volume : snapshot.volume)
+	{
+		total += volume;
+	}
+	return total;
+}
+
+void TradeAnalytics::beginWrite(int slot)
+{
+	slots_[slot].sequence.store(slots_[slot].sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	// Column stores below must not move before the odd sequence number
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+void TradeAnalytics::endWrite(int slot)
+{
+	slots_[slot].sequence.store(slots_[slot].sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void TradeAnalytics::clearSlot(int slot, double startTime)
+{
+	value_[slot].store(0, std::memory_order_relaxed);
+	volume_[slot].store(0, std::memory_order_relaxed);
+	trades_[slot].store(0, std::memory_order_relaxed);
+	twapSum_[slot].store(0, std::memory_order_relaxed);
+	twapTime_[slot].store(0, std::memory_order_relaxed);
+	lastPx_[slot].store(0, std::memory_order_relaxed);
+	lastTradeTime_[slot].store(0, std::memory_order_relaxed);
+	slots_[slot].startTime.store(startTime, std::memory_order_relaxed);
+	slots_[slot].lastAccumSize.store(-1, std::memory_order_relaxed);
+}
+
+void TradeAnalytics::checkSlot(int slot) const
+{
+	if (slot < 0 || slot >= capacity_)
+	{
+		throw std::runtime_error("Trade analytics slot " + std::to_string(slot) + " is out of range");
+	}
+}
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct TradeStats
+{
+	// NAN when there are no trades
+	double vwap;
+	double twap;
+	double volume;
+	double value;
+	long long trades;
+	double lastPx;
+	double lastTradeTime;
+};
+
+// Plain copy of all accumulators, one element per slot: batch computations over it are simple loops the compiler vectorizes
+struct TradeSnapshot
+{
+	std::vector<double> value;
+	std::vector<double> volume;
+	std::vector<double> trades;
+	std::vector<double> twapSum;
+	std::vector<double> twapTime;
+	std::vector<double> lastPx;
+	std::vector<double> lastTradeTime;
+
+	size_t size() const
+	{
+		return value.size();
+	}
+};
+
+/**
+Trade accumulators of many instruments: interval VWAP, TWAP, traded volume and trade count, without a mutex on either side.
+
+Each instrument gets a slot, and accumulators are kept as structure of arrays: a column per accumulator, each starting on its own cache line,
+so a batch query over the whole universe streams through a few contiguous arrays. A slot has exactly one writer at a time
+(e.g. the listener or market data hub stream delivering its instrument), readers may be anywhere. Writer makes its changes
+under slot's sequence number (a seqlock): it's odd while the slot is being changed, and a reader retries if it saw an odd
+number or the number has moved while it was reading. Writers never wait for readers.
+
+Sequence number and the writer's own state of each slot have a cache line to themselves, so writers of neighbouring slots
+don't contend for the line every reader checks. Accumulator columns are not padded: 8 slots share a line, and writers of
+neighbouring slots on different threads do false-share it. That's the price of batch queries reading 8 slots per line
+instead of one: a writer touches a column line once per trade, while padding would make snapshot() read 8 times as many lines.
+
+Trade detection is the one of market data updates: an update is a trade when AccumSize has grown. The first update after the interval start
+only counts if its trade time is after the start, since it may be the last trade before the interval.
+TWAP weighs each trade price by the time until the next trade; the last price counts until the time the query asks about.
+Times are in the units of TradeTime field, milliseconds since epoch.
+
+Usage:
+	TradeAnalytics& analytics = TradeAnalytics::getInstance();
+	int slot = analytics.addInstrument("IBM");
+	analytics.startInterval(slot, nowMs);
+...
+	analytics.onMarketData(slot, lastPx, lastSize, accumSize, tradeTime); // Writer: market data consumer of the instrument
+...
+	TradeStats stats;
+	analytics.getStats(slot, &stats); // Any thread
+	TradeSnapshot snapshot;
+	analytics.snapshot(&snapshot);
+	std::vector<double> vwaps;
+	TradeAnalytics::computeVwaps(snapshot, &vwaps); // VWAPs of all slots
+...
+	analytics.removeInstrument(slot); // Once its writer is done
+*/
+class TradeAnalytics
+{
+public:
+	static const int DefaultCapacity = 16384;
+
+	// Slots are preallocated, capacity can't grow: columns are read without locks
+	explicit TradeAnalytics(int capacity = DefaultCapacity);
+	// Shared instance with DefaultCapacity
+	static TradeAnalytics& getInstance();
+
+	TradeAnalytics(const TradeAnalytics&) = delete;
+	void operator=(const TradeAnalytics&) = delete;
+
+	// Every call gets its own slot, even for the same instrument, so that each slot has a single writer. Throws if all slots are taken.
+	int addInstrument(const std::string& instrument);
+	// Slot is reset and reused by later addInstrument() calls: its writer must be done with it
+	void removeInstrument(int slot);
+	// Instrument of the slot, empty for removed slots
+	std::string getInstrument(int slot) const;
+	int getCapacity() const;
+	// Slots ever used: batch queries cover slots from 0 to this
+	int getSlotCount() const;
+
+	// Writer side: one thread at a time per slot
+	// Clears accumulators, trades up to startTime are not counted
+	void startInterval(int slot, double startTime);
+	// Applies market data update, true if it was a trade
+	bool onMarketData(int slot, double lastPx, double lastSize, double accumSize, double tradeTime);
+	void addTrade(int slot, double px, double size, double tradeTime);
+
+	// Reader side: any thread, never blocks the writer
+	// TWAP includes the last price up to now, 0 means up to the last trade
+	void getStats(int slot, TradeStats* stats, double now = 0) const;
+	// Each slot is consistent by itself, but slots are read one after another, not at the same instant
+	void snapshot(TradeSnapshot* snapshot) const;
+	static void computeVwaps(const TradeSnapshot& snapshot, std::vector<double>* vwaps);
+	static void computeTwaps(const TradeSnapshot& snapshot, double now, std::vector<double>* twaps);
+	static double computeTotalVolume(const TradeSnapshot& snapshot);
+
+private:
+	static const size_t CacheLineSize = 64;
+
+	// Array of atomics in whole cache lines, so that no two columns share a line
+	template <class T> class Column
+	{
+	public:
+		explicit Column(int capacity) :
+			lines_(new Line[(capacity + PerLine - 1)/PerLine])
+		{
+			for (int i = 0; i < (capacity + PerLine - 1)/PerLine*PerLine; i++)
+			{
+				(*this)[i].store(T(), std::memory_order_relaxed);
+			}
+		}
+
+		std::atomic<T>& operator[](int i)
+		{
+			return lines_[i/PerLine].values[i%PerLine];
+		}
+
+		const std::atomic<T>& operator[](int i) const
+		{
+			return lines_[i/PerLine].values[i%PerLine];
+		}
+
+	private:
+		static const int PerLine = CacheLineSize/sizeof(std::atomic<T>);
+		struct alignas(CacheLineSize) Line
+		{
+			std::atomic<T> values[PerLine];
+		};
+		std::unique_ptr<Line[]> lines_;
+	};
+
+	// Calls read until it has seen the slot between two writes
+	template <class Read> void readSlot(int slot, Read read) const
+	{
+		while (true)
+		{
+			uint64_t before = slots_[slot].sequence.load(std::memory_order_acquire);
+			if (before & 1)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+			read();
+			// Column loads of read() must not move past the second sequence check
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (slots_[slot].sequence.load(std::memory_order_relaxed) == before)
+			{
+				return;
+			}
+		}
+	}
+	void beginWrite(int slot);
+	void endWrite(int slot);
+	// Writer's part of the slot, must be called between beginWrite() and endWrite()
+	void clearSlot(int slot, double startTime);
+	void checkSlot(int slot) const;
+
+private:
+	const int capacity_;
+
+	// State of a slot that isn't read by batch queries
+	struct alignas(CacheLineSize) SlotState
+	{
+		// Seqlock: odd while the writer is changing the slot
+		std::atomic<uint64_t> sequence;
+		// Writer's own
+		std::atomic<double> startTime;
+		std::atomic<double> lastAccumSize;
+	};
+	std::unique_ptr<SlotState[]> slots_;
+	// Columns read by readers
+	Column<double> value_;
+	Column<double> volume_;
+	Column<double> trades_;
+	// Sum of price times its duration, and total duration, of all but the last trade
+	Column<double> twapSum_;
+	Column<double> twapTime_;
+	Column<double> lastPx_;
+	Column<double> lastTradeTime_;
+
+	// Slot allocation, guarded by registryLock_
+	mutable std::mutex registryLock_;
+	std::vector<std::string> instruments_;
+	std::deque<int> freeSlots_;
+	std::atomic<int> slotCount_;
+};